@@ -4,12 +4,16 @@
 #include <FS.h>
 #include <SD.h>
 
+#include <functional>
+
 #include "NJU72341.h"
 #include "common.h"
 #include "disp.h"
 #include "fm.h"
 #include "nd.h"
+#include "synthbus.h"
 #include "vgm.h"
+#include "xgmpages.h"
 
 int mod(int i, int j);
 
@@ -26,17 +30,22 @@ extern volatile int cachePos;     // キャッシュ内の位置
 void fillCacheTask(void* pvParameters);
 bool initCache(String path);
 
-enum AccessMode { ACCESS_PSRAM, ACCESS_CACHE };  // アクセスモード PSRAM に全部入れる | 逐次
+enum AccessMode { ACCESS_PSRAM, ACCESS_CACHE, ACCESS_STREAM };  // アクセスモード PSRAM に全部入れる | 逐次 | XGM サンプルだけ逐次
 
 class NDFile {
  public:
   bool init();
+  bool mountSD();  // SD だけマウントする (シリアルモード用。マウント済みなら何もしない)
   void listDir(const char* dirname);
   FileFormat readFile(String path);
   bool filePlay(int count);
+  bool trackPlay(u8_t track);
   bool dirPlay(int count);
   bool play(uint16_t d, uint16_t f, int8_t att = -1);
   bool fileOpen(uint16_t d, uint16_t f, int8_t att = -1);
+  bool allocData();                 // data を PSRAM に確保 (シリアルモードでも使う)
+  bool playUploaded(u32_t size);  // シリアルでアップロードされた data を再生
+  FileFormat inflateVGZ(std::function<int(u8_t*, size_t)> read, String name);
   uint8_t getFolderAttenuation(String path);  // フォルダの音量減衰取得
 
   uint16_t currentDir;      // 現在のディレクトリ
@@ -67,6 +76,7 @@ class NDFile {
   u32_t get_ui32_at_header(uint32_t p);
 
   AccessMode accessMode;
+  u32_t bankSkip = 0;  // ACCESS_STREAM: data から抜いたサンプルバンクのサイズ (ヘッダ以降)
 
   uint8_t header[256] __attribute__((aligned(4)));  // ヘッダのキャッシュ
   std::vector<u8_t> gd3Cache;                       // GD3部分のキャッシュ
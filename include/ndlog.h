@@ -0,0 +1,19 @@
+#ifndef NDLOG_H
+#define NDLOG_H
+#include <Arduino.h>
+
+// ------------------------------------------------------------------------------
+// テキストのログ出力 (Serial.printf の代わりに ndLog.printf)
+//    シリアルモードでは同じ USB CDC にバイナリの応答 (ACK / NAK, 0xf8, 0xf9) を返すので、
+//    ホストが応答の代わりにログを読まないようにシリアルモードの間は捨てる
+//    バイナリの応答は今まで通り Serial に直接書く
+
+class NDLog : public Print {
+ public:
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t* buf, size_t size) override;
+};
+
+extern NDLog ndLog;
+
+#endif
@@ -2,8 +2,6 @@
 #define SERIALMAN_H
 #include <Arduino.h>
 
-u8_t getSerial();
-
 class SerialMan {
  public:
   SerialMan();
@@ -11,6 +9,29 @@ class SerialMan {
   void startSerialTask();
   void changeYM2612Clock();
   void changeSN76489Clock();
+  void update();
+
+  // 受信した書き込みを SD に VGM として記録する (include/vgmcapture.h)
+  bool startCapture();
+  void stopCapture();
+  void toggleCapture();
+
+  // リンクの統計 (0xf8 で返す。画面の状態表示も表示タイマーがこれを読む)
+  volatile u32_t commandsPerSec = 0;   // 処理したコマンド数 / 秒
+  volatile u32_t executed = 0;         // チップに書いたコマンド数 (展開後)
+  volatile u32_t unknownCommands = 0;  // 不明なコマンド数
+  volatile u8_t lastUnknown = 0;       // 最後の不明なコマンド
+  volatile u32_t rxFull = 0;           // 受信リングが一杯になった回数 (続くと USB 側で溢れる)
+  volatile u32_t ringFree = 0;         // 受信リングの空き (バイト)
+  volatile u32_t underruns = 0;        // タイムドモード: 再生が遅れた回数
+  volatile u32_t overruns = 0;         // タイムドモード: ジッタバッファが一杯になった回数
+  volatile bool timed = false;         // タイムドモード中
+  volatile u32_t resyncBytes = 0;      // アップロードのタイムアウト後に読み捨てたバイト数
+
+  // アップロード曲 (受信タスクから loop への依頼)
+  volatile bool playRequest = false;
+  volatile bool stopRequest = false;
+  u32_t uploadSize = 0;
 
  private:
   int YM2612Clock = 0, SN76489Clock = 0;
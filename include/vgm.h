@@ -6,58 +6,51 @@
 #include "SI5351.hpp"
 #include "common.h"
 #include "disp.h"
+#include "pcmvoice.h"
+#include "vgmcmd.h"
+#include "xgm.h"
+#include "xgm2timeline.h"
 
 #define XGM1_MAX_PCM_CH 8
 #define XGM1_PCM_DELAY 68
-
-// XGM V2 FM
-#define WAIT_SHORT 0x00 ... 0x0e
-#define WAIT_LONG 0x0F
-#define PCM 0x10 ... 0x1f
-#define FM_LOAD_INST 0x20 ... 0x2f
-#define FM_FREQ 0x30 ... 0x3f
-#define FM_KEY 0x40 ... 0x4f
-#define FM_KEY_SEQ 0x50 ... 0x5f
-#define FM0_PAN 0x60 ... 0x6f
-#define FM1_PAN 0x70 ... 0x7f
-#define FM_FREQ_WAIT 0x80 ... 0x8f
-#define FM_TL 0x90 ... 0x9f
-#define FM_FREQ_DELTA 0xa0 ... 0xaf
-#define FM_FREQ_DELTA_WAIT 0xb0 ... 0xbf
-#define FM_TL_DELTA 0xc0 ... 0xcf
-#define FM_TL_DELTA_WAIT 0xd0 ... 0xdf
-#define FM_WRITE 0xe0 ... 0xef
-#define FRAME_DELAY 0xf0
-
-#define FM_KEY_ADV 0xf8
-#define FM_LFO 0xf9
-#define FM_CH3_SPECIAL_ON 0xfa
-#define FM_CH3_SPECIAL_OFF 0xfb
-#define FM_DAC_ON 0xfc
-#define FM_DAC_OFF 0xfd
-#define FM_LOOP 0xff
-
-// XGM V2 PSG
-#define PSG_WAIT_SHORT 0x00 ... 0x0d
-#define PSG_WAIT_LONG 0x0e
-#define PSG_LOOP 0x0f
-#define PSG_FREQ_LOW 0x10 ... 0x1f
-#define PSG_FREQ 0x20 ... 0x2f
-#define PSG_FREQ_WAIT 0x30 ... 0x3f
-#define PSG_FREQ0_DELTA 0x40 ... 0x4f
-#define PSG_FREQ1_DELTA 0x50 ... 0x5f
-#define PSG_FREQ2_DELTA 0x60 ... 0x6f
-#define PSG_FREQ3_DELTA 0x70 ... 0x7f
-#define PSG_ENV0 0x80 ... 0x8f
-#define PSG_ENV1 0x90 ... 0x9f
-#define PSG_ENV2 0xa0 ... 0xaf
-#define PSG_ENV3 0xb0 ... 0xbf
-#define PSG_ENV0_DELTA 0xc0 ... 0xcf
-#define PSG_ENV1_DELTA 0xd0 ... 0xdf
-#define PSG_ENV2_DELTA 0xe0 ... 0xef
-#define PSG_ENV3_DELTA 0xf0 ... 0xff
+#define XGM1_PCM_RATE 14000  // タイマー駆動時の PCM レート
+#define XGM1_PCM_LEAD 28     // タイマー駆動時の先行サンプル数 (2ms)
+
+// XGM フレーム周期 (メガドライブのマスタークロック / 1 ライン 3420 クロック x ライン数)
+#define XGM_NTSC_MCLK 53693175
+#define XGM_PAL_MCLK 53203424
+#define XGM_NTSC_FRAME_CLOCKS (3420 * 262)  // 59.92Hz
+#define XGM_PAL_FRAME_CLOCKS (3420 * 313)   // 49.70Hz
+#define XGM_PREFETCH_FRAMES 30  // ストリームモードでサンプルを先読みするフレーム数 (0.5秒)
+
+// ループ先・よく使うサンプルを内部 SRAM に置く
+#define XGM_PIN_BUDGET (32 * 1024)        // サンプルに使う内部 SRAM の上限
+#define XGM_PIN_HEAP_RESERVE (64 * 1024)  // 内部 SRAM の空きはこれだけ残す
+#define XGM_PIN_LOOP_FRAMES 60            // ループ先から何フレーム分のサンプルを優先するか
+#define XGM2_PIN_LOOP_EVENTS 512          // ループ先から内部 SRAM に置くタイムラインのイベント数
 
 #define XGM2_PCM_DELAY 72
+#define XGM2_PCM_BLOCK 8  // ポーリング 1 回分の先行ミックス数
+
+// XGM2 タイムラインの展開に使わずに残す PSRAM (展開には空きからこれを引いた分まで使う)
+#define XGM2_TIMELINE_PSRAM_RESERVE (512 * 1024)
+
+// XGM サンプルテーブル (ロード時に作る)
+#define XGM_MAX_SAMPLES 249  // ID 0 (停止) + XGM2 マルチトラックの 248 個 (XGM2: 124 個, XGM1: 63 個)
+
+// ファイル上のサンプルブロック先頭
+#define XGM_SAMPLE_BASE 0x104         // XGM1 / XGM2
+#define XGM2_MULTI_SAMPLE_BASE 0x3fc  // XGM2 マルチトラック (SID 248 個 + FMID / PSGID 128 個ずつ)
+
+
+typedef struct {
+  u32_t addr;          // ファイル上の位置
+  u32_t len;           // サンプル数 (0 = なし)
+  const int8_t* data;  // PSRAM 上の先頭 (ストリームモードでは NULL)
+  int8_t* half;        // 半速用に各サンプルを 2 回ずつ並べたもの (最初の半速再生で作る)
+  int8_t* pinned;      // 内部 SRAM 上のコピー (あれば data はこれを指す)
+  u32_t uses;          // 曲中の発音回数 (ロード時に数える)
+} t_xgmSample;
 
 // GD3 構造体
 typedef struct {
@@ -83,8 +76,6 @@ class VGM {
   bool xgmLoaded = false;
 
   u8_t XGMVersion;  // XGM バージョン 1 or 2
-  std::vector<u32_t> XGMSampleAddressTable;
-  std::vector<u32_t> XGMSampleSizeTable;
 
   u32_t XGM_SLEN;
   u32_t XGM_MLEN;
@@ -92,17 +83,25 @@ class VGM {
   u32_t XGM_FMLEN;   // XGM2
   u32_t XGM_PSGLEN;  // XGM2
 
+  u8_t xgmTrack = 0;      // 再生中のトラック
+  u8_t xgmNumTracks = 0;  // ファイル内のトラック数 (マルチトラックでなければ 1)
+
   VGM();
-  bool ready();     // VGM の再生準備
-  bool XGMReady();  // XGM の再生準備
+  bool ready();                     // VGM の再生準備
+  bool XGMReady();                  // XGM の再生準備
+  bool XGMSelectTrack(u8_t track);  // トラックを頭から再生 (サンプルは読み直さない)
   void vgmProcess();
   void vgmProcessMain();
   void xgmProcess();
   void xgm2Process();
+  void stop();  // 再生を止める (次の曲には進まない)
   u64_t getCurrentTime();
+  void updateConfig();  // FM/PCM 設定を反映
 
  private:
+  bool _pcmEnabled = true;  // CFG_FMPCM != FMPCM_FM のキャッシュ
   static const int VGM_STREAM_MAX = 4;
+  static const u32_t VGM_STREAM_BURST = 16;  // まとめて書く最大サンプル数 (周期を空けて書くのでその間は戻らない)
   struct t_vgmDataBlock {
     u32_t pos;
     u32_t size;
@@ -138,28 +137,38 @@ class VGM {
   void _vgmProcessStreams();
   void _vgmStopStream(u8_t streamID);
 
-  u32_t _xgmSamplePos[XGM1_MAX_PCM_CH];
-  u8_t _xgmSampleId[XGM1_MAX_PCM_CH];
-  u8_t _xgmPriorities[XGM1_MAX_PCM_CH];
-  bool _xgmSampleOn[XGM1_MAX_PCM_CH];
-  bool _xgmPCMHalfSpeed[3];
-  bool _xgmPCMHalfSent[3];
+  PCMVoices _xgmVoices;  // PCM 再生状態 (XGM1: 8ch, XGM2: 3ch)
   u32_t _xgmFrame;
-  u32_t _xgmYMSNFrame;
   u64_t _xgmStartTick;
   u64_t _xgmWaitUntil;
   u64_t _xgmWaitYMUntil;
   u64_t _xgmWaitPsgUntil;
   bool _xgmIsNTSC;
-
-  u8_t _xgmYmState[2][0x100];
-  s16_t _xgmPsgState[2][4];
-  u32_t _xgmYMFrame, _xgmPSGFrame;
-
-  u32_t _xgm2_ym_offset;
-  u32_t _xgm2_ym_pos;
-  u32_t _xgm2_psg_offset;
-  u32_t _xgm2_psg_pos;
+  u32_t _xgmMasterClock = XGM_NTSC_MCLK;
+  u32_t _xgmFrameClocks = XGM_NTSC_FRAME_CLOCKS;
+  u64_t _xgmFrameTime(u32_t frame, u32_t rate);  // frame 先頭の時刻 (rate 単位)
+
+  // XGM1 PCM タイマー駆動
+  bool _xgmPCMTimer = false;  // DAC タイマーで出力中
+  u32_t _xgmPCMMixed = 0;     // ミックス済みサンプル数
+  u32_t _xgmPCMDrop = 0;      // 取りこぼしで捨てる残りサンプル数
+  u32_t _xgmPCMUnderruns = 0;
+
+  // XGM ストリームモード (サンプルバンクをページキャッシュから読む)
+  u32_t _xgmSampleBase;        // ファイル上のサンプルブロック先頭
+  u32_t _xgmMusicOffset;       // data 上の曲データ先頭
+  u32_t _xgmPrefetchPos;       // XGM1: 先読み位置 / XGM2: タイムライン上の先読み位置
+  u32_t _xgmPrefetchFrame;     // 先読み位置のフレーム
+  bool _xgmPrefetchEnd;        // 曲の最後まで先読みした
+
+  XGM1Decoder _xgm1;  // 曲データの解釈 (lib/xgm)
+  XGM2Decoder _xgm2;
+  void _xgmCountLoop();
+  void _xgmPCMCommand(u8_t command, u8_t sampleID);
+  friend class XGMChipSink;
+
+  std::vector<t_xgm2Track> _xgm2Tracks;  // トラックごとのストリーム位置
+  bool _xgm2IndexTracks();
 
   si5351Freq_t normalizeFreq(u32_t freq, t_chip chip);
 
@@ -172,22 +181,52 @@ class VGM {
 
   // when reach the end of the song
   void endProcedure();
+  void _endRecording();
 
   // xgm1
   bool _xgm1ProcessYMSN();
   void _xgm1ProcessPCM();
+  void _xgm1MixBlock(u16_t* out, u32_t n);
+  void _xgm1FillPCM(u32_t target);
+  bool _xgmMixSample(int16_t* acc, u8_t* hit, u32_t n, u8_t ch);
+  void _xgmPrefetchSample(u8_t sampleID);
+  t_xgmSample _xgmSampleTable[XGM_MAX_SAMPLES];
+  void _xgmClearSamples();
+  void _xgmUnpin();
+  void _xgmSetSample(u8_t id, u32_t addr, u32_t end);
+  void _xgmStartSample(u8_t ch, u8_t prio, u8_t sampleID, bool halfSpeed);
+  const int8_t* _xgmHalfSample(u8_t sampleID);
+  void _xgm1Prefetch();
+  void _xgm2Prefetch();
+  void _xgmPinHotData();
+  u32_t _xgm1ScanSamples(u8_t* loopIDs);
+  u32_t _xgm2ScanSamples(u8_t* loopIDs);
+  bool _xgmPinSample(u8_t sampleID);
 
   // xgm2
   bool _xgm2ProcessYM();
   bool _xgm2ProcessSN();
-  void _xgm2ProcessPCM();
-
-  int _getYMPort(u32_t pos);
-  int _getYMChannel(u32_t pos);
-  int _getYMSlot(u8_t command);
-  u8_t _getChannel(u32_t pos);
+  void _xgm2ProcessPCM(u32_t remain);
+  void _xgm2StartPCM(u8_t command, u8_t sampleID);
+
+  // xgm2 タイムライン
+  XGM2Timeline _xgm2Timeline;
+  u32_t _xgm2Cursor = 0;
+  t_xgm2Cmd* _xgm2LoopPin = NULL;  // ループ先からのイベントの内部 SRAM コピー
+  u32_t _xgm2LoopPinLen = 0;
+  bool _xgm2Compiled = false;  // タイムラインで再生
+  bool _xgm2Compile();
+  bool _xgm2ProcessTimeline();
+  void _xgm2MixBlock(u16_t* out, u32_t n);
+  u16_t _xgm2PCMBuf[XGM2_PCM_BLOCK];
+  u8_t _xgm2PCMBufPos = 0, _xgm2PCMBufLen = 0;
 };
 
 extern VGM vgm;
 
+// チップ書き込みの振り分け (ファイル再生とシリアルモードで共通)
+// psg1Freq: 0x50 (SN76489 CHIP 1), psg2Freq: 0x30 (CHIP 2), psgRaw: writeRaw() を使う
+extern VGMRouter chipRouter;  // ファイル再生用 (シリアルモードはストリームごとに持つ)
+void setupChipRoutes(VGMRouter& router, si5351Freq_t psg1Freq, si5351Freq_t psg2Freq, bool psgRaw);
+
 #endif
@@ -0,0 +1,65 @@
+#ifndef VGMCAPTURE_H
+#define VGMCAPTURE_H
+#include <Arduino.h>
+#include <FS.h>
+
+// ------------------------------------------------------------------------------
+// シリアルモードの書き込みを SD に VGM として記録する
+//    チップに書いた時刻 (esp_timer) で待ちを入れ、そのまま再生できる VGM にする
+//    記録は PSRAM のバッファ 2 面に溜め、一杯になった面を別タスク (PRO_CPU) が SD に書く
+//    SD が追いつかないときは書き込みを捨てて数える (受信側は待たない)
+//    ヘッダと GD3 は停止時に書く
+
+#define CAPTURE_BUFFER_SIZE (64 * 1024)  // 1 面のバイト数 (PSRAM に 2 面)
+#define CAPTURE_DIR "/capture"
+#define CAPTURE_HEADER_SIZE 0x80  // VGM 1.51 のヘッダ (YM2203 のクロックまで)
+#define CAPTURE_LOCK_MS 2  // write が begin / end を待つ最長時間
+
+class VGMCapture {
+ public:
+  // /capture/capNNNN.vgm を作って記録開始 (クロックは Hz)
+  bool begin(u32_t ym2612Clock, u32_t sn76489Clock);
+  void end();
+  bool isRecording() { return _recording; }
+
+  // チップに書いたコマンドを記録する (VGM と同じ形。DAC は 0x52 0x2a にして渡す)
+  void write(u8_t command, u8_t a, u8_t b, u8_t len) {
+    if (_recording) _write(command, a, b, len);
+  }
+
+  String path;
+  volatile u32_t bytes = 0;       // 記録したバイト数 (データ部)
+  volatile u32_t dropped = 0;     // 捨てたバイト数 (SD が追いつかなかった / begin / end と重なった)
+  volatile u32_t maxStallUs = 0;  // 1 面の書き込みにかかった最長時間
+  volatile u32_t writeUs = 0;     // 書き込みにかかった合計時間 (スループット用)
+
+ private:
+  File _file;
+  u8_t* _buf[2] = {NULL, NULL};
+  u8_t _active = 0;     // 記録中の面
+  u32_t _fill = 0;      // 記録中の面のバイト数
+  u32_t _len = 0;       // 書き込みタスクに渡した面のバイト数
+  volatile bool _busy = false;  // もう一方の面を書き込み中
+  volatile bool _recording = false;
+
+  u64_t _startUs = 0;
+  u32_t _lastSample = 0;  // 最後に書いた待ちまでのサンプル数
+  u32_t _ym2612Clock = 0, _sn76489Clock = 0;
+  bool _usedYM2612 = false, _usedYM2203 = false, _usedSN[2] = {false, false};
+
+  SemaphoreHandle_t _mutex = NULL;  // write と begin / end の排他
+  QueueHandle_t _queue = NULL;      // 書く面の番号
+
+  void _write(u8_t command, u8_t a, u8_t b, u8_t len);
+  bool _put(const u8_t* p, u32_t n);
+  bool _putWait(u32_t sample);
+  void _submit();
+  void _waitIdle();
+  void _writeHeader(u32_t gd3Offset, u32_t eofOffset, u32_t totalSamples);
+  u32_t _writeGD3();
+  static void _writerTask(void* param);
+};
+
+extern VGMCapture vgmCapture;
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef XGMPAGES_H
+#define XGMPAGES_H
+#include <Arduino.h>
+#include <FS.h>
+
+// ------------------------------------------------------------------------------
+// XGM サンプルバンクのページキャッシュ
+//    PSRAM に入りきらない XGM/XGM2 のサンプルデータを 4KB ページ単位で SD から読む
+//    ページは LRU で入れ替え、先読みは別タスク (PRO_CPU) で行う
+//    get() で返したページは release() するまで入れ替えない
+
+#define XGM_PAGE_BITS 12
+#define XGM_PAGE_SIZE (1 << XGM_PAGE_BITS)  // 4KB
+#define XGM_NUM_PAGES 256                   // 1MB (PSRAM)
+#define XGM_PREFETCH_PAGES 4                // 1 サンプルあたりの先読みページ数
+#define XGM_PREFETCH_QUEUE 32
+
+class XGMPageCache {
+ public:
+  bool begin(String path, u32_t base, u32_t size);  // ファイルの base から size バイトを対象にする
+  void end();
+  bool isActive() { return _file; }
+
+  // offset を含むページのポインタを返す。avail にはページ内で連続して読めるバイト数
+  // 使い終わったら release() する
+  // wait = false (再生中) はミスでも SD を待たずに先読みタスクへ頼んで NULL を返す
+  // 戻り値 NULL: avail > 0 ならまだ読めていない (その分は鳴らさずに進める), avail = 0 なら読めない
+  const u8_t* get(u32_t offset, u32_t* avail, bool wait = true);
+  void release(const u8_t* p);
+  void prefetch(u32_t offset, u32_t len);  // 先読み要求 (キューが一杯なら捨てる)
+  void printStats();
+
+ private:
+  File _file;          // メインタスク用
+  File _prefetchFile;  // 先読みタスク用
+  u32_t _base = 0;
+  u32_t _size = 0;
+
+  u8_t* _pages = NULL;   // XGM_NUM_PAGES * XGM_PAGE_SIZE
+  s16_t* _slotOf = NULL;  // ファイル上のページ番号 -> スロット (-1 = なし)
+  u32_t _numFilePages = 0;
+  u32_t _pageOf[XGM_NUM_PAGES];   // スロット -> ページ番号
+  u32_t _lastUse[XGM_NUM_PAGES];  // LRU 用
+  bool _loading[XGM_NUM_PAGES];   // 読み込み中 (入れ替え対象外)
+  u8_t _pins[XGM_NUM_PAGES];      // get() で渡していて release() されていない数 (入れ替え対象外)
+  u32_t _tick = 0;
+
+  u32_t _hits = 0, _misses = 0, _prefetched = 0, _dropped = 0;
+  u32_t _late = 0;  // 再生中のミスで鳴らさなかった回数
+
+  SemaphoreHandle_t _mutex = NULL;
+  QueueHandle_t _queue = NULL;
+
+  int _reserve(u32_t page);
+  int _publish(int slot, u32_t page, bool pin);
+  int _load(File& file, u32_t page, bool pin);
+  static void _prefetchTask(void* param);
+};
+
+extern XGMPageCache xgmPages;
+
+#endif
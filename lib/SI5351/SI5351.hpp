@@ -114,6 +114,7 @@ class SI5351_cls {
   void setupMultisynthInt(uint8_t output, si5351PLL_t pllSource, si5351MultisynthDiv_t div);
   void enableOutputs(bool enabled);
   void setFreq(si5351Freq_t newFreq, uint8_t output = 0);
+  si5351Freq_t getFreq(uint8_t output = 0) { return output == 0 ? currentFreq0 : currentFreq1; }
 
  private:
   si5351Freq_t currentFreq0, currentFreq1;
@@ -0,0 +1,44 @@
+#ifndef BUSCYCLES_H
+#define BUSCYCLES_H
+
+#include <stdint.h>
+
+// ------------------------------------------------------------------------------
+// バス用の待ちの計算 (busdelay.h の中身)
+//    サイクルカウンタは Clock::now() で読むので、ホスト側のツール (tools/buscheck) では
+//    シミュレーションのカウンタに差し替えて確かめられる
+//    DAC タイマーの割り込み (IRAM) からも呼ぶので必ずインライン展開させる
+//    Arduino に依存しない
+
+#define BUS_INLINE inline __attribute__((always_inline))
+
+// ns -> サイクル (切り上げ)
+//    ns * cyclesPerUs が 32 ビットに収まる範囲 (240MHz で 17ms まで)
+static BUS_INLINE uint32_t busCyclesForNs(uint32_t ns, uint32_t cyclesPerUs) { return (ns * cyclesPerUs + 999) / 1000; }
+
+// cycles 以上進むまで待つ (カウンタの一周は引き算で吸収する)
+template <class Clock>
+static BUS_INLINE void busWaitCycles(Clock& clock, uint32_t cycles) {
+  const uint32_t start = clock.now();
+  while ((uint32_t)(clock.now() - start) < cycles) {
+  }
+}
+
+// 校正: us 間にカウンタが cycles 進んだときの 1us あたりのサイクル数 (四捨五入, 失敗は 0)
+static inline uint32_t busCyclesPerUsFrom(uint32_t cycles, int64_t us) {
+  if (us <= 0) return 0;
+  return (uint32_t)((cycles + us / 2) / us);
+}
+
+// SN76489 の WR 幅: 32 クロック + 余裕 500ns
+static inline uint32_t busPsgWriteNs(uint32_t clock) { return (uint32_t)(32000000000ULL / clock) + 500; }
+
+// YM2612 のデータライト後の待ち: cycles クロック + 余裕 500ns
+//    $21 - $9E は 83 サイクル, $A0 - $B6 は 47 サイクル (YM3438 マニュアル)
+#define BUS_YM_WAIT_CYCLES_LONG 83
+#define BUS_YM_WAIT_CYCLES_SHORT 47
+static inline uint32_t busYmWaitNs(uint32_t cycles, uint32_t clock) {
+  return (uint32_t)(cycles * 1000000000ULL / clock) + 500;
+}
+
+#endif
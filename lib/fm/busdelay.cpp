@@ -0,0 +1,26 @@
+#include "busdelay.h"
+#include "../../include/ndlog.h"
+
+u32_t busCyclesPerUs = BUS_CPU_MHZ;
+
+// esp_timer の 10ms 間にサイクルカウンタがいくつ進むかを測る
+void busDelayCalibrate() {
+  portDISABLE_INTERRUPTS();
+  const int64_t t0 = esp_timer_get_time();
+  const u32_t c0 = cpu_hal_get_cycle_count();
+  while (esp_timer_get_time() - t0 < 10000) {
+  }
+  const u32_t c1 = cpu_hal_get_cycle_count();
+  const int64_t t1 = esp_timer_get_time();
+  portENABLE_INTERRUPTS();
+
+  u32_t measured = busCyclesPerUsFrom(c1 - c0, t1 - t0);
+  if (measured == 0) {
+    ndLog.println("ERROR: Bus delay calibration failed.");
+    return;
+  }
+  if (measured != BUS_CPU_MHZ) {
+    ndLog.printf("Bus delay: %u cycles/us (expected %u)\n", measured, BUS_CPU_MHZ);
+  }
+  busCyclesPerUs = measured;
+}
@@ -0,0 +1,35 @@
+#ifndef BUSDELAY_H
+#define BUSDELAY_H
+#include <Arduino.h>
+#include <hal/cpu_hal.h>
+
+#include "buscycles.h"
+
+// ------------------------------------------------------------------------------
+// サイクルカウンタによるバス用の待ち
+//    ets_delay_us は 1us 単位なので、ns オーダーのストローブ幅用に使う
+//    1us あたりのサイクル数は起動時に esp_timer と比べて校正する
+//    DELAY_NS() は定数を渡せばサイクル数への変換がほぼ畳み込まれる
+//    計算は buscycles.h (ホストでも確かめられるようにカウンタを差し替えられる)
+
+#define BUS_CPU_MHZ (F_CPU / 1000000)  // 校正前の既定値
+
+extern u32_t busCyclesPerUs;  // 校正済み 1us あたりのサイクル数
+
+void busDelayCalibrate();
+
+struct BusCpuClock {
+  static BUS_INLINE u32_t now() { return cpu_hal_get_cycle_count(); }
+};
+
+// ns -> サイクル (切り上げ)
+static BUS_INLINE u32_t busNsToCycles(u32_t ns) { return busCyclesForNs(ns, busCyclesPerUs); }
+
+static BUS_INLINE void busDelayCycles(u32_t cycles) {
+  BusCpuClock clock;
+  busWaitCycles(clock, cycles);
+}
+
+#define DELAY_NS(ns) busDelayCycles(busNsToCycles(ns))
+
+#endif
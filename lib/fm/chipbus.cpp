@@ -0,0 +1,135 @@
+#include "chipbus.h"
+
+#include <SD.h>
+
+#include "fm.h"
+#include "../../include/ndlog.h"
+
+// ------------------------------------------------------------------------------
+// トレース記録用チップバス
+//    書き込みをそのまま _target に転送しつつ、PSRAM バッファに記録する
+//    バッファが一杯になったら SD に書き出す
+
+bool TraceChipBus::begin(const char* path) {
+  end();
+
+  if (!_buffer) {
+    _buffer = (t_traceRecord*)ps_malloc(TRACE_BUFFER_RECORDS * sizeof(t_traceRecord));
+    if (!_buffer) {
+      ndLog.println("ERROR: TraceChipBus buffer allocation failed.");
+      return false;
+    }
+  }
+
+  _file = SD.open(path, FILE_WRITE);
+  if (!_file) {
+    ndLog.printf("ERROR: Failed to open trace file: %s\n", path);
+    return false;
+  }
+
+  const u32_t version = TRACE_VERSION;
+  _file.write((const uint8_t*)"NDTR", 4);
+  _file.write((const uint8_t*)&version, sizeof(version));
+
+  _count = 0;
+  _total = 0;
+  _startUs = esp_timer_get_time();
+  return true;
+}
+
+void TraceChipBus::end() {
+  if (!_file) return;
+  _flush();
+  _file.close();
+  ndLog.printf("Trace: %u records\n", _total);
+}
+
+void TraceChipBus::_flush() {
+  if (_count == 0) return;
+  _file.write((const uint8_t*)_buffer, _count * sizeof(t_traceRecord));
+  _count = 0;
+}
+
+void TraceChipBus::_record(u8_t chip, u8_t port, u8_t reg, u8_t value) {
+  if (!_file) return;
+
+  t_traceRecord& r = _buffer[_count++];
+  r.sample = (u32_t)(((u64_t)esp_timer_get_time() - _startUs) * 44100 / 1000000);
+  r.chip = chip;
+  r.port = port;
+  r.reg = reg;
+  r.value = value;
+  _total++;
+
+  if (_count == TRACE_BUFFER_RECORDS) {
+    _flush();
+  }
+}
+
+void TraceChipBus::reset() {
+  _record(TRACE_RESET, 0, 0, 0);
+  if (_target) _target->reset();
+}
+
+void TraceChipBus::setRegister(byte addr, byte value, int chipno) {
+  _record(TRACE_OPN | chipno, 0, addr, value);
+  if (_target) _target->setRegister(addr, value, chipno);
+}
+
+void TraceChipBus::setRegisterOPM(byte addr, byte value, uint8_t chipno) {
+  _record(TRACE_OPM | chipno, 0, addr, value);
+  if (_target) _target->setRegisterOPM(addr, value, chipno);
+}
+
+void TraceChipBus::setRegisterOPL3(byte port, byte addr, byte data, int chipno) {
+  _record(TRACE_OPL3 | chipno, port, addr, data);
+  if (_target) _target->setRegisterOPL3(port, addr, data, chipno);
+}
+
+void TraceChipBus::setRegisterOPLL(byte addr, byte value, uint8_t chipno) {
+  _record(TRACE_OPLL | chipno, 0, addr, value);
+  if (_target) _target->setRegisterOPLL(addr, value, chipno);
+}
+
+void TraceChipBus::setYM2612(byte port, byte addr, byte data, uint8_t chipno) {
+  _record(TRACE_YM2612 | chipno, port, addr, data);
+  if (_target) _target->setYM2612(port, addr, data, chipno);
+}
+
+void TraceChipBus::setYM2612DAC(byte data, uint8_t chipno) {
+  _record(TRACE_YM2612_DAC | chipno, 0, 0x2a, data);
+  if (_target) _target->setYM2612DAC(data, chipno);
+}
+
+// サンプル時刻は転送前にまとめて記録する
+void TraceChipBus::setYM2612DACBurst(const u8_t* buf, u32_t n, u32_t periodUs, uint8_t chipno) {
+  for (u32_t i = 0; i < n; i++) {
+    _record(TRACE_YM2612_DAC | chipno, 0, 0x2a, buf[i]);
+  }
+  if (_target) _target->setYM2612DACBurst(buf, n, periodUs, chipno);
+}
+
+void TraceChipBus::write(byte data, byte chipno, si5351Freq_t freq) {
+  _record(TRACE_SN76489 | chipno, 0, 0, data);
+  if (_target) _target->write(data, chipno, freq);
+}
+
+void TraceChipBus::writeRaw(byte data, byte chipno, si5351Freq_t freq) {
+  _record(TRACE_SN76489_RAW | chipno, 0, 0, data);
+  if (_target) _target->writeRaw(data, chipno, freq);
+}
+
+// 個別に書いた場合と同じバイト列で記録する
+void TraceChipBus::writeRawPair(byte latch, byte data, uint8_t chipMask, si5351Freq_t freq) {
+  for (u8_t c = 0; c < 3; c++) {
+    if (chipMask & PSG_CHIP(c)) {
+      _record(TRACE_SN76489_RAW | c, 0, 0, latch);
+      _record(TRACE_SN76489_RAW | c, 0, 0, data);
+    }
+  }
+  if (_target) _target->writeRawPair(latch, data, chipMask, freq);
+}
+
+NullChipBus chipNull;
+TraceChipBus chipTrace;
+ChipBus* chipBus = &FM;
@@ -0,0 +1,140 @@
+#ifndef CHIPBUS_H
+#define CHIPBUS_H
+#include <Arduino.h>
+#include <FS.h>
+
+#include "SI5351.hpp"
+
+#define PSG_CHIP(n) (1 << (n))  // writeRawPair() のチップマスク
+#define DAC_SKIP 0x100          // pushDAC() 用: 書き込みなし
+#define DAC_RING_SIZE 512       // pushDAC() のバッファ容量 (2 のべき乗)
+
+// ------------------------------------------------------------------------------
+// チップバス抽象クラス
+//    再生エンジン (vgm.cpp, serialman.cpp) はこのインターフェース経由で書き込む
+//    FMChip    : 実機の GPIO バス
+//    NullChipBus : 何もしない (パーサ性能測定用)
+//    TraceChipBus: 書き込みを記録して別のバスへ転送する
+class ChipBus {
+ public:
+  typedef si5351Freq_t freq_t;  // VGMRouter 用
+
+  virtual ~ChipBus() {}
+  virtual void reset() = 0;
+  virtual void setRegister(byte addr, byte value, int chipno) = 0;
+  virtual void setRegisterOPM(byte addr, byte value, uint8_t chipno) = 0;
+  virtual void setRegisterOPL3(byte port, byte addr, byte data, int chipno) = 0;
+  virtual void setRegisterOPLL(byte addr, byte value, uint8_t chipno) = 0;
+  virtual void setYM2612(byte port, byte addr, byte data, uint8_t chipno) = 0;
+  virtual void setYM2612DAC(byte data, uint8_t chipno) = 0;
+  virtual void write(byte data, byte chipno, si5351Freq_t freq) = 0;
+  virtual void writeRaw(byte data, byte chipno, si5351Freq_t freq) = 0;
+
+  // YM2612 DAC に n サンプルを periodUs 間隔で書く (0 = 間隔なし)
+  virtual void setYM2612DACBurst(const u8_t* buf, u32_t n, u32_t periodUs, uint8_t chipno) {
+    for (u32_t i = 0; i < n; i++) {
+      setYM2612DAC(buf[i], chipno);
+      if (periodUs) ets_delay_us(periodUs);
+    }
+  }
+
+  // タイマー割り込みで rate Hz ごとに DAC に書く
+  // 対応していないバスは false を返すので、呼び出し側で従来の書き込みに戻す
+  virtual bool startDACTimer(u32_t rate, uint8_t chipno) { return false; }
+  virtual void stopDACTimer() {}
+  // DAC_SKIP はそのサンプル時刻に何も書かない
+  virtual bool pushDAC(u16_t data) { return false; }
+  virtual u32_t dacQueued() { return 0; }
+  virtual u32_t takeDACUnderruns() { return 0; }
+
+  // SN76489 ラッチ+データの 2 バイトをまとめて書く
+  // chipMask: PSG_CHIP(n) の OR で複数チップへ同時に書く
+  virtual void writeRawPair(byte latch, byte data, uint8_t chipMask, si5351Freq_t freq) {
+    for (uint8_t c = 0; c < 3; c++) {
+      if (chipMask & PSG_CHIP(c)) {
+        writeRaw(latch, c, freq);
+        writeRaw(data, c, freq);
+      }
+    }
+  }
+};
+
+// 出力先なし
+class NullChipBus : public ChipBus {
+ public:
+  void reset() override {}
+  void setRegister(byte addr, byte value, int chipno) override {}
+  void setRegisterOPM(byte addr, byte value, uint8_t chipno) override {}
+  void setRegisterOPL3(byte port, byte addr, byte data, int chipno) override {}
+  void setRegisterOPLL(byte addr, byte value, uint8_t chipno) override {}
+  void setYM2612(byte port, byte addr, byte data, uint8_t chipno) override {}
+  void setYM2612DAC(byte data, uint8_t chipno) override {}
+  void setYM2612DACBurst(const u8_t* buf, u32_t n, u32_t periodUs, uint8_t chipno) override {}
+  void write(byte data, byte chipno, si5351Freq_t freq) override {}
+  void writeRaw(byte data, byte chipno, si5351Freq_t freq) override {}
+  void writeRawPair(byte latch, byte data, uint8_t chipMask, si5351Freq_t freq) override {}
+};
+
+// トレースの書き込み種別 (レコードの chip 上位4ビット)
+typedef enum {
+  TRACE_SN76489 = 0x00,      // write()
+  TRACE_SN76489_RAW = 0x10,  // writeRaw()
+  TRACE_YM2612 = 0x20,
+  TRACE_YM2612_DAC = 0x30,
+  TRACE_OPN = 0x40,  // setRegister()
+  TRACE_OPM = 0x50,
+  TRACE_OPL3 = 0x60,
+  TRACE_OPLL = 0x70,
+  TRACE_RESET = 0xF0,
+} tTraceKind;
+
+// トレースファイル
+//   ヘッダ: "NDTR" + u32 バージョン
+//   レコード: 8 バイト固定, リトルエンディアン
+typedef struct __attribute__((packed)) {
+  u32_t sample;  // 記録開始からの経過サンプル数 (44.1kHz)
+  u8_t chip;     // tTraceKind | チップ番号
+  u8_t port;
+  u8_t reg;
+  u8_t value;
+} t_traceRecord;
+
+#define TRACE_VERSION 1
+#define TRACE_BUFFER_RECORDS (64 * 1024)  // 512KB (PSRAM)
+
+class TraceChipBus : public ChipBus {
+ public:
+  void setTarget(ChipBus* target) { _target = target; }
+  bool begin(const char* path);
+  void end();
+  bool isRecording() { return _file; }
+  u32_t recordCount() { return _total; }
+
+  void reset() override;
+  void setRegister(byte addr, byte value, int chipno) override;
+  void setRegisterOPM(byte addr, byte value, uint8_t chipno) override;
+  void setRegisterOPL3(byte port, byte addr, byte data, int chipno) override;
+  void setRegisterOPLL(byte addr, byte value, uint8_t chipno) override;
+  void setYM2612(byte port, byte addr, byte data, uint8_t chipno) override;
+  void setYM2612DAC(byte data, uint8_t chipno) override;
+  void setYM2612DACBurst(const u8_t* buf, u32_t n, u32_t periodUs, uint8_t chipno) override;
+  void write(byte data, byte chipno, si5351Freq_t freq) override;
+  void writeRaw(byte data, byte chipno, si5351Freq_t freq) override;
+  void writeRawPair(byte latch, byte data, uint8_t chipMask, si5351Freq_t freq) override;
+
+ private:
+  ChipBus* _target = NULL;
+  File _file;
+  t_traceRecord* _buffer = NULL;
+  u32_t _count = 0;
+  u32_t _total = 0;
+  u64_t _startUs = 0;
+  void _record(u8_t chip, u8_t port, u8_t reg, u8_t value);
+  void _flush();
+};
+
+extern ChipBus* chipBus;  // 再生エンジンが使うバス
+extern NullChipBus chipNull;
+extern TraceChipBus chipTrace;
+
+#endif
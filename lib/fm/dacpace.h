@@ -0,0 +1,49 @@
+#ifndef DACPACE_H
+#define DACPACE_H
+
+#include <stdint.h>
+
+// ------------------------------------------------------------------------------
+// DAC タイマーの周期
+//    タイマーのカウント周波数 / rate の端数は、周期を 1 カウント伸ばす回数で合わせる
+//    (40MHz で 14kHz なら 2857 x 6 + 2858 で 7 サンプル 500us ちょうど)
+//    割り込みから呼ぶので全部インライン。ホスト側のツール (tools/dacratecheck) でも使う
+//    Arduino に依存しない
+
+#define DACPACE_INLINE inline __attribute__((always_inline))
+
+class DACPacer {
+ public:
+  DACPACE_INLINE void begin(uint32_t rate, uint32_t timerHz) {
+    _rate = rate;
+    _period = timerHz / rate;
+    _remainder = timerHz % rate;
+    _acc = _remainder;  // 1 周期目の分 (端数が溜まった周期を伸ばすので、ずれは常に 1 カウント未満)
+    _long = false;
+  }
+
+  // 今の周期 (カウント数)
+  DACPACE_INLINE uint32_t period() const { return _period + (_long ? 1 : 0); }
+
+  // 割り込みごとに呼んで次の周期を決める。周期が変わったら true (タイマーのアラームを書き直す)
+  DACPACE_INLINE bool step() {
+    _acc += _remainder;
+    bool lng = false;
+    if (_acc >= _rate) {
+      _acc -= _rate;
+      lng = true;
+    }
+    if (lng == _long) return false;
+    _long = lng;
+    return true;
+  }
+
+ private:
+  uint32_t _rate = 0;
+  uint32_t _period = 0;
+  uint32_t _remainder = 0;  // timerHz / rate の余り
+  uint32_t _acc = 0;
+  bool _long = false;  // 現在の周期が +1 カウントか
+};
+
+#endif
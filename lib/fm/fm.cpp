@@ -1,11 +1,32 @@
 #include "fm.h"
 
 #include <driver/dedic_gpio.h>
+#include <driver/timer.h>
+#include <hal/dedic_gpio_cpu_ll.h>
 
 #include "../../include/config.h"
+#include "busdelay.h"
+#include "../../include/ndlog.h"
 
 dedic_gpio_bundle_handle_t dataBus = NULL;  // GPIOバンドル用ハンドラ
 
+#define DAC_TIMER_NO 0
+#define DAC_TIMER_GROUP TIMER_GROUP_0  // DAC_TIMER_NO 0 = グループ 0 のタイマー 0 (割り込み内でアラームを書く)
+#define DAC_TIMER_IDX TIMER_0
+
+static portMUX_TYPE busMux = portMUX_INITIALIZER_UNLOCKED;
+
+// DAC タイマー動作中はバス操作の間だけ割り込みを止める
+struct BusLock {
+  bool locked;
+  BusLock(FMChip* chip) : locked(chip->_dacTimerActive) {
+    if (locked) portENTER_CRITICAL(&busMux);
+  }
+  ~BusLock() {
+    if (locked) portEXIT_CRITICAL(&busMux);
+  }
+};
+
 // ------------------------------------------------------------------------------
 // FM音源クラス
 //    表記の違い
@@ -34,6 +55,9 @@ void FMChip::begin() {
           },
   };
   ESP_ERROR_CHECK(dedic_gpio_new_bundle(&bundle_config, &dataBus));
+  u32_t offset = 0;
+  dedic_gpio_get_out_offset(dataBus, &offset);
+  _dacDataShift = offset;
 
   // その他の GPIO
   pinMode(WR, OUTPUT);
@@ -53,9 +77,16 @@ void FMChip::begin() {
   CS0_HIGH;
   CS1_HIGH;
   CS2_HIGH;
+
+  busDelayCalibrate();
+  // DAC の割り込みで変換しなくて済むように
+  _twwCycles = busNsToCycles(200);
+  _latchWaitCycles = busNsToCycles(4000);
 }
 
 void FMChip::reset(void) {
+  stopDACTimer();
+
   CS0_LOW;
   CS1_LOW;
   CS2_LOW;
@@ -73,53 +104,41 @@ void FMChip::reset(void) {
   CS2_HIGH;
 
   // stop sound output from SN76489
-  FM.write(0x9f, 1, SI5351_1500);
-  FM.write(0xbf, 1, SI5351_1500);
-  FM.write(0xdf, 1, SI5351_1500);
-  FM.write(0xff, 1, SI5351_1500);
-
-  FM.write(0x9f, 2, SI5351_1500);
-  FM.write(0xbf, 2, SI5351_1500);
-  FM.write(0xdf, 2, SI5351_1500);
-  FM.write(0xff, 2, SI5351_1500);
+  writeRawPair(0x9f, 0xbf, PSG_CHIP(1) | PSG_CHIP(2), SI5351_1500);
+  writeRawPair(0xdf, 0xff, PSG_CHIP(1) | PSG_CHIP(2), SI5351_1500);
 
-  _psgFrqLowByte = 0;
+  _psgLatch.reset();
+  _lastAddr[0] = _lastAddr[1] = 0;
 
   delay(16);
 }
 
 // SN76489
 void FMChip::write(byte data, byte chipno, si5351Freq_t freq) {
-  //
-
-  if ((data & 0x90) == 0x80 && (data & 0x60) >> 5 != 3) {
-    // Low byte 周波数 0x8n, 0xan, 0xcn
-    _psgFrqLowByte = data;
-
-  } else if ((data & 0x80) == 0) {  // High byte
-    if ((_psgFrqLowByte & 0x0F) == 0) {
-      if ((data & 0x3F) == 0) _psgFrqLowByte |= 1;
-    }
-    writeRaw(_psgFrqLowByte, chipno, freq);
-    writeRaw(data, chipno, freq);
-
-  } else {
-    writeRaw(data, chipno, freq);
+  u8_t latch;
+  switch (_psgLatch.write(data, chipno, &latch)) {
+    case PSG_LATCH_PAIR:
+      writeRawPair(latch, data, PSG_CHIP(chipno), freq);
+      break;
+    case PSG_LATCH_RAW:
+      writeRaw(data, chipno, freq);
+      break;
   }
 }
 
+// chipMask の CS をまとめて切り替える
+void FMChip::_psgSelect(uint8_t chipMask, bool select) {
+  const uint32_t level = select ? 0 : 1;
+  if (chipMask & PSG_CHIP(0)) gpio_set_level((gpio_num_t)CS0, level);
+  if (chipMask & PSG_CHIP(1)) gpio_set_level((gpio_num_t)CS1, level);
+  if (chipMask & PSG_CHIP(2)) gpio_set_level((gpio_num_t)CS2, level);
+}
+
 void FMChip::writeRaw(byte data, byte chipno, si5351Freq_t freq) {
-  switch (chipno) {
-    case 0:
-      CS0_LOW;
-      break;
-    case 1:
-      CS1_LOW;
-      break;
-    case 2:
-      CS2_LOW;
-      break;
-  }
+  const u32_t delay = _psgDelay(chipno, freq);
+  BusLock lock(this);
+
+  _psgSelect(PSG_CHIP(chipno), true);
   WR_HIGH;
   dedic_gpio_bundle_write(dataBus, 0xff, data);
 
@@ -129,32 +148,57 @@ void FMChip::writeRaw(byte data, byte chipno, si5351Freq_t freq) {
   // 1.5MHz   :  0.66us   * 32 = 21.3 us
   WR_LOW;
 
-  ets_delay_us((32000000 / freq) + 1);
+  busDelayCycles(delay);
 
   WR_HIGH;
-  switch (chipno) {
-    case 0:
-      CS0_HIGH;
-      break;
-    case 1:
-      CS1_HIGH;
-      break;
-    case 2:
-      CS2_HIGH;
-      break;
+  _psgSelect(PSG_CHIP(chipno), false);
+}
+
+// ラッチ+データの 2 バイトを CS を下げたまま続けて書く
+// 複数チップ指定時は同じクロックで動いている前提で遅い方の待ち時間に合わせる
+void FMChip::writeRawPair(byte latch, byte data, uint8_t chipMask, si5351Freq_t freq) {
+  u32_t delay = 0;
+  for (uint8_t c = 0; c < 3; c++) {
+    if (chipMask & PSG_CHIP(c)) {
+      u32_t d = _psgDelay(c, freq);
+      if (d > delay) delay = d;
+    }
   }
+
+  BusLock lock(this);
+  _psgSelect(chipMask, true);
+  WR_HIGH;
+
+  dedic_gpio_bundle_write(dataBus, 0xff, latch);
+  WR_LOW;
+  busDelayCycles(delay);
+  WR_HIGH;
+
+  dedic_gpio_bundle_write(dataBus, 0xff, data);
+  WR_LOW;
+  busDelayCycles(delay);
+  WR_HIGH;
+
+  _psgSelect(chipMask, false);
+}
+
+// CFG_FMPCM を読み直す (設定変更時)
+void FMChip::updateConfig() {
+  _fmOnly = ndConfig.get(CFG_FMPCM) == FMPCM_FM;
+  _pcmOnly = ndConfig.get(CFG_FMPCM) == FMPCM_PCM;
 }
 
-byte lastAddr = 0;
 void FMChip::setYM2612(byte bank, byte addr, byte data, uint8_t chipno) {
-  if (ndConfig.get(CFG_FMPCM) == FMPCM_FM && addr == 0x2A) {
+  if (_fmOnly && addr == 0x2A) {
     return;  // DAC data off (FM only)
   }
 
-  if (ndConfig.get(CFG_FMPCM) == FMPCM_PCM && addr == 0x28) {
+  if (_pcmOnly && addr == 0x28) {
     data &= 0x0F;  // キーオフ
   }
 
+  BusLock lock(this);
+
   switch (chipno) {
     case 0:
       CS0_LOW;
@@ -172,7 +216,7 @@ void FMChip::setYM2612(byte bank, byte addr, byte data, uint8_t chipno) {
     A1_LOW;
   }
 
-  lastAddr = addr;
+  _lastAddr[chipno & 1] = addr;  // DAC 側はこれを見てラッチし直す
 
   // Address
   A0_LOW;
@@ -183,7 +227,7 @@ void FMChip::setYM2612(byte bank, byte addr, byte data, uint8_t chipno) {
 
   // アドレスライト後の待ちサイクル
   // アドレス＄21-＄B6 待ちサイクル 17 = 2.21us
-  ets_delay_us(5);  // 3 は一部足りない
+  DELAY_NS(5000);  // 3 は一部足りない
 
   // data
   dedic_gpio_bundle_write(dataBus, 0xff, data);
@@ -207,52 +251,243 @@ void FMChip::setYM2612(byte bank, byte addr, byte data, uint8_t chipno) {
   }
   // unsigned long deltaTime = micros() - startTime;
   // Serial.printf("%x%d\n", addr, deltaTime);
+  // 待ちはクロックから (7.67MHz で 10.82us / 6.13us, 6MHz で 13.83us / 7.83us)
   if (addr == 0x2a) {
   } else if (addr >= 0x21 && addr <= 0x9e) {
-    ets_delay_us(12);  // 83 cycles = 10.79us,
+    busDelayCycles(_ymDelay()[0]);  // 83 cycles
   } else if (addr >= 0xa0 && addr <= 0xb6) {
-    ets_delay_us(8);  // 47 cycles = 6.11us
+    busDelayCycles(_ymDelay()[1]);  // 47 cycles
   }
+  _relatchDAC();
 
   // YM3438 Twww マニュアルより
   // WR_LOW -> WR_HIGH: Tww 200 ns
   // Dn -> WR_HIGH: Twds 100 ns
 
-  // データ-アドレスライト間, データデータ間 ($21 - $9E) 83サイクル = 10.79 us
-  // データ-アドレスライト間  データデータ間 ($A0 - $B6) 47サイクル = 6.11 us
+  // データ-アドレスライト間, データデータ間 ($21 - $9E) 83サイクル (7.67MHz で 10.82 us)
+  // データ-アドレスライト間  データデータ間 ($A0 - $B6) 47サイクル (7.67MHz で 6.13 us)
+}
+
+void FMChip::_ymSelect(uint8_t chipno, bool select) {
+  switch (chipno) {
+    case 0:
+      gpio_set_level((gpio_num_t)CS0, select ? 0 : 1);
+      break;
+    case 1:
+      gpio_set_level((gpio_num_t)CS1, select ? 0 : 1);
+      break;
+  }
+}
+
+// データバスに出す (専用 GPIO の CPU 命令なので割り込みからも使える)
+static inline __attribute__((always_inline)) void dacDataOut(u32_t shift, u8_t data) {
+  dedic_gpio_cpu_ll_write_mask(0xff << shift, (u32_t)data << shift);
+}
+
+// アドレス 0x2a をラッチ (CS 選択済みで呼ぶ)
+//    DAC タイマー動作中は FM 側の書き込みの後に _relatchDAC() でラッチし直しておくので、
+//    割り込みからここに来る (4us 待つ) ことは普通はない
+void IRAM_ATTR FMChip::_latchDAC(uint8_t chipno) {
+  if (_lastAddr[chipno & 1] == 0x2a) return;
+  _lastAddr[chipno & 1] = 0x2a;
+  // Address
+  GPIO_FAST_LOW(A0);
+  dacDataOut(_dacDataShift, 0x2a);
+  GPIO_FAST_LOW(WR);
+  busDelayCycles(_twwCycles);  // Tww
+  GPIO_FAST_HIGH(WR);
+  GPIO_FAST_HIGH(A0);
+  // アドレスライト後の待ちサイクル
+  // アドレス＄21-＄B6 待ちサイクル 17 = 2.21us
+  busDelayCycles(_latchWaitCycles);
+}
+
+// DAC タイマー動作中に FM の書き込みで DAC のチップのアドレスが変わったら、
+// 割り込みで待たなくて済むようにタスク側 (BusLock の中) で 0x2a をラッチし直す
+void FMChip::_relatchDAC() {
+  if (!_dacTimerActive || _lastAddr[_dacChip & 1] == 0x2a) return;
+  _ymSelect(_dacChip, true);
+  _latchDAC(_dacChip);
+  _ymSelect(_dacChip, false);
 }
 
 // YM2612 の DAC データ送信専用
 void FMChip::setYM2612DAC(byte data, uint8_t chipno) {
-  if (ndConfig.get(CFG_FMPCM) == FMPCM_FM) {
+  if (_fmOnly) {
     return;  // DAC data off (FM only)
   }
 
+  BusLock lock(this);
+  _ymSelect(chipno, true);
+  _latchDAC(chipno);
+
+  // data
+  dedic_gpio_bundle_write(dataBus, 0xff, data);
+  WR_LOW;
+  WR_HIGH;
+  _ymSelect(chipno, false);
+}
+
+// DAC 連続書き込み
+// 0x2a をラッチしたまま CS を下げっぱなしにして periodUs 間隔でデータだけ書く
+// 途中で FM 書き込みはできないので、長いバッファは分けて呼ぶこと
+void FMChip::setYM2612DACBurst(const u8_t* buf, u32_t n, u32_t periodUs, uint8_t chipno) {
+  if (_fmOnly || n == 0) {
+    return;
+  }
+
+  BusLock lock(this);
+  _ymSelect(chipno, true);
+  _latchDAC(chipno);
+
+  int64_t next = esp_timer_get_time();
+  for (u32_t i = 0; i < n; i++) {
+    if (periodUs) {
+      while (esp_timer_get_time() < next) {
+      }
+      next += periodUs;
+    }
+    dedic_gpio_bundle_write(dataBus, 0xff, buf[i]);
+    WR_LOW;
+    WR_HIGH;
+  }
+  _ymSelect(chipno, false);
+}
+
+// ------------------------------------------------------------------------------
+// DAC タイマー
+//    APB 80MHz / 2 = 40MHz でカウントし、40MHz / rate の端数は周期を 1 カウント伸ばして合わせる (dacpace.h)
+//    割り込みは ESP_INTR_FLAG_IRAM で登録し (フラッシュの書き込み中も止まらない)、経路は全部 IRAM に置く
+//    GPIO はレジスタに直接書き、待ちは起動時に計算したサイクル数で回る (busdelay.h は always_inline)
+
+static bool IRAM_ATTR dacTimerHandler(void* arg) {
+  ((FMChip*)arg)->dacTimerISR();
+  return false;  // 起こすタスクはない
+}
+
+bool FMChip::startDACTimer(u32_t rate, uint8_t chipno) {
+  stopDACTimer();
+  if (_fmOnly || rate == 0) {
+    return false;
+  }
+
+  _dacHead = 0;
+  _dacTail = 0;
+  _dacUnderruns = 0;
+  _dacChip = chipno;
+  _dacPacer.begin(rate, DAC_TIMER_HZ);
+
+  if (!_dacTimer) {
+    _dacTimer = timerBegin(DAC_TIMER_NO, 80000000 / DAC_TIMER_HZ, true);
+    if (!_dacTimer) {
+      ndLog.println("ERROR: DAC timer allocation failed.");
+      return false;
+    }
+    // timerAttachInterrupt は IRAM フラグを付けないので IDF のドライバに直接登録する
+    if (timer_isr_callback_add(DAC_TIMER_GROUP, DAC_TIMER_IDX, dacTimerHandler, this, ESP_INTR_FLAG_IRAM) != ESP_OK) {
+      ndLog.println("ERROR: DAC timer interrupt allocation failed.");
+      timerEnd(_dacTimer);
+      _dacTimer = NULL;
+      return false;
+    }
+  }
+  timerWrite(_dacTimer, 0);
+  timerAlarmWrite(_dacTimer, _dacPacer.period(), true);
+  _dacTimerActive = true;
+  _relatchDAC();  // 最初の割り込みで待たないように
+  timerAlarmEnable(_dacTimer);
+  return true;
+}
+
+void FMChip::stopDACTimer() {
+  if (!_dacTimerActive) return;
+  timerAlarmDisable(_dacTimer);
+  _dacTimerActive = false;
+}
+
+bool FMChip::pushDAC(u16_t data) {
+  if (_dacHead - _dacTail >= DAC_RING_SIZE) {
+    return false;
+  }
+  _dacRing[_dacHead & (DAC_RING_SIZE - 1)] = data;
+  _dacHead = _dacHead + 1;
+  return true;
+}
+
+u32_t FMChip::dacQueued() { return _dacHead - _dacTail; }
+
+u32_t FMChip::takeDACUnderruns() {
+  portENTER_CRITICAL(&busMux);
+  u32_t n = _dacUnderruns;
+  _dacUnderruns = 0;
+  portEXIT_CRITICAL(&busMux);
+  return n;
+}
+
+void IRAM_ATTR FMChip::dacTimerISR() {
+  // 次の周期
+  if (_dacPacer.step()) {
+    timer_group_set_alarm_value_in_isr(DAC_TIMER_GROUP, DAC_TIMER_IDX, _dacPacer.period());
+  }
+
+  if (_dacTail == _dacHead) {
+    _dacUnderruns = _dacUnderruns + 1;
+    return;
+  }
+  u16_t v = _dacRing[_dacTail & (DAC_RING_SIZE - 1)];
+  _dacTail = _dacTail + 1;
+  if (v & DAC_SKIP) {
+    return;
+  }
+
+  const int cs = _dacChip ? CS1 : CS0;
+  portENTER_CRITICAL_ISR(&busMux);
+  GPIO_FAST_LOW(cs);
+  _latchDAC(_dacChip);  // 普通はラッチ済み
+  dacDataOut(_dacDataShift, v);
+  GPIO_FAST_LOW(WR);
+  busDelayCycles(_twwCycles);  // Tww
+  GPIO_FAST_HIGH(WR);
+  GPIO_FAST_HIGH(cs);
+  portEXIT_CRITICAL_ISR(&busMux);
+}
+
+// YM2203, AY-8910用レジスタ設定
+void FMChip::setRegister(byte addr, byte data, int chipno = 0) {
+  BusLock lock(this);
+  // Address
+  dedic_gpio_bundle_write(dataBus, 0xff, addr);
+  A0_LOW;  // 375ns
   switch (chipno) {
     case 0:
       CS0_LOW;
+      CS1_HIGH;
+      CS2_HIGH;
       break;
     case 1:
+      CS0_HIGH;
       CS1_LOW;
+      CS2_HIGH;
+      break;
+    case 2:
+      CS0_HIGH;
+      CS1_HIGH;
+      CS2_LOW;
       break;
   }
+  DELAY_NS(500);
+  WR_LOW;
+  DELAY_NS(500);
+  WR_HIGH;
+  A0_HIGH;
 
-  if (lastAddr != 0x2a) {
-    lastAddr = 0x2a;
-    // Address
-    A0_LOW;
-    dedic_gpio_bundle_write(dataBus, 0xff, 0x2a);
-    WR_LOW;
-    WR_HIGH;
-    A0_HIGH;
-    // アドレスライト後の待ちサイクル
-    // アドレス＄21-＄B6 待ちサイクル 17 = 2.21us
-    ets_delay_us(4);
-  }
+  DELAY_NS(3000);
 
   // data
   dedic_gpio_bundle_write(dataBus, 0xff, data);
+  DELAY_NS(500);
   WR_LOW;
+  DELAY_NS(500);
   WR_HIGH;
   switch (chipno) {
     case 0:
@@ -261,14 +496,18 @@ void FMChip::setYM2612DAC(byte data, uint8_t chipno) {
     case 1:
       CS1_HIGH;
       break;
+    case 2:
+      CS2_HIGH;
+      break;
   }
+  DELAY_NS(16000);  // 最低16
 }
 
-// YM2203, AY-8910用レジスタ設定
-void FMChip::setRegister(byte addr, byte data, int chipno = 0) {
-  // Address
+// 　YM2151用レジスタ設定(最適化済)
+void FMChip::setRegisterOPM(byte addr, byte data, uint8_t chipno = 0) {
+  BusLock lock(this);
   dedic_gpio_bundle_write(dataBus, 0xff, addr);
-  A0_LOW;  // 375ns
+  A0_LOW;
   switch (chipno) {
     case 0:
       CS0_LOW;
@@ -286,20 +525,21 @@ void FMChip::setRegister(byte addr, byte data, int chipno = 0) {
       CS2_LOW;
       break;
   }
-  ets_delay_us(2);
+  DELAY_NS(500);
   WR_LOW;
-  ets_delay_us(2);
+  DELAY_NS(500);
   WR_HIGH;
   A0_HIGH;
 
-  ets_delay_us(3);
+  DELAY_NS(3000);
 
   // data
   dedic_gpio_bundle_write(dataBus, 0xff, data);
-  ets_delay_us(2);
+  DELAY_NS(500);
   WR_LOW;
-  ets_delay_us(2);
+  DELAY_NS(500);
   WR_HIGH;
+
   switch (chipno) {
     case 0:
       CS0_HIGH;
@@ -311,11 +551,14 @@ void FMChip::setRegister(byte addr, byte data, int chipno = 0) {
       CS2_HIGH;
       break;
   }
-  ets_delay_us(16);  // 最低16
+  DELAY_NS(12000);
 }
 
-// 　YM2151用レジスタ設定(最適化済)
-void FMChip::setRegisterOPM(byte addr, byte data, uint8_t chipno = 0) {
+// YM2413 (OPLL) 用レジスタ設定
+//    アドレス書き込み後 12 サイクル、データ書き込み後 84 サイクル待つ
+//    3.58MHz: 3.35us / 23.5us
+void FMChip::setRegisterOPLL(byte addr, byte data, uint8_t chipno) {
+  BusLock lock(this);
   dedic_gpio_bundle_write(dataBus, 0xff, addr);
   A0_LOW;
   switch (chipno) {
@@ -335,19 +578,19 @@ void FMChip::setRegisterOPM(byte addr, byte data, uint8_t chipno = 0) {
       CS2_LOW;
       break;
   }
-  ets_delay_us(2);
+  DELAY_NS(500);
   WR_LOW;
-  ets_delay_us(2);
+  DELAY_NS(500);
   WR_HIGH;
   A0_HIGH;
 
-  ets_delay_us(3);
+  DELAY_NS(3500);
 
   // data
   dedic_gpio_bundle_write(dataBus, 0xff, data);
-  ets_delay_us(2);
+  DELAY_NS(500);
   WR_LOW;
-  ets_delay_us(2);
+  DELAY_NS(500);
   WR_HIGH;
 
   switch (chipno) {
@@ -361,10 +604,11 @@ void FMChip::setRegisterOPM(byte addr, byte data, uint8_t chipno = 0) {
       CS2_HIGH;
       break;
   }
-  ets_delay_us(12);
+  DELAY_NS(24000);
 }
 
 void FMChip::setRegisterOPL3(byte port, byte addr, byte data, int chipno) {
+  BusLock lock(this);
   switch (chipno) {
     case 0:
       CS0_LOW;
@@ -391,11 +635,11 @@ void FMChip::setRegisterOPL3(byte port, byte addr, byte data, int chipno) {
   A0_LOW;
   dedic_gpio_bundle_write(dataBus, 0xff, addr);
   WR_LOW;
-  ets_delay_us(16);
+  DELAY_NS(16000);
   WR_HIGH;
   A0_HIGH;
 
-  ets_delay_us(16);
+  DELAY_NS(16000);
 
   // 32 clocks to write address
   // 14.318180 MHz: 69.84 ns / cycle
@@ -404,7 +648,7 @@ void FMChip::setRegisterOPL3(byte port, byte addr, byte data, int chipno) {
   // data
   dedic_gpio_bundle_write(dataBus, 0xff, data);
   WR_LOW;
-  ets_delay_us(16);
+  DELAY_NS(16000);
   WR_HIGH;
   switch (chipno) {
     case 0:
@@ -421,7 +665,7 @@ void FMChip::setRegisterOPL3(byte port, byte addr, byte data, int chipno) {
     A1_LOW;
   }
 
-  ets_delay_us(16);
+  DELAY_NS(16000);
 }
 
 FMChip FM;
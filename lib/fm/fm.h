@@ -2,7 +2,13 @@
 #define FM_H
 #include <Arduino.h>
 
+#include <soc/gpio_struct.h>
+
 #include "SI5351.hpp"
+#include "busdelay.h"
+#include "chipbus.h"
+#include "dacpace.h"
+#include "psglatch.h"
 
 // GPIO Assignment
 #define D0 9
@@ -37,20 +43,96 @@
 #define IC_HIGH (gpio_set_level((gpio_num_t)IC, 1))
 #define IC_LOW (gpio_set_level((gpio_num_t)IC, 0))
 
-class FMChip {
+// DAC タイマー割り込み用: gpio_set_level を通さずに出力レジスタに直接書く (IRAM から呼べる)
+#define GPIO_FAST_HIGH(pin) \
+  ((pin) < 32 ? (void)(GPIO.out_w1ts = 1UL << (pin)) : (void)(GPIO.out1_w1ts.val = 1UL << ((pin) - 32)))
+#define GPIO_FAST_LOW(pin) \
+  ((pin) < 32 ? (void)(GPIO.out_w1tc = 1UL << (pin)) : (void)(GPIO.out1_w1tc.val = 1UL << ((pin) - 32)))
+
+#define DAC_TIMER_HZ 40000000
+
+class FMChip : public ChipBus {
  public:
   void begin();
-  void reset();
-  void setRegister(byte addr, byte value, int chipno);
-  void setRegisterOPM(byte addr, byte value, uint8_t chipno);
-  void setRegisterOPL3(byte port, byte addr, byte data, int chipno);
-  void setYM2612(byte port, byte addr, byte data, uint8_t chipno);
-  void setYM2612DAC(byte data, uint8_t chipno);
-  void write(byte data, byte chipno, si5351Freq_t freq);
-  void writeRaw(byte data, byte chipno, si5351Freq_t freq);
+  void reset() override;
+  void setRegister(byte addr, byte value, int chipno) override;
+  void setRegisterOPM(byte addr, byte value, uint8_t chipno) override;
+  void setRegisterOPL3(byte port, byte addr, byte data, int chipno) override;
+  void setRegisterOPLL(byte addr, byte value, uint8_t chipno) override;
+  void setYM2612(byte port, byte addr, byte data, uint8_t chipno) override;
+  void setYM2612DAC(byte data, uint8_t chipno) override;
+  void setYM2612DACBurst(const u8_t* buf, u32_t n, u32_t periodUs, uint8_t chipno) override;
+  void write(byte data, byte chipno, si5351Freq_t freq) override;
+  void writeRaw(byte data, byte chipno, si5351Freq_t freq) override;
+  void writeRawPair(byte latch, byte data, uint8_t chipMask, si5351Freq_t freq) override;
+  void updateConfig();  // FM/PCM 設定を反映
+
+  bool startDACTimer(u32_t rate, uint8_t chipno) override;
+  void stopDACTimer() override;
+  bool pushDAC(u16_t data) override;
+  u32_t dacQueued() override;
+  u32_t takeDACUnderruns() override;
+  void dacTimerISR();
 
  private:
-  u8_t _psgFrqLowByte = 0;
+  PSGLatch _psgLatch;  // write() の下位バイト保持 (チップ毎)
+
+  // YM2612 最後に書いたアドレス (チップ毎, 0x2a なら DAC ラッチ済み)
+  u8_t _lastAddr[2] = {0, 0};
+  // CFG_FMPCM のキャッシュ
+  bool _fmOnly = false;
+  bool _pcmOnly = false;
+
+  // DAC タイマー
+  //   リングバッファ (下位 8 ビットがデータ, DAC_SKIP は書かない)
+  //   タイマー動作中はバス操作をクリティカルセクションで囲んで割り込みと衝突させない
+  hw_timer_t* _dacTimer = NULL;
+  volatile bool _dacTimerActive = false;
+  u8_t _dacChip = 0;
+  u16_t _dacRing[DAC_RING_SIZE];
+  volatile u32_t _dacHead = 0;  // 書き込み位置 (メインタスク)
+  volatile u32_t _dacTail = 0;  // 読み出し位置 (割り込み)
+  volatile u32_t _dacUnderruns = 0;
+  DACPacer _dacPacer;
+  u32_t _dacDataShift = 0;  // データバスの専用 GPIO 上の位置
+  u32_t _twwCycles = 0;      // WR 幅 Tww (200ns) の CPU サイクル数 (校正後に計算, 割り込みで使う)
+  u32_t _latchWaitCycles = 0;  // アドレスライト後の待ち (4us)
+
+  friend struct BusLock;
+
+  void _ymSelect(uint8_t chipno, bool select);
+  void _latchDAC(uint8_t chipno);
+  void _relatchDAC();
+
+  // SN76489 の WR 待ち時間 (CPU サイクル) をクロックごとに保持
+  si5351Freq_t _psgDelayFreq[3] = {SI5351_UNDEFINED, SI5351_UNDEFINED, SI5351_UNDEFINED};
+  u32_t _psgDelayCycles[3] = {0, 0, 0};
+
+  inline u32_t _psgDelay(uint8_t chipno, si5351Freq_t freq) {
+    if (_psgDelayFreq[chipno] != freq) {
+      _psgDelayFreq[chipno] = freq;
+      _psgDelayCycles[chipno] = busNsToCycles(busPsgWriteNs(freq));
+    }
+    return _psgDelayCycles[chipno];
+  }
+  void _psgSelect(uint8_t chipMask, bool select);
+
+  // YM2612 のデータライト後の待ち (CPU サイクル, [0] = $21 - $9E, [1] = $A0 - $B6)
+  //   YM2612 のクロック (SI5351 の出力 0) が変わったときだけ計算し直す
+  //   未設定なら選べる中で一番遅い 6MHz として待つ
+  si5351Freq_t _ymDelayFreq = SI5351_UNDEFINED;
+  u32_t _ymDelayCycles[2] = {0, 0};
+
+  inline const u32_t* _ymDelay() {
+    si5351Freq_t freq = SI5351.getFreq(0);
+    if (_ymDelayFreq != freq || _ymDelayCycles[0] == 0) {
+      _ymDelayFreq = freq;
+      u32_t clock = freq != SI5351_UNDEFINED ? freq : SI5351_6000;
+      _ymDelayCycles[0] = busNsToCycles(busYmWaitNs(BUS_YM_WAIT_CYCLES_LONG, clock));
+      _ymDelayCycles[1] = busNsToCycles(busYmWaitNs(BUS_YM_WAIT_CYCLES_SHORT, clock));
+    }
+    return _ymDelayCycles;
+  }
 };
 
 extern FMChip FM;
@@ -0,0 +1,134 @@
+#include "synthbus.h"
+#include "../../include/ndlog.h"
+
+#include <SD.h>
+
+// ------------------------------------------------------------------------------
+// ソフトウェア音源チップバス
+
+bool SynthChipBus::begin(const char* path) {
+  end();
+
+  if (!_buffer) {
+    _buffer = (int16_t*)ps_malloc(SYNTH_BUFFER_FRAMES * 2 * sizeof(int16_t));
+    if (!_buffer) {
+      ndLog.println("ERROR: SynthChipBus buffer allocation failed.");
+      return false;
+    }
+  }
+
+  _file = SD.open(path, FILE_WRITE);
+  if (!_file) {
+    ndLog.printf("ERROR: Failed to open render file: %s\n", path);
+    return false;
+  }
+  _writeHeader(0);  // サイズは end() で書き直す
+
+  _count = 0;
+  _rendered = 0;
+  _renderUs = 0;
+  _startUs = esp_timer_get_time();
+  reset();
+  return true;
+}
+
+void SynthChipBus::end() {
+  if (!_file) return;
+  _advance();
+  _flush();
+  _writeHeader(_rendered * 4);
+  _file.close();
+
+  // 実時間比 (1.0 未満なら実時間より速くレンダリングできている)
+  float audioSec = (float)_rendered / SYNTH_RATE;
+  float renderSec = (float)_renderUs / 1000000.0f;
+  ndLog.printf("Synth: %.2f sec rendered in %.2f sec (RTF %.3f)\n", audioSec, renderSec,
+               audioSec > 0 ? renderSec / audioSec : 0.0f);
+}
+
+void SynthChipBus::setYMClock(uint32_t clock) {
+  if (clock == 0) return;
+  _mix.setYMClock(clock);
+}
+
+void SynthChipBus::reset() {
+  _advance();
+  _mix.reset(7670453, 3579545);
+}
+
+void SynthChipBus::setYM2612(byte port, byte addr, byte data, uint8_t chipno) {
+  if (chipno != 0) return;
+  _advance();
+  _mix.ym(port, addr, data);
+}
+
+void SynthChipBus::setYM2612DAC(byte data, uint8_t chipno) {
+  if (chipno != 0) return;
+  _advance();
+  _mix.ym(0, 0x2a, data);
+}
+
+void SynthChipBus::write(byte data, byte chipno, si5351Freq_t freq) {
+  _advance();
+  _mix.snWrite(data, chipno, freq != SI5351_UNDEFINED ? (u32_t)freq : 0);
+}
+
+void SynthChipBus::writeRaw(byte data, byte chipno, si5351Freq_t freq) {
+  _advance();
+  _mix.snWriteRaw(data, chipno, freq != SI5351_UNDEFINED ? (u32_t)freq : 0);
+}
+
+// 経過時間の位置までレンダリング
+void SynthChipBus::_advance() {
+  if (!_file) return;
+  u32_t target = (u32_t)((esp_timer_get_time() - _startUs) * SYNTH_RATE / 1000000);
+  if (target <= _rendered) return;
+
+  u64_t t = esp_timer_get_time();
+  u32_t frames = target - _rendered;
+  while (frames > 0) {
+    u32_t n = frames > SYNTH_BLOCK ? SYNTH_BLOCK : frames;
+    if (n > SYNTH_BUFFER_FRAMES - _count) n = SYNTH_BUFFER_FRAMES - _count;
+    _mix.render(&_buffer[_count * 2], n);
+    _count += n;
+    _rendered += n;
+    frames -= n;
+    if (_count == SYNTH_BUFFER_FRAMES) {
+      _flush();
+    }
+  }
+  _renderUs += esp_timer_get_time() - t;
+}
+
+void SynthChipBus::_flush() {
+  if (_count == 0) return;
+  _file.write((const uint8_t*)_buffer, _count * 2 * sizeof(int16_t));
+  _count = 0;
+}
+
+// 44 バイトの WAV ヘッダ (16bit ステレオ)
+void SynthChipBus::_writeHeader(u32_t dataBytes) {
+  struct __attribute__((packed)) {
+    char riff[4];
+    u32_t riffSize;
+    char wave[4];
+    char fmt[4];
+    u32_t fmtSize;
+    u16_t format;
+    u16_t channels;
+    u32_t rate;
+    u32_t byteRate;
+    u16_t blockAlign;
+    u16_t bits;
+    char data[4];
+    u32_t dataSize;
+  } h = {{'R', 'I', 'F', 'F'}, 36 + dataBytes, {'W', 'A', 'V', 'E'}, {'f', 'm', 't', ' '}, 16, 1, 2, SYNTH_RATE,
+         SYNTH_RATE * 4,       4,               16,                   {'d', 'a', 't', 'a'}, dataBytes};
+
+  size_t pos = _file.position();
+  _file.seek(0);
+  _file.write((const uint8_t*)&h, sizeof(h));
+  if (pos > sizeof(h)) _file.seek(pos);
+}
+
+SynthChipBus chipSynth;
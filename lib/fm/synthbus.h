@@ -0,0 +1,52 @@
+#ifndef SYNTHBUS_H
+#define SYNTHBUS_H
+#include <Arduino.h>
+#include <FS.h>
+
+#include "chipbus.h"
+#include "synthmix.h"
+
+// ------------------------------------------------------------------------------
+// ソフトウェア音源チップバス
+//    YM2612 (chipno 0) と SN76489 (chipno 1, 2) をソフトで鳴らして SD に WAV で書き出す
+//    実機なしで再生エンジンの出力を確認するためのもの
+//    書き込みのたびに経過時間 (esp_timer) の位置までレンダリングしてからレジスタを反映する
+//    OPM, OPL3, OPLL, その他の OPN は無視
+
+#define SYNTH_BUFFER_FRAMES (64 * 1024)  // 256KB (PSRAM, 16bit ステレオ)
+
+class SynthChipBus : public ChipBus {
+ public:
+  bool begin(const char* path);
+  void end();
+  bool isRecording() { return _file; }
+  void setYMClock(uint32_t clock);
+
+  void reset() override;
+  void setRegister(byte addr, byte value, int chipno) override {}
+  void setRegisterOPM(byte addr, byte value, uint8_t chipno) override {}
+  void setRegisterOPL3(byte port, byte addr, byte data, int chipno) override {}
+  void setRegisterOPLL(byte addr, byte value, uint8_t chipno) override {}
+  void setYM2612(byte port, byte addr, byte data, uint8_t chipno) override;
+  void setYM2612DAC(byte data, uint8_t chipno) override;
+  void write(byte data, byte chipno, si5351Freq_t freq) override;
+  void writeRaw(byte data, byte chipno, si5351Freq_t freq) override;
+
+ private:
+  SynthMix _mix;  // 音源とミキサー (lib/synth)
+
+  File _file;
+  int16_t* _buffer = NULL;
+  u32_t _count = 0;     // バッファ内のフレーム数
+  u32_t _rendered = 0;  // 開始からのフレーム数
+  u64_t _startUs = 0;
+  u64_t _renderUs = 0;  // レンダリングに掛かった時間
+
+  void _advance();
+  void _flush();
+  void _writeHeader(u32_t dataBytes);
+};
+
+extern SynthChipBus chipSynth;
+
+#endif
@@ -0,0 +1,163 @@
+#include "glyphatlas.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ft2build.h"
+#include FT_FREETYPE_H
+
+#define ASCENDER_UNKNOWN 0x7f
+
+static uint32_t glyphKey(uint8_t face, uint8_t size, uint32_t codepoint) {
+  return ((uint32_t)face << 29) | ((uint32_t)size << 21) | (codepoint & 0x1fffff);
+}
+
+bool GlyphAtlas::begin() {
+  if (!_library && FT_Init_FreeType(&_library)) {
+    _library = NULL;
+    return false;
+  }
+  if (!_slots) _slots = (t_glyph*)malloc(GLYPH_ATLAS_SLOTS * sizeof(t_glyph));
+  if (!_pool) _pool = (uint8_t*)malloc(GLYPH_ATLAS_POOL);
+  if (!_slots || !_pool) return false;
+  memset(_ascender, ASCENDER_UNKNOWN, sizeof(_ascender));
+  clear();
+  return true;
+}
+
+bool GlyphAtlas::addFace(uint8_t face, const uint8_t* data, size_t size) {
+  if (!_library || face >= GLYPH_ATLAS_FACES || _faces[face]) return false;
+  FT_Face f;
+  if (FT_New_Memory_Face(_library, data, size, 0, &f)) return false;
+  _faces[face] = f;
+  _faceSize[face] = 0;
+  return true;
+}
+
+void GlyphAtlas::clear() {
+  if (_slots) memset(_slots, 0, GLYPH_ATLAS_SLOTS * sizeof(t_glyph));
+  _count = 0;
+  _poolUsed = 0;
+}
+
+const t_glyph* GlyphAtlas::get(uint8_t face, uint8_t size, uint32_t codepoint) {
+  if (!_slots || face >= GLYPH_ATLAS_FACES || !_faces[face] || size == 0 || size >= GLYPH_ATLAS_MAX_SIZE) {
+    return NULL;
+  }
+  uint32_t key = glyphKey(face, size, codepoint);
+  t_glyph* g = _slot(key);
+  if (g->key == key) {
+    hits++;
+    return g;
+  }
+  misses++;
+  return _rasterize(face, size, codepoint, key);
+}
+
+int GlyphAtlas::ascender(uint8_t face, uint8_t size) {
+  if (face >= GLYPH_ATLAS_FACES || size >= GLYPH_ATLAS_MAX_SIZE) return 0;
+  int8_t& a = _ascender[face][size];
+  if (a == ASCENDER_UNKNOWN) {
+    if (!_setSize(face, size)) return 0;
+    a = _faces[face]->size->metrics.ascender >> 6;
+  }
+  return a;
+}
+
+void GlyphAtlas::measure(uint8_t face, uint8_t size, const char* str, int32_t* inkLeft, uint32_t* inkWidth) {
+  int32_t pen = 0;
+  int32_t left = INT32_MAX, right = INT32_MIN;
+  uint32_t c;
+  while ((c = nextCodepoint(&str)) != 0) {
+    const t_glyph* g = get(face, size, c);
+    if (!g) continue;
+    if (g->width) {
+      if (pen + g->left < left) left = pen + g->left;
+      if (pen + g->left + g->width > right) right = pen + g->left + g->width;
+    }
+    pen += g->advance;
+  }
+  if (left > right) {
+    // 空白だけ
+    *inkLeft = 0;
+    *inkWidth = 0;
+    return;
+  }
+  *inkLeft = left;
+  *inkWidth = right - left;
+}
+
+uint32_t GlyphAtlas::nextCodepoint(const char** p) {
+  const uint8_t* s = (const uint8_t*)*p;
+  uint32_t c = s[0];
+  int n = 0;
+  if (c == 0) return 0;
+  if (c < 0x80) {
+    n = 0;
+  } else if ((c & 0xe0) == 0xc0) {
+    c &= 0x1f;
+    n = 1;
+  } else if ((c & 0xf0) == 0xe0) {
+    c &= 0x0f;
+    n = 2;
+  } else if ((c & 0xf8) == 0xf0) {
+    c &= 0x07;
+    n = 3;
+  }
+  s++;
+  for (int i = 0; i < n; i++) {
+    if ((*s & 0xc0) != 0x80) break;  // 途中で切れている
+    c = (c << 6) | (*s++ & 0x3f);
+  }
+  *p = (const char*)s;
+  return c;
+}
+
+bool GlyphAtlas::_setSize(uint8_t face, uint8_t size) {
+  if (!_faces[face]) return false;
+  if (_faceSize[face] == size) return true;
+  if (FT_Set_Pixel_Sizes(_faces[face], 0, size)) return false;
+  _faceSize[face] = size;
+  return true;
+}
+
+// key のスロット (なければ入れる場所の空きスロット)
+t_glyph* GlyphAtlas::_slot(uint32_t key) {
+  uint32_t i = (key * 2654435761u) >> 20;  // 上位 12 ビット (GLYPH_ATLAS_SLOTS)
+  while (_slots[i].key != 0 && _slots[i].key != key) {
+    i = (i + 1) & (GLYPH_ATLAS_SLOTS - 1);
+  }
+  return &_slots[i];
+}
+
+t_glyph* GlyphAtlas::_rasterize(uint8_t face, uint8_t size, uint32_t codepoint, uint32_t key) {
+  if (!_setSize(face, size)) return NULL;
+  FT_Face f = _faces[face];
+  if (FT_Load_Char(f, codepoint, FT_LOAD_RENDER)) return NULL;
+
+  FT_GlyphSlot gs = f->glyph;
+  uint32_t w = gs->bitmap.width, h = gs->bitmap.rows;
+  if (w > 255 || h > 255) w = h = 0;  // 大きすぎるものは送りだけ
+  uint32_t bytes = w * h;
+
+  // 一杯なら全部捨てて入れ直す
+  if (_count >= GLYPH_ATLAS_MAX_LOAD || _poolUsed + bytes > GLYPH_ATLAS_POOL) {
+    clear();
+    flushes++;
+  }
+
+  t_glyph* g = _slot(key);
+  g->key = key;
+  g->offset = _poolUsed;
+  g->width = w;
+  g->rows = h;
+  g->left = gs->bitmap_left;
+  g->top = gs->bitmap_top;
+  g->advance = gs->advance.x >> 6;
+  for (uint32_t y = 0; y < h; y++) {
+    memcpy(_pool + _poolUsed + y * w, gs->bitmap.buffer + y * gs->bitmap.pitch, w);
+  }
+  _poolUsed += bytes;
+  _count++;
+  return g;
+}
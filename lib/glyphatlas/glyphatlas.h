@@ -0,0 +1,77 @@
+#ifndef GLYPHATLAS_H
+#define GLYPHATLAS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// ------------------------------------------------------------------------------
+// グリフアトラス
+//    フォントは 1 回だけ FreeType に読み込んでおき、ラスタライズしたグリフ (8 ビットのアルファ) を
+//    (フェイス, サイズ, コードポイント) をキーにしてバッファに貯めておく
+//    2 回目からは FreeType を通さずにビットマップを返すので、描画はアトラスからのコピーだけになる
+//    一杯になったら全部捨てて入れ直す (曲が変わるたびに同じ文字を使うことが多いので十分)
+//    Arduino に依存しない。スレッドセーフではないので呼ぶ側で排他する
+
+#define GLYPH_ATLAS_FACES 4              // 登録できるフェイス数
+#define GLYPH_ATLAS_MAX_SIZE 64          // 扱えるフォントサイズ (px) の上限 + 1
+#define GLYPH_ATLAS_POOL (512 * 1024)    // ビットマップ用バッファ
+#define GLYPH_ATLAS_SLOTS 4096           // ハッシュ表のスロット数 (2 のべき乗)
+#define GLYPH_ATLAS_MAX_LOAD (GLYPH_ATLAS_SLOTS * 3 / 4)
+
+typedef struct {
+  uint32_t key;     // face << 29 | size << 21 | codepoint (0 = 空き)
+  uint32_t offset;  // ビットマップの位置 (バッファ内)
+  uint8_t width;    // ビットマップの幅 (= ピッチ)
+  uint8_t rows;     // ビットマップの高さ
+  int8_t left;      // ペン位置からビットマップの左端まで
+  int8_t top;       // ベースラインからビットマップの上端まで (上が正)
+  uint8_t advance;  // 次の文字までの送り (px)
+} t_glyph;
+
+struct FT_LibraryRec_;
+struct FT_FaceRec_;
+
+class GlyphAtlas {
+ public:
+  bool begin();  // FreeType の初期化とバッファの確保 (大きいので PSRAM に行く)
+  bool addFace(uint8_t face, const uint8_t* data, size_t size);  // フォントデータは捨てずに置いておくこと
+
+  // グリフを返す。なければラスタライズしてアトラスに入れる (失敗したら NULL)
+  // 戻り値とビットマップは次の get まで有効 (入れ直しで消えることがある)
+  const t_glyph* get(uint8_t face, uint8_t size, uint32_t codepoint);
+  const uint8_t* bitmap(const t_glyph* g) const { return _pool + g->offset; }
+
+  int ascender(uint8_t face, uint8_t size);  // ベースラインから上の高さ (px)
+
+  // 文字列 (UTF-8) のインクの範囲。ペンの開始位置から見た左端と幅
+  void measure(uint8_t face, uint8_t size, const char* str, int32_t* inkLeft, uint32_t* inkWidth);
+
+  void clear();  // アトラスを空にする
+  uint32_t used() const { return _poolUsed; }
+  uint32_t glyphs() const { return _count; }
+
+  // UTF-8 を 1 文字読んで進める (終わりは 0)
+  static uint32_t nextCodepoint(const char** p);
+
+  // 統計
+  uint32_t hits = 0;
+  uint32_t misses = 0;
+  uint32_t flushes = 0;  // 一杯になって入れ直した回数
+
+ private:
+  FT_LibraryRec_* _library = NULL;
+  FT_FaceRec_* _faces[GLYPH_ATLAS_FACES] = {};
+  uint8_t _faceSize[GLYPH_ATLAS_FACES] = {};  // FT_Set_Pixel_Sizes 済みのサイズ
+  int8_t _ascender[GLYPH_ATLAS_FACES][GLYPH_ATLAS_MAX_SIZE];
+
+  t_glyph* _slots = NULL;  // GLYPH_ATLAS_SLOTS
+  uint32_t _count = 0;
+  uint8_t* _pool = NULL;  // GLYPH_ATLAS_POOL
+  uint32_t _poolUsed = 0;
+
+  bool _setSize(uint8_t face, uint8_t size);
+  t_glyph* _slot(uint32_t key);
+  t_glyph* _rasterize(uint8_t face, uint8_t size, uint32_t codepoint, uint32_t key);
+};
+
+#endif
@@ -0,0 +1,127 @@
+#include "pcmmix.h"
+
+#include <string.h>
+
+void pcmMixClear(int16_t* acc, uint8_t* hit, uint32_t n) {
+  memset(acc, 0, n * sizeof(int16_t));
+  memset(hit, 0, n);
+}
+
+uint32_t pcmMixAddScalar(int16_t* acc, uint8_t* hit, uint32_t n, const int8_t* src, uint32_t len, uint8_t step,
+                         uint8_t phase) {
+  if (step == 1) {
+    // 通常速度: 分岐なしの単純なループ
+    uint32_t m = n < len ? n : len;
+    for (uint32_t i = 0; i < m; i++) {
+      acc[i] += src[i];
+    }
+    memset(hit, 1, m);
+    return m;
+  }
+
+  uint32_t used = 0;
+  for (uint32_t i = phase; i < n && used < len; i += step) {
+    acc[i] += src[used++];
+    hit[i] = 1;
+  }
+  return used;
+}
+
+#if PCM_MIX_PIE
+// src の 16 サンプルを int16 に符号拡張して acc (16 バイト境界) に飽和加算する
+// src は境界に揃っていなくてよいが、揃えた位置から 32 バイト読む
+// (8 チャンネル分足しても int16 は飽和しないので、結果はスカラー版と同じ)
+static inline __attribute__((always_inline)) void pcmMixAdd16(int16_t* acc, const int8_t* src) {
+  int16_t* st = acc;
+  asm volatile(
+      "ee.zero.q q7\n"
+      "ee.ld.128.usar.ip q0, %[src], 16\n"  // src を含む 16 バイト, SAR_BYTE = src & 15
+      "ee.vld.128.ip q1, %[src], 0\n"       // 次の 16 バイト
+      "ee.src.q q0, q0, q1\n"               // q0 = src[0..15]
+      "ee.vcmp.lt.s8 q1, q0, q7\n"          // q1 = 負なら 0xff
+      "ee.vzip.8 q0, q1\n"                  // q0 = src[0..7], q1 = src[8..15] (int16)
+      "ee.vld.128.ip q2, %[acc], 16\n"
+      "ee.vld.128.ip q3, %[acc], 0\n"
+      "ee.vadds.s16 q2, q2, q0\n"
+      "ee.vadds.s16 q3, q3, q1\n"
+      "ee.vst.128.ip q2, %[st], 16\n"
+      "ee.vst.128.ip q3, %[st], 0\n"
+      : [src] "+r"(src), [acc] "+r"(acc), [st] "+r"(st)
+      :
+      : "memory");
+}
+#endif
+
+uint32_t pcmMixAdd(int16_t* acc, uint8_t* hit, uint32_t n, const int8_t* src, uint32_t len, uint8_t step,
+                   uint8_t phase) {
+#if PCM_MIX_PIE
+  if (step == 1) {
+    uint32_t m = n < len ? n : len;
+    uint32_t i = 0;
+    // acc が 16 バイト境界になるまでと、src の終わりを越えて読む端数はスカラーで
+    for (; i < m && ((uintptr_t)(acc + i) & 15); i++) {
+      acc[i] += src[i];
+    }
+    for (; i + 16 <= m && i + 32 <= len; i += 16) {
+      pcmMixAdd16(acc + i, src + i);
+    }
+    for (; i < m; i++) {
+      acc[i] += src[i];
+    }
+    memset(hit, 1, m);
+    return m;
+  }
+#endif
+  return pcmMixAddScalar(acc, hit, n, src, len, step, phase);
+}
+
+void pcmMixOut(const int16_t* acc, const uint8_t* hit, uint16_t* out, uint32_t n) {
+  for (uint32_t i = 0; i < n; i++) {
+    int16_t s = acc[i];
+    s = s > INT8_MAX ? INT8_MAX : s;
+    s = s < INT8_MIN ? INT8_MIN : s;
+    out[i] = hit[i] ? (uint16_t)(s + 128) : PCM_MIX_SKIP;
+  }
+}
+
+#ifdef ARDUINO
+#include <Arduino.h>
+
+void pcmMixBenchmark() {
+  const uint32_t len = 16384;
+  int8_t* src = (int8_t*)ps_malloc(len);
+  if (!src) {
+    Serial.println("ERROR: pcmMixBenchmark allocation failed.");
+    return;
+  }
+  for (uint32_t i = 0; i < len; i++) {
+    src[i] = (int8_t)esp_random();
+  }
+
+  alignas(16) int16_t acc[PCM_MIX_BLOCK];
+  uint8_t hit[PCM_MIX_BLOCK];
+  uint16_t out[PCM_MIX_BLOCK];
+
+  for (int pie = 0; pie <= PCM_MIX_PIE; pie++) {
+    for (int ch = 1; ch <= 8; ch++) {
+      u32_t start = ESP.getCycleCount();
+      for (uint32_t pos = 0; pos + PCM_MIX_BLOCK <= len; pos += PCM_MIX_BLOCK) {
+        pcmMixClear(acc, hit, PCM_MIX_BLOCK);
+        for (int c = 0; c < ch; c++) {
+          // チャンネルごとに別の位置を読む
+          const int8_t* p = src + ((pos + c * 1031) % (len - PCM_MIX_BLOCK));
+          if (pie) {
+            pcmMixAdd(acc, hit, PCM_MIX_BLOCK, p, len - (p - src), 1, 0);
+          } else {
+            pcmMixAddScalar(acc, hit, PCM_MIX_BLOCK, p, len - (p - src), 1, 0);
+          }
+        }
+        pcmMixOut(acc, hit, out, PCM_MIX_BLOCK);
+      }
+      u32_t cycles = ESP.getCycleCount() - start;
+      Serial.printf("pcmMix%s: %d ch %.1f cycles/sample\n", pie ? " (PIE)" : "", ch, (float)cycles / len);
+    }
+  }
+  free(src);
+}
+#endif
@@ -0,0 +1,47 @@
+#ifndef PCMMIX_H
+#define PCMMIX_H
+
+#include <stdint.h>
+
+#ifdef ESP_PLATFORM
+#include <sdkconfig.h>
+#endif
+
+// ------------------------------------------------------------------------------
+// 符号付き 8 ビット PCM のブロックミキサー
+//    チャンネルごとに n サンプルをまとめて int16 のアキュムレータに足し込み、
+//    最後に 1 回だけ飽和させて DAC 用の値 (0 - 255) にする
+//    1 サンプルずつチャンネルを回すより、チャンネル数に対するサンプル毎のオーバーヘッドが減る
+//    Arduino に依存しない
+
+#define PCM_MIX_BLOCK 64    // 1 回にミックスする最大サンプル数
+#define PCM_MIX_SKIP 0x100  // 出力: どのチャンネルも鳴っていない (DAC に書かない)
+
+// ESP32-S3 では通常速度の足し込みを PIE (EE.* 命令) で 16 サンプルずつ行う
+// PCM_MIX_NO_PIE を定義するとスカラー版だけになる
+#if defined(CONFIG_IDF_TARGET_ESP32S3) && !defined(PCM_MIX_NO_PIE)
+#define PCM_MIX_PIE 1
+#else
+#define PCM_MIX_PIE 0
+#endif
+
+// acc, hit を n サンプル分クリア
+void pcmMixClear(int16_t* acc, uint8_t* hit, uint32_t n);
+
+// src (残り len サンプル) を acc に足す
+// step = 2 で 1 つおき (半速), phase = 最初に足す位置
+// 戻り値: 消費したサンプル数
+uint32_t pcmMixAdd(int16_t* acc, uint8_t* hit, uint32_t n, const int8_t* src, uint32_t len, uint8_t step,
+                   uint8_t phase);
+
+// pcmMixAdd のスカラー版 (PIE が使えないときと、比較用)
+uint32_t pcmMixAddScalar(int16_t* acc, uint8_t* hit, uint32_t n, const int8_t* src, uint32_t len, uint8_t step,
+                         uint8_t phase);
+
+// int8 に飽和させて +128, 鳴っていないサンプルは PCM_MIX_SKIP
+void pcmMixOut(const int16_t* acc, const uint8_t* hit, uint16_t* out, uint32_t n);
+
+// 1 - 8 チャンネルでの 1 サンプルあたりのサイクル数を Serial に出す
+void pcmMixBenchmark();
+
+#endif
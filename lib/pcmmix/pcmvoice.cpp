@@ -0,0 +1,44 @@
+#include "pcmvoice.h"
+
+#include <string.h>
+
+void PCMVoices::reset() {
+  memset(ptr, 0, sizeof(ptr));
+  memset(addr, 0, sizeof(addr));
+  memset(left, 0, sizeof(left));
+  memset(id, 0, sizeof(id));
+  memset(priority, 0, sizeof(priority));
+  active = 0;
+  stride = 0;
+  strideOdd = 0;
+  started = stopped = steals = drops = 0;
+}
+
+bool PCMVoices::claim(uint8_t ch, uint8_t prio, uint8_t sampleID) {
+  uint8_t bit = 1 << ch;
+  if ((active & bit) && prio < priority[ch]) {
+    drops++;
+    return false;
+  }
+
+  if (sampleID == 0) {
+    if (active & bit) stopped++;
+  } else {
+    if (active & bit) steals++;
+    started++;
+  }
+  priority[ch] = prio;
+  return true;
+}
+
+void PCMVoices::start(uint8_t ch, uint8_t sampleID, const int8_t* src, uint32_t fileAddr, uint32_t len,
+                      bool useStride) {
+  uint8_t bit = 1 << ch;
+  id[ch] = sampleID;
+  ptr[ch] = src;
+  addr[ch] = fileAddr;
+  left[ch] = len;
+  stride = useStride ? (stride | bit) : (stride & ~bit);
+  strideOdd &= ~bit;
+  active = len ? (active | bit) : (active & ~bit);
+}
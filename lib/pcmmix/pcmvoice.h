@@ -0,0 +1,44 @@
+#ifndef PCMVOICE_H
+#define PCMVOICE_H
+
+#include <stdint.h>
+
+// ------------------------------------------------------------------------------
+// XGM の PCM ボイス管理
+//    XGM1 (8ch) / XGM2 (3ch) 共通。チャンネルは曲データで指定されるので割り当てはせず、
+//    優先度の判定 (鳴っているサンプルより低い優先度の発音は捨てる) と再生状態の保持を行う
+//    状態はボイスごとの配列 (SoA) で持ち、ミキサーは active のビットだけ回す
+//    Arduino に依存しない
+
+#define PCM_MAX_VOICES 8
+
+class PCMVoices {
+ public:
+  // ボイスごとの状態
+  const int8_t* ptr[PCM_MAX_VOICES];  // 再生位置 (NULL = PSRAM にない。addr から読む)
+  uint32_t addr[PCM_MAX_VOICES];      // ファイル上の再生位置
+  uint32_t left[PCM_MAX_VOICES];      // 残りサンプル数
+  uint8_t id[PCM_MAX_VOICES];         // サンプル ID
+  uint8_t priority[PCM_MAX_VOICES];
+
+  uint8_t active = 0;    // 発音中のボイス (ビットマスク)
+  uint8_t stride = 0;    // 1 サンプルおきにミックスするボイス (半速版がないとき)
+  uint8_t strideOdd = 0;  // 次のブロックを奇数位置から始めるボイス
+
+  // 統計
+  uint32_t started = 0;  // 発音
+  uint32_t stopped = 0;  // 停止コマンドで止めた
+  uint32_t steals = 0;   // 鳴っているサンプルを新しいサンプルで置き換えた
+  uint32_t drops = 0;    // 優先度が低くて捨てた発音 / 停止
+
+  void reset();
+
+  // ch への発音 (sampleID 0 は停止) を受け付けるか判定する
+  // 鳴っていない、または鳴っているサンプルと同じかそれより高い優先度なら受け付ける
+  bool claim(uint8_t ch, uint8_t prio, uint8_t sampleID);
+
+  void start(uint8_t ch, uint8_t sampleID, const int8_t* src, uint32_t fileAddr, uint32_t len, bool useStride);
+  void stop(uint8_t ch) { active &= ~(1 << ch); }
+};
+
+#endif
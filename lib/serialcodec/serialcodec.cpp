@@ -0,0 +1,206 @@
+#include "serialcodec.h"
+
+#define BURST_REGS 30     // 0xf6 の mask で使うビット数 (= SERIAL_PACKED_MAX)
+#define BURST_MIN 4       // これより短いまとめ書きは通常のコマンドの方が短い
+#define DAC_RUN_MIN 3     // 同上 (DAC ランレングス)
+#define DAC_RUN_MAX 256
+
+uint8_t serialCodecReg(uint8_t index, uint8_t ch) {
+  if (index < 28) return 0x30 + (index >> 2) * 0x10 + (index & 3) * 4 + ch;
+  return (index == 28 ? 0xb0 : 0xb4) + ch;
+}
+
+// 0xf6 で書けるレジスタならそのインデックス、でなければ -1
+static int burstIndex(uint8_t reg, uint8_t* ch) {
+  if (reg >= 0x30 && reg < 0xa0) {
+    if ((reg & 3) == 3) return -1;
+    *ch = reg & 3;
+    return ((reg - 0x30) >> 4) * 4 + ((reg >> 2) & 3);
+  }
+  if ((reg >= 0xb0 && reg <= 0xb2) || (reg >= 0xb4 && reg <= 0xb6)) {
+    *ch = reg & 3;
+    return reg < 0xb4 ? 28 : 29;
+  }
+  return -1;
+}
+
+size_t serialWriteCommand(const t_serialCmd& c, uint8_t* out) {
+  uint8_t len = serialCommandLength(c.command);
+  out[0] = c.command;
+  if (len == 5) {
+    for (int i = 0; i < 4; i++) {
+      out[1 + i] = c.value >> (i * 8);
+    }
+  } else {
+    if (len > 1) out[1] = c.a;
+    if (len > 2) out[2] = c.b;
+  }
+  return len;
+}
+
+void SerialCodec::reset() {
+  for (int p = 0; p < 2; p++) {
+    for (int ch = 0; ch < 3; ch++) {
+      _hi[p][ch] = 0;
+      _freq[p][ch] = 0;
+    }
+    _valid[p] = 0;
+  }
+}
+
+void SerialCodec::observe(const t_serialCmd& c) {
+  if (c.command == 0x00) {
+    reset();
+    return;
+  }
+  if (c.command != 0x52 && c.command != 0x53) return;
+  uint8_t port = c.command & 1;
+  uint8_t ch = c.a & 3;
+  if (ch == 3) return;
+  if ((c.a & 0xfc) == 0xa4) {
+    _hi[port][ch] = c.b;
+  } else if ((c.a & 0xfc) == 0xa0) {
+    _freq[port][ch] = (_hi[port][ch] & 0x3f) << 8 | c.b;
+    _valid[port] |= 1 << ch;
+  }
+}
+
+static inline void makeCmd(t_serialCmd* out, uint8_t command, uint8_t a, uint8_t b) {
+  out->command = command;
+  out->a = a;
+  out->b = b;
+  out->length = 0;
+  out->value = 0;
+}
+
+uint32_t SerialCodec::expand(const t_serialCmd& c, const uint8_t* values, t_serialCmd* out) {
+  switch (c.command) {
+    case 0xf5: {  // F5 w n v
+      uint32_t n = c.b + 1;
+      for (uint32_t i = 0; i < n; i++) {
+        makeCmd(&out[i], 0x80 | (c.a & 0x0f), c.value, 0);
+      }
+      return n;
+    }
+    case 0xf6: {  // F6 pc mask32 values...
+      uint8_t command = (c.a & 4) ? 0x53 : 0x52;
+      uint8_t ch = c.a & 3;
+      if (ch == 3) return 0;
+      uint32_t n = 0;
+      for (uint8_t i = 0; i < BURST_REGS && n < c.length; i++) {
+        if (c.value & (1u << i)) {
+          makeCmd(&out[n], command, serialCodecReg(i, ch), values[n]);
+          n++;
+        }
+      }
+      return n;
+    }
+    case 0xf7: {  // F7 pc d
+      uint8_t port = (c.a >> 2) & 1;
+      uint8_t ch = c.a & 3;
+      if (ch == 3 || !(_valid[port] & (1 << ch))) return 0;  // 基準の周波数がない
+      uint16_t freq = (_freq[port][ch] + (int8_t)c.b) & 0x3fff;
+      uint8_t command = port ? 0x53 : 0x52;
+      makeCmd(&out[0], command, 0xa4 + ch, freq >> 8);
+      makeCmd(&out[1], command, 0xa0 + ch, freq & 0xff);
+      return 2;
+    }
+    default:
+      return 0;
+  }
+}
+
+// ------------------------------------------------------------------------------
+// エンコーダ (ホスト側)
+//    先頭から貪欲に DAC ランレングス -> 周波数の差分 -> レジスタ一括 -> そのまま の順に試す
+//    in をそのまま observe して、デコーダと同じ周波数を追いかける
+
+size_t SerialCodec::_encodeDAC(const t_serialCmd* in, size_t n, uint8_t* out, size_t* used) {
+  if ((in[0].command & 0xf0) != 0x80) return 0;
+  size_t run = 1;
+  while (run < n && run < DAC_RUN_MAX && in[run].command == in[0].command && in[run].a == in[0].a) {
+    run++;
+  }
+  if (run < DAC_RUN_MIN) return 0;
+  out[0] = 0xf5;
+  out[1] = in[0].command & 0x0f;
+  out[2] = run - 1;
+  out[3] = in[0].a;
+  *used = run;
+  dacRuns++;
+  return 4;
+}
+
+size_t SerialCodec::_encodeDelta(const t_serialCmd* in, size_t n, uint8_t* out, size_t* used) {
+  if (n < 2) return 0;
+  const t_serialCmd& hi = in[0];
+  const t_serialCmd& lo = in[1];
+  if (hi.command != 0x52 && hi.command != 0x53) return 0;
+  if (lo.command != hi.command) return 0;
+  uint8_t ch = hi.a - 0xa4;
+  if (ch > 2 || lo.a != 0xa0 + ch || (hi.b & 0xc0)) return 0;
+
+  uint8_t port = hi.command & 1;
+  if (!(_valid[port] & (1 << ch))) return 0;
+  int d = (hi.b << 8 | lo.b) - _freq[port][ch];
+  if (d < -128 || d > 127) return 0;
+
+  out[0] = 0xf7;
+  out[1] = port << 2 | ch;
+  out[2] = (uint8_t)d;
+  *used = 2;
+  deltas++;
+  return 3;
+}
+
+size_t SerialCodec::_encodeBurst(const t_serialCmd* in, size_t n, uint8_t* out, size_t* used) {
+  if (in[0].command != 0x52 && in[0].command != 0x53) return 0;
+  uint8_t ch;
+  int index = burstIndex(in[0].a, &ch);
+  if (index < 0) return 0;
+
+  // 同じポート・チャンネルでインデックスが増えていく間だけまとめる (書き込み順を変えない)
+  uint32_t mask = 0;
+  size_t count = 0;
+  int last = -1;
+  while (count < n && in[count].command == in[0].command) {
+    uint8_t c;
+    int i = burstIndex(in[count].a, &c);
+    if (i <= last || c != ch) break;
+    mask |= 1u << i;
+    out[6 + count] = in[count].b;
+    last = i;
+    count++;
+  }
+  if (count < BURST_MIN) return 0;
+
+  out[0] = 0xf6;
+  out[1] = (in[0].command & 1) << 2 | ch;
+  for (int i = 0; i < 4; i++) {
+    out[2 + i] = mask >> (i * 8);
+  }
+  *used = count;
+  bursts++;
+  return 6 + count;
+}
+
+size_t SerialCodec::encode(const t_serialCmd* in, size_t n, uint8_t* out) {
+  size_t bytes = 0;
+  size_t i = 0;
+  while (i < n) {
+    size_t used = 1;
+    size_t len = _encodeDAC(&in[i], n - i, &out[bytes], &used);
+    if (!len) len = _encodeDelta(&in[i], n - i, &out[bytes], &used);
+    if (!len) len = _encodeBurst(&in[i], n - i, &out[bytes], &used);
+    if (!len) {
+      len = serialWriteCommand(in[i], &out[bytes]);
+      used = 1;
+    }
+    for (size_t k = 0; k < used; k++) {
+      observe(in[i + k]);
+    }
+    bytes += len;
+    i += used;
+  }
+  return bytes;
+}
@@ -0,0 +1,58 @@
+#ifndef SERIALCODEC_H
+#define SERIALCODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "serialrx.h"
+
+// ------------------------------------------------------------------------------
+// シリアルモードの圧縮コマンド
+//    ホストは通常のコマンド列を encode() で圧縮して送り、デバイスは expand() で
+//    通常のコマンドに戻して同じ書き込み経路に流す (送るかどうかはホスト次第)
+//
+//    F5 w n v         : DAC に v を書いて w サンプル待つ (0x8w v) を n + 1 回
+//    F6 pc mask32 ... : 1 チャンネルのレジスタをまとめて書く (XGM2 の FM_LOAD_INST と同じ考え方)
+//                       pc = port << 2 | ch。mask のビット i が立っているレジスタの値が i の順に続く
+//                       i = 0 - 27: 0x30 + (i / 4) * 0x10 + (i % 4) * 4 + ch, 28: 0xb0 + ch, 29: 0xb4 + ch
+//    F7 pc d          : チャンネルの周波数 (ブロック + F ナンバーの 14 ビット) に符号付き d を足して 0xa4, 0xa0 に書く
+//                       周波数はエンコーダ・デコーダが同じ書き込みを見て追いかける
+//    Arduino に依存しない
+
+#define SERIAL_CODEC_MAX_EXPAND 256  // 1 コマンドを展開した最大コマンド数 (0xf5)
+
+// 0xf6 の i 番目のレジスタ
+uint8_t serialCodecReg(uint8_t index, uint8_t ch);
+
+// 通常コマンドのバイト列を書く。戻り値: バイト数
+size_t serialWriteCommand(const t_serialCmd& c, uint8_t* out);
+
+class SerialCodec {
+ public:
+  void reset();
+
+  // 書き込みを見て周波数を追いかける (展開したコマンドを含め、実行するすべてのコマンドで呼ぶ)
+  void observe(const t_serialCmd& c);
+
+  // 0xf5 - 0xf7 を通常のコマンドに展開する (values: 0xf6 の値)
+  // 戻り値: out に書いたコマンド数
+  uint32_t expand(const t_serialCmd& c, const uint8_t* values, t_serialCmd* out);
+
+  // ホスト側: 通常のコマンド列 in[0, n) を圧縮して out に書く (out は 8 * n バイトあれば足りる)
+  // 戻り値: out のバイト数
+  size_t encode(const t_serialCmd* in, size_t n, uint8_t* out);
+
+  // 統計 (encode)
+  uint32_t dacRuns = 0, bursts = 0, deltas = 0;
+
+ private:
+  uint8_t _hi[2][3];     // 0xa4 に書いた値 (0xa0 で反映される)
+  uint16_t _freq[2][3];  // 反映済みの周波数
+  uint8_t _valid[2];     // _freq が分かっているチャンネル (ビット)
+
+  size_t _encodeDAC(const t_serialCmd* in, size_t n, uint8_t* out, size_t* used);
+  size_t _encodeDelta(const t_serialCmd* in, size_t n, uint8_t* out, size_t* used);
+  size_t _encodeBurst(const t_serialCmd* in, size_t n, uint8_t* out, size_t* used);
+};
+
+#endif
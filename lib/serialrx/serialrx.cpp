@@ -0,0 +1,135 @@
+#include "serialrx.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "vgmcmd.h"
+
+uint8_t* SerialRing::writePtr(uint32_t* space) {
+  uint32_t free = freeSpace();
+  uint32_t pos = _head & (SERIAL_RING_SIZE - 1);
+  uint32_t toEnd = SERIAL_RING_SIZE - pos;
+  *space = free < toEnd ? free : toEnd;
+  return &_buf[pos];
+}
+
+uint32_t SerialRing::read(uint8_t* dst, uint32_t n) {
+  uint32_t avail = available();
+  if (n > avail) n = avail;
+  for (uint32_t done = 0; done < n;) {
+    uint32_t pos = _tail & (SERIAL_RING_SIZE - 1);
+    uint32_t chunk = SERIAL_RING_SIZE - pos;
+    if (chunk > n - done) chunk = n - done;
+    if (dst) memcpy(dst + done, &_buf[pos], chunk);
+    _tail += chunk;
+    done += chunk;
+  }
+  return n;
+}
+
+uint8_t serialCommandLength(uint8_t command) {
+  switch (command) {
+    case 0x80 ... 0x8f:  // YM2612 DAC (+ 待ち)
+    case 0xf4:           // SD への記録 (op)
+    case 0xf9:           // クレジット通知の間隔 (256 バイト単位)
+    case 0xfc:           // ストリーム選択
+      return 2;
+    case 0xf2:  // ジッタバッファの遅延 (ms)
+    case 0xf7:  // 周波数の差分
+      return 3;
+    case 0xf5:  // DAC ランレングス (lib/serialcodec)
+      return 4;
+    case 0xf0:  // クロック 0
+    case 0xf1:  // クロック 1
+      return 5;
+    case 0xf6:  // チャンネルのレジスタ一括 (ヘッダ 6 バイト + mask のビット数)
+      return 6;
+    case 0xf3:  // アップロード (op, arg32, len16)
+      return 8;
+    case 0x00:  // リセット
+    case 0x67:  // データブロック (長さ可変なので受け付けない)
+    case 0xf8:  // 状態要求
+    case 0xfa ... 0xfb:
+    case 0xfd ... 0xff:
+      return 1;
+    default:  // チップへの書き込み (0x30, 0x50 - 0x5f, 0xa0 - 0xbf ...) と待ちは VGM と同じ
+      return vgmCommandLength(command);
+  }
+}
+
+uint32_t serialCommandWait(const t_serialCmd& cmd) {
+  switch (cmd.command) {
+    case 0x61:
+      return cmd.a | (cmd.b << 8);
+    case 0x62:
+      return 735;  // 1/60 秒
+    case 0x63:
+      return 882;  // 1/50 秒
+    case 0x70 ... 0x7f:
+      return (cmd.command & 0x0f) + 1;
+    case 0x80 ... 0x8f:
+      return cmd.command & 0x0f;
+    default:
+      return 0;
+  }
+}
+
+bool SerialDecoder::next(SerialRing& ring, t_serialCmd& cmd) {
+  uint32_t avail = ring.available();
+  if (avail == 0) return false;
+
+  uint8_t command = ring.peek(0);
+  uint8_t len = serialCommandLength(command);
+  if (avail < len) return false;
+
+  // 0xf6 は mask のビット数だけ値が続く
+  uint32_t extra = 0;
+  if (command == 0xf6) {
+    uint32_t mask = ring.peek(2) | (ring.peek(3) << 8) | (ring.peek(4) << 16) | ((uint32_t)ring.peek(5) << 24);
+    extra = __builtin_popcount(mask & ((1u << SERIAL_PACKED_MAX) - 1));
+    if (avail < len + extra) return false;
+  }
+
+  cmd.command = command;
+  cmd.a = len > 1 ? ring.peek(1) : 0;
+  cmd.b = len > 2 ? ring.peek(2) : 0;
+  cmd.length = 0;
+  cmd.value = 0;
+  if (len == 5) {
+    cmd.value = ring.peek(1) | (ring.peek(2) << 8) | (ring.peek(3) << 16) | ((uint32_t)ring.peek(4) << 24);
+  } else if (command == 0xf3) {
+    cmd.value = ring.peek(2) | (ring.peek(3) << 8) | (ring.peek(4) << 16) | ((uint32_t)ring.peek(5) << 24);
+    cmd.length = ring.peek(6) | (ring.peek(7) << 8);
+  } else if (command == 0xf5) {
+    cmd.value = ring.peek(3);
+  } else if (command == 0xf6) {
+    cmd.value = ring.peek(2) | (ring.peek(3) << 8) | (ring.peek(4) << 16) | ((uint32_t)ring.peek(5) << 24);
+    cmd.value &= (1u << SERIAL_PACKED_MAX) - 1;
+    cmd.length = extra;
+    for (uint32_t i = 0; i < extra; i++) {
+      packed[i] = ring.peek(len + i);
+    }
+  }
+  ring.consume(len + extra);
+  commands++;
+  return true;
+}
+
+bool SerialJitterBuffer::begin() {
+  if (!_buf) _buf = (t_serialEvent*)malloc(SERIAL_JITTER_SIZE * sizeof(t_serialEvent));
+  return _buf != NULL;
+}
+
+bool SerialJitterBuffer::push(const t_serialEvent& ev) {
+  uint32_t head = _head.load(std::memory_order_relaxed);
+  if (head - _tail.load(std::memory_order_acquire) >= SERIAL_JITTER_SIZE) return false;
+  _buf[head & (SERIAL_JITTER_SIZE - 1)] = ev;
+  _head.store(head + 1, std::memory_order_release);
+  return true;
+}
+
+const t_serialEvent* SerialJitterBuffer::front() const {
+  uint32_t tail = _tail.load(std::memory_order_relaxed);
+  if (_head.load(std::memory_order_acquire) == tail) return NULL;
+  return &_buf[tail & (SERIAL_JITTER_SIZE - 1)];
+}
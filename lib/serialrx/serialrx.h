@@ -0,0 +1,99 @@
+#ifndef SERIALRX_H
+#define SERIALRX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+// ------------------------------------------------------------------------------
+// シリアルモードの受信バッファとコマンドデコーダ
+//    受信済みのデータをまとめてリングバッファに移し、デコーダはリング上で
+//    コマンドの長さ分そろっているかを見てから 1 コマンドずつ取り出す
+//    1 バイトずつ Serial.read() するより呼び出しが減る
+//    タイムスタンプ付きの再生用にジッタバッファも持つ
+//    Arduino に依存しない
+
+#define SERIAL_RING_SIZE (16 * 1024)  // 2 の累乗
+#define SERIAL_CMD_MAX_LEN 8          // 最長のコマンド (0xf3 のヘッダ)
+#define SERIAL_JITTER_SIZE 4096       // ジッタバッファのイベント数 (2 の累乗)
+#define SERIAL_PACKED_MAX 30          // 0xf6 の後に続く値の最大数
+
+class SerialRing {
+ public:
+  // 連続して書き込める領域を返す (space にバイト数)
+  uint8_t* writePtr(uint32_t* space);
+  void commit(uint32_t n) { _head += n; }
+
+  uint32_t available() const { return _head - _tail; }
+  uint8_t peek(uint32_t i) const { return _buf[(_tail + i) & (SERIAL_RING_SIZE - 1)]; }
+  void consume(uint32_t n) { _tail += n; }
+  uint32_t freeSpace() const { return SERIAL_RING_SIZE - available(); }
+
+  // 累計のバイト数 (32 ビットで回る。フロー制御のクレジットに使う)
+  uint32_t received() const { return _head; }
+  uint32_t consumed() const { return _tail; }
+
+  // 最大 n バイトを dst にコピーして消費する (dst = NULL は読み捨て)
+  // 戻り値: 消費したバイト数
+  uint32_t read(uint8_t* dst, uint32_t n);
+
+ private:
+  uint8_t _buf[SERIAL_RING_SIZE];
+  uint32_t _head = 0;  // 書き込み位置 (マスク前)
+  uint32_t _tail = 0;  // 読み出し位置 (マスク前)
+};
+
+typedef struct {
+  uint8_t command;
+  uint8_t a;        // 1 バイト目の引数 (reg / data / 0xf3 の op)
+  uint8_t b;        // 2 バイト目の引数 (data)
+  uint16_t length;  // 0xf3: 後に続くデータのバイト数 / 0xf6: 値の数 (SerialDecoder::packed)
+  uint32_t value;   // 32bit 引数 (0xf0 / 0xf1 / 0xf3 / 0xf6) / 0xf5 の 3 バイト目
+} t_serialCmd;
+
+// コマンドバイトを含むコマンドの長さ (不明なコマンドは 1)
+// 0xf0 - 0xff はシリアルモード独自、0x80 - 0x8f は DAC の値が続く。それ以外は VGM と同じ (lib/vgmcmd)
+uint8_t serialCommandLength(uint8_t command);
+
+// 待ちコマンド (0x61 - 0x63, 0x70 - 0x7f, 0x80 - 0x8f) の待ちサンプル数 (44.1kHz)。待ちでなければ 0
+uint32_t serialCommandWait(const t_serialCmd& cmd);
+
+class SerialDecoder {
+ public:
+  // リングから 1 コマンド取り出す。コマンドがそろっていなければ false で何も消費しない
+  bool next(SerialRing& ring, t_serialCmd& cmd);
+
+  uint32_t commands = 0;  // 取り出したコマンド数
+
+  uint8_t packed[SERIAL_PACKED_MAX];  // 0xf6 の値 (次の next まで有効)
+};
+
+// ------------------------------------------------------------------------------
+// タイムスタンプ付きコマンドのジッタバッファ
+//    受信タスクが積み、再生タスクが時刻になったら取り出す (1 対 1 のロックなしリング)
+
+typedef struct {
+  uint32_t sample;  // 再生するサンプル時刻 (44.1kHz)
+  t_serialCmd cmd;
+} t_serialEvent;
+
+class SerialJitterBuffer {
+ public:
+  bool begin();  // バッファ確保 (大きいので PSRAM に行く)
+  bool push(const t_serialEvent& ev);  // 一杯なら false
+  const t_serialEvent* front() const;  // 空なら NULL
+  void pop() { _tail.store(_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+  uint32_t size() const {
+    return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire);
+  }
+  bool empty() const { return size() == 0; }
+
+ private:
+  t_serialEvent* _buf = NULL;
+  std::atomic<uint32_t> _head{0};
+  std::atomic<uint32_t> _tail{0};
+};
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef PSG_LATCH_H
+#define PSG_LATCH_H
+
+#include <stdint.h>
+
+// ------------------------------------------------------------------------------
+// SN76489 の write() (周波数の下位バイトを保持して上位バイトと一緒に書く) の振り分け
+//    FMChip と SynthMix で共通。ホスト側のツール (tools/psgcheck) でも使う
+//    Arduino に依存しない
+
+#define PSG_LATCH_HOLD 0  // 下位バイトを保持した (まだ書かない)
+#define PSG_LATCH_RAW 1   // data をそのまま 1 バイト書く
+#define PSG_LATCH_PAIR 2  // 保持していた下位バイト (*latch) と data の 2 バイトを続けて書く
+
+class PSGLatch {
+ public:
+  void reset() { _low[0] = _low[1] = _low[2] = 0; }
+
+  uint8_t write(uint8_t data, uint8_t chipno, uint8_t* latch) {
+    if ((data & 0x90) == 0x80 && (data & 0x60) >> 5 != 3) {
+      // Low byte 周波数 0x8n, 0xan, 0xcn
+      _low[chipno] = data;
+      return PSG_LATCH_HOLD;
+    }
+    if ((data & 0x80) == 0) {  // High byte
+      if ((_low[chipno] & 0x0F) == 0) {
+        if ((data & 0x3F) == 0) _low[chipno] |= 1;
+      }
+      *latch = _low[chipno];
+      return PSG_LATCH_PAIR;
+    }
+    return PSG_LATCH_RAW;
+  }
+
+ private:
+  uint8_t _low[3] = {0, 0, 0};  // チップ毎 (シリアルモードの複数ストリームで別のチップに交互に書く)
+};
+
+#endif
@@ -0,0 +1,81 @@
+#include "sn76489.h"
+
+#include <string.h>
+
+// 2dB ステップの音量 (15 = 無音)
+static const int16_t volumeTable[16] = {8191, 6506, 5168, 4105, 3261, 2590, 2057, 1642,
+                                        1298, 1031, 819,  650,  516,  410,  326,  0};
+
+void SN76489Core::reset(uint32_t clock) {
+  _clock = clock;
+  memset(_period, 0, sizeof(_period));
+  memset(_counter, 0, sizeof(_counter));
+  memset(_output, 0, sizeof(_output));
+  for (int i = 0; i < 4; i++) {
+    _volume[i] = 15;
+  }
+  _lfsr = 0x8000;
+  _latch = 0;
+}
+
+void SN76489Core::write(uint8_t data) {
+  if (data & 0x80) {
+    _latch = data;
+  }
+  int ch = (_latch >> 5) & 3;
+
+  if (_latch & 0x10) {
+    // 音量
+    _volume[ch] = data & 0x0f;
+    return;
+  }
+
+  if (ch == 3) {
+    // ノイズ: 書き込みで LFSR リセット
+    _period[3] = data & 0x07;
+    _lfsr = 0x8000;
+    return;
+  }
+
+  if (data & 0x80) {
+    _period[ch] = (_period[ch] & 0x3f0) | (data & 0x0f);
+  } else {
+    _period[ch] = (_period[ch] & 0x00f) | ((data & 0x3f) << 4);
+  }
+}
+
+void SN76489Core::render(int32_t* out, int n, uint32_t rate) {
+  // 出力 1 サンプルあたりのチップティック数 (clock / 16)
+  const int32_t step = (int32_t)(((uint64_t)_clock << 12) / rate);  // 16.16 でティック数 / 16
+
+  for (int s = 0; s < n; s++) {
+    int32_t sum = 0;
+
+    for (int ch = 0; ch < 3; ch++) {
+      int32_t period = _period[ch] ? _period[ch] : 0x400;
+      _counter[ch] -= step;
+      while (_counter[ch] <= 0) {
+        _counter[ch] += period << 16;
+        _output[ch] = !_output[ch];
+      }
+      // 周期 1 は直流 (PCM 用途)
+      bool high = (_period[ch] == 1) ? true : _output[ch];
+      sum += high ? volumeTable[_volume[ch]] : -volumeTable[_volume[ch]];
+    }
+
+    int32_t noisePeriod = ((_period[3] & 3) == 3) ? (_period[2] ? _period[2] : 0x400) : (0x10 << (_period[3] & 3));
+    _counter[3] -= step;
+    while (_counter[3] <= 0) {
+      _counter[3] += noisePeriod << 16;
+      _output[3] = !_output[3];
+      if (_output[3]) {
+        // 立ち上がりでシフト
+        uint16_t feedback = (_period[3] & 4) ? ((_lfsr ^ (_lfsr >> 3)) & 1) : (_lfsr & 1);
+        _lfsr = (_lfsr >> 1) | (feedback << 15);
+      }
+    }
+    sum += (_lfsr & 1) ? volumeTable[_volume[3]] : -volumeTable[_volume[3]];
+
+    out[s] += sum;
+  }
+}
@@ -0,0 +1,31 @@
+#ifndef SN76489_CORE_H
+#define SN76489_CORE_H
+
+#include <stdint.h>
+
+// ------------------------------------------------------------------------------
+// SN76489AN ソフトウェア音源
+//    ホスト側でも動くように Arduino に依存しない
+//    トーン周期 0 は 0x400 として扱う (ディスクリート版 SN76489)
+//    ノイズは 16 ビット LFSR, タップ bit0/bit3 (セガ VDP 互換)
+
+class SN76489Core {
+ public:
+  void reset(uint32_t clock);
+  void setClock(uint32_t clock) { _clock = clock; }
+  uint32_t getClock() const { return _clock; }
+  void write(uint8_t data);
+  // rate Hz で n サンプル分を out に加算する
+  void render(int32_t* out, int n, uint32_t rate);
+
+ private:
+  uint32_t _clock = 3579545;
+  uint16_t _period[4];
+  uint8_t _volume[4];
+  int32_t _counter[4];  // 16.16 固定小数点
+  bool _output[4];
+  uint16_t _lfsr = 0x8000;
+  uint8_t _latch = 0;
+};
+
+#endif
@@ -0,0 +1,76 @@
+#include "synthmix.h"
+
+#include <string.h>
+
+void SynthMix::reset(uint32_t ymClock, uint32_t snClock) {
+  _ym.reset(ymClock);
+  for (int i = 0; i < 3; i++) {
+    _sn[i].reset(snClock);
+  }
+  _snActive = 0;
+  _psgLatch.reset();
+  _ymAcc = 0;
+}
+
+// FMChip::write と同じく周波数の下位バイトを保持して上位バイトと一緒に書く
+void SynthMix::snWrite(uint8_t data, uint8_t chipno, uint32_t clock) {
+  if (chipno > 2) return;
+  uint8_t latch;
+  switch (_psgLatch.write(data, chipno, &latch)) {
+    case PSG_LATCH_PAIR:
+      snWriteRaw(latch, chipno, clock);
+      snWriteRaw(data, chipno, clock);
+      break;
+    case PSG_LATCH_RAW:
+      snWriteRaw(data, chipno, clock);
+      break;
+  }
+}
+
+void SynthMix::snWriteRaw(uint8_t data, uint8_t chipno, uint32_t clock) {
+  if (chipno > 2) return;
+  if (clock && _sn[chipno].getClock() != clock) {
+    _sn[chipno].setClock(clock);
+  }
+  _sn[chipno].write(data);
+  _snActive |= 1 << chipno;
+}
+
+void SynthMix::render(int16_t* out, uint32_t frames) {
+  int32_t sn[SYNTH_BLOCK];
+  memset(sn, 0, frames * sizeof(int32_t));
+  for (int i = 0; i < 3; i++) {
+    if (_snActive & (1 << i)) {
+      _sn[i].render(sn, frames, SYNTH_RATE);
+    }
+  }
+
+  const uint32_t ymRate = _ym.sampleRate();
+  for (uint32_t s = 0; s < frames; s++) {
+    // YM のネイティブレート (clock / 144) のサンプルを平均して 44.1kHz にする
+    int32_t l = 0, r = 0, n = 0;
+    _ymAcc += ymRate;
+    while (_ymAcc >= SYNTH_RATE) {
+      int32_t yl, yr;
+      _ym.clock(&yl, &yr);
+      l += yl;
+      r += yr;
+      n++;
+      _ymAcc -= SYNTH_RATE;
+    }
+    if (n > 1) {
+      l /= n;
+      r /= n;
+    }
+
+    l = (l >> 1) + (sn[s] >> 2);
+    r = (r >> 1) + (sn[s] >> 2);
+    if (l > 32767) l = 32767;
+    if (l < -32768) l = -32768;
+    if (r > 32767) r = 32767;
+    if (r < -32768) r = -32768;
+
+    out[s * 2] = l;
+    out[s * 2 + 1] = r;
+  }
+}
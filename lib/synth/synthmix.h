@@ -0,0 +1,40 @@
+#ifndef SYNTH_MIX_H
+#define SYNTH_MIX_H
+
+#include <stdint.h>
+
+#include "psglatch.h"
+#include "sn76489.h"
+#include "ym2612.h"
+
+// ------------------------------------------------------------------------------
+// ソフトウェア音源のミキサー
+//    YM2612 (1 台) と SN76489 (chipno 0 - 2) を 44.1kHz 16bit ステレオにまとめる
+//    実機の SynthChipBus とホスト側のツール (tools/vgmhost) が同じ音を出すように共通にしている
+//    Arduino に依存しない
+
+#define SYNTH_RATE 44100
+#define SYNTH_BLOCK 256  // 1 回のレンダリング単位
+
+class SynthMix {
+ public:
+  void reset(uint32_t ymClock, uint32_t snClock);
+  void setYMClock(uint32_t clock) { _ym.setClock(clock); }
+
+  void ym(uint8_t port, uint8_t reg, uint8_t data) { _ym.write(port, reg, data); }
+  // clock: 0 ならクロックを変えない
+  void snWrite(uint8_t data, uint8_t chipno, uint32_t clock);     // FMChip::write と同じ (下位バイトを保持)
+  void snWriteRaw(uint8_t data, uint8_t chipno, uint32_t clock);  // そのまま
+
+  // frames (SYNTH_BLOCK 以下) 分を out (L, R 交互) に書く
+  void render(int16_t* out, uint32_t frames);
+
+ private:
+  YM2612Core _ym;
+  SN76489Core _sn[3];
+  PSGLatch _psgLatch;
+  uint8_t _snActive = 0;  // 書き込みのあった SN のビットマスク
+  uint32_t _ymAcc = 0;    // YM ネイティブレート -> 44.1kHz 変換用
+};
+
+#endif
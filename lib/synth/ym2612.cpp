@@ -0,0 +1,328 @@
+#include "ym2612.h"
+
+#include <math.h>
+#include <string.h>
+
+// 正弦波 (振幅 ±8191) と減衰量 -> 倍率 (0.09375dB 単位, 8192 = 0dB)
+static int16_t sinTable[1024];
+static uint16_t expTable[1024];
+static bool tablesReady = false;
+
+// デチューン (MAME fm.c の dt_tab)
+static const uint8_t dtTable[4][32] = {
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5, 5, 6, 6, 7, 8, 8, 8, 8},
+    {1, 1, 1, 1, 2, 2, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5, 5, 6, 6, 7, 8, 8, 9, 10, 11, 12, 13, 14, 16, 16, 16, 16},
+    {2, 2, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5, 5, 6, 6, 7, 8, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 20, 22, 22, 22, 22},
+};
+
+// F-Number 上位 4 ビットからキーコード下位 2 ビット
+static const uint8_t fnNote[16] = {0, 0, 0, 0, 0, 0, 0, 1, 2, 3, 3, 3, 3, 3, 3, 3};
+
+static void buildTables() {
+  for (int i = 0; i < 1024; i++) {
+    sinTable[i] = (int16_t)lround(sin((i + 0.5) * 2.0 * M_PI / 1024.0) * 8191.0);
+    expTable[i] = (uint16_t)lround(8192.0 * pow(10.0, -(i * 0.09375) / 20.0));
+  }
+  tablesReady = true;
+}
+
+void YM2612Core::reset(uint32_t clock) {
+  if (!tablesReady) buildTables();
+
+  _clock = clock;
+  memset(_ch, 0, sizeof(_ch));
+  for (int c = 0; c < 6; c++) {
+    _ch[c].left = _ch[c].right = true;
+    for (int o = 0; o < 4; o++) {
+      _ch[c].op[o].eg = 1023;
+      _ch[c].op[o].state = EG_RELEASE;
+    }
+  }
+  memset(_sl3Fnum, 0, sizeof(_sl3Fnum));
+  memset(_sl3Block, 0, sizeof(_sl3Block));
+  _sl3FbHi = 0;
+  _mode = 0;
+  _dac = 0x80;
+  _dacEnabled = false;
+  _egCounter = 0;
+  _egDivider = 0;
+}
+
+void YM2612Core::write(uint8_t port, uint8_t reg, uint8_t data) {
+  // グローバルレジスタ (ポート0のみ)
+  if (port == 0 && reg < 0x30) {
+    switch (reg) {
+      case 0x27:
+        _mode = data;
+        _updateInc(_ch[2], 2);
+        break;
+      case 0x28: {
+        int c = data & 3;
+        if (c == 3) return;
+        if (data & 4) c += 3;
+        Ch& ch = _ch[c];
+        (data & 0x10) ? _keyOn(ch.op[0]) : _keyOff(ch.op[0]);
+        (data & 0x20) ? _keyOn(ch.op[2]) : _keyOff(ch.op[2]);
+        (data & 0x40) ? _keyOn(ch.op[1]) : _keyOff(ch.op[1]);
+        (data & 0x80) ? _keyOn(ch.op[3]) : _keyOff(ch.op[3]);
+        break;
+      }
+      case 0x2a:
+        _dac = data;
+        break;
+      case 0x2b:
+        _dacEnabled = data & 0x80;
+        break;
+    }
+    return;
+  }
+
+  int c = reg & 3;
+  if (c == 3) return;
+  int chIndex = c + (port ? 3 : 0);
+  Ch& ch = _ch[chIndex];
+
+  if (reg >= 0x30 && reg < 0xa0) {
+    _writeOp(ch, (reg >> 2) & 3, reg & 0xf0, data);
+    _updateInc(ch, chIndex);
+    return;
+  }
+
+  switch (reg & 0xfc) {
+    case 0xa0:
+      ch.fnum = ((ch.fbHi & 7) << 8) | data;
+      ch.block = (ch.fbHi >> 3) & 7;
+      _updateInc(ch, chIndex);
+      break;
+    case 0xa4:
+      ch.fbHi = data;
+      break;
+    case 0xa8:
+      if (port == 0) {
+        _sl3Fnum[c] = ((_sl3FbHi & 7) << 8) | data;
+        _sl3Block[c] = (_sl3FbHi >> 3) & 7;
+        _updateInc(_ch[2], 2);
+      }
+      break;
+    case 0xac:
+      if (port == 0) _sl3FbHi = data;
+      break;
+    case 0xb0:
+      ch.fb = (data >> 3) & 7;
+      ch.alg = data & 7;
+      break;
+    case 0xb4:
+      ch.left = data & 0x80;
+      ch.right = data & 0x40;
+      break;
+  }
+}
+
+void YM2612Core::_writeOp(Ch& ch, int slot, uint8_t reg, uint8_t data) {
+  Op& op = ch.op[slot];
+  switch (reg) {
+    case 0x30:
+      op.dt = (data >> 4) & 7;
+      op.mul = data & 0x0f;
+      break;
+    case 0x40:
+      op.tl = data & 0x7f;
+      break;
+    case 0x50:
+      op.ks = data >> 6;
+      op.ar = data & 0x1f;
+      break;
+    case 0x60:
+      op.dr = data & 0x1f;
+      break;
+    case 0x70:
+      op.sr = data & 0x1f;
+      break;
+    case 0x80:
+      op.sl = data >> 4;
+      op.rr = data & 0x0f;
+      break;
+  }
+}
+
+void YM2612Core::_keyOn(Op& op) {
+  if (op.key) return;
+  op.key = true;
+  op.phase = 0;
+  op.state = EG_ATTACK;
+}
+
+void YM2612Core::_keyOff(Op& op) {
+  if (!op.key) return;
+  op.key = false;
+  op.state = EG_RELEASE;
+}
+
+void YM2612Core::_calcInc(Op& op, uint16_t fnum, uint8_t block) {
+  op.kcode = (block << 2) | fnNote[fnum >> 7];
+  int32_t fc = (fnum << block) >> 1;
+  int32_t dt = dtTable[op.dt & 3][op.kcode];
+  fc = (op.dt & 4) ? fc - dt : fc + dt;
+  fc &= 0x1ffff;
+  op.inc = op.mul ? fc * op.mul : fc >> 1;
+}
+
+void YM2612Core::_updateInc(Ch& ch, int chIndex) {
+  if (chIndex == 2 && (_mode & 0x40)) {
+    // CH3 スペシャルモード: A9 -> S1 (M1), AA -> S2 (C1), A8 -> S3 (M2), A2 -> S4 (C2)
+    _calcInc(ch.op[0], _sl3Fnum[1], _sl3Block[1]);
+    _calcInc(ch.op[2], _sl3Fnum[2], _sl3Block[2]);
+    _calcInc(ch.op[1], _sl3Fnum[0], _sl3Block[0]);
+    _calcInc(ch.op[3], ch.fnum, ch.block);
+    return;
+  }
+  for (int o = 0; o < 4; o++) {
+    _calcInc(ch.op[o], ch.fnum, ch.block);
+  }
+}
+
+void YM2612Core::_egStep(Op& op) {
+  int rate;
+  switch (op.state) {
+    case EG_ATTACK:
+      rate = op.ar;
+      break;
+    case EG_DECAY:
+      rate = op.dr;
+      break;
+    case EG_SUSTAIN:
+      rate = op.sr;
+      break;
+    default:
+      rate = op.rr * 2 + 1;
+      break;
+  }
+  if (rate == 0) return;
+
+  int r = rate * 2 + (op.kcode >> (3 - op.ks));
+  if (r > 63) r = 63;
+
+  int shift = 11 - (r >> 2);
+  if (shift > 0 && (_egCounter & ((1 << shift) - 1)) != 0) return;
+  int inc = (r < 48) ? 1 : 1 << ((r >> 2) - 12);
+  if (inc == 0) inc = 1;
+
+  switch (op.state) {
+    case EG_ATTACK:
+      if (r >= 62) {
+        op.eg = 0;
+      } else {
+        op.eg += (~op.eg * inc) >> 4;
+      }
+      if (op.eg <= 0) {
+        op.eg = 0;
+        op.state = EG_DECAY;
+      }
+      break;
+    case EG_DECAY: {
+      int32_t sl = (op.sl == 15) ? 0x3e0 : op.sl << 5;
+      op.eg += inc;
+      if (op.eg >= sl) op.state = EG_SUSTAIN;
+      break;
+    }
+    default:
+      op.eg += inc;
+      break;
+  }
+  if (op.eg > 1023) op.eg = 1023;
+}
+
+// pm: 位相インデックスへの加算量
+int32_t YM2612Core::_opOut(Op& op, int32_t pm) {
+  int32_t att = op.eg + (op.tl << 3);
+  uint32_t idx = ((op.phase >> 10) + pm) & 1023;
+  op.phase = (op.phase + op.inc) & 0xfffff;
+  if (att >= 1023) return 0;
+  return (sinTable[idx] * expTable[att]) >> 13;
+}
+
+void YM2612Core::clock(int32_t* left, int32_t* right) {
+  // エンベロープは 3 サンプルに 1 回
+  if (++_egDivider == 3) {
+    _egDivider = 0;
+    _egCounter++;
+    for (int c = 0; c < 6; c++) {
+      for (int o = 0; o < 4; o++) {
+        _egStep(_ch[c].op[o]);
+      }
+    }
+  }
+
+  int32_t l = 0, r = 0;
+  for (int c = 0; c < 6; c++) {
+    Ch& ch = _ch[c];
+    int32_t out;
+
+    if (c == 5 && _dacEnabled) {
+      out = ((int32_t)_dac - 128) << 6;
+    } else {
+      int32_t fb = ch.fb ? (ch.fbOut[0] + ch.fbOut[1]) >> (10 - ch.fb) : 0;
+      int32_t m1 = _opOut(ch.op[0], fb);
+      ch.fbOut[0] = ch.fbOut[1];
+      ch.fbOut[1] = m1;
+
+      // 接続は S1 (M1) -> S2 (C1) -> S3 (M2) -> S4 (C2)。レジスタ順では S2 が op[2], S3 が op[1]
+      int32_t c1, m2, c2;
+      switch (ch.alg) {
+        case 0:
+          c1 = _opOut(ch.op[2], m1 >> 1);
+          m2 = _opOut(ch.op[1], c1 >> 1);
+          out = _opOut(ch.op[3], m2 >> 1);
+          break;
+        case 1:
+          c1 = _opOut(ch.op[2], 0);
+          m2 = _opOut(ch.op[1], (m1 + c1) >> 1);
+          out = _opOut(ch.op[3], m2 >> 1);
+          break;
+        case 2:
+          c1 = _opOut(ch.op[2], 0);
+          m2 = _opOut(ch.op[1], c1 >> 1);
+          out = _opOut(ch.op[3], (m1 + m2) >> 1);
+          break;
+        case 3:
+          c1 = _opOut(ch.op[2], m1 >> 1);
+          m2 = _opOut(ch.op[1], 0);
+          out = _opOut(ch.op[3], (c1 + m2) >> 1);
+          break;
+        case 4:
+          c1 = _opOut(ch.op[2], m1 >> 1);
+          m2 = _opOut(ch.op[1], 0);
+          c2 = _opOut(ch.op[3], m2 >> 1);
+          out = c1 + c2;
+          break;
+        case 5:
+          c1 = _opOut(ch.op[2], m1 >> 1);
+          m2 = _opOut(ch.op[1], m1 >> 1);
+          c2 = _opOut(ch.op[3], m1 >> 1);
+          out = c1 + m2 + c2;
+          break;
+        case 6:
+          c1 = _opOut(ch.op[2], m1 >> 1);
+          m2 = _opOut(ch.op[1], 0);
+          c2 = _opOut(ch.op[3], 0);
+          out = c1 + m2 + c2;
+          break;
+        default:
+          c1 = _opOut(ch.op[2], 0);
+          m2 = _opOut(ch.op[1], 0);
+          c2 = _opOut(ch.op[3], 0);
+          out = m1 + c1 + m2 + c2;
+          break;
+      }
+      if (out > 8191) out = 8191;
+      if (out < -8192) out = -8192;
+    }
+
+    if (ch.left) l += out;
+    if (ch.right) r += out;
+  }
+
+  *left = l;
+  *right = r;
+}
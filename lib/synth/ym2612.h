@@ -0,0 +1,64 @@
+#ifndef YM2612_CORE_H
+#define YM2612_CORE_H
+
+#include <stdint.h>
+
+// ------------------------------------------------------------------------------
+// YM2612 / YM3438 ソフトウェア音源
+//    ホスト側でも動くように Arduino に依存しない
+//    チップクロック / 144 で 1 サンプル (7.67MHz で 53.267kHz)
+//    未実装: LFO, SSG-EG, タイマー
+
+class YM2612Core {
+ public:
+  void reset(uint32_t clock);
+  void setClock(uint32_t clock) { _clock = clock; }
+  uint32_t sampleRate() const { return _clock / 144; }
+  void write(uint8_t port, uint8_t reg, uint8_t data);
+  void clock(int32_t* left, int32_t* right);  // 1 サンプル進める
+
+ private:
+  enum { EG_ATTACK, EG_DECAY, EG_SUSTAIN, EG_RELEASE };
+
+  struct Op {
+    uint8_t dt, mul, tl, ks, ar, dr, sr, sl, rr;
+    uint32_t phase, inc;
+    int32_t eg;  // 減衰量 0 - 1023
+    uint8_t state;
+    bool key;
+    uint8_t kcode;
+  };
+
+  struct Ch {
+    Op op[4];  // レジスタ順 S1/M1(+0), S3/M2(+4), S2/C1(+8), S4/C2(+C)
+    uint16_t fnum;
+    uint8_t block;
+    uint8_t fbHi;  // A4 ラッチ
+    uint8_t fb, alg;
+    bool left, right;
+    int32_t fbOut[2];
+  };
+
+  uint32_t _clock = 7670453;
+  Ch _ch[6];
+  uint8_t _mode = 0;  // $27
+  uint8_t _dac = 0x80;
+  bool _dacEnabled = false;
+  uint32_t _egCounter = 0;
+  uint8_t _egDivider = 0;
+
+  // CH3 スペシャルモード
+  uint16_t _sl3Fnum[3];
+  uint8_t _sl3Block[3];
+  uint8_t _sl3FbHi = 0;
+
+  void _writeOp(Ch& ch, int slot, uint8_t reg, uint8_t data);
+  void _keyOn(Op& op);
+  void _keyOff(Op& op);
+  void _updateInc(Ch& ch, int chIndex);
+  void _calcInc(Op& op, uint16_t fnum, uint8_t block);
+  void _egStep(Op& op);
+  int32_t _opOut(Op& op, int32_t pm);
+};
+
+#endif
@@ -0,0 +1,44 @@
+#include "vgmcmd.h"
+
+uint8_t vgmCommandLength(uint8_t command) {
+  switch (command) {
+    case 0x30 ... 0x3f:  // SN76489 2 台目 / 予約 (オペランド 1)
+    case 0x4f ... 0x50:  // Game Gear ステレオ / SN76489
+    case 0x94:           // ストリーム停止
+      return 2;
+    case 0x40 ... 0x4e:  // 予約 (オペランド 2)
+    case 0x51 ... 0x5f:  // YM2413 - YMF262
+    case 0x61:           // 待ち nnnn サンプル
+    case 0xa0 ... 0xbf:  // AY8910 ほか / 2 台目
+      return 3;
+    case 0xc0 ... 0xdf:
+      return 4;
+    case 0x90:
+    case 0x91:
+    case 0x95:
+    case 0xe0 ... 0xff:
+      return 5;
+    case 0x92:
+      return 6;
+    case 0x67:
+      return 7;
+    case 0x93:
+      return 11;
+    case 0x68:
+      return 12;
+    default:  // 0x62, 0x63, 0x66, 0x70 - 0x8f / 不明
+      return 1;
+  }
+}
+
+void VGMRouter::clear() {
+  for (int i = 0; i < 256; i++) {
+    _routes[i] = {VGM_ROUTE_NONE, 0, 0, 0, 0, 0};
+  }
+}
+
+void VGMRouter::route(uint8_t command, tVGMRouteKind kind, uint8_t chipno, uint8_t port, uint32_t freq, bool raw) {
+  uint8_t operands = vgmCommandLength(command) - 1;
+  if (operands < 1 || operands > 2) kind = VGM_ROUTE_NONE;  // 書き込みコマンドではない
+  _routes[command] = {(uint8_t)kind, chipno, port, raw, operands, freq};
+}
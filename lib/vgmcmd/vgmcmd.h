@@ -0,0 +1,104 @@
+#ifndef VGMCMD_H
+#define VGMCMD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// ------------------------------------------------------------------------------
+// VGM コマンドの長さとチップ書き込みの振り分け表
+//    ファイル再生 (vgm.cpp) とシリアルモード (serialman.cpp) が同じ表でチップに書く
+//    どのコマンドをどのチップ (バス上の番号・クロック) に書くかは実行時に route() で決める
+//    バスは ChipBus と同じメソッドと freq_t を持つ型なら何でもよい (ホスト側のツールでも使う)
+//    Arduino に依存しない
+
+typedef enum : uint8_t {
+  VGM_ROUTE_NONE = 0,  // 書き込まない (オペランドは読み飛ばす)
+  VGM_ROUTE_SN76489,   // write() / writeRaw()
+  VGM_ROUTE_YM2612,    // setYM2612() (port)
+  VGM_ROUTE_OPN,       // setRegister() (YM2203, AY8910, YM3812)
+  VGM_ROUTE_OPM,       // setRegisterOPM()
+  VGM_ROUTE_OPL3,      // setRegisterOPL3() (port)
+  VGM_ROUTE_OPLL,      // setRegisterOPLL()
+} tVGMRouteKind;
+
+typedef struct {
+  uint8_t kind;      // tVGMRouteKind
+  uint8_t chipno;    // バス上のチップ番号
+  uint8_t port;      // YM2612 / OPL3 のポート
+  uint8_t raw;       // SN76489: writeRaw() を使う
+  uint8_t operands;  // オペランドのバイト数 (1 or 2)
+  uint32_t freq;     // SN76489: チップのクロック (si5351Freq_t)
+} t_vgmRoute;
+
+// コマンドバイトを含む VGM コマンドの長さ
+// 0x67 (データブロック) はヘッダの 7 バイトを返す (ブロック本体は呼び出し側で飛ばす)
+uint8_t vgmCommandLength(uint8_t command);
+
+class VGMRouter {
+ public:
+  VGMRouter() { clear(); }
+  void clear();
+  void route(uint8_t command, tVGMRouteKind kind, uint8_t chipno, uint8_t port = 0, uint32_t freq = 0,
+             bool raw = false);
+  const t_vgmRoute& operator[](uint8_t command) const { return _routes[command]; }
+
+  // チップ書き込みコマンドならバスに書いて true (シリアルモード: オペランドはデコード済み)
+  template <class Bus>
+  bool write(Bus* bus, uint8_t command, uint8_t a, uint8_t b) const {
+    const t_vgmRoute& r = _routes[command];
+    if (r.kind == VGM_ROUTE_NONE) return false;
+    _write(bus, r, a, b);
+    return true;
+  }
+
+  // チップ書き込みコマンドなら read() でオペランドを読んで書き、true (ファイル再生)
+  // そうでなければ何も読まずに false
+  template <class Bus, class Read>
+  bool dispatch(Bus* bus, uint8_t command, Read read) const {
+    const t_vgmRoute& r = _routes[command];
+    if (r.kind == VGM_ROUTE_NONE) return false;
+    uint8_t a = read();
+    uint8_t b = r.operands > 1 ? read() : 0;
+    _write(bus, r, a, b);
+    return true;
+  }
+
+ private:
+  t_vgmRoute _routes[256];
+
+  template <class Bus>
+  static void _write(Bus* bus, const t_vgmRoute& r, uint8_t a, uint8_t b) {
+    switch (r.kind) {
+      case VGM_ROUTE_SN76489:
+        if (r.raw) {
+          bus->writeRaw(a, r.chipno, (typename Bus::freq_t)r.freq);
+        } else {
+          bus->write(a, r.chipno, (typename Bus::freq_t)r.freq);
+        }
+        break;
+      case VGM_ROUTE_YM2612:
+        // タイマーなど音に関係ないレジスタは書かない
+        if ((a >= 0x30 && a <= 0xb6) ||
+            (r.port == 0 && (a == 0x22 || a == 0x27 || a == 0x28 || a == 0x2a || a == 0x2b))) {
+          bus->setYM2612(r.port, a, b, r.chipno);
+        }
+        break;
+      case VGM_ROUTE_OPN:
+        bus->setRegister(a, b, r.chipno);
+        break;
+      case VGM_ROUTE_OPM:
+        if (a != 0x10 && a != 0x11) {  // タイマー設定は無視
+          bus->setRegisterOPM(a, b, r.chipno);
+        }
+        break;
+      case VGM_ROUTE_OPL3:
+        bus->setRegisterOPL3(r.port, a, b, r.chipno);
+        break;
+      case VGM_ROUTE_OPLL:
+        bus->setRegisterOPLL(a, b, r.chipno);
+        break;
+    }
+  }
+};
+
+#endif
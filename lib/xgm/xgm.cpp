@@ -0,0 +1,632 @@
+#include "xgm.h"
+
+#include <string.h>
+
+// XGM V2 FM
+#define WAIT_SHORT 0x00 ... 0x0e
+#define WAIT_LONG 0x0F
+#define PCM 0x10 ... 0x1f
+#define FM_LOAD_INST 0x20 ... 0x2f
+#define FM_FREQ 0x30 ... 0x3f
+#define FM_KEY 0x40 ... 0x4f
+#define FM_KEY_SEQ 0x50 ... 0x5f
+#define FM0_PAN 0x60 ... 0x6f
+#define FM1_PAN 0x70 ... 0x7f
+#define FM_FREQ_WAIT 0x80 ... 0x8f
+#define FM_TL 0x90 ... 0x9f
+#define FM_FREQ_DELTA 0xa0 ... 0xaf
+#define FM_FREQ_DELTA_WAIT 0xb0 ... 0xbf
+#define FM_TL_DELTA 0xc0 ... 0xcf
+#define FM_TL_DELTA_WAIT 0xd0 ... 0xdf
+#define FM_WRITE 0xe0 ... 0xef
+#define FRAME_DELAY 0xf0
+
+#define FM_KEY_ADV 0xf8
+#define FM_LFO 0xf9
+#define FM_CH3_SPECIAL_ON 0xfa
+#define FM_CH3_SPECIAL_OFF 0xfb
+#define FM_DAC_ON 0xfc
+#define FM_DAC_OFF 0xfd
+#define FM_LOOP 0xff
+
+// XGM V2 PSG
+#define PSG_WAIT_SHORT 0x00 ... 0x0d
+#define PSG_WAIT_LONG 0x0e
+#define PSG_LOOP 0x0f
+#define PSG_FREQ_LOW 0x10 ... 0x1f
+#define PSG_FREQ 0x20 ... 0x2f
+#define PSG_FREQ_WAIT 0x30 ... 0x3f
+#define PSG_FREQ0_DELTA 0x40 ... 0x4f
+#define PSG_FREQ1_DELTA 0x50 ... 0x5f
+#define PSG_FREQ2_DELTA 0x60 ... 0x6f
+#define PSG_FREQ3_DELTA 0x70 ... 0x7f
+#define PSG_ENV0 0x80 ... 0x8f
+#define PSG_ENV1 0x90 ... 0x9f
+#define PSG_ENV2 0xa0 ... 0xaf
+#define PSG_ENV3 0xb0 ... 0xbf
+#define PSG_ENV0_DELTA 0xc0 ... 0xcf
+#define PSG_ENV1_DELTA 0xd0 ... 0xdf
+#define PSG_ENV2_DELTA 0xe0 ... 0xef
+#define PSG_ENV3_DELTA 0xf0 ... 0xff
+
+#define XGM_NO_LOOP 0xffffff
+
+// ------------------------------------------------------------------------------
+// XGM1
+
+int XGM1Decoder::step(XGMSink& sink) {
+  uint8_t command = data[pos++];
+
+  switch (command) {
+    case 0x00:
+      // frame wait
+      frame++;
+      break;
+
+    case 0x10 ... 0x1f:
+      for (int i = 0; i < command % 16 + 1; i++) {
+        sink.psgLatched(data[pos++]);
+      }
+      break;
+
+    case 0x20 ... 0x2f:
+      for (int i = 0; i < command % 16 + 1; i++) {
+        sink.ym(0, data[pos], data[pos + 1]);
+        pos += 2;
+      }
+      break;
+
+    case 0x30 ... 0x3f:
+      for (int i = 0; i < command % 16 + 1; i++) {
+        sink.ym(1, data[pos], data[pos + 1]);
+        pos += 2;
+      }
+      break;
+
+    case 0x40 ... 0x4f:
+      for (int i = 0; i < command % 16 + 1; i++) {
+        sink.ym(0, 0x28, data[pos++]);
+      }
+      break;
+
+    case 0x50 ... 0x5f:
+      // PCM play command
+      sink.pcm(command & 0x0f, data[pos++]);
+      break;
+
+    case 0x7e:
+      // Loop command, used for music looping sequence
+      pos = start + (data[pos] | (data[pos + 1] << 8) | ((uint32_t)data[pos + 2] << 16));
+      return XGM_STEP_LOOP;
+
+    case 0x7f:
+      // End command (end of music data).
+      return XGM_STEP_END;
+
+    default:
+      unknown++;
+      break;
+  }
+
+  return XGM_STEP_NEXT;
+}
+
+// ------------------------------------------------------------------------------
+// XGM2
+
+void XGM2Decoder::begin(const uint8_t* d, uint32_t fmStart, uint32_t fmSize, uint32_t psgStart, uint32_t psgSize) {
+  data = d;
+  fmOffset = fmStart;
+  fmLen = fmSize;
+  psgOffset = psgStart;
+  psgLen = psgSize;
+  rewind();
+}
+
+void XGM2Decoder::rewind() {
+  fmPos = fmOffset;
+  psgPos = psgOffset;
+  fmFrame = 0;
+  psgFrame = 0;
+  fmLoop = XGM_NO_LOOP;
+  psgLoop = XGM_NO_LOOP;
+  memset(ymState, 0, sizeof(ymState));
+  memset(psgState, 0, sizeof(psgState));
+}
+
+int XGM2Decoder::stepFM(XGMSink& sink) {
+  uint8_t port = _fmPort(fmPos);
+  uint8_t channel = _fmChannel(fmPos);
+  uint8_t command = _u8(fmPos++);
+  uint8_t reg;
+  uint8_t value;
+
+  switch (command) {
+    case FM_LOOP: {
+      fmLoop = _u24(fmPos);
+      if (fmLoop == XGM_NO_LOOP) {
+        return XGM_STEP_END;  // 曲終了
+      }
+      fmPos = fmOffset + fmLoop;
+      return XGM_STEP_LOOP;
+    }
+
+    case PCM: {
+      sink.pcm(command & 0x0f, _u8(fmPos++));
+      break;
+    }
+
+    case FM_LOAD_INST: {
+      for (int i = 0x30; i <= 0x9C; i += 0x04) {
+        reg = i + channel;
+        value = _u8(fmPos++);
+        ymState[port][reg] = value;
+        sink.ym(port, reg, value);
+      }
+
+      reg = 0xb0 + channel;
+      value = _u8(fmPos++);
+      ymState[port][reg] = value;
+      sink.ym(port, reg, value);
+
+      reg = 0xb4 + channel;
+      value = _u8(fmPos++);
+      ymState[port][reg] = value;
+      sink.ym(port, reg, value);
+      break;
+    }
+
+    case FM_WRITE: {
+      uint8_t comsize = (command & 7) + 1;
+      for (int j = 0; j < comsize; j++) {
+        reg = _u8(fmPos++);
+        value = _u8(fmPos++);
+        ymState[port][reg] = value;
+        sink.ym(port, reg, value);
+      }
+      break;
+    }
+
+    case FM0_PAN:
+    case FM1_PAN: {
+      reg = 0xb4 + channel;
+      value = (ymState[port][reg] & 0x3f) | ((command << 4) & 0xc0);
+      ymState[port][reg] = value;
+      sink.ym(port, reg, value);
+      break;
+    }
+
+    case FM_FREQ:
+    case FM_FREQ_WAIT: {
+      // wait
+      if ((command & 0xf0) == 0x80) {
+        fmFrame++;
+      }
+
+      uint8_t data1 = _u8(fmPos++);
+      uint8_t data2 = _u8(fmPos++);
+
+      // pre-key off?
+      if ((data1 & 0x40) != 0) {
+        sink.ym(0, 0x28, 0x00 + (port << 2) + channel);
+      }
+
+      // special mode ?
+      reg = ((command & 8) != 0) ? 0xa8 : 0xa0;
+      // set channel from slot
+      if ((command & 8) != 0) {
+        channel = _fmSlot(command) - 1;
+      }
+      uint16_t lvalue = ((data1 & 0x3f) << 8) | (data2 & 0xff);
+      ymState[port][reg + channel + 4] = ((lvalue >> 8) & 0x3f);
+      ymState[port][reg + channel + 0] = (lvalue & 0xff);
+      sink.ym(port, reg + channel + 4, ymState[port][reg + channel + 4]);
+      sink.ym(port, reg + channel + 0, ymState[port][reg + channel + 0]);
+
+      // post-key on?
+      if ((data1 & 0x80) != 0) {
+        sink.ym(0, 0x28, 0xf0 + (port << 2) + channel);
+      }
+      break;
+    }
+
+    case FM_FREQ_DELTA:
+    case FM_FREQ_DELTA_WAIT: {
+      // wait
+      if ((command & 0xf0) == 0xb0) {
+        fmFrame++;
+      }
+
+      uint8_t data1 = _u8(fmPos++);
+      // sepecial mode?
+      reg = ((command & 8) != 0) ? 0xa8 : 0xa0;
+      // set channel from slot
+      if ((command & 8) != 0) {
+        channel = _fmSlot(command) - 1;
+      }
+      // get state
+      uint16_t lvalue = (ymState[port][reg + channel + 4] & 0x3f) << 8;
+      lvalue |= ymState[port][reg + channel + 0] & 0xff;
+      int delta = ((data1 >> 1) & 0x7f) + 1;
+      delta = ((data1 & 1) != 0) ? -delta : delta;
+      lvalue += delta;
+      ymState[port][reg + channel + 4] = (lvalue >> 8) & 0x3f;
+      ymState[port][reg + channel + 0] = lvalue & 0xff;
+      sink.ym(port, reg + channel + 4, ymState[port][reg + channel + 4]);
+      sink.ym(port, reg + channel + 0, ymState[port][reg + channel + 0]);
+      break;
+    }
+
+    case FM_TL: {
+      uint8_t data1 = _u8(fmPos++);
+      // compute reg
+      reg = 0x40 + (_fmSlot(command) << 2) + channel;
+      // save state
+      ymState[port][reg] = (data1 >> 1) & 0x7F;
+      // create commands
+      sink.ym(port, reg, ymState[port][reg]);
+      break;
+    }
+
+    case FM_TL_DELTA:
+    case FM_TL_DELTA_WAIT: {
+      // wait
+      if ((command & 0xf0) == 0xd0) {
+        fmFrame++;
+      }
+
+      uint8_t data1 = _u8(fmPos++);
+      // compute reg
+      reg = 0x40 + (_fmSlot(command) << 2) + channel;
+
+      int delta = ((data1 >> 2) & 0x3f) + 1;
+      delta = ((data1 & 2) != 0) ? -delta : delta;
+
+      // get state
+      int lvalue = ymState[port][reg] & 0xff;
+      lvalue += delta;
+      // save state
+      ymState[port][reg] = lvalue;
+      // create commands
+      sink.ym(port, reg, ymState[port][reg]);
+      break;
+    }
+
+    case FM_KEY: {
+      sink.ym(0, 0x28, (((command & 8) != 0) ? 0xf0 : 0x00) + (port << 2) + channel);
+      break;
+    }
+
+    case FM_KEY_SEQ: {
+      // create key sequence commands
+      if ((command & 8) != 0) {
+        // ON-OFF sequence
+        sink.ym(0, 0x28, 0xf0 + (port << 2) + channel);
+        sink.ym(0, 0x28, 0x00 + (port << 2) + channel);
+      } else {
+        // OFF-ON sequence
+        sink.ym(0, 0x28, 0x00 + (port << 2) + channel);
+        sink.ym(0, 0x28, 0xf0 + (port << 2) + channel);
+      }
+      break;
+    }
+
+    case FM_DAC_ON: {
+      ymState[0][0x2b] = 0x80;
+      sink.ym(0, 0x2b, 0x80);
+      break;
+    }
+
+    case FM_DAC_OFF: {
+      ymState[0][0x2b] = 0x00;
+      sink.ym(0, 0x2b, 0x00);
+      break;
+    }
+
+    case FM_LFO: {
+      uint8_t data1 = _u8(fmPos++);
+      ymState[0][0x22] = data1;
+      sink.ym(0, 0x22, ymState[0][0x22]);
+      break;
+    }
+
+    case FM_CH3_SPECIAL_ON: {
+      value = (ymState[0][0x27] & 0xbf) | 0x40;
+      ymState[0][0x27] = value;
+      sink.ym(0, 0x27, value);
+      break;
+    }
+
+    case FM_CH3_SPECIAL_OFF: {
+      value = (ymState[0][0x27] & 0xbf) | 0x00;
+      ymState[0][0x27] = value;
+      sink.ym(0, 0x27, value);
+      break;
+    }
+
+    case WAIT_SHORT: {
+      fmFrame += command + 1;
+      break;
+    }
+    case WAIT_LONG: {
+      fmFrame += _u8(fmPos++) + 16;
+      break;
+    }
+
+    case FRAME_DELAY: {
+      break;
+    }
+
+    default: {
+      unknown++;
+    }
+  }
+
+  return XGM_STEP_NEXT;
+}
+
+// XGM 2 port and channel
+int XGM2Decoder::_fmPort(uint32_t p) const {
+  uint8_t command = _u8(p);
+  switch (command) {
+    case FM0_PAN:
+      return 0;
+    case FM1_PAN:
+      return 1;
+    case FM_LOAD_INST:
+    case FM_FREQ:
+    case FM_FREQ_WAIT:
+    case FM_FREQ_DELTA:
+    case FM_FREQ_DELTA_WAIT:
+    case FM_KEY:
+    case FM_KEY_SEQ:
+      return (command >> 2) & 1;
+    case FM_WRITE:
+      return (command >> 3) & 1;
+    case FM_TL:
+    case FM_TL_DELTA:
+    case FM_TL_DELTA_WAIT:
+      return (_u8(p + 1) >> 0) & 1;
+    case FM_KEY_ADV:
+      return (_u8(p + 1) >> 2) & 1;
+  }
+  return 0;
+}
+
+int XGM2Decoder::_fmChannel(uint32_t p) const {
+  uint8_t command = _u8(p);
+  switch (command) {
+    case FM_FREQ:
+    case FM_FREQ_WAIT:
+    case FM_FREQ_DELTA:
+    case FM_FREQ_DELTA_WAIT:
+      if ((command & 8) != 0) return 2;
+      [[fallthrough]];
+    case FM_LOAD_INST:
+    case FM_KEY:
+    case FM_KEY_SEQ:
+    case FM_TL:
+    case FM_TL_DELTA:
+    case FM_TL_DELTA_WAIT:
+    case FM0_PAN:
+    case FM1_PAN:
+      return (command & 3);
+    case FM_WRITE:
+      if ((_u8(p + 1) & 0xF8) == 0xA8) return 2;
+      [[fallthrough]];
+    case FM_KEY_ADV:
+      return (_u8(p + 1) & 3);
+  }
+  return -1;
+}
+
+int XGM2Decoder::_fmSlot(uint8_t command) {
+  switch (command) {
+    case FM_FREQ:
+    case FM_FREQ_WAIT:
+    case FM_FREQ_DELTA:
+    case FM_FREQ_DELTA_WAIT:
+      return ((command & 8) != 0) ? ((command & 3) + 1) : -1;
+    case FM_TL:
+    case FM_TL_DELTA:
+    case FM_TL_DELTA_WAIT:
+      return ((command >> 2) & 3);
+  }
+  return -1;
+}
+
+int XGM2Decoder::stepPSG(XGMSink& sink) {
+  uint8_t channel = _psgChannel(psgPos);
+  uint8_t command = _u8(psgPos++);
+  uint8_t value;
+
+  switch (command) {
+    int oldHighFreq;
+
+    case PSG_LOOP: {
+      psgLoop = _u24(psgPos);
+      if (psgLoop == XGM_NO_LOOP) {
+        return XGM_STEP_END;  // 処理終了
+      }
+      psgPos = psgOffset + psgLoop;
+      return XGM_STEP_LOOP;
+    }
+
+    case PSG_ENV0:
+    case PSG_ENV1:
+    case PSG_ENV2:
+    case PSG_ENV3: {
+      psgState[0][channel] = command & 0x0f;
+      value = (0x90 + (channel << 5)) | psgState[0][channel];
+      sink.psg(value);
+      break;
+    }
+
+    case PSG_ENV0_DELTA:
+    case PSG_ENV1_DELTA:
+    case PSG_ENV2_DELTA:
+    case PSG_ENV3_DELTA: {
+      // wait
+      if ((command & 0x08)) {
+        psgFrame++;
+      }
+
+      int delta = ((command >> 0) & 3) + 1;
+      delta = ((command & 4) != 0) ? -delta : delta;
+      psgState[0][channel] = delta + (psgState[0][channel] & 0xf);
+      value = (0x90 + (channel << 5)) | psgState[0][channel];
+      sink.psg(value);
+      break;
+    }
+
+    case PSG_FREQ:
+    case PSG_FREQ_WAIT: {
+      // wait
+      if ((command & 0xf0) == 0x30) {
+        psgFrame++;
+      }
+
+      uint8_t data1 = _u8(psgPos++);
+      int lvalue = ((command & 0x3) << 8) | (data1 & 0xFF);
+
+      psgState[1][channel] = lvalue;
+
+      // Workaround for Sega VDP and SN76489
+      if (lvalue == 0) {
+        value = ((0x80 + (channel << 5)) | 1);
+      } else {
+        value = ((0x80 + (channel << 5)) | (lvalue & 0x0f));
+      }
+
+      // Always send High value for SN76489
+      if (channel < 3) {
+        sink.psgPair(value, (lvalue >> 4) & 0x3f);
+      } else {
+        sink.psg(value);
+      }
+      break;
+    }
+
+    case PSG_FREQ_LOW: {
+      // wait
+      if ((command & 0x1)) {
+        psgFrame++;
+      }
+
+      uint8_t data1 = _u8(psgPos++);
+      int lvalue = (psgState[1][channel] & 0x03f0) | (data1 & 0xF);
+      psgState[1][channel] = lvalue;
+      if (lvalue == 0) {
+        value = ((0x80 + (channel << 5)) | 1);
+      } else {
+        value = ((0x80 + (channel << 5)) | (lvalue & 0x0f));
+      }
+      sink.psg(value);
+      break;
+    }
+
+    case PSG_FREQ0_DELTA:
+    case PSG_FREQ1_DELTA:
+    case PSG_FREQ2_DELTA:
+    case PSG_FREQ3_DELTA: {
+      // wait
+      if ((command & 0x08)) {
+        psgFrame++;
+      }
+
+      oldHighFreq = psgState[1][channel] & 0x03f0;
+      int delta = ((command >> 0) & 3) + 1;
+      delta = ((command & 4) != 0) ? -delta : delta;
+      int lvalue = (psgState[1][channel] & 0x03ff) + delta;
+      psgState[1][channel] = lvalue;
+
+      // Workaround for Sega VDP and SN76489
+      if (lvalue == 0) {
+        value = ((0x80 + (channel << 5)) | 1);
+      } else {
+        value = ((0x80 + (channel << 5)) | (lvalue & 0x0f));
+      }
+
+      // high byte changed and not channel 3 (single byte write for channel 3)
+      if ((oldHighFreq != (lvalue & 0x3f0)) && (channel < 3)) {
+        sink.psgPair(value, (lvalue >> 4) & 0x3f);
+      } else {
+        sink.psg(value);
+      }
+      break;
+    }
+
+    case PSG_WAIT_SHORT: {
+      psgFrame += command + 1;
+      break;
+    }
+    case PSG_WAIT_LONG: {
+      psgFrame += _u8(psgPos++) + 15;
+      break;
+    }
+  }
+  return XGM_STEP_NEXT;
+}
+
+uint8_t XGM2Decoder::_psgChannel(uint32_t p) const {
+  uint8_t command = _u8(p);
+  switch (command) {
+    case PSG_ENV0:
+    case PSG_ENV0_DELTA:
+    case PSG_FREQ0_DELTA:
+      return 0;
+    case PSG_ENV1:
+    case PSG_ENV1_DELTA:
+    case PSG_FREQ1_DELTA:
+      return 1;
+    case PSG_ENV2:
+    case PSG_ENV2_DELTA:
+    case PSG_FREQ2_DELTA:
+      return 2;
+    case PSG_ENV3:
+    case PSG_ENV3_DELTA:
+    case PSG_FREQ3_DELTA:
+      return 3;
+    case PSG_FREQ:
+    case PSG_FREQ_WAIT:
+      return ((command >> 2) & 3);
+    case PSG_FREQ_LOW:
+      return ((_u8(p + 1) >> 5) & 3);
+  }
+  return 255;
+}
+
+// ------------------------------------------------------------------------------
+// XGM2 の ID テーブル
+
+uint32_t xgm2BlockEnd(const uint16_t* ids, int count, uint16_t id, uint32_t blockLen) {
+  uint32_t end = blockLen;
+  for (int i = 0; i < count; i++) {
+    if (ids[i] != 0xffff && ids[i] > id && ids[i] * 256u < end) end = ids[i] * 256u;
+  }
+  return end;
+}
+
+void xgm2SampleRanges(const uint16_t* sid, int count, uint32_t slen, uint32_t* start, uint32_t* len) {
+  for (int i = 0; i < count; i++) {
+    start[i] = 0;
+    len[i] = 0;
+    if (sid[i] == 0xffff || sid[i] * 256u >= slen) continue;
+    start[i] = sid[i] * 256u;
+    len[i] = xgm2BlockEnd(sid, count, sid[i], slen) - start[i];
+  }
+}
+
+int xgm2IndexTracks(const uint16_t* fmID, const uint16_t* psgID, uint32_t musicOffset, uint32_t fmBlockLen,
+                    uint32_t psgBlockLen, t_xgm2Track* tracks) {
+  const uint32_t psgBlock = musicOffset + fmBlockLen;
+  int n = 0;
+  for (int i = 0; i < XGM2_MAX_TRACKS; i++) {
+    if (fmID[i] == 0xffff || psgID[i] == 0xffff) break;
+    uint32_t fm = fmID[i] * 256u, psg = psgID[i] * 256u;
+    if (fm >= fmBlockLen || psg >= psgBlockLen) break;
+    tracks[n++] = {musicOffset + fm, xgm2BlockEnd(fmID, XGM2_MAX_TRACKS, fmID[i], fmBlockLen) - fm, psgBlock + psg,
+                   xgm2BlockEnd(psgID, XGM2_MAX_TRACKS, psgID[i], psgBlockLen) - psg};
+  }
+  return n;
+}
@@ -0,0 +1,114 @@
+#ifndef XGM_H
+#define XGM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// ------------------------------------------------------------------------------
+// XGM / XGM2 の曲データの解釈
+//    曲データ (ファイルの先頭からのバイト列) を読んでチップへの書き込みを XGMSink に渡す
+//    待ちはフレーム数を数えるだけで、時刻や PCM の再生は呼び出し側 (vgm.cpp) が持つ
+//    ホスト側のツール (tools/vgmhost など) も同じ解釈で動かす
+//    Arduino に依存しない
+
+// step() の戻り値
+#define XGM_STEP_NEXT 0  // 続ける
+#define XGM_STEP_LOOP 1  // ループコマンドでループ先に戻った
+#define XGM_STEP_END 2   // 曲の終わり
+
+// チップへの書き込み先
+class XGMSink {
+ public:
+  virtual ~XGMSink() {}
+  virtual void ym(uint8_t port, uint8_t reg, uint8_t value) = 0;  // YM2612
+  virtual void psg(uint8_t data) = 0;                             // SN76489 (writeRaw)
+  virtual void psgPair(uint8_t latch, uint8_t data) = 0;          // SN76489 ラッチ+データ (writeRawPair)
+  virtual void psgLatched(uint8_t data) { psg(data); }            // XGM1: 周波数の下位バイトをまとめる (write)
+  // PCM の発音 / 停止 (id 0)
+  // XGM1: command = 優先度 << 2 | チャンネル, XGM2: command = 優先度 << 3 | 半速 << 2 | チャンネル
+  virtual void pcm(uint8_t command, uint8_t id) = 0;
+};
+
+// XGM1 曲データ
+//    start: ファイル上の曲データ先頭 (MLEN の後), size: MLEN
+class XGM1Decoder {
+ public:
+  const uint8_t* data = NULL;
+  uint32_t start = 0;
+  uint32_t size = 0;
+  uint32_t pos = 0;
+  uint32_t frame = 0;  // 読んだ待ちコマンドの数
+  uint32_t unknown = 0;
+
+  void begin(const uint8_t* d, uint32_t musicStart, uint32_t musicSize) {
+    data = d;
+    start = musicStart;
+    size = musicSize;
+    rewind();
+  }
+  void rewind() {
+    pos = start;
+    frame = 0;
+  }
+
+  // コマンドを 1 つ処理する
+  int step(XGMSink& sink);
+};
+
+// XGM2 の FM / PSG ストリーム
+//    FM / PSG は別々のフレームカウンタで進む。レジスタのシャドウ状態 (デルタ系コマンド用) も持つ
+class XGM2Decoder {
+ public:
+  const uint8_t* data = NULL;
+  uint32_t fmOffset = 0, fmLen = 0, fmPos = 0;
+  uint32_t psgOffset = 0, psgLen = 0, psgPos = 0;
+  uint32_t fmFrame = 0, psgFrame = 0;
+  uint32_t fmLoop = 0, psgLoop = 0;  // 最後に処理したループコマンドのループ先 (ストリーム先頭から, 0xffffff = なし)
+  uint32_t unknown = 0;              // 不明な FM コマンドの数
+
+  uint8_t ymState[2][0x100];
+  int16_t psgState[2][4];
+
+  void begin(const uint8_t* d, uint32_t fmStart, uint32_t fmSize, uint32_t psgStart, uint32_t psgSize);
+  void rewind();  // 両ストリームを先頭から (シャドウ状態もクリア)
+
+  // コマンドを 1 つ処理する
+  int stepFM(XGMSink& sink);
+  int stepPSG(XGMSink& sink);
+
+ private:
+  uint8_t _u8(uint32_t p) const { return data[p]; }
+  uint32_t _u24(uint32_t p) const { return data[p] | (data[p + 1] << 8) | ((uint32_t)data[p + 2] << 16); }
+  int _fmPort(uint32_t p) const;
+  int _fmChannel(uint32_t p) const;
+  static int _fmSlot(uint8_t command);
+  uint8_t _psgChannel(uint32_t p) const;
+};
+
+// XGM2 の ID テーブル (SID / FMID / PSGID: ブロック内オフセット / 256, 0xffff = なし) は長さを持たないので、
+// テーブル全体で id より大きいオフセットのうち最小のもの (なければブロックの終わり) までを 1 つ分とする
+// 戻り値: 終わり (ブロック内のバイト数, blockLen 以下)
+uint32_t xgm2BlockEnd(const uint16_t* ids, int count, uint16_t id, uint32_t blockLen);
+
+// XGM2 マルチトラックのトラックごとのストリーム位置
+typedef struct {
+  uint32_t fmOffset;  // data 上の FM ストリーム先頭
+  uint32_t fmLen;
+  uint32_t psgOffset;  // data 上の PSG ストリーム先頭
+  uint32_t psgLen;
+} t_xgm2Track;
+
+#define XGM2_MAX_TRACKS 128
+
+// FMID / PSGID テーブル (XGM2_MAX_TRACKS 個ずつ, ブロック内オフセット / 256, 0xffff = なし) からトラックを並べる
+// musicOffset: data 上の FM ブロック先頭 (PSG ブロックはその fmBlockLen 後)
+// トラックは先頭から詰まっていて、どちらかが 0xffff かブロックの外になったところで終わり
+// 戻り値: トラック数
+int xgm2IndexTracks(const uint16_t* fmID, const uint16_t* psgID, uint32_t musicOffset, uint32_t fmBlockLen,
+                    uint32_t psgBlockLen, t_xgm2Track* tracks);
+
+// XGM2 のサンプル ID テーブル (ID 1 から count 個) からサンプルの範囲を作る
+// start / len はサンプルブロック先頭からのバイト数。なし・ブロック (slen) の外のサンプルは len = 0
+void xgm2SampleRanges(const uint16_t* sid, int count, uint32_t slen, uint32_t* start, uint32_t* len);
+
+#endif
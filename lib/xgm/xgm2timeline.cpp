@@ -0,0 +1,213 @@
+#include "xgm2timeline.h"
+
+#include <string.h>
+
+// 書き込みを数える / 記録する / 記録済みの列と比べるシンク
+class XGM2Recorder : public XGMSink {
+ public:
+  t_xgm2Event* buf = NULL;        // 記録先 (NULL なら数えるだけ)
+  uint32_t cap = 0;               // buf の大きさ
+  const t_xgm2Event* ref = NULL;  // 比べる相手 (ループの 2 周目)
+  uint32_t refLen = 0;
+  uint32_t frameShift = 0;  // ref のフレームとの差
+  uint32_t count = 0;
+  uint32_t frame = 0;
+  bool same = true;
+
+  void ym(uint8_t port, uint8_t reg, uint8_t value) override { _add(XGM2_EV_YM, port, reg, value); }
+  void psg(uint8_t data) override { _add(XGM2_EV_PSG, data, 0, 0); }
+  void psgPair(uint8_t latch, uint8_t data) override { _add(XGM2_EV_PSG_PAIR, latch, data, 0); }
+  void pcm(uint8_t command, uint8_t id) override { _add(XGM2_EV_PCM, command, id, 0); }
+
+ private:
+  void _add(uint8_t type, uint8_t a, uint8_t b, uint8_t c) {
+    t_xgm2Cmd cmd = {type, a, b, c};
+    if (buf) {
+      if (count < cap) buf[count] = {frame, cmd};
+    } else if (ref) {
+      if (count >= refLen || ref[count].frame + frameShift != frame ||
+          memcmp(&ref[count].cmd, &cmd, sizeof(t_xgm2Cmd)) != 0) {
+        same = false;
+      }
+    }
+    count++;
+  }
+};
+
+static int stepStream(XGM2Decoder& dec, bool fm, XGMSink& sink) { return fm ? dec.stepFM(sink) : dec.stepPSG(sink); }
+
+void XGM2Timeline::clear() {
+  free(cmds);
+  cmds = NULL;
+  len = 0;
+  loopIndex = 0;
+  _used = 0;
+}
+
+void* XGM2Timeline::_alloc(size_t bytes) {
+  if (_used + bytes > _maxBytes) return NULL;
+  void* p = alloc(bytes);
+  if (p) _used += bytes;
+  return p;
+}
+
+bool XGM2Timeline::compile(const XGM2Decoder& dec, size_t maxBytes) {
+  clear();
+  _maxBytes = maxBytes;
+
+  t_xgm2Event* fm = NULL;
+  t_xgm2Event* psg = NULL;
+  bool ok = _compileStream(dec, true, &fm, fmInfo) && _compileStream(dec, false, &psg, psgInfo);
+
+  // 大きさを数えてから確保して並べる
+  uint32_t n = ok ? _merge(fm, psg, NULL) : 0;
+  if (n) {
+    cmds = (t_xgm2Cmd*)_alloc(n * sizeof(t_xgm2Cmd));
+  }
+  if (cmds) {
+    len = _merge(fm, psg, cmds);
+  }
+  free(fm);
+  free(psg);
+
+  if (!len) {
+    clear();
+    return false;
+  }
+  return true;
+}
+
+// 1 ストリームを展開
+bool XGM2Timeline::_compileStream(const XGM2Decoder& src, bool fm, t_xgm2Event** events, t_xgm2StreamInfo& info) {
+  XGM2Decoder dec = src;
+  const uint32_t offset = fm ? dec.fmOffset : dec.psgOffset;
+  const uint32_t end = offset + (fm ? dec.fmLen : dec.psgLen);
+  const uint32_t& pos = fm ? dec.fmPos : dec.psgPos;
+  const uint32_t& frame = fm ? dec.fmFrame : dec.psgFrame;
+  const uint32_t& loop = fm ? dec.fmLoop : dec.psgLoop;
+  const uint32_t maxEvents = (_maxBytes - _used) / sizeof(t_xgm2Event);
+  XGM2Recorder rec;
+  int r = XGM_STEP_NEXT;
+
+  // 1. ループ / 終了コマンドまでの書き込みを数える
+  // (ループコマンドを処理するとデコーダはループ先に戻っている)
+  dec.rewind();
+  while (r == XGM_STEP_NEXT) {
+    if (pos >= end || rec.count > maxEvents) return false;
+    rec.frame = frame;
+    r = stepStream(dec, fm, rec);
+  }
+  info.loops = r == XGM_STEP_LOOP;
+  info.events = rec.count;
+  info.endFrame = frame;
+  info.loopOffset = loop;
+  info.loopIndex = 0;
+  info.loopFrame = 0;
+
+  *events = (t_xgm2Event*)_alloc((info.events ? info.events : 1) * sizeof(t_xgm2Event));
+  if (!*events) return false;
+
+  // 2. 記録する (ループ先のコマンドの位置も。1 周目はジャンプがないので pos は昇順)
+  const uint32_t target = offset + info.loopOffset;
+  bool found = !info.loops;
+  dec = src;
+  dec.rewind();
+  rec = XGM2Recorder();
+  rec.buf = *events;
+  rec.cap = info.events;
+  r = XGM_STEP_NEXT;
+  while (r == XGM_STEP_NEXT) {
+    if (pos >= end) return false;
+    if (!found && pos == target) {
+      found = true;
+      info.loopIndex = rec.count;
+      info.loopFrame = frame;
+    }
+    rec.frame = frame;
+    r = stepStream(dec, fm, rec);
+  }
+  if (!found || rec.count != info.events) return false;
+  if (!info.loops) return true;
+
+  // 3. 2 周目: 1 周目のループ先からと同じ書き込み・同じ間隔になっているか
+  rec = XGM2Recorder();
+  rec.ref = *events + info.loopIndex;
+  rec.refLen = info.events - info.loopIndex;
+  rec.frameShift = info.endFrame - info.loopFrame;
+  r = XGM_STEP_NEXT;
+  while (r == XGM_STEP_NEXT) {
+    if (pos >= end || !rec.same) return false;
+    rec.frame = frame;
+    r = stepStream(dec, fm, rec);
+  }
+  return r == XGM_STEP_LOOP && loop == info.loopOffset && rec.same && rec.count == rec.refLen &&
+         frame - info.endFrame == info.endFrame - info.loopFrame;
+}
+
+// FM / PSG をフレーム順に並べる (out が NULL なら数えるだけ)
+// インタープリタと同じく、同じフレーム内では FM -> PSG の順
+// ループはフレーム単位でしか表せないので、両ストリームのループ位置がずれていたら使わない
+// 戻り値: コマンド数, 0 = 使えない
+uint32_t XGM2Timeline::_merge(const t_xgm2Event* fm, const t_xgm2Event* psg, t_xgm2Cmd* out) {
+  if (fmInfo.loops != psgInfo.loops) return 0;
+  const bool loops = fmInfo.loops;
+  if (loops) {
+    if (fmInfo.loopFrame != psgInfo.loopFrame || fmInfo.endFrame != psgInfo.endFrame) return 0;
+    if (fmInfo.loopFrame >= fmInfo.endFrame) return 0;
+    // ループ先がフレームの先頭であること
+    if (fmInfo.loopIndex > 0 && fm[fmInfo.loopIndex - 1].frame == fmInfo.loopFrame) return 0;
+    if (psgInfo.loopIndex > 0 && psg[psgInfo.loopIndex - 1].frame == psgInfo.loopFrame) return 0;
+    // ループコマンドのフレームに PSG の書き込みがあると、インタープリタ (ループ後の FM を先に処理する) と順が変わる
+    if (psgInfo.events > 0 && psg[psgInfo.events - 1].frame == psgInfo.endFrame) return 0;
+  }
+  const uint32_t loopFrame = fmInfo.loopFrame;
+
+  uint32_t n = 0;
+  auto emit = [&](const t_xgm2Cmd& c) {
+    if (out) out[n] = c;
+    n++;
+  };
+
+  uint32_t i = 0, j = 0, f = 0;
+  while (true) {
+    if (loops && f == loopFrame) {
+      loopIndex = n;
+    }
+
+    while (i < fmInfo.events && fm[i].frame == f) {
+      emit(fm[i++].cmd);
+    }
+    if (!loops && f == fmInfo.endFrame) {
+      emit({XGM2_EV_END, 0, 0, 0});
+      break;
+    }
+    while (j < psgInfo.events && psg[j].frame == f) {
+      emit(psg[j++].cmd);
+    }
+    if (!loops && f == psgInfo.endFrame) {
+      emit({XGM2_EV_END, 0, 0, 0});
+      break;
+    }
+    if (loops && f == fmInfo.endFrame) {
+      emit({XGM2_EV_LOOP, 0, 0, 0});
+      break;
+    }
+
+    // 次にイベントのあるフレーム
+    uint32_t next = fmInfo.endFrame;
+    if (!loops && psgInfo.endFrame < next) next = psgInfo.endFrame;
+    if (i < fmInfo.events && fm[i].frame < next) next = fm[i].frame;
+    if (j < psgInfo.events && psg[j].frame < next) next = psg[j].frame;
+    if (loops && f < loopFrame && loopFrame < next) next = loopFrame;
+    if (next <= f) return 0;
+
+    uint32_t wait = next - f;
+    while (wait > 0) {
+      uint16_t w = wait > 0xffff ? 0xffff : wait;
+      emit({XGM2_EV_WAIT, (uint8_t)(w & 0xff), (uint8_t)(w >> 8), 0});
+      wait -= w;
+    }
+    f = next;
+  }
+  return n;
+}
@@ -0,0 +1,74 @@
+#ifndef XGM2TIMELINE_H
+#define XGM2TIMELINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "xgm.h"
+
+// ------------------------------------------------------------------------------
+// XGM2 タイムライン
+//    ロード時に FM / PSG の 2 ストリームを解釈して、フレーム順に並べた書き込み列にしたもの
+//    デルタ系・パン・キーなどのコマンドはすべて絶対値のレジスタ書き込みに展開済み
+//    インタープリタ (XGM2Decoder) をそのまま記録用のシンクで走らせて書き込みを集めるので、
+//    展開結果はインタープリタと同じになる
+//    ループ部分は 2 回通してシャドウ状態が収束している (2 周目も同じ書き込みになる) ことを確認し、
+//    だめなら作らない (インタープリタで再生する)
+//    Arduino に依存しない
+
+typedef enum {
+  XGM2_EV_YM,        // a: port, b: reg, c: value
+  XGM2_EV_PSG,       // a: data
+  XGM2_EV_PSG_PAIR,  // a: latch, b: data
+  XGM2_EV_PCM,       // a: command 下位 4 ビット, b: sample id
+  XGM2_EV_WAIT,      // a | b << 8: フレーム数
+  XGM2_EV_LOOP,
+  XGM2_EV_END,
+} tXGM2Event;
+
+typedef struct {
+  uint8_t type, a, b, c;
+} t_xgm2Cmd;
+
+typedef struct {
+  uint32_t frame;
+  t_xgm2Cmd cmd;
+} t_xgm2Event;
+
+typedef struct {
+  bool loops;
+  uint32_t events;      // 1 周目の書き込み数
+  uint32_t loopIndex;   // ループ先のイベント番号
+  uint32_t loopFrame;   // ループ先のフレーム
+  uint32_t loopOffset;  // ループ先 (ストリーム先頭からのバイト数)
+  uint32_t endFrame;    // ループ / 終了コマンドのフレーム
+} t_xgm2StreamInfo;
+
+class XGM2Timeline {
+ public:
+  t_xgm2Cmd* cmds = NULL;
+  uint32_t len = 0;
+  uint32_t loopIndex = 0;  // ループ先 (最後が XGM2_EV_LOOP のとき)
+  t_xgm2StreamInfo fmInfo, psgInfo;
+  void* (*alloc)(size_t) = malloc;  // 確保先 (ESP32 では ps_malloc)。free() で解放する
+
+  ~XGM2Timeline() { clear(); }
+
+  // dec のコピーを先頭から走らせて作る (dec 自体は動かさない)
+  // maxBytes: 作業用も含めて確保してよいバイト数
+  // 戻り値: false = 使えない (大きすぎる / 確保できない / ループが収束しない)
+  bool compile(const XGM2Decoder& dec, size_t maxBytes);
+  void clear();
+
+  bool loops() const { return len && cmds[len - 1].type == XGM2_EV_LOOP; }
+
+ private:
+  size_t _used = 0, _maxBytes = 0;
+
+  void* _alloc(size_t bytes);
+  bool _compileStream(const XGM2Decoder& src, bool fm, t_xgm2Event** events, t_xgm2StreamInfo& info);
+  uint32_t _merge(const t_xgm2Event* fm, const t_xgm2Event* psg, t_xgm2Cmd* out);
+};
+
+#endif
@@ -10,6 +10,12 @@
 #define USE_SN76489
 #define USE_YM2203_0
 
+// チップバス切り替え (デバッグ用)
+// #define USE_CHIPBUS_NULL   // チップに書き込まない
+// #define USE_CHIPBUS_TRACE  // 書き込みを SD の /trace に記録
+// #define USE_CHIPBUS_SYNTH  // チップの代わりにソフト音源で SD の /render に WAV 出力
+// #define PCM_MIX_BENCH      // 起動時に PCM ミキサーのサイクル数を計測
+
 #define CHIP0_CLOCK CLK_0
 #define CHIP1_CLOCK CLK_1
 #define CHIP2_CLOCK CLK_0
@@ -90,6 +90,8 @@ void NDConfig::saveCfg() {
   uint32_t dummy = 0;
   xQueueSend(cfgSaveQueue, &dummy, 0);
   nju72341.setFadeoutDuration(get(CFG_FADEOUT));
+  FM.updateConfig();
+  vgm.updateConfig();
   return;
 }
 
@@ -118,6 +120,9 @@ void NDConfig::loadCfg() {
   } else {
     currentMode = MODE_PLAYER;
   }
+
+  FM.updateConfig();
+  vgm.updateConfig();
 }
 
 // 最後に開いたフォルダ番号の照合
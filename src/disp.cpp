@@ -1,6 +1,10 @@
 #include "disp.h"
 
+#include "glyphatlas.h"
 #include "pics.h"
+#include "serialman.h"
+#include "vgmcapture.h"
+#include "ndlog.h"
 
 enum class cfgEvent { Open, Close, Up, Down, Left, Right };
 
@@ -68,7 +72,6 @@ static LGFX_Sprite sprPng(&lcd);
 static LGFX_Sprite sprPngResized(&lcd);
 static String lastPNGPath = "";
 
-static OpenFontRender render;
 static TimerHandle_t hDispTimer;
 static int currentPage = 0;
 
@@ -89,6 +92,124 @@ void redrawOnCore0Task(void* pvParameters) {
 
 void redrawOnCore0() { xTaskCreateUniversal(redrawOnCore0Task, "task", 8192, NULL, 1, NULL, PRO_CPU_NUM); }
 
+//---------------------------------------------------------------------------
+// 文字描画 (lib/glyphatlas)
+//    フォントは起動時に 1 回だけ読み込み、ラスタライズしたグリフは PSRAM のアトラスから描く
+//    1 文字ずつ fg / bg を混ぜた色にしてからまとめて pushImage する (アルファ 0 は透過)
+enum { FACE_MAIN, FACE_BOLD };
+
+#define GLYPH_BLIT_MAX 1024  // 1 回に pushImage するピクセル数
+
+static GlyphAtlas glyphs;
+static SemaphoreHandle_t spGlyphs;  // アトラスの排他 (設定画面のタスクからも描く)
+static uint16_t _glyphBuf[GLYPH_BLIT_MAX];
+
+// OpenFontRender と同じアルファブレンド
+static uint16_t alphaBlend(uint8_t alpha, uint16_t fgc, uint16_t bgc) {
+  uint16_t fgR = ((fgc >> 10) & 0x3E) + 1;
+  uint16_t fgG = ((fgc >> 4) & 0x7E) + 1;
+  uint16_t fgB = ((fgc << 1) & 0x3E) + 1;
+
+  uint16_t bgR = ((bgc >> 10) & 0x3E) + 1;
+  uint16_t bgG = ((bgc >> 4) & 0x7E) + 1;
+  uint16_t bgB = ((bgc << 1) & 0x3E) + 1;
+
+  uint16_t r = (((fgR * alpha) + (bgR * (255 - alpha))) >> 9);
+  uint16_t g = (((fgG * alpha) + (bgG * (255 - alpha))) >> 9);
+  uint16_t b = (((fgB * alpha) + (bgB * (255 - alpha))) >> 9);
+  return (r << 11) | (g << 5) | (b << 0);
+}
+
+static bool initFonts() {
+  spGlyphs = xSemaphoreCreateMutex();
+  if (!spGlyphs || !glyphs.begin()) {
+    ndLog.println("ERROR: Glyph atlas allocation failed.");
+    return false;
+  }
+  if (!glyphs.addFace(FACE_MAIN, fontMain, sizeof(fontMain)) ||
+      !glyphs.addFace(FACE_BOLD, nimbusBold, sizeof(nimbusBold))) {
+    ndLog.println("ERROR: Failed to load fonts.");
+    return false;
+  }
+  return true;
+}
+
+// インクの幅 (OpenFontRender::getTextWidth と同じ)
+static uint32_t textWidth(uint8_t face, uint8_t size, const char* str) {
+  int32_t left;
+  uint32_t width;
+  xSemaphoreTake(spGlyphs, portMAX_DELAY);
+  glyphs.measure(face, size, str, &left, &width);
+  xSemaphoreGive(spGlyphs);
+  return width;
+}
+
+// 送りの合計 (次の文字を置く位置)
+static uint32_t textAdvance(uint8_t face, uint8_t size, const char* str) {
+  uint32_t w = 0, c;
+  xSemaphoreTake(spGlyphs, portMAX_DELAY);
+  while ((c = GlyphAtlas::nextCodepoint(&str)) != 0) {
+    const t_glyph* g = glyphs.get(face, size, c);
+    if (g) w += g->advance;
+  }
+  xSemaphoreGive(spGlyphs);
+  return w;
+}
+
+// 文字列を描く。(x, y) は align の基準で、y は文字の上端
+static void drawText(LovyanGFX& dst, uint8_t face, uint8_t size, int32_t x, int32_t y, Align align, uint16_t fg,
+                     uint16_t bg, const char* str) {
+  xSemaphoreTake(spGlyphs, portMAX_DELAY);
+
+  // 横位置はインクの範囲で合わせる
+  if (align == Align::TopCenter || align == Align::TopRight) {
+    int32_t left;
+    uint32_t width;
+    glyphs.measure(face, size, str, &left, &width);
+    x -= left + (int32_t)(align == Align::TopCenter ? width / 2 : width);
+  }
+  int32_t baseline = y + glyphs.ascender(face, size);
+
+  // アルファ (上位 6 ビット) -> 色。pushImage の uint16_t はバイトスワップした RGB565
+  uint16_t lut[64];
+  for (int i = 0; i < 64; i++) {
+    lut[i] = __builtin_bswap16(alphaBlend((i << 2) | (i >> 4), fg, bg));
+  }
+  // 透過色: どの色とも重ならない値
+  uint16_t transparent = 0x0120;
+  for (int i = 0; i < 64; i++) {
+    if (lut[i] == transparent) {
+      transparent++;
+      i = -1;
+    }
+  }
+
+  dst.startWrite();
+  uint32_t c;
+  while ((c = GlyphAtlas::nextCodepoint(&str)) != 0) {
+    const t_glyph* g = glyphs.get(face, size, c);
+    if (!g) continue;
+    const uint8_t* bmp = glyphs.bitmap(g);
+    int32_t gx = x + g->left;
+    int32_t gy = baseline - g->top;
+
+    // バッファに入る行数ずつ (空白はビットマップなし)
+    uint32_t chunk = g->width ? GLYPH_BLIT_MAX / g->width : 0;
+    for (uint32_t row = 0; chunk && row < g->rows; row += chunk) {
+      uint32_t n = g->rows - row < chunk ? g->rows - row : chunk;
+      const uint8_t* src = bmp + row * g->width;
+      for (uint32_t i = 0; i < n * g->width; i++) {
+        _glyphBuf[i] = src[i] ? lut[src[i] >> 2] : transparent;
+      }
+      dst.pushImage(gx, gy + row, g->width, n, _glyphBuf, transparent);
+    }
+    x += g->advance;
+  }
+  dst.endWrite();
+
+  xSemaphoreGive(spGlyphs);
+}
+
 //---------------------------------------------------------------------------
 // Scrolling label class
 Label::Label(const int16_t x, const int16_t y, const int16_t w, const uint16_t fontColor, const uint16_t bgColor,
@@ -107,41 +228,27 @@ void Label::setCaption(const String newCaption) {
   if (_caption != newCaption) {
     _caption = newCaption;
 
-    OpenFontRender ofr;
-
-    ofr.setUseRenderTask(false);
-
-    ofr.setDrawer(_sprite);
-    ofr.loadFont(fontMain, sizeof(fontMain));
-
-    ofr.setFontSize(_fontSize);
-    ofr.setFontColor(_fontColor, _bgColor);
-    _textWidth = ofr.getTextWidth(_caption.c_str());
-    _devWidth = ofr.getTextWidth(TITLE_DEVIDER) + ofr.getTextWidth("/");
+    _textWidth = textWidth(FACE_MAIN, _fontSize, _caption.c_str());
+    _devWidth = textWidth(FACE_MAIN, _fontSize, TITLE_DEVIDER) + textWidth(FACE_MAIN, _fontSize, "/");
     _sprite.deleteSprite();
     _sprite.setPsram(true);
 
+    Align align;
+    int32_t x = 0;
     if (_textWidth > _labelWidth) {
       _caption += TITLE_DEVIDER;
       _isScrolling = true;
       _sprite.createSprite(_textWidth + _devWidth, _fontSize);
-
-      ofr.setAlignment(Align::TopLeft);
-      ofr.setCursor(0, 0);
+      align = Align::TopLeft;
     } else {
       _isScrolling = false;
       _sprite.createSprite(_labelWidth, _fontSize);
-      ofr.setAlignment(_textAlign);
-      if (_textAlign == Align::TopCenter) {
-        ofr.setCursor(_labelWidth / 2, 0);
-      } else {
-        ofr.setCursor(0, 0);
-      }
+      align = _textAlign;
+      if (_textAlign == Align::TopCenter) x = _labelWidth / 2;
     }
 
     _sprite.fillSprite(_bgColor);
-    ofr.printf(_caption.c_str());
-    ofr.unloadFont();
+    drawText(_sprite, FACE_MAIN, _fontSize, x, 0, align, _fontColor, _bgColor, _caption.c_str());
   }
 
   _sprite.pushSprite(&frameBuffer, _x, _y);
@@ -184,21 +291,114 @@ void pngDraw(PNGDRAW* pDraw) {
 
 //---------------------------------------------------------------------------
 // Draw header info
-static LGFX_Sprite sprHeader(&lcd);
+//    経過時間は起動時に 1 回だけ描いた数字の帯 ("0123456789:") から、変わった桁だけを LCD に DMA で送る
+#define TIME_X 50  // 経過時間の表示範囲
+#define TIME_Y 4
+#define TIME_W 70
+#define TIME_H 14
+#define DIGIT_CHARS "0123456789:"
+
+static LGFX_Sprite sprDigits(&lcd);
+static uint16_t _digitX[11], _digitW[11];  // 帯の中の各文字の位置と幅 (送り)
+static char _timeShown[8];                 // 表示中の時間 ("" = 全部描き直す)
+static int32_t _timeShownX;                // 表示中の時間の左端
+
+static bool initDigits() {
+  int32_t x = 0;
+  for (int i = 0; i < 11; i++) {
+    char c[2] = {DIGIT_CHARS[i], 0};
+    _digitX[i] = x;
+    _digitW[i] = textAdvance(FACE_BOLD, TIME_H, c);
+    x += _digitW[i];
+  }
+  sprDigits.setPsram(true);
+  if (!sprDigits.createSprite(x, TIME_H)) {
+    ndLog.println("ERROR: Digit strip allocation failed.");
+    return false;
+  }
+  sprDigits.fillSprite(C_HEADER);
+  for (int i = 0; i < 11; i++) {
+    char c[2] = {DIGIT_CHARS[i], 0};
+    drawText(sprDigits, FACE_BOLD, TIME_H, _digitX[i], 0, Align::TopLeft, TFT_WHITE, C_HEADER, c);
+  }
+  return true;
+}
+
 void updateHeader(uint64_t sec) {
+  char buf[8];
+  snprintf(buf, sizeof(buf), "%d:%02d", (uint8_t)(sec / 60), (uint8_t)(sec % 60));
+
+  // 中央揃え。幅が変わったら (9:59 -> 10:00 など) 全部描き直す
+  int32_t w = 0;
+  for (int i = 0; buf[i]; i++) {
+    w += _digitW[buf[i] == ':' ? 10 : buf[i] - '0'];
+  }
+  int32_t x = TIME_X + TIME_W / 2 - w / 2;
+
   if (xSemaphoreTake(spFrameBuffer, portMAX_DELAY) == pdTRUE) {
-    sprHeader.createSprite(70, 14);
-    sprHeader.fillSprite(C_HEADER);
-    render.setDrawer(sprHeader);
-    render.setAlignment(Align::TopCenter);
-    render.loadFont(nimbusBold, sizeof(nimbusBold));
-    render.setFontSize(14);
-    render.setFontColor(TFT_WHITE);
-    render.setCursor(35, 0);
-    render.printf("%d:%02d", (uint8_t)(sec / 60), (uint8_t)(sec % 60));
-    render.unloadFont();
-    sprHeader.pushSprite(50, 4);
-    sprHeader.deleteSprite();
+    bool all = x != _timeShownX || strlen(buf) != strlen(_timeShown);
+    lcd.startWrite();
+    if (all) lcd.fillRect(TIME_X, TIME_Y, TIME_W, TIME_H, C_HEADER);
+    for (int i = 0; buf[i]; i++) {
+      int d = buf[i] == ':' ? 10 : buf[i] - '0';
+      if (all || buf[i] != _timeShown[i]) {
+        // 帯の該当する文字だけがクリップ範囲に入るように帯全体を置く
+        lcd.setClipRect(x, TIME_Y, _digitW[d], TIME_H);
+        lcd.pushImageDMA(x - _digitX[d], TIME_Y, sprDigits.width(), TIME_H,
+                         (const lgfx::swap565_t*)sprDigits.getBuffer());
+      }
+      x += _digitW[d];
+    }
+    lcd.setClipRect(0, 0, LCD_W, LCD_H);
+    lcd.endWrite();
+    strcpy(_timeShown, buf);
+    _timeShownX = TIME_X + TIME_W / 2 - w / 2;
+    xSemaphoreGive(spFrameBuffer);
+  }
+}
+
+//---------------------------------------------------------------------------
+// シリアルモードの状態表示 (1 秒ごと、変化があったときだけ)
+static LGFX_Sprite sprSerialStatus(&lcd);
+static uint32_t _serialStatusShown[8];  // 表示中の値 (serialModeDraw で消したら描き直す)
+static void updateSerialStatus() {
+  static uint32_t lastTick = 0;
+  uint32_t* shown = _serialStatusShown;
+  uint32_t now = millis();
+  if (now - lastTick < 1000) return;
+  lastTick = now;
+
+  uint32_t cur[8] = {serialMan.commandsPerSec,
+                     serialMan.ringFree,
+                     serialMan.rxFull,
+                     serialMan.unknownCommands,
+                     serialMan.underruns,
+                     serialMan.overruns,
+                     vgmCapture.isRecording() ? vgmCapture.bytes / 1024 + 1 : 0,  // 0 = 記録していない
+                     vgmCapture.dropped};
+  if (memcmp(cur, shown, sizeof(cur)) == 0 && shown[1]) return;
+
+  if (xSemaphoreTake(spFrameBuffer, 0) == pdTRUE) {
+    memcpy(shown, cur, sizeof(cur));
+    sprSerialStatus.createSprite(LCD_W - 8, 28);
+    sprSerialStatus.fillSprite(C_BASEBG);
+    sprSerialStatus.setFont(&fonts::Font0);
+    sprSerialStatus.setTextColor(C_GRAY, C_BASEBG);
+    sprSerialStatus.setCursor(0, 0);
+    sprSerialStatus.printf("%u cmd/s free %u", cur[0], cur[1]);
+    sprSerialStatus.setCursor(0, 10);
+    sprSerialStatus.printf("full %u unk %u", cur[2], cur[3]);
+    if (cur[3]) sprSerialStatus.printf("(%02x)", serialMan.lastUnknown);
+    if (serialMan.timed) sprSerialStatus.printf(" U%u O%u", cur[4], cur[5]);
+    if (cur[6]) {
+      // SD に記録中
+      sprSerialStatus.setTextColor(C_ORANGE, C_BASEBG);
+      sprSerialStatus.setCursor(0, 20);
+      sprSerialStatus.printf("REC %uKB", cur[6] - 1);
+      if (cur[7]) sprSerialStatus.printf(" drop %u", cur[7]);
+    }
+    sprSerialStatus.pushSprite(5, 77);
+    sprSerialStatus.deleteSprite();
     xSemaphoreGive(spFrameBuffer);
   }
 }
@@ -215,6 +415,11 @@ void dispTimerHandler(void* param) {
     return;
   }
 
+  if (ndConfig.currentMode == MODE_SERIAL) {
+    updateSerialStatus();
+    return;
+  }
+
   if (!_stopTimerDrawing) {
     if (xSemaphoreTake(spFrameBuffer, 0) == pdTRUE) {
       lblTitle.update();
@@ -246,60 +451,32 @@ void drawBG() {
 // プレーヤー描画
 void redraw() {
   xSemaphoreTake(spFrameBuffer, portMAX_DELAY);
+  uint32_t startUs = micros();
+  uint32_t hits = glyphs.hits, misses = glyphs.misses;
   _stopTimerDrawing = true;
+  _timeShown[0] = 0;  // frameBuffer で上書きされる
   drawBG();
-  render.setUseRenderTask(false);
-  render.setDrawer(frameBuffer);
-  render.setAlignment(Align::TopLeft);
-
-  render.loadFont(fontMain, sizeof(fontMain));
-  render.setFontSize(16);
-  render.setFontColor(C_GRAY, C_BASEBG);
-  render.setCursor(27, 256);
-  render.printf(_dispData.date.c_str());
-  render.unloadFont();
-
-  render.loadFont(nimbusBold, sizeof(nimbusBold));
-  render.setFontSize(13);
-  render.setFontColor(C_YELLOW, C_DARK);
-  render.setCursor(27, 284);
-  render.printf(_dispData.chip0.c_str());
-  render.setCursor(27, 303);
-  render.printf(_dispData.chip1.c_str());
-
-  render.setFontColor(C_LIGHTGRAY, C_FOOTER_INACTIVE);
-  render.setCursor(11, 284);
-  render.printf("1");
-  render.setCursor(11, 303);
-  render.printf("2");
+  drawText(frameBuffer, FACE_MAIN, 16, 27, 256, Align::TopLeft, C_GRAY, C_BASEBG, _dispData.date.c_str());
 
+  drawText(frameBuffer, FACE_BOLD, 13, 27, 284, Align::TopLeft, C_YELLOW, C_DARK, _dispData.chip0.c_str());
+  drawText(frameBuffer, FACE_BOLD, 13, 27, 303, Align::TopLeft, C_YELLOW, C_DARK, _dispData.chip1.c_str());
+
+  drawText(frameBuffer, FACE_BOLD, 13, 11, 284, Align::TopLeft, C_LIGHTGRAY, C_FOOTER_INACTIVE, "1");
+  drawText(frameBuffer, FACE_BOLD, 13, 11, 303, Align::TopLeft, C_LIGHTGRAY, C_FOOTER_INACTIVE, "2");
+
+  char buf[16];
   if (_dispData.no != 0 && _dispData.maxFiles != 0) {
-    render.setFontSize(14);
-    render.setFontColor(C_GRAY, C_HEADER);
-    render.setCursor(167, 4);
-    render.setAlignment(Align::TopRight);
-    render.printf("%02d/%02d", _dispData.no, _dispData.maxFiles);
+    snprintf(buf, sizeof(buf), "%02d/%02d", _dispData.no, _dispData.maxFiles);
+    drawText(frameBuffer, FACE_BOLD, 14, 167, 4, Align::TopRight, C_GRAY, C_HEADER, buf);
   }
 
   if (ndConfig.get(CFG_UPDATE) == UPDATE_YES) {
-    render.setAlignment(Align::TopCenter);
-    render.setFontSize(14);
-    render.setFontColor(C_LIGHTGRAY, C_HEADER);
-    render.setCursor(LCD_W / 2, 4);
-    render.printf("%d:%02d", (uint8_t)(_dispData.time / 60), (uint8_t)(_dispData.time % 60));
-  }
-
-  render.setFontSize(13);
-  if (ndFile.accessMode == ACCESS_CACHE) {
-    render.setFontColor(C_ACCENT_LIGHT, C_HEADER);
-  } else {
-    render.setFontColor(C_ORANGE, C_HEADER);
+    snprintf(buf, sizeof(buf), "%d:%02d", (uint8_t)(_dispData.time / 60), (uint8_t)(_dispData.time % 60));
+    drawText(frameBuffer, FACE_BOLD, TIME_H, LCD_W / 2, TIME_Y, Align::TopCenter, C_LIGHTGRAY, C_HEADER, buf);
   }
 
-  render.setCursor(4, 4);
-  render.setAlignment(Align::TopLeft);
-  render.printf(_dispData.type.c_str());
-  render.unloadFont();
+  drawText(frameBuffer, FACE_BOLD, 13, 4, 4, Align::TopLeft,
+           ndFile.accessMode != ACCESS_PSRAM ? C_ACCENT_LIGHT : C_ORANGE, C_HEADER, _dispData.type.c_str());
 
   if (ndConfig.get(CFG_LANG) == LANG_JA) {
     lblTitle.setCaption(_dispData.trackJp);
@@ -327,6 +504,13 @@ void redraw() {
     }
   }
 
+  // 文字描画の統計 (PNG を含む描画時間とグリフのヒット率)
+  hits = glyphs.hits - hits;
+  misses = glyphs.misses - misses;
+  ndLog.printf("Redraw: %u us, glyphs hit %u / miss %u (%.1f%%), atlas %u glyphs %uKB, flushed %u\n",
+               micros() - startUs, hits, misses, hits + misses ? 100.0f * hits / (hits + misses) : 0.0f,
+               glyphs.glyphs(), glyphs.used() / 1024, glyphs.flushes);
+
   frameBuffer.pushSprite(0, 0);
   _stopTimerDrawing = false;
   xSemaphoreGive(spFrameBuffer);
@@ -336,53 +520,33 @@ void redraw() {
 void serialModeDraw() {
   xSemaphoreTake(spFrameBuffer, portMAX_DELAY);
   _stopTimerDrawing = true;
+  memset(_serialStatusShown, 0, sizeof(_serialStatusShown));
+  _timeShown[0] = 0;
   drawBG();
-  render.setUseRenderTask(false);
-  render.setDrawer(frameBuffer);
 
   frameBuffer.pushImage(170 - 2 - USB_ICON_WIDTH, 2, USB_ICON_WIDTH, USB_ICON_HEIGHT, usb_icon);  // usb icon
 
-  render.loadFont(nimbusBold, sizeof(nimbusBold));
-  render.setFontSize(13);
-  render.setFontColor(C_YELLOW, C_DARK);
-  render.setCursor(27, 284);
-
+  String st = "YM2612 @ -- MHz";
   if (ND::freq[0] != SI5351_UNDEFINED) {
     char buf[7];
     dtostrf((double)ND::freq[0] / 1000000.0, 1, 4, buf);
-    String st = "YM2612 @ " + String(buf).substring(0, 5) + " MHz";
-    render.printf(st.c_str());
-  } else {
-    render.printf("YM2612 @ -- MHz");
+    st = "YM2612 @ " + String(buf).substring(0, 5) + " MHz";
   }
-  render.setCursor(27, 303);
+  drawText(frameBuffer, FACE_BOLD, 13, 27, 284, Align::TopLeft, C_YELLOW, C_DARK, st.c_str());
+
+  st = "SN76489 @ -- MHz";
   if (ND::freq[1] != SI5351_UNDEFINED) {
     char buf[7];
     dtostrf((double)ND::freq[1] / 1000000.0, 1, 4, buf);
-    String st = "SN76489 @ " + String(buf).substring(0, 5) + " MHz";
-    render.printf(st.c_str());
-  } else {
-    render.printf("SN76489 @ -- MHz");
+    st = "SN76489 @ " + String(buf).substring(0, 5) + " MHz";
   }
+  drawText(frameBuffer, FACE_BOLD, 13, 27, 303, Align::TopLeft, C_YELLOW, C_DARK, st.c_str());
 
-  render.setFontColor(C_LIGHTGRAY, C_FOOTER_INACTIVE);
-  render.setCursor(11, 284);
-  render.printf("1");
-  render.setCursor(11, 303);
-  render.printf("2");
+  drawText(frameBuffer, FACE_BOLD, 13, 11, 284, Align::TopLeft, C_LIGHTGRAY, C_FOOTER_INACTIVE, "1");
+  drawText(frameBuffer, FACE_BOLD, 13, 11, 303, Align::TopLeft, C_LIGHTGRAY, C_FOOTER_INACTIVE, "2");
+  drawText(frameBuffer, FACE_BOLD, 13, 4, 4, Align::TopLeft, C_ORANGE, C_HEADER, "USB");
 
-  render.setFontColor(C_ORANGE, C_HEADER);
-  render.setCursor(4, 4);
-  render.setAlignment(Align::TopLeft);
-  render.printf("USB");
-  render.unloadFont();
-
-  render.loadFont(fontMain, sizeof(fontMain));
-  render.setFontSize(16);
-  render.setFontColor(C_GRAY, C_BASEBG);
-  render.setCursor(28, 256);
-  render.printf("--");
-  render.unloadFont();
+  drawText(frameBuffer, FACE_MAIN, 16, 28, 256, Align::TopLeft, C_GRAY, C_BASEBG, "--");
 
   if (ndConfig.get(CFG_LANG) == LANG_JA) {
     lblTitle.setCaption("シリアルモード");
@@ -433,6 +597,9 @@ bool initDisp() {
   spFrameBuffer = xSemaphoreCreateBinary();
   xSemaphoreGive(spFrameBuffer);
 
+  // フォント (起動時に 1 回だけ読み込む) と経過時間の数字
+  if (!initFonts() || !initDigits()) return false;
+
   // フレームバッファスプライト作成
   frameBuffer.setPsram(true);
   frameBuffer.createSprite(LCD_W, LCD_H);
@@ -698,6 +865,7 @@ void CFGWindow::right() {
 
 void CFGWindow::draw() {
   xSemaphoreTake(spFrameBuffer, portMAX_DELAY);
+  _timeShown[0] = 0;
 
   frameBuffer.fillSprite(TFT_WHITE);
   frameBuffer.fillRect(0, 0, LCD_W, 26, C_HEADER);
@@ -705,24 +873,12 @@ void CFGWindow::draw() {
 
   frameBuffer.fillRoundRect(124, 293, 42, 23, 2, C_FOOTER_ACTIVE);
 
-  render.setDrawer(frameBuffer);
-  render.setAlignment(Align::TopLeft);
-  render.setFontColor(C_LIGHTGRAY, C_FOOTER_ACTIVE);
-
   if (ndConfig.get(CFG_LANG) == LANG_JA) {
-    render.loadFont(fontMain, sizeof(fontMain));
-    render.setFontSize(17);
-    render.setCursor(6, 4);
-    render.printf("設定");
-    render.setCursor(130, 297);
-    render.printf("戻る");
+    drawText(frameBuffer, FACE_MAIN, 17, 6, 4, Align::TopLeft, C_LIGHTGRAY, C_FOOTER_ACTIVE, "設定");
+    drawText(frameBuffer, FACE_MAIN, 17, 130, 297, Align::TopLeft, C_LIGHTGRAY, C_FOOTER_ACTIVE, "戻る");
   } else {
-    render.loadFont(nimbusBold, sizeof(nimbusBold));
-    render.setFontSize(16);
-    render.setCursor(6, 5);
-    render.printf("Settings");
-    render.setCursor(133, 298);
-    render.printf("OK");
+    drawText(frameBuffer, FACE_BOLD, 16, 6, 5, Align::TopLeft, C_LIGHTGRAY, C_FOOTER_ACTIVE, "Settings");
+    drawText(frameBuffer, FACE_BOLD, 16, 133, 298, Align::TopLeft, C_LIGHTGRAY, C_FOOTER_ACTIVE, "OK");
   }
 
   drawFooter(true);
@@ -731,7 +887,6 @@ void CFGWindow::draw() {
     cfgWindow.drawItem(i, true);
   }
 
-  render.unloadFont();
   frameBuffer.pushSprite(0, 0);
   xSemaphoreGive(spFrameBuffer);  // 描画完了
 }
@@ -745,19 +900,17 @@ void CFGWindow::drawItem(int index, bool toFrameBuffer) {
     backgroundColor = C_ACCENT_DARK;
   }
 
-  OpenFontRender ofr;
-  ofr.setDrawer(_sprite);
-
   String label, option;
   int fontSize;
+  uint8_t face;
   if (ndConfig.get(CFG_LANG) == LANG_JA) {
-    ofr.loadFont(fontMain, sizeof(fontMain));
+    face = FACE_MAIN;
     fontSize = 17;
     label = ndConfig.items[index].labelJp;
     option = ndConfig.items[index].optionsJp[ndConfig.items[index].index];
   } else {
     fontSize = 16;
-    ofr.loadFont(nimbusBold, sizeof(nimbusBold));
+    face = FACE_BOLD;
     label = ndConfig.items[index].labelEn;
     option = ndConfig.items[index].optionsEn[ndConfig.items[index].index];
   }
@@ -765,24 +918,11 @@ void CFGWindow::drawItem(int index, bool toFrameBuffer) {
   _sprite.fillSprite(backgroundColor);
   _sprite.drawLine(0, ITEM_HEIGHT - 1, LCD_W, ITEM_HEIGHT - 1, borderColor);
 
-  ofr.setFontSize(fontSize);
-  ofr.setAlignment(Align::TopLeft);
-  ofr.setFontColor(titleTextColor, backgroundColor);
-  ofr.setCursor(6, (ITEM_HEIGHT - fontSize) / 2);
-  ofr.printf(label.c_str());
-
-  /*
-  if (ndConfig.get(CFG_LANG) == LANG_EN) {
-    ofr.unloadFont();
-    ofr.loadFont(nimbusRegular, sizeof(nimbusRegular));
-  }
-  */
-  ofr.setFontColor(optionTextColor, backgroundColor);
-  ofr.setAlignment(Align::TopRight);
-  ofr.setCursor(LCD_W - 6, (ITEM_HEIGHT - fontSize) / 2);
-  ofr.printf(option.c_str());
+  drawText(_sprite, face, fontSize, 6, (ITEM_HEIGHT - fontSize) / 2, Align::TopLeft, titleTextColor, backgroundColor,
+           label.c_str());
+  drawText(_sprite, face, fontSize, LCD_W - 6, (ITEM_HEIGHT - fontSize) / 2, Align::TopRight, optionTextColor,
+           backgroundColor, option.c_str());
 
-  ofr.unloadFont();
   if (toFrameBuffer) {
     _sprite.pushSprite(&frameBuffer, 0, 26 + ITEM_HEIGHT * (index));
   } else {
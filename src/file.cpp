@@ -1,4 +1,5 @@
 #include "file.h"
+#include "ndlog.h"
 
 static SPIClass SPI_SD;
 std::vector<String> dirs;                // ルートのディレクトリ一覧
@@ -92,7 +93,7 @@ void fillCacheTask(void* pvParameters) {
 
   fillCache(pos, cacheIndex);
   delete param;
-  Serial.printf("Task End.\n");
+  ndLog.printf("Task End.\n");
   vTaskDelete(NULL);
 }
 
@@ -113,7 +114,7 @@ bool initCache(String path) {
   }
   _cacheFile = SD.open(path.c_str());
   if (!_cacheFile) {
-    Serial.printf("ERROR: Failed to open cache file: %s\n", path.c_str());
+    ndLog.printf("ERROR: Failed to open cache file: %s\n", path.c_str());
     return false;
   }
 
@@ -173,8 +174,7 @@ bool NDFile::init() {
   vTaskDelay(100);
 
   // メモリ確保
-  psramInit();  // ALWAYS CALL THIS BEFORE USING THE PSRAM
-  data = (u8_t*)ps_calloc(MAX_FILE_SIZE, sizeof(u8_t));
+  allocData();
 
   // PSRAMキャッシュ確保
   for (int i = 0; i < NUM_CACHE; i++) {
@@ -186,7 +186,7 @@ bool NDFile::init() {
   // キューを初期化
   cacheQueue = xQueueCreate(2, sizeof(CacheTaskParam));
   if (!cacheQueue) {
-    Serial.println("ERROR: cacheQueue create failed!");
+    ndLog.println("ERROR: cacheQueue create failed!");
     return false;
   }
 
@@ -196,6 +196,20 @@ bool NDFile::init() {
   return true;
 }
 
+bool NDFile::mountSD() {
+  if (SD.cardType() != CARD_NONE) return true;
+  SPI_SD.begin(SD_CLK, SD_MISO, SD_MOSI, SD_CS);
+  return SD.begin(SD_CS, SPI_SD, 80000000) && SD.cardType() != CARD_NONE;
+}
+
+bool NDFile::allocData() {
+  if (!data) {
+    psramInit();  // ALWAYS CALL THIS BEFORE USING THE PSRAM
+    data = (u8_t*)ps_calloc(MAX_FILE_SIZE, sizeof(u8_t));
+  }
+  return data != NULL;
+}
+
 uint16_t NDFile::getNumFilesinCurrentDir() { return files[currentDir].size(); }
 
 void NDFile::listDir(const char* dirname) {
@@ -285,7 +299,7 @@ void NDFile::listDir(const char* dirname) {
 FileFormat NDFile::readFile(String path) {
   int n = 0;
   vgm.size = 0;
-  Serial.printf("readFile: %s\n", path.c_str());
+  ndLog.printf("readFile: %s\n", path.c_str());
 
   hFile = SD.open(path.c_str());
   if (!hFile) {
@@ -308,24 +322,54 @@ FileFormat NDFile::readFile(String path) {
   bool isXGM2 = (header[0] == 'X' && header[1] == 'G' && header[2] == 'M' && header[3] == '2');
 
   vgm.size = hFile.size();
-  Serial.printf("file size: %u Bytes.\n", vgm.size);
+  ndLog.printf("file size: %u Bytes.\n", vgm.size);
+
+  xgmPages.end();
+  bankSkip = 0;
+
+  if (isXGM1 || isXGM2) {
+    if (vgm.size > MAX_FILE_SIZE) {
+      // ストリームモード: サンプルバンクを抜いてヘッダの後に曲データを詰める
+      // |  ヘッダ  |  サンプル (SLEN)  |  曲データ  |
+      //       -> |  ヘッダ  |  曲データ  |
+      u8_t slen[2];
+      hFile.seek(isXGM1 ? 0x100 : 0x6);
+      hFile.read(slen, sizeof(slen));
+      u32_t bankSize = (slen[0] | (slen[1] << 8)) << 8;
+
+      // XGM2 マルチトラックはヘッダが長い
+      u32_t base = XGM_SAMPLE_BASE;
+      if (isXGM2) {
+        hFile.seek(0x5);
+        if (hFile.read() & 0b10) base = XGM2_MULTI_SAMPLE_BASE;
+      }
 
-  if (isXGM1) {  // XGM1 のとき
-    accessMode = ACCESS_PSRAM;
-    hFile.seek(0);
-    hFile.read(data, vgm.size);
-    Serial.printf("XGM1 file name: %s\n", path.c_str());
-    hFile.close();
-    return FileFormat::XGM1;
-  }
+      if (vgm.size < base + bankSize || vgm.size - bankSize > MAX_FILE_SIZE) {
+        showError("ERROR: The XGM music data is too large.\nMax size is " + String(MAX_FILE_SIZE) + ".\n" + path);
+        hFile.close();
+        return FileFormat::Unknown;
+      }
 
-  if (isXGM2) {  // XGM2 のとき
-    accessMode = ACCESS_PSRAM;
-    hFile.seek(0);
-    hFile.read(data, vgm.size);
-    Serial.printf("XGM2 file name: %s\n", path.c_str());
-    hFile.close();
-    return FileFormat::XGM2;
+      accessMode = ACCESS_STREAM;
+      bankSkip = bankSize;
+      hFile.seek(0);
+      hFile.read(data, base);
+      hFile.seek(base + bankSize);
+      hFile.read(data + base, vgm.size - base - bankSize);
+      hFile.close();
+
+      if (!xgmPages.begin(path, base, bankSize)) {
+        return FileFormat::Unknown;
+      }
+      ndLog.printf("Stream mode.\n");
+    } else {
+      accessMode = ACCESS_PSRAM;
+      hFile.seek(0);
+      hFile.read(data, vgm.size);
+      hFile.close();
+    }
+    ndLog.printf("XGM%d file name: %s\n", isXGM1 ? 1 : 2, path.c_str());
+    return isXGM1 ? FileFormat::XGM1 : FileFormat::XGM2;
   }
 
   if (isVgm) {  // VGM のとき
@@ -333,17 +377,17 @@ FileFormat NDFile::readFile(String path) {
     if (hFile.size() > MAX_FILE_SIZE) {
       //  シーケンシャルモード
       accessMode = ACCESS_CACHE;
-      Serial.printf("Sequential mode.\n");
+      ndLog.printf("Sequential mode.\n");
     } else {
       // PSRAM モード
       accessMode = ACCESS_PSRAM;
-      Serial.printf("PSRAM mode.\n");
+      ndLog.printf("PSRAM mode.\n");
     }
 
     if (accessMode == ACCESS_PSRAM) {
       hFile.seek(0);
       hFile.read(data, vgm.size);
-      Serial.printf("File name: %s\n", path.c_str());
+      ndLog.printf("File name: %s\n", path.c_str());
     }
     hFile.close();
 
@@ -354,7 +398,7 @@ FileFormat NDFile::readFile(String path) {
   }
 
   if (isGz) {  // VGZ のとき
-    Serial.printf("isGz\n");
+    ndLog.printf("isGz\n");
 
     // gzip footer(ISIZE) から解凍後サイズを先読みして上限チェック
     const u32_t gzFileSize = hFile.size();
@@ -380,183 +424,212 @@ FileFormat NDFile::readFile(String path) {
 
     // gzip 解凍して PSRAM に展開する
     hFile.seek(0);
+    FileFormat format = inflateVGZ([&](u8_t* buf, size_t len) -> int { return hFile.read(buf, len); }, path);
+    hFile.close();
+    if (format == FileFormat::VGZ) {
+      ndLog.printf("File name: %s\n", path.c_str());
+    }
+    return format;
+  }
 
-    auto readByte = [&](void) -> int {
-      int c = hFile.read();
-      if (c < 0) return -1;
-      return c & 0xFF;
-    };
+  return FileFormat::Unknown;
+}
 
-    auto skipBytes = [&](size_t count) -> bool {
-      while (count--) {
-        if (readByte() < 0) return false;
-      }
-      return true;
-    };
-
-    // Parse gzip header.
-    int id1 = readByte();
-    int id2 = readByte();
-    int cm = readByte();
-    int flg = readByte();
-    if (id1 != 0x1F || id2 != 0x8B || cm != 8 || flg < 0) {
-      showError("ERROR: Invalid gzip header\n" + path);
-      hFile.close();
+//----------------------------------------------------------------------
+// gzip を data に解凍する (read: 圧縮データを読む関数, name: エラー表示用)
+// 戻り値: FileFormat::VGZ / 失敗は FileFormat::Unknown
+FileFormat NDFile::inflateVGZ(std::function<int(u8_t*, size_t)> read, String name) {
+  auto readByte = [&](void) -> int {
+    u8_t c;
+    if (read(&c, 1) != 1) return -1;
+    return c;
+  };
+
+  auto skipBytes = [&](size_t count) -> bool {
+    while (count--) {
+      if (readByte() < 0) return false;
+    }
+    return true;
+  };
+
+  // Parse gzip header.
+  int id1 = readByte();
+  int id2 = readByte();
+  int cm = readByte();
+  int flg = readByte();
+  if (id1 != 0x1F || id2 != 0x8B || cm != 8 || flg < 0) {
+    showError("ERROR: Invalid gzip header\n" + name);
+    return FileFormat::Unknown;
+  }
+  // MTIME(4), XFL(1), OS(1)
+  if (!skipBytes(6)) {
+    showError("ERROR: Invalid gzip header\n" + name);
+    return FileFormat::Unknown;
+  }
+
+  if (flg & 0x04) {  // FEXTRA
+    int xlen0 = readByte();
+    int xlen1 = readByte();
+    if (xlen0 < 0 || xlen1 < 0) {
+      showError("ERROR: Invalid gzip header\n" + name);
       return FileFormat::Unknown;
     }
-    // MTIME(4), XFL(1), OS(1)
-    if (!skipBytes(6)) {
-      showError("ERROR: Invalid gzip header\n" + path);
-      hFile.close();
+    uint16_t xlen = (uint16_t)xlen0 | ((uint16_t)xlen1 << 8);
+    if (!skipBytes(xlen)) {
+      showError("ERROR: Invalid gzip header\n" + name);
       return FileFormat::Unknown;
     }
-
-    if (flg & 0x04) {  // FEXTRA
-      int xlen0 = readByte();
-      int xlen1 = readByte();
-      if (xlen0 < 0 || xlen1 < 0) {
-        showError("ERROR: Invalid gzip header\n" + path);
-        hFile.close();
-        return FileFormat::Unknown;
-      }
-      uint16_t xlen = (uint16_t)xlen0 | ((uint16_t)xlen1 << 8);
-      if (!skipBytes(xlen)) {
-        showError("ERROR: Invalid gzip header\n" + path);
-        hFile.close();
+  }
+  if (flg & 0x08) {  // FNAME
+    while (true) {
+      int c = readByte();
+      if (c < 0) {
+        showError("ERROR: Invalid gzip header\n" + name);
         return FileFormat::Unknown;
       }
+      if (c == 0) break;
     }
-    if (flg & 0x08) {  // FNAME
-      while (true) {
-        int c = readByte();
-        if (c < 0) {
-          showError("ERROR: Invalid gzip header\n" + path);
-          hFile.close();
-          return FileFormat::Unknown;
-        }
-        if (c == 0) break;
-      }
-    }
-    if (flg & 0x10) {  // FCOMMENT
-      while (true) {
-        int c = readByte();
-        if (c < 0) {
-          showError("ERROR: Invalid gzip header\n" + path);
-          hFile.close();
-          return FileFormat::Unknown;
-        }
-        if (c == 0) break;
-      }
-    }
-    if (flg & 0x02) {  // FHCRC
-      if (!skipBytes(2)) {
-        showError("ERROR: Invalid gzip header\n" + path);
-        hFile.close();
+  }
+  if (flg & 0x10) {  // FCOMMENT
+    while (true) {
+      int c = readByte();
+      if (c < 0) {
+        showError("ERROR: Invalid gzip header\n" + name);
         return FileFormat::Unknown;
       }
+      if (c == 0) break;
     }
-
-    static uint8_t zlib_buf[sizeof(inflate_state) + 32768];
-    z_stream stream;
-    memset(&stream, 0, sizeof(stream));
-    memset(zlib_buf, 0, sizeof(zlib_buf));
-    stream.zalloc = (alloc_func)0;
-    stream.zfree = (free_func)0;
-    stream.opaque = (voidpf)0;
-
-    inflate_state* state = (inflate_state*)zlib_buf;
-    stream.state = (struct internal_state*)state;
-    state->window = &zlib_buf[sizeof(inflate_state)];
-    if (inflateInit2(&stream, -15) != Z_OK) {
-      showError("ERROR: gzip init failed.\n" + path);
-      hFile.close();
+  }
+  if (flg & 0x02) {  // FHCRC
+    if (!skipBytes(2)) {
+      showError("ERROR: Invalid gzip header\n" + name);
       return FileFormat::Unknown;
     }
+  }
 
-    uint8_t inbuf[1024];
-    size_t out_pos = 0;
-    int status = Z_OK;
+  static uint8_t zlib_buf[sizeof(inflate_state) + 32768];
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  memset(zlib_buf, 0, sizeof(zlib_buf));
+  stream.zalloc = (alloc_func)0;
+  stream.zfree = (free_func)0;
+  stream.opaque = (voidpf)0;
+
+  inflate_state* state = (inflate_state*)zlib_buf;
+  stream.state = (struct internal_state*)state;
+  state->window = &zlib_buf[sizeof(inflate_state)];
+  if (inflateInit2(&stream, -15) != Z_OK) {
+    showError("ERROR: gzip init failed.\n" + name);
+    return FileFormat::Unknown;
+  }
 
-    while (true) {
-      if (stream.avail_in == 0) {
-        int r = hFile.read(inbuf, sizeof(inbuf));
-        if (r <= 0) {
-          status = Z_DATA_ERROR;
-          break;
-        }
-        stream.next_in = inbuf;
-        stream.avail_in = (unsigned int)r;
-      }
+  uint8_t inbuf[1024];
+  size_t out_pos = 0;
+  int status = Z_OK;
 
-      if (out_pos >= MAX_FILE_SIZE) {
-        status = Z_BUF_ERROR;
-        break;
-      }
-      stream.next_out = data + out_pos;
-      stream.avail_out = (unsigned int)(MAX_FILE_SIZE - out_pos);
-
-      int ret = inflate(&stream, Z_NO_FLUSH, 0);
-      size_t produced = (MAX_FILE_SIZE - out_pos) - stream.avail_out;
-      out_pos += produced;
-      if (out_pos > MAX_FILE_SIZE) {
-        status = Z_BUF_ERROR;
-        break;
-      }
-
-      if (ret == Z_STREAM_END) {
-        status = Z_STREAM_END;
-        break;
-      }
-      if (ret == Z_BUF_ERROR && stream.avail_out == 0) {
-        status = Z_BUF_ERROR;
-        break;
-      }
-      if (ret == Z_BUF_ERROR && stream.avail_in == 0) {
-        continue;
-      }
-      if (ret != Z_OK && ret != Z_BUF_ERROR) {
-        status = ret;
+  while (true) {
+    if (stream.avail_in == 0) {
+      int r = read(inbuf, sizeof(inbuf));
+      if (r <= 0) {
+        status = Z_DATA_ERROR;
         break;
       }
+      stream.next_in = inbuf;
+      stream.avail_in = (unsigned int)r;
     }
 
-    inflateEnd(&stream);
-
-    if (status != Z_STREAM_END) {
-      if (status == Z_BUF_ERROR) {
-        showError("ERROR: The file is too large.\nMax file size is " + String(MAX_FILE_SIZE) + ".\n" + path);
-      } else {
-        showError("ERROR: gzip decode failed.\n" + path);
-      }
-      hFile.close();
-      return FileFormat::Unknown;
+    if (out_pos >= MAX_FILE_SIZE) {
+      status = Z_BUF_ERROR;
+      break;
+    }
+    stream.next_out = data + out_pos;
+    stream.avail_out = (unsigned int)(MAX_FILE_SIZE - out_pos);
+
+    int ret = inflate(&stream, Z_NO_FLUSH, 0);
+    size_t produced = (MAX_FILE_SIZE - out_pos) - stream.avail_out;
+    out_pos += produced;
+    if (out_pos > MAX_FILE_SIZE) {
+      status = Z_BUF_ERROR;
+      break;
     }
 
-    if (get_ui32_at(0) != 0x206d6756) {
-      showError("ERROR: File format is not VGM.\n" + path);
-      hFile.close();
-      return FileFormat::Unknown;
+    if (ret == Z_STREAM_END) {
+      status = Z_STREAM_END;
+      break;
     }
+    if (ret == Z_BUF_ERROR && stream.avail_out == 0) {
+      status = Z_BUF_ERROR;
+      break;
+    }
+    if (ret == Z_BUF_ERROR && stream.avail_in == 0) {
+      continue;
+    }
+    if (ret != Z_OK && ret != Z_BUF_ERROR) {
+      status = ret;
+      break;
+    }
+  }
 
-    Serial.printf("File name: %s\n", path.c_str());
-    vgm.size = (u32_t)out_pos;
-    hFile.close();
+  inflateEnd(&stream);
 
-    return FileFormat::VGZ;
+  if (status != Z_STREAM_END) {
+    if (status == Z_BUF_ERROR) {
+      showError("ERROR: The file is too large.\nMax file size is " + String(MAX_FILE_SIZE) + ".\n" + name);
+    } else {
+      showError("ERROR: gzip decode failed.\n" + name);
+    }
+    return FileFormat::Unknown;
   }
 
-  return FileFormat::Unknown;
+  if (get_ui32_at(0) != 0x206d6756) {
+    showError("ERROR: File format is not VGM.\n" + name);
+    return FileFormat::Unknown;
+  }
+
+  vgm.size = (u32_t)out_pos;
+  return FileFormat::VGZ;
 }
 
 //----------------------------------------------------------------------
 // ディレクトリ内の count 個あとの曲再生。マイナスは前の曲
 // 戻り値: 成功/不成功
 bool NDFile::filePlay(int count) {
+  // XGM2 マルチトラックはファイル内のトラックを先に移る (ファイルは読み直さない)
+  if (ND::fileFormat == FileFormat::XGM2 && vgm.xgmNumTracks > 1) {
+    int track = vgm.xgmTrack + count;
+    if (track >= 0 && track < vgm.xgmNumTracks) {
+      return trackPlay(track);
+    }
+  }
+
   currentFile = mod(currentFile + count, files[currentDir].size());
   ndConfig.saveHistory();
   return fileOpen(currentDir, currentFile);
 }
 
+//----------------------------------------------------------------------
+// 読み込み済みの XGM2 マルチトラックのトラックを切り替える
+// 戻り値: 成功/不成功
+bool NDFile::trackPlay(u8_t track) {
+  if (xSemaphoreTake(spFileOpen, 0) != pdTRUE) {
+    ndLog.printf("Semapho is already taken.\n");
+    return false;
+  }
+
+  nju72341.mute();
+  nju72341.resetFadeout();
+  chipBus->reset();
+
+  ndLog.printf("XGM2 track %d / %d\n", track + 1, vgm.xgmNumTracks);
+  ND::canPlay = vgm.XGMSelectTrack(track);
+
+  nju72341.reset(-1);
+  xSemaphoreGive(spFileOpen);
+  nju72341.unmute();
+
+  return ND::canPlay;
+}
+
 //----------------------------------------------------------------------
 // count 個あとのディレクトリを開いて最初のファイルを再生。
 // マイナスは前のディレクトリ
@@ -583,19 +656,38 @@ bool NDFile::play(uint16_t d, uint16_t f, int8_t att) {
 
 bool NDFile::fileOpen(uint16_t d, uint16_t f, int8_t att) {
   if (xSemaphoreTake(spFileOpen, 0) != pdTRUE) {
-    Serial.printf("Semapho is already taken.\n");
+    ndLog.printf("Semapho is already taken.\n");
     return false;
   }
 
   nju72341.mute();
   nju72341.resetFadeout();
   ndConfig.saveHistory();
-  FM.reset();
+  chipBus->reset();
 
   String st = dirs[d] + "/" + files[d][f];
 
   ND::fileFormat = readFile(st);
 
+#ifdef USE_CHIPBUS_TRACE
+  // 曲ごとにトレースファイルを作成
+  if (!SD.exists("/trace")) {
+    SD.mkdir("/trace");
+  }
+  String traceName = files[d][f];
+  traceName = traceName.substring(0, traceName.lastIndexOf('.'));
+  chipTrace.begin(("/trace/" + traceName + ".bin").c_str());
+#endif
+#ifdef USE_CHIPBUS_SYNTH
+  // 曲ごとに WAV を作成
+  if (!SD.exists("/render")) {
+    SD.mkdir("/render");
+  }
+  String renderName = files[d][f];
+  renderName = renderName.substring(0, renderName.lastIndexOf('.'));
+  chipSynth.begin(("/render/" + renderName + ".wav").c_str());
+#endif
+
   switch (ND::fileFormat) {
     case FileFormat::VGM: {
       ND::canPlay = vgm.ready();
@@ -615,6 +707,10 @@ bool NDFile::fileOpen(uint16_t d, uint16_t f, int8_t att) {
     }
   }
 
+#ifdef USE_CHIPBUS_SYNTH
+  chipSynth.setYMClock(vgm.freq[CHIP0_CLOCK]);
+#endif
+
   nju72341.reset(att);
   xSemaphoreGive(spFileOpen);
   nju72341.unmute();
@@ -622,6 +718,83 @@ bool NDFile::fileOpen(uint16_t d, uint16_t f, int8_t att) {
   return ND::canPlay;
 }
 
+//----------------------------------------------------------------------
+// シリアルモードでアップロードされた data[0, size) を再生する
+// SD は使わない。表示などのためにディレクトリ一覧は "/USB" の 1 曲だけにする
+// 戻り値: 成功/不成功
+bool NDFile::playUploaded(u32_t size) {
+  nju72341.mute();
+  nju72341.resetFadeout();
+  chipBus->reset();
+
+  xgmPages.end();
+  bankSkip = 0;
+  accessMode = ACCESS_PSRAM;
+  vgm.size = size;
+
+  String name = "upload.vgm";
+  ND::fileFormat = FileFormat::Unknown;
+  u32_t ident = get_ui32_at(0);
+  if (data[0] == 0x1f && data[1] == 0x8b) {
+    // gzip: 圧縮データを退避して data に解凍
+    name = "upload.vgz";
+    u8_t* gz = (u8_t*)ps_malloc(size);
+    if (gz) {
+      memcpy(gz, data, size);
+      u32_t pos = 0;
+      ND::fileFormat = inflateVGZ(
+          [&](u8_t* buf, size_t len) -> int {
+            u32_t n = min((u32_t)len, size - pos);
+            memcpy(buf, gz + pos, n);
+            pos += n;
+            return n;
+          },
+          "/USB/" + name);
+      free(gz);
+    } else {
+      showError("ERROR: Not enough memory to inflate the upload.");
+    }
+  } else if (ident == 0x206d6756) {
+    ND::fileFormat = FileFormat::VGM;
+  } else if (ident == 0x204d4758) {
+    name = "upload.xgm";
+    ND::fileFormat = FileFormat::XGM1;
+  } else if (ident == 0x324d4758) {
+    name = "upload.xgm";
+    ND::fileFormat = FileFormat::XGM2;
+  }
+
+  dirs = {"/USB"};
+  pngs = {""};
+  files = {{name}};
+  currentDir = 0;
+  currentFile = 0;
+  ndLog.printf("Upload: %s, %u bytes\n", name.c_str(), size);
+
+  switch (ND::fileFormat) {
+    case FileFormat::VGM:
+    case FileFormat::VGZ: {
+      ND::canPlay = vgm.ready();
+      break;
+    }
+    case FileFormat::XGM1:
+    case FileFormat::XGM2: {
+      ND::canPlay = vgm.XGMReady();
+      break;
+    }
+    default: {
+      showError("ERROR: Unknown upload format.");
+      ND::canPlay = false;
+      break;
+    }
+  }
+
+  nju72341.reset(-1);
+  nju72341.unmute();
+
+  return ND::canPlay;
+}
+
 //----------------------------------------------------------------------
 // フォルダの減衰量取得
 // 戻り値: 0 - 96 dB
@@ -666,12 +839,12 @@ bool NDFile::getHeaderCache(String filePath) {
     // キャッシュモードのとき
     File file = SD.open(filePath);
     if (!file) {
-      Serial.println("getHeaderCache: failed to open file");
+      ndLog.println("getHeaderCache: failed to open file");
       return false;
     }
 
     if (file.size() < 256) {
-      Serial.println("getHeaderCache: file too small");
+      ndLog.println("getHeaderCache: file too small");
       file.close();
       return false;
     }
@@ -722,7 +895,7 @@ u16_t NDFile::getGD3Cache(String filePath, u32_t gd3Offset) {
 u8_t NDFile::get_ui8() {
   u8_t result;
 
-  if (accessMode == ACCESS_PSRAM) {
+  if (accessMode != ACCESS_CACHE) {
     result = data[pos++];
   } else {
     result = cache[activeCache][cachePos++];
@@ -764,7 +937,7 @@ u32_t NDFile::get_ui32_at(uint32_t p) {
 // キャッシュ版
 u8_t NDFile::get_ui8_at_header(uint32_t p) {
   if (p >= sizeof(header)) {
-    Serial.printf("[WARN] get_ui8_at_header: out of range! p=%u (size=%u)\n", p, sizeof(header));
+    ndLog.printf("[WARN] get_ui8_at_header: out of range! p=%u (size=%u)\n", p, sizeof(header));
     return 0;
   }
   return header[p];
@@ -772,7 +945,7 @@ u8_t NDFile::get_ui8_at_header(uint32_t p) {
 
 u16_t NDFile::get_ui16_at_header(uint32_t p) {
   if (p + 1 >= sizeof(header)) {
-    Serial.printf("[WARN] get_ui16_at_header: out of range! p=%u (size=%u)\n", p, sizeof(header));
+    ndLog.printf("[WARN] get_ui16_at_header: out of range! p=%u (size=%u)\n", p, sizeof(header));
     return 0;
   }
   return (u32_t(header[p])) + (u32_t(header[p + 1]) << 8);
@@ -780,7 +953,7 @@ u16_t NDFile::get_ui16_at_header(uint32_t p) {
 
 u32_t NDFile::get_ui24_at_header(uint32_t p) {
   if (p + 2 >= sizeof(header)) {
-    Serial.printf("[WARN] get_ui24_at_header: out of range! p=%u (size=%u)\n", p, sizeof(header));
+    ndLog.printf("[WARN] get_ui24_at_header: out of range! p=%u (size=%u)\n", p, sizeof(header));
     return 0;
   }
   return (u32_t(header[p])) + (u32_t(header[p + 1]) << 8) + (u32_t(header[p + 2]) << 16);
@@ -788,7 +961,7 @@ u32_t NDFile::get_ui24_at_header(uint32_t p) {
 
 u32_t NDFile::get_ui32_at_header(uint32_t p) {
   if (p + 3 >= sizeof(header)) {
-    Serial.printf("[WARN] get_ui32_at_header: out of range! p=%u (size=%u)\n", p, sizeof(header));
+    ndLog.printf("[WARN] get_ui32_at_header: out of range! p=%u (size=%u)\n", p, sizeof(header));
     return 0;
   }
   return (u32_t(header[p])) + (u32_t(header[p + 1]) << 8) + (u32_t(header[p + 2]) << 16) + (u32_t(header[p + 3]) << 24);
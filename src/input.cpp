@@ -117,6 +117,7 @@ void Input::inputHandler() {
           break;
         }
         case btnRIGHT: {
+          serialMan.toggleCapture();  // SD への記録開始・停止
           break;
         }
         case btnLEFT: {
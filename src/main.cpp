@@ -38,8 +38,11 @@
 #include "file.h"
 #include "fm.h"
 #include "input.h"
+#include "pcmmix.h"
 #include "serialman.h"
+#include "synthbus.h"
 #include "vgm.h"
+#include "ndlog.h"
 
 void setup() {
   // 最初にミュート
@@ -51,15 +54,15 @@ void setup() {
   digitalWrite(D0, HIGH);
 
   Serial.begin(1500000);
-  Serial.printf("Heap - %'d Bytes free\n", ESP.getFreeHeap());
-  Serial.printf("Flash - %'d Bytes at %'d\n", ESP.getFlashChipSize(), ESP.getFlashChipSpeed());
-  Serial.printf("PSRAM - Total %'d, Free %'d\n", ESP.getPsramSize(), ESP.getFreePsram());
+  ndLog.printf("Heap - %'d Bytes free\n", ESP.getFreeHeap());
+  ndLog.printf("Flash - %'d Bytes at %'d\n", ESP.getFlashChipSize(), ESP.getFlashChipSpeed());
+  ndLog.printf("PSRAM - Total %'d, Free %'d\n", ESP.getPsramSize(), ESP.getFreePsram());
 
   disableCore0WDT();  // ウォッチドッグ0無効化
 
   // ディスプレイ初期化
   if (!initDisp()) {
-    Serial.println("initDisp failed.");
+    ndLog.println("initDisp failed.");
   }
 
   lcd.setFont(&fonts::Font2);
@@ -94,6 +97,21 @@ void setup() {
   FM.begin();
   FM.reset();
 
+#if defined(PCM_MIX_BENCH)
+  pcmMixBenchmark();
+#endif
+
+  // 再生エンジンの書き込み先
+#if defined(USE_CHIPBUS_NULL)
+  chipBus = &chipNull;
+#elif defined(USE_CHIPBUS_SYNTH)
+  chipBus = &chipSynth;
+#endif
+#if defined(USE_CHIPBUS_TRACE)
+  chipTrace.setTarget(chipBus);
+  chipBus = &chipTrace;
+#endif
+
   // 動作切り替え
   // プレイヤーモード
   if (ndConfig.currentMode == MODE_PLAYER) {
@@ -140,9 +158,9 @@ void setup() {
 
   cfgWindow.init();
 
-  Serial.printf("Heap - %'d Bytes free\n", ESP.getFreeHeap());
-  Serial.printf("Flash - %'d Bytes at %'d\n", ESP.getFlashChipSize(), ESP.getFlashChipSpeed());
-  Serial.printf("PSRAM - Total %'d, Free %'d\n", ESP.getPsramSize(), ESP.getFreePsram());
+  ndLog.printf("Heap - %'d Bytes free\n", ESP.getFreeHeap());
+  ndLog.printf("Flash - %'d Bytes at %'d\n", ESP.getFlashChipSize(), ESP.getFlashChipSpeed());
+  ndLog.printf("PSRAM - Total %'d, Free %'d\n", ESP.getPsramSize(), ESP.getFreePsram());
 }
 
 void loop() {
@@ -161,8 +179,19 @@ void loop() {
 
   } else {
     while (1) {
+      // アップロードされた曲の再生
+      serialMan.update();
+      if (vgm.vgmLoaded) {
+        vgm.vgmProcess();
+      } else if (vgm.xgmLoaded) {
+        if (vgm.XGMVersion == 1)
+          vgm.xgmProcess();
+        else
+          vgm.xgm2Process();
+      } else {
+        delay(1);
+      }
       input.inputHandler();
-      delay(1);
     }
   }
 }
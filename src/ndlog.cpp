@@ -0,0 +1,12 @@
+#include "ndlog.h"
+
+#include "config.h"
+
+size_t NDLog::write(uint8_t c) { return write(&c, 1); }
+
+size_t NDLog::write(const uint8_t* buf, size_t size) {
+  if (ndConfig.currentMode == MODE_SERIAL) return size;
+  return Serial.write(buf, size);
+}
+
+NDLog ndLog;
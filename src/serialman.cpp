@@ -1,13 +1,28 @@
 #include "serialman.h"
 
 #include <Arduino.h>
+#include <esp_rom_crc.h>
+#include <esp_timer.h>
 
 #include "NJU72341.h"
 #include "SI5351.hpp"
 #include "disp.h"
+#include "file.h"
 #include "fm.h"
+#include "serialcodec.h"
+#include "serialrx.h"
+#include "vgmcapture.h"
+#include "ndlog.h"
 
 #define SERIAL_SIZE_RX 65535
+#define SERIAL_LATENCY_MS 50  // タイムドモードの初期遅延
+#define SERIAL_LATE_US 1000   // これ以上遅れたらアンダーラン
+#define SERIAL_UPLOAD_TIMEOUT 1000  // アップロードのデータ待ち (ms)
+#define SERIAL_ACK 0x06
+#define SERIAL_NAK 0x15
+#define SERIAL_STATUS_FIELDS 14  // 0xf8 の応答の u32 の数
+#define SERIAL_STREAMS 2          // 0xfc で選べるストリーム数
+#define SERIAL_QUANTUM 16         // 再生タスクが 1 ストリームを続けて実行するイベント数
 
 constexpr std::array<si5351Freq_t, 5> YM2612ClockOptions = {
     SI5351_7670,  // 7.670453 MHz
@@ -25,96 +40,530 @@ constexpr std::array<si5351Freq_t, 5> SN76489ClockOptions = {
     SI5351_1536,  // 1.536 MHz
 };
 
-u8_t getSerial() {
-  while (1) {
-    if (Serial.available()) {
-      return Serial.read();
+static TaskHandle_t serialTaskHandle = NULL;
+static SerialRing rxRing;
+static SerialDecoder decoder;
+
+// 受信イベント: 受信タスクを起こすだけ
+static void onSerialRx(void* arg, esp_event_base_t base, int32_t id, void* data) {
+  if (serialTaskHandle) xTaskNotifyGive(serialTaskHandle);
+}
+
+// 受信済みのデータをまとめてリングに移す
+// 戻り値: 移したバイト数
+static u32_t pullSerial() {
+  static bool wasFull = false;
+  u32_t total = 0;
+  while (true) {
+    int n = Serial.available();
+    if (n <= 0) break;
+    u32_t space;
+    u8_t* p = rxRing.writePtr(&space);
+    if (space == 0) {
+      // 一杯になった回数 (空くまでは数えない)
+      if (!wasFull) serialMan.rxFull++;
+      wasFull = true;
+      break;
     }
+    wasFull = false;
+    n = Serial.read(p, (u32_t)n < space ? n : space);
+    if (n <= 0) break;
+    rxRing.commit(n);
+    total += n;
   }
+  return total;
 }
 
-u32_t getSerial32() { return getSerial() + (getSerial() << 8) + (getSerial() << 16) + (getSerial() << 24); }
+// ------------------------------------------------------------------------------
+// ストリーム (0xfc)
+//    1 本のシリアルに独立したセッションを 2 つまで載せる (YM2612 の MIDI 演奏と PSG の演奏など)
+//    0xfc ss : 以後のコマンドをストリーム ss (0 - 1) のものとして扱う (初期値 0)
+//    ストリームごとにジッタバッファ・タイムドモード・latency・クロック設定・振り分け・圧縮の状態を持つ
+//    0xf0 / 0xf1 の SI5351 の出力は全ストリームで共有なので最後に設定したものが有効
+//    0xf3 / 0xf4 / 0xf8 / 0xf9 はストリームに関係なくリンク全体に対して働く
 
-// シリアル受信用タスク
-void serialCheckerTask(void* param) {
-  u8_t command, reg, dat, samples;
-  u32_t clock0 = SI5351_3579, clock1 = SI5351_2000;
-  int32_t wait = 0;
-  lcd.setCursor(5, 77);
-  // lcd.printf("%02x %02x %02x", 0x53, reg, dat);
+struct t_serialStream {
+  SerialJitterBuffer jitter;
+  bool timedMode = false;  // 受信タスク側の状態
+  u32_t sampleClock = 0;   // 次に積むコマンドのサンプル時刻
+  volatile u32_t latencyUs = SERIAL_LATENCY_MS * 1000;
+  volatile bool needSync = false;  // 再生タスクで時刻の基準を取り直す
+  s64_t origin = 0;                // 再生タスク側: サンプル時刻 0 の時刻 (µs)
+  u32_t clock0 = SI5351_3579;      // このストリームが設定したクロック (振り分けの周波数計算用)
+  u32_t clock1 = SI5351_2000;
+  VGMRouter router;
+  SerialCodec codec;
+};
+
+static t_serialStream streams[SERIAL_STREAMS];
+static u8_t rxStream = 0;  // 受信中のコマンドのストリーム
+
+// ストリームのチップ振り分け (0x50: chip 1 / clock 1, 0x30: chip 2 / clock 0)
+static void routeStream(t_serialStream& st) {
+  setupChipRoutes(st.router, (si5351Freq_t)st.clock1, (si5351Freq_t)st.clock0, false);
+}
+
+// 受信タスク (即時のコマンド) と再生タスク (タイムドモード) の両方がチップに書くので、
+// 1 コマンドごとにバスを取る (FMChip の BusLock は DAC タイマーとの排他だけ)
+static SemaphoreHandle_t busMutex = NULL;
+
+// 1 コマンド実行 (busMutex を持って呼ぶ)
+static void runCommand(t_serialStream& st, const t_serialCmd& c) {
+  // チップへの書き込み (振り分けはファイル再生と同じ setupChipRoutes)
+  if (st.router.write(chipBus, c.command, c.a, c.b)) {
+    vgmCapture.write(c.command, c.a, c.b, serialCommandLength(c.command));
+    serialMan.executed++;
+    return;
+  }
+
+  switch (c.command) {
+    case 0x80 ... 0x8f:
+      chipBus->setYM2612DAC(c.a, 0);
+      vgmCapture.write(0x52, 0x2a, c.a, 3);
+      break;
+
+      // Additional Commands
+
+    case 0xf0: {
+      // クロック0の周波数設定
+      st.clock0 = c.value;
+      SI5351.setFreq((si5351Freq_t)st.clock0, 0);
+      ND::freq[0] = (si5351Freq_t)st.clock0;
+      routeStream(st);
+      serialModeDraw();
+      break;
+    }
+
+    case 0xf1: {
+      // クロック1の周波数設定
+      st.clock1 = c.value;
+      SI5351.setFreq((si5351Freq_t)st.clock1, 1);
+      ND::freq[1] = (si5351Freq_t)st.clock1;
+      routeStream(st);
+      serialModeDraw();
+      break;
+    }
+
+    case 0x00: {
+      // リセット
+      chipBus->reset();
+      break;
+    }
+
+    default:
+      // 数えるだけ (画面には表示タイマーが出す)
+      serialMan.unknownCommands++;
+      serialMan.lastUnknown = c.command;
+      return;
+  }
+  serialMan.executed++;
+}
+
+// アップロード曲の再生中は loop がバスを使うので、即時・タイムドのコマンドは捨てる
+// (再生の開始と停止は update が busMutex を持って行う)
+static void execCommand(t_serialStream& st, const t_serialCmd& c) {
+  xSemaphoreTake(busMutex, portMAX_DELAY);
+  if (!vgm.vgmLoaded && !vgm.xgmLoaded) runCommand(st, c);
+  xSemaphoreGive(busMutex);
+}
+
+// ------------------------------------------------------------------------------
+// タイムスタンプ付き再生 (タイムドモード)
+//    待ちコマンド (0x61 - 0x63, 0x70 - 0x7f) か 0xf2 を受けるとタイムドモードになり、
+//    以後のコマンドは受信時刻ではなく待ちの合計 (サンプル時刻) に latency を足した時刻に再生タスクが実行する
+//    タイムドモードでは 0x80 - 0x8f の下位 4 ビットも待ちとして扱う
+//    待ちを送らない従来のホスト (MAmidiMEmo など) は今まで通り受け取った順にすぐ書き込む
+//    0xf2 nnnn: latency を nnnn ms にしてタイムドモードに入る (0 = タイムドモードを抜ける)
+
+static bool jitterReady = false;
+static TaskHandle_t playTaskHandle = NULL;
+
+// 再生タスク: 時刻の来たコマンドを実行する
+//    ストリームを順番に回り、1 回に SERIAL_QUANTUM 個までしか続けて実行しない
+//    (片方が詰め込んでももう片方の書き込みが遅れすぎないようにする)
+static void serialPlayTask(void* param) {
+  u8_t turn = 0;
 
   while (1) {
-    command = getSerial();
-    switch (command) {
-      case 0x30: {  // SN76489 chip 2
-        dat = getSerial();
-        FM.write(dat, 2, (si5351Freq_t)clock0);
-        break;
+    bool pending = false;   // どこかに積んである
+    bool ran = false;       // 今回どこかで実行した
+    s64_t next = INT64_MAX;  // 実行しなかったストリームの一番早い時刻
+    s64_t now = esp_timer_get_time();
+
+    for (int i = 0; i < SERIAL_STREAMS; i++) {
+      t_serialStream& st = streams[(turn + i) % SERIAL_STREAMS];
+      for (int n = 0; n < SERIAL_QUANTUM; n++) {
+        const t_serialEvent* ev = st.jitter.front();
+        if (!ev) break;
+        pending = true;
+        if (st.needSync) {
+          st.needSync = false;
+          st.origin = now + st.latencyUs - (s64_t)ev->sample * 1000000 / 44100;
+        }
+
+        s64_t due = st.origin + (s64_t)ev->sample * 1000000 / 44100;
+        if (due > now) {
+          if (due < next) next = due;
+          break;
+        }
+
+        // 遅れすぎ (バッファが空になった): 遅れた分と latency だけ後ろにずらして余裕を取り戻す
+        if (now - due > SERIAL_LATE_US) {
+          serialMan.underruns++;
+          st.origin += (now - due) + st.latencyUs;
+        }
+
+        execCommand(st, ev->cmd);
+        st.jitter.pop();
+        ran = true;
+        now = esp_timer_get_time();
       }
-      case 0x50: {  // SN76489 chip 1
-        dat = getSerial();
-        FM.write(dat, 1, (si5351Freq_t)clock1);
-        break;
+    }
+    turn = (turn + 1) % SERIAL_STREAMS;
+
+    if (ran) continue;
+    if (!pending) {
+      ulTaskNotifyTake(pdTRUE, 1);
+    } else if (next > now + 2000) {
+      vTaskDelay(1);
+    } else {
+      // 2ms 以内なら時刻まで回る。同じ優先度の受信タスクを止めないように譲りながら
+      while (esp_timer_get_time() < next) {
+        taskYIELD();
       }
-      case 0x52: {
-        reg = getSerial();
-        dat = getSerial();
-        FM.setYM2612(0, reg, dat, 0);
+    }
+  }
+}
+
+// タイムドモードのコマンドを積む (一杯なら空くまで待つ)
+static void pushTimed(t_serialStream& st, const t_serialCmd& c) {
+  t_serialEvent ev = {st.sampleClock, c};
+  if (st.jitter.push(ev)) return;
+  serialMan.overruns++;
+  while (!st.jitter.push(ev)) {
+    vTaskDelay(1);
+  }
+}
+
+// ------------------------------------------------------------------------------
+// ファイルのアップロード (0xf3)
+//    VGM / VGZ / XGM をまるごと PSRAM (ndFile.data) に送り、SD から読んだときと同じエンジンで再生する
+//    F3 op arg32 len16 [データ]
+//      'B' arg = ファイルサイズ       : 受信開始 (再生中なら止める)
+//      'D' arg = 位置, len = バイト数 : len バイトのデータと CRC32 (zlib と同じ, 4 バイト LE) が続く
+//      'P'                             : 受信したファイルを再生
+//      'S'                             : 再生停止
+//    それぞれ ACK (0x06) / NAK (0x15) を返す。NAK のチャンクはホストが送り直す
+//    データ待ちがタイムアウトしたら、遅れて届くチャンクの残りをコマンドとして読まないように
+//    次の 0xf3 のヘッダまで読み捨てる (受信が止まったら通常に戻る)
+
+static u32_t uploadSize = 0;       // 受信中のファイルサイズ
+static u32_t uploadReceived = 0;   // 先頭から受信済みのバイト数
+static bool uploadResync = false;  // タイムアウト後の読み捨て中
+static u32_t resyncTime = 0;       // 最後に読み捨てた時刻 (ms)
+
+// リングから n バイト読む。足りなければ受信を待つ (dst = NULL は読み捨て)
+// 戻り値: 全部読めた
+static bool readPayload(u8_t* dst, u32_t n) {
+  u32_t start = millis();
+  while (n) {
+    u32_t got = rxRing.read(dst, n);
+    n -= got;
+    if (dst) dst += got;
+    if (n && pullSerial() == 0) {
+      if (millis() - start > SERIAL_UPLOAD_TIMEOUT) return false;
+      ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(10));
+    }
+  }
+  return true;
+}
+
+// 再生タスク (loop) に停止を頼んで止まるのを待つ
+static void stopUploaded() {
+  if (!vgm.vgmLoaded && !vgm.xgmLoaded) return;
+  serialMan.stopRequest = true;
+  while (serialMan.stopRequest) {
+    vTaskDelay(1);
+  }
+}
+
+static void uploadCommand(const t_serialCmd& c) {
+  bool ok = false;
+  switch (c.a) {
+    case 'B': {
+      stopUploaded();
+      ok = c.value > 0 && c.value <= MAX_FILE_SIZE && ndFile.allocData();
+      uploadSize = ok ? c.value : 0;
+      uploadReceived = 0;
+      break;
+    }
+    case 'D': {
+      u32_t offset = c.value;
+      // 再生中は data を書き換えない ('B' で止めてから送る)
+      bool inRange = uploadSize && offset <= uploadSize && c.length <= uploadSize - offset && !vgm.vgmLoaded &&
+                     !vgm.xgmLoaded;
+      u8_t crc[4];
+      if (!readPayload(inRange ? ndFile.data + offset : NULL, c.length) || !readPayload(crc, sizeof(crc))) {
+        uploadResync = true;
+        resyncTime = millis();
         break;
       }
-      case 0x53: {
-        reg = getSerial();
-        dat = getSerial();
-        FM.setYM2612(1, reg, dat, 0);
-        break;
+      if (!inRange) break;
+      u32_t expected = crc[0] | (crc[1] << 8) | (crc[2] << 16) | ((u32_t)crc[3] << 24);
+      ok = esp_rom_crc32_le(0, ndFile.data + offset, c.length) == expected;
+      if (ok && offset <= uploadReceived && offset + c.length > uploadReceived) {
+        uploadReceived = offset + c.length;
       }
-      case 0x55: {
-        reg = getSerial();
-        dat = getSerial();
-        FM.setRegister(reg, dat, 0);
-        break;
+      break;
+    }
+    case 'P': {
+      ok = uploadSize && uploadReceived == uploadSize;
+      if (ok) {
+        stopUploaded();
+        serialMan.uploadSize = uploadSize;
+        serialMan.playRequest = true;
       }
-      case 0x80 ... 0x8f:
-        dat = getSerial();
-        FM.setYM2612DAC(dat, 0);
-        // samples = command & 15;
-        // wait = samples * 22.675 - 16;
-        // if (wait > 0) {
-        //   ets_delay_us(wait);
-        // }
-        break;
+      break;
+    }
+    case 'S': {
+      stopUploaded();
+      ok = true;
+      break;
+    }
+  }
+  Serial.write(ok ? SERIAL_ACK : SERIAL_NAK);
+}
 
-        // Additional Commands
+// リング先頭の 8 バイトがアップロードのヘッダとしてありえるか
+static bool isUploadHeader() {
+  u8_t op = rxRing.peek(1);
+  u32_t arg = rxRing.peek(2) | (rxRing.peek(3) << 8) | (rxRing.peek(4) << 16) | ((u32_t)rxRing.peek(5) << 24);
+  u32_t len = rxRing.peek(6) | (rxRing.peek(7) << 8);
+  switch (op) {
+    case 'B':
+    case 'P':
+    case 'S':
+      return len == 0;
+    case 'D':
+      return uploadSize && arg <= uploadSize && len <= uploadSize - arg;
+    default:
+      return false;
+  }
+}
 
-      case 0xf0: {
-        // クロック0の周波数設定
-        clock0 = getSerial32();
-        SI5351.setFreq((si5351Freq_t)clock0, 0);
-        ND::freq[0] = (si5351Freq_t)clock0;
-        serialModeDraw();
-        break;
-      }
+// タイムアウト後の読み捨て
+// 戻り値: true = ヘッダが見つかった / 受信が止まった (通常のデコードに戻る)
+static bool resyncUpload() {
+  while (rxRing.available()) {
+    if (rxRing.peek(0) == 0xf3) {
+      if (rxRing.available() < SERIAL_CMD_MAX_LEN) break;  // ヘッダの残りを待つ
+      if (isUploadHeader()) return true;
+    }
+    rxRing.consume(1);
+    serialMan.resyncBytes++;
+    resyncTime = millis();
+  }
+  return millis() - resyncTime > SERIAL_UPLOAD_TIMEOUT;
+}
 
-      case 0xf1: {
-        // クロック1の周波数設定
-        clock1 = getSerial32();
-        SI5351.setFreq((si5351Freq_t)clock1, 1);
-        ND::freq[1] = (si5351Freq_t)clock1;
-        serialModeDraw();
-        break;
-      }
+// ------------------------------------------------------------------------------
+// フロー制御と状態の応答
+//    0xf8    : 状態要求。F8 len [u32 LE x len/4] を返す
+//              受信リングの空き, 選択中のストリームのジッタバッファの空き (イベント数), 受信バイト数, 消費バイト数,
+//              デコードしたコマンド数, 実行したコマンド数, 受信リングが一杯になった回数,
+//              不明なコマンド数, アンダーラン, オーバーラン,
+//              SD への記録: バイト数, 捨てたバイト数, 最長の書き込み時間 (µs),
+//              アップロードのタイムアウト後に読み捨てたバイト数
+//    0xf9 nn : クレジット通知。nn * 256 バイト消費するごと (とリングが空になったとき) に
+//              F9 [消費バイト数 u32 LE] を返す (0 = 止める)
+//              ホストは 送信バイト数 - 消費バイト数 <= SERIAL_RING_SIZE を守れば受信リングが溢れない
+//              (有効にした直後にも 1 回返すので、ホストはそれを送信済みバイト数の基準にする)
 
-      case 0x00: {
-        // リセット
-        FM.reset();
-        break;
+static u32_t creditStep = 0;  // 0 = クレジット通知なし
+static u32_t creditSent = 0;  // 最後に通知した消費バイト数
+
+static void putU32(u8_t* p, u32_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+static void sendStatus() {
+  const u32_t fields[SERIAL_STATUS_FIELDS] = {
+      rxRing.freeSpace(),
+      jitterReady ? SERIAL_JITTER_SIZE - streams[rxStream].jitter.size() : 0,
+      rxRing.received(),
+      rxRing.consumed(),
+      decoder.commands,
+      serialMan.executed,
+      serialMan.rxFull,
+      serialMan.unknownCommands,
+      serialMan.underruns,
+      serialMan.overruns,
+      vgmCapture.bytes,
+      vgmCapture.dropped,
+      vgmCapture.maxStallUs,
+      serialMan.resyncBytes,
+  };
+  u8_t buf[2 + SERIAL_STATUS_FIELDS * 4];
+  buf[0] = 0xf8;
+  buf[1] = SERIAL_STATUS_FIELDS * 4;
+  for (int i = 0; i < SERIAL_STATUS_FIELDS; i++) {
+    putU32(&buf[2 + i * 4], fields[i]);
+  }
+  Serial.write(buf, sizeof(buf));
+}
+
+static void sendCredit() {
+  u8_t buf[5];
+  creditSent = rxRing.consumed();
+  buf[0] = 0xf9;
+  putU32(&buf[1], creditSent);
+  Serial.write(buf, sizeof(buf));
+}
+
+// 消費が進んでいればクレジットを返す (受信タスクのループごと)
+static void updateCredit() {
+  if (!creditStep) return;
+  u32_t progress = rxRing.consumed() - creditSent;
+  if (progress >= creditStep || (progress && rxRing.available() == 0)) {
+    sendCredit();
+  }
+}
+
+// ------------------------------------------------------------------------------
+// 圧縮コマンド (0xf5 - 0xf7, lib/serialcodec)
+//    通常のコマンドに展開してから同じ経路 (タイムドモードを含む) に流す
+
+static t_serialCmd expanded[SERIAL_CODEC_MAX_EXPAND];
+
+// 受信したコマンドの振り分け
+static void dispatchCommand(const t_serialCmd& c) {
+  if (c.command == 0xf3) {
+    uploadCommand(c);
+    return;
+  }
+
+  if (c.command == 0xf8) {
+    sendStatus();
+    return;
+  }
+
+  if (c.command == 0xf4) {
+    // SD への記録 'R' 開始 / 'S' 停止
+    bool ok = false;
+    if (c.a == 'R') {
+      ok = serialMan.startCapture();
+    } else if (c.a == 'S') {
+      serialMan.stopCapture();
+      ok = true;
+    }
+    Serial.write(ok ? SERIAL_ACK : SERIAL_NAK);
+    return;
+  }
+
+  if (c.command == 0xf9) {
+    // 間隔がリングより大きいとホストが待ったままになるので半分までにする
+    creditStep = min((u32_t)c.a * 256, (u32_t)SERIAL_RING_SIZE / 2);
+    if (creditStep) sendCredit();
+    return;
+  }
+
+  if (c.command == 0xfc) {
+    if (c.a < SERIAL_STREAMS) {
+      rxStream = c.a;
+    } else {
+      serialMan.unknownCommands++;
+      serialMan.lastUnknown = c.command;
+    }
+    return;
+  }
+
+  t_serialStream& st = streams[rxStream];
+
+  if (c.command >= 0xf5 && c.command <= 0xf7) {
+    u32_t n = st.codec.expand(c, decoder.packed, expanded);
+    for (u32_t i = 0; i < n; i++) {
+      dispatchCommand(expanded[i]);
+    }
+    return;
+  }
+  st.codec.observe(c);
+
+  if (c.command == 0xf2) {
+    // latency 設定
+    u32_t ms = c.a | (c.b << 8);
+    if (ms == 0) {
+      // タイムドモードを抜ける: 積んである分を出し切ってから
+      while (!st.jitter.empty()) {
+        vTaskDelay(1);
       }
+      st.timedMode = false;
+    } else {
+      st.latencyUs = ms * 1000;
+      if (!st.timedMode && jitterReady) {
+        st.timedMode = true;
+        st.sampleClock = 0;
+        st.needSync = true;
+      }
+    }
+    return;
+  }
 
-      default:
-        // lcd.setCursor(5, 77);
-        lcd.printf("%02x ", command);
-        // Serial.printf("%02x\n", command);
-        break;
+  u32_t wait = serialCommandWait(c);
+  bool isWrite = (c.command < 0x61 || c.command > 0x7f);  // 0x80 - 0x8f は書き込み + 待ち
+
+  if (wait && !isWrite && !st.timedMode && jitterReady) {
+    // 最初の待ちでタイムドモードに入る
+    st.timedMode = true;
+    st.sampleClock = 0;
+    st.needSync = true;
+  }
+
+  if (!st.timedMode) {
+    execCommand(st, c);
+    return;
+  }
+
+  if (isWrite) {
+    pushTimed(st, c);
+    xTaskNotifyGive(playTaskHandle);
+  }
+  st.sampleClock += wait;
+}
+
+// シリアル受信用タスク
+void serialCheckerTask(void* param) {
+  t_serialCmd c;
+  u32_t statTime = millis();
+  u32_t statCommands = 0;
+
+  while (1) {
+    // そろっているコマンドを全部処理してから受信しに行く
+    if (uploadResync) uploadResync = !resyncUpload();
+    while (!uploadResync && decoder.next(rxRing, c)) {
+      dispatchCommand(c);
+    }
+    updateCredit();
+
+    // 1 秒ごとの処理コマンド数 (画面には表示タイマーが出す)
+    u32_t now = millis();
+    if (now - statTime >= 1000) {
+      serialMan.commandsPerSec = (u64_t)(decoder.commands - statCommands) * 1000 / (now - statTime);
+      statCommands = decoder.commands;
+      statTime = now;
+    }
+    serialMan.ringFree = rxRing.freeSpace();
+    bool timed = false;
+    for (int i = 0; i < SERIAL_STREAMS; i++) {
+      timed |= streams[i].timedMode;
+    }
+    serialMan.timed = timed;
+
+    // 何も来ていなければ受信イベントまで休む (取りこぼし対策で 10ms ごとにも見る)
+    if (pullSerial() == 0) {
+      ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(10));
     }
   }
 }
@@ -136,13 +585,68 @@ void SerialMan::init() {
   // 音出す
   SI5351.setFreq(SI5351_7670, 0);
   SI5351.setFreq(SI5351_3579, 1);
-  FM.reset();
+  chipBus->reset();
   nju72341.setVolumeAll(0);
+  for (int i = 0; i < SERIAL_STREAMS; i++) {
+    routeStream(streams[i]);
+  }
+}
+
+// SD への VGM 記録 (ボタンか 0xf4 から)
+bool SerialMan::startCapture() {
+  // 記録するのは実際に出ているクロック (ストリームで共有)
+  return vgmCapture.begin(ND::freq[0], ND::freq[1]);
+}
+
+void SerialMan::stopCapture() { vgmCapture.end(); }
+
+void SerialMan::toggleCapture() {
+  if (vgmCapture.isRecording()) {
+    stopCapture();
+  } else {
+    startCapture();
+  }
 }
 
 // シリアル受信用タスク開始
 void SerialMan::startSerialTask() {
-  xTaskCreateUniversal(serialCheckerTask, "serialTask", 10000, NULL, 1, NULL, APP_CPU_NUM);
+  busMutex = xSemaphoreCreateMutex();
+  if (!busMutex) {
+    ndLog.println("ERROR: Serial bus mutex create failed!");
+    return;
+  }
+  jitterReady = true;
+  for (int i = 0; i < SERIAL_STREAMS; i++) {
+    jitterReady &= streams[i].jitter.begin();
+  }
+  if (!jitterReady) {
+    ndLog.println("ERROR: Serial jitter buffer allocation failed.");
+  }
+  xTaskCreateUniversal(serialPlayTask, "serialPlayTask", 4096, NULL, 1, &playTaskHandle, APP_CPU_NUM);
+  xTaskCreateUniversal(serialCheckerTask, "serialTask", 10000, NULL, 1, &serialTaskHandle, APP_CPU_NUM);
+#if ARDUINO_USB_MODE
+  Serial.onEvent(ARDUINO_HW_CDC_RX_EVENT, onSerialRx);
+#else
+  Serial.onEvent(ARDUINO_USB_CDC_RX_EVENT, onSerialRx);
+#endif
+}
+
+// アップロード曲の再生開始・停止 (再生と同じ loop から呼ぶ)
+void SerialMan::update() {
+  if (stopRequest) {
+    if (busMutex) xSemaphoreTake(busMutex, portMAX_DELAY);
+    vgm.stop();
+    chipBus->reset();
+    if (busMutex) xSemaphoreGive(busMutex);
+    serialModeDraw();
+    stopRequest = false;
+  }
+  if (playRequest) {
+    playRequest = false;
+    if (busMutex) xSemaphoreTake(busMutex, portMAX_DELAY);
+    ndFile.playUploaded(uploadSize);
+    if (busMutex) xSemaphoreGive(busMutex);
+  }
 }
 
 // YM2612クロック変更
@@ -1,6 +1,9 @@
 
 #include "vgm.h"
 
+#include <esp_heap_caps.h>
+
+#include <algorithm>
 #include <cassert>
 #include <codecvt>
 #include <locale>
@@ -8,6 +11,8 @@
 
 #include "file.h"
 #include "fm.h"
+#include "pcmmix.h"
+#include "ndlog.h"
 
 #define ONE_CYCLE \
   22675.737f  // 22.67573696145125 us
@@ -23,6 +28,75 @@ static std::string wstringToUTF8(const std::wstring& src) {
 static u32_t gd3p;
 void parseGD3(t_gd3* gd3, u32_t offset) {}
 
+//---------------------------------------------------------------------
+// チップ書き込みの振り分け (ファイル再生とシリアルモードで共通)
+//    どのチップが載っているかは common.h の USE_* で決まる。ここ以外で USE_* を見ない
+VGMRouter chipRouter;
+
+void setupChipRoutes(VGMRouter& router, si5351Freq_t psg1Freq, si5351Freq_t psg2Freq, bool psgRaw) {
+  router.clear();
+
+#ifdef USE_SN76489
+  // WORKAROUND FOR COMMAND TO UNDEFINED SN CHIP
+  // Sonic & Knuckles 30th song
+  if (psg1Freq != SI5351_UNDEFINED) {
+    router.route(0x50, VGM_ROUTE_SN76489, 1, 0, psg1Freq, psgRaw);  // SN76489 CHIP 1
+  }
+  router.route(0x30, VGM_ROUTE_SN76489, 2, 0, psg2Freq, psgRaw);  // SN76489 CHIP 2
+#endif
+
+#ifdef USE_YM2413
+  router.route(0x51, VGM_ROUTE_OPLL, 1);
+#endif
+
+#ifdef USE_YM2612
+  router.route(0x52, VGM_ROUTE_YM2612, 0, 0);  // YM2612 port 0
+  router.route(0x53, VGM_ROUTE_YM2612, 0, 1);  // YM2612 port 1
+#endif
+
+#ifdef USE_AY8910
+  router.route(0xa0, VGM_ROUTE_OPN, 0);  // AY8910, YM2203 PSG, YM2149, YMZ294D
+#endif
+
+#ifdef USE_YM2151
+  router.route(0x54, VGM_ROUTE_OPM, 0);
+  router.route(0xa4, VGM_ROUTE_OPM, 0);
+#endif
+
+#ifdef USE_YM2203_0
+  router.route(0x55, VGM_ROUTE_OPN, 0);
+#endif
+
+#ifdef USE_YM2203_1
+  router.route(0xa5, VGM_ROUTE_OPN, 1);
+#endif
+
+#ifdef USE_YM3812
+  router.route(0x5a, VGM_ROUTE_OPN, 1);
+#endif
+
+#ifdef USE_YMF262
+  router.route(0x5a, VGM_ROUTE_OPL3, 1, 0);  // YM3812
+  router.route(0x5e, VGM_ROUTE_OPL3, 1, 0);  // YMF262 Port 0
+  router.route(0x5f, VGM_ROUTE_OPL3, 1, 1);  // YMF262 Port 1
+#endif
+}
+
+//---------------------------------------------------------------------
+// XGM の書き込みをチップバスに渡す (lib/xgm のデコーダから呼ばれる)
+class XGMChipSink : public XGMSink {
+ public:
+  void ym(u8_t port, u8_t reg, u8_t value) override { chipBus->setYM2612(port, reg, value, 0); }
+  void psg(u8_t data) override { chipBus->writeRaw(data, 1, vgm.freq[vgm.chipSlot[CHIP_SN76489_0]]); }
+  void psgPair(u8_t latch, u8_t data) override {
+    chipBus->writeRawPair(latch, data, PSG_CHIP(1), vgm.freq[vgm.chipSlot[CHIP_SN76489_0]]);
+  }
+  void psgLatched(u8_t data) override { chipBus->write(data, 1, vgm.freq[vgm.chipSlot[CHIP_SN76489_0]]); }
+  void pcm(u8_t command, u8_t id) override { vgm._xgmPCMCommand(command, id); }
+};
+
+static XGMChipSink xgmSink;
+
 //---------------------------------------------------------------------
 // VGM クラス
 VGM::VGM() {
@@ -67,7 +141,7 @@ bool VGM::ready() {
   // ヘッダキャッシュ版
   if (!ndFile.getHeaderCache(ndFile.dirs[ndFile.currentDir] + "/" +
                              ndFile.files[ndFile.currentDir][ndFile.currentFile])) {
-    Serial.println("ERROR: Failed to read file header.");
+    ndLog.println("ERROR: Failed to read file header.");
     vgmLoaded = false;
     return false;
   }
@@ -75,7 +149,7 @@ bool VGM::ready() {
   // VGM ident
   if (ndFile.get_ui32_at_header(0) != 0x206d6756) {
     lcd.printf("ERROR: File format is not VGM.\n");
-    Serial.println("ERROR: VGM以外のファイルです。");
+    ndLog.println("ERROR: VGM以外のファイルです。");
     vgmLoaded = false;
     return false;
   }
@@ -250,6 +324,13 @@ bool VGM::ready() {
 
   SI5351.enableOutputs(true);
 
+  // チップの振り分け
+  if (SN76489_Freq0is0X400) {
+    setupChipRoutes(chipRouter, freq[chipSlot[CHIP_SN76489_0]], freq[chipSlot[CHIP_SN76489_1]], true);
+  } else {
+    setupChipRoutes(chipRouter, freq[chipSlot[CHIP_SN76489_0]], freq[chipSlot[CHIP_SN76489_0]], false);
+  }
+
   vgmLoaded = true;  // VGM 開始できる
   // GD3 tags
   //_parseGD3(gd3Offset);
@@ -290,8 +371,8 @@ bool VGM::ready() {
               gd3.date, chip[0], chip[1], FORMAT_LABEL[(int)ND::fileFormat], 0, n,
               ndFile.files[ndFile.currentDir].size()});
 
-  Serial.printf("Heap - %'d Bytes free\n", ESP.getFreeHeap());
-  Serial.printf("PSRAM - Total %'d, Free %'d\n", ESP.getPsramSize(), ESP.getFreePsram());
+  ndLog.printf("Heap - %'d Bytes free\n", ESP.getFreeHeap());
+  ndLog.printf("PSRAM - Total %'d, Free %'d\n", ESP.getPsramSize(), ESP.getFreePsram());
 
   _vgmStart = micros64() + 20000;
   return true;
@@ -666,7 +747,7 @@ void VGM::_vgmStopStream(u8_t streamID) {
 }
 
 void VGM::_vgmProcessStreams() {
-  if (ndConfig.get(CFG_FMPCM) == FMPCM_FM) {
+  if (!_pcmEnabled) {
     return;
   }
 
@@ -688,6 +769,19 @@ void VGM::_vgmProcessStreams() {
     }
 
     int guard = 0;
+
+    // 連続したサンプルが溜まっていたらストリームの周期でまとめて書く
+    // (一度に書くと最後の 1 サンプルしか聞こえないので、周期は空ける。止まる時間は VGM_STREAM_BURST 分まで)
+    if (stream.stepSize == 1 && stream.pos < stream.endPos && stream.nextTickUs + intervalUs <= now) {
+      u32_t due = (now - stream.nextTickUs) / intervalUs + 1;
+      if (due > VGM_STREAM_BURST) due = VGM_STREAM_BURST;
+      if (due > stream.endPos - stream.pos) due = stream.endPos - stream.pos;
+      chipBus->setYM2612DACBurst(&ndFile.data[stream.pos], due, intervalUs, (stream.chipType & 0x80) ? 1 : 0);
+      stream.pos += due;
+      stream.nextTickUs += intervalUs * due;
+      guard = 512;  // 残りの遅れは下で捨てる (1 サンプルずつ詰めて書かない)
+    }
+
     while (stream.playing && stream.nextTickUs <= now && guard < 512) {
       if (stream.pos >= stream.endPos) {
         if (!stream.loop) {
@@ -697,7 +791,7 @@ void VGM::_vgmProcessStreams() {
         stream.pos = stream.startPos;
       }
 
-      FM.setYM2612DAC(ndFile.get_ui8_at(stream.pos), (stream.chipType & 0x80) ? 1 : 0);
+      chipBus->setYM2612DAC(ndFile.get_ui8_at(stream.pos), (stream.chipType & 0x80) ? 1 : 0);
       stream.pos += stream.stepSize;
       stream.nextTickUs += intervalUs;
       guard++;
@@ -710,117 +804,14 @@ void VGM::_vgmProcessStreams() {
 }
 
 void VGM::vgmProcessMain() {
-  u8_t reg;
-  u8_t dat;
   u8_t command = ndFile.get_ui8();
 
-  switch (command) {
-#ifdef USE_AY8910
-    case 0xA0:  // AY8910, YM2203 PSG, YM2149, YMZ294D
-      reg = ndFile.get_ui8();
-      dat = ndFile.get_ui8();
-      FM.setRegister(reg, dat, 0);
-      break;
-#endif
-
-#ifdef USE_SN76489
-    case 0x30:  // SN76489 CHIP 2
-      if (SN76489_Freq0is0X400) {
-        FM.writeRaw(ndFile.get_ui8(), 2, freq[chipSlot[CHIP_SN76489_1]]);
-      } else {
-        FM.write(ndFile.get_ui8(), 2, freq[chipSlot[CHIP_SN76489_0]]);
-      }
-      break;
-
-    case 0x50:  // SN76489 CHIP 1
-      // WORKAROUND FOR COMMAND TO UNDEFINED SN CHIP
-      // Sonic & Knuckles 30th song
-      if (freq[chipSlot[CHIP_SN76489_0]] != SI5351_UNDEFINED) {
-        if (SN76489_Freq0is0X400) {
-          FM.writeRaw(ndFile.get_ui8(), 1, freq[chipSlot[CHIP_SN76489_0]]);
-        } else {
-          FM.write(ndFile.get_ui8(), 1, freq[chipSlot[CHIP_SN76489_0]]);
-        }
-      }
-      break;
-#endif
-
-#ifdef USE_YM2413
-    case 0x51:
-      reg = ndFile.get_ui8();
-      dat = ndFile.get_ui8();
-      FM.setRegisterOPLL(reg, dat, 1);
-      break;
-#endif
-
-#ifdef USE_YM2612
-    case 0x52:  // YM2612 port 0, write value dd to register aa
-      reg = ndFile.get_ui8();
-      dat = ndFile.get_ui8();
-      if ((reg >= 0x30 && reg <= 0xB6) || reg == 0x22 || reg == 0x27 || reg == 0x28 || reg == 0x2A || reg == 0x2B) {
-        FM.setYM2612(0, reg, dat, 0);
-      }
-      break;
-
-    case 0x53:  // YM2612 port 1, write value dd to register aa
-      reg = ndFile.get_ui8();
-      dat = ndFile.get_ui8();
-      if (reg >= 0x30 && reg <= 0xB6) {
-        FM.setYM2612(1, reg, dat, 0);
-      }
-      break;
-#endif
-
-#ifdef USE_YM2151
-    case 0x54:  // YM2151
-    case 0xa4:
-      reg = ndFile.get_ui8();
-      dat = ndFile.get_ui8();
-      if (reg != 0x10 || reg != 0x11) {  // タイマー設定は無視
-        FM.setRegisterOPM(reg, dat, 0);
-      }
-      break;
-#endif
-
-#ifdef USE_YM2203_0
-    case 0x55:  // YM2203_0
-      reg = ndFile.get_ui8();
-      dat = ndFile.get_ui8();
-      FM.setRegister(reg, dat, 0);
-      break;
-#endif
-
-#ifdef USE_YM2203_1
-    case 0xA5:  // YM2203_1
-      reg = ndFile.get_ui8();
-      dat = ndFile.get_ui8();
-      FM.setRegister(reg, dat, 1);
-      break;
-#endif
-
-#ifdef USE_YM3812
-    case 0x5A:  // YM3812
-      reg = ndFile.get_ui8();
-      dat = ndFile.get_ui8();
-      FM.setRegister(reg, dat, 1);
-      break;
-
-#endif
-
-#ifdef USE_YMF262
-    case 0x5A:  // YM3812
-    case 0x5E:  // YMF262 Port 0
-      reg = ndFile.get_ui8();
-      dat = ndFile.get_ui8();
-      FM.setRegisterOPL3(0, reg, dat, 1);
-      break;
-    case 0x5F:  // YMF262 Port 1
-      reg = ndFile.get_ui8();
-      dat = ndFile.get_ui8();
-      FM.setRegisterOPL3(1, reg, dat, 1);
-      break;
-#endif
+  // チップへの書き込み (振り分けはシリアルモードと共通の setupChipRoutes)
+  if (chipRouter.dispatch(chipBus, command, []() { return ndFile.get_ui8(); })) {
+    return;
+  }
 
+  switch (command) {
     // Wait n samples, n can range from 0 to 65535 (approx 1.49 seconds)
     case 0x61: {
       u16_t w = ndFile.get_ui16();
@@ -872,8 +863,8 @@ void VGM::vgmProcessMain() {
       break;
 
     case 0x80 ... 0x8f:
-      if (ndConfig.get(CFG_FMPCM) != FMPCM_FM) {
-        FM.setYM2612DAC(ndFile.data[_pcmpos++], 0);
+      if (_pcmEnabled) {
+        chipBus->setYM2612DAC(ndFile.data[_pcmpos++], 0);
       }
 
       _vgmSamples += (command & 15);
@@ -893,8 +884,8 @@ void VGM::vgmProcessMain() {
         _vgmStreams[streamID].command = commandReg;
       }
 
-      Serial.printf("Setup Stream Control 0x90: stream %d chip 0x%02x port 0x%02x cmd 0x%02x\n", streamID, chipType,
-                    port, commandReg);
+      ndLog.printf("Setup Stream Control 0x90: stream %d chip 0x%02x port 0x%02x cmd 0x%02x\n", streamID, chipType,
+                   port, commandReg);
       break;
     }
     case 0x91: {
@@ -910,8 +901,8 @@ void VGM::vgmProcessMain() {
         _vgmStreams[streamID].stepBase = stepBase;
       }
 
-      Serial.printf("Set Stream Data 0x91: stream %d bank %d step %d base %d\n", streamID, dataBankID, stepSize,
-                    stepBase);
+      ndLog.printf("Set Stream Data 0x91: stream %d bank %d step %d base %d\n", streamID, dataBankID, stepSize,
+                   stepBase);
       break;
     }
     case 0x92: {
@@ -923,7 +914,7 @@ void VGM::vgmProcessMain() {
         _vgmStreams[streamID].frequency = frequency;
       }
 
-      Serial.printf("Set Stream Frequency 0x92: id %d, 0x%x\n", streamID, frequency);
+      ndLog.printf("Set Stream Frequency 0x92: id %d, 0x%x\n", streamID, frequency);
       break;
     }
     case 0x93: {
@@ -932,8 +923,8 @@ void VGM::vgmProcessMain() {
       u32_t dataStart = ndFile.get_ui32();
       u8_t lengthMode = ndFile.get_ui8();
       u32_t dataLength = ndFile.get_ui32();
-      Serial.printf("Start Stream 0x93: stream %d start 0x%x mode 0x%02x len 0x%x\n", streamID, dataStart, lengthMode,
-                    dataLength);
+      ndLog.printf("Start Stream 0x93: stream %d start 0x%x mode 0x%02x len 0x%x\n", streamID, dataStart, lengthMode,
+                   dataLength);
       break;
     }
     case 0x94: {
@@ -946,7 +937,7 @@ void VGM::vgmProcessMain() {
       } else {
         _vgmStopStream(streamID);
       }
-      Serial.printf("Stop Stream 0x94: stream ID %d\n", streamID);
+      ndLog.printf("Stop Stream 0x94: stream ID %d\n", streamID);
       break;
     }
     case 0x95: {
@@ -971,14 +962,18 @@ void VGM::vgmProcessMain() {
           }
         }
       }
-      Serial.printf("Start Stream Fast 0x95: stream ID %d, blockID %d, flags 0x%x\n", streamID, blockID, flags);
+      ndLog.printf("Start Stream Fast 0x95: stream ID %d, blockID %d, flags 0x%x\n", streamID, blockID, flags);
       break;
     }
     case 0xe0:
       _pcmpos = 0x47 + ndFile.get_ui32();
       break;
     default:
+      // 対応していないチップのコマンドもオペランドは読み飛ばす
       ESP_LOGI("Unknown VGM Command: %0.2X\n", command);
+      for (u8_t i = 1; i < vgmCommandLength(command); i++) {
+        ndFile.get_ui8();
+      }
       break;
   }
 }
@@ -993,43 +988,28 @@ bool VGM::XGMReady() {
   xgmLoaded = false;
   ndFile.pos = 0;
 
-  _vgmSamples = 0;
-  _vgmLoop = 0;
-  _xgmFrame = 0;
-  _xgmYMSNFrame = 0;
-
-  // XGM2
-  _xgmYMFrame = 0;
-  _xgmPSGFrame = 0;
-
-  _xgmWaitUntil = 0;
-
-  XGMSampleAddressTable.clear();
-  XGMSampleSizeTable.clear();
-  XGMSampleAddressTable.push_back(0);
-  XGMSampleSizeTable.push_back(0);
-
-  for (int i = 0; i < XGM1_MAX_PCM_CH; i++) {
-    _xgmSampleOn[i] = false;
-    _xgmPriorities[i] = 0;
-  }
+  _xgmClearSamples();
+  _xgm2Tracks.clear();
+  xgmTrack = 0;
+  xgmNumTracks = 1;
+  _xgmSampleBase = XGM_SAMPLE_BASE;
 
   // XGM ident
   if (ndFile.get_ui32_at(0) == 0x204d4758) {
     XGMVersion = 1;
     ND::fileFormat = FileFormat::XGM1;
-    Serial.println("XGM Version 1.1");
+    ndLog.println("XGM Version 1.1");
   } else if (ndFile.get_ui32_at(0) == 0x324d4758) {
     XGMVersion = 2;
     ND::fileFormat = FileFormat::XGM2;
-    Serial.println("XGM Version 2");
+    ndLog.println("XGM Version 2");
   } else {
-    Serial.println("ERROR: XGM ファイル解析失敗");
+    ndLog.println("ERROR: XGM ファイル解析失敗");
     ND::fileFormat = FileFormat::Unknown;
     u32_t n = 1 + ndFile.currentFile;
     updateDisp({"Bad XGM file ident", "XGMファイル解析失敗", "", "", "--", "--", "--", "--", "--", "", "",
                 FORMAT_LABEL[(int)ND::fileFormat], 0, n, ndFile.files[(int)ndFile.currentDir].size()});
-    Serial.println("ERROR: Bad XGM file ident.");
+    ndLog.println("ERROR: Bad XGM file ident.");
 
     xgmLoaded = false;
     return false;
@@ -1038,16 +1018,19 @@ bool VGM::XGMReady() {
   // XGM 1.1 / 2 information
   switch (XGMVersion) {
     case 1: {
-      // Sample id table
+      // Sample data block size = SLEN
+      XGM_SLEN = ndFile.get_ui16_at(0x100) << 8;
+
+      // Sample id table (ID 1 - 63, $FFFF = なし)
       ndFile.pos = 0x4;
-      for (int i = 0; i < 63; i++) {
-        XGMSampleAddressTable.push_back(ndFile.get_ui16() * 256 + 0x104);
-        XGMSampleSizeTable.push_back(ndFile.get_ui16() * 256);
+      for (int i = 1; i <= 63; i++) {
+        u16_t addr = ndFile.get_ui16();
+        u16_t size = ndFile.get_ui16();
+        if (addr != 0xffff) {
+          _xgmSetSample(i, addr * 256 + XGM_SAMPLE_BASE, (addr + size) * 256 + XGM_SAMPLE_BASE);
+        }
       }
 
-      // Sample data block size = SLEN
-      XGM_SLEN = ndFile.get_ui16() << 8;
-
       // Version
       // Serial.printf("XGM Version: %d\n", get_ui8());
 
@@ -1056,18 +1039,17 @@ bool VGM::XGMReady() {
       // PAL
       // GD3
       // Ignore MultiTrack
-      _xgmIsNTSC = (XGM_FLAGS & 0b1 == 0);
+      _xgmIsNTSC = (XGM_FLAGS & 0b1) == 0;
       hasGd3 = XGM_FLAGS & 0b10;
 
+      // ストリームモードではサンプルバンクが抜けている
+      _xgmMusicOffset = XGM_SAMPLE_BASE + XGM_SLEN - ndFile.bankSkip;
+
       // Music data block size = MLEN
-      XGM_MLEN = ndFile.get_ui32_at(0x104 + XGM_SLEN);
+      XGM_MLEN = ndFile.get_ui32_at(_xgmMusicOffset);
       // Serial.printf("MLEN: %x\n", XGM_MLEN);
 
-      // Music data block position
-      ndFile.pos = 0x108 + XGM_SLEN;
-      // Serial.printf("0x108+ SLEN: %x\n", _pos);
-
-      gd3Offset = 0x108 + XGM_SLEN + XGM_MLEN;
+      gd3Offset = _xgmMusicOffset + 4 + XGM_MLEN;
 
       break;
     }
@@ -1075,62 +1057,58 @@ bool VGM::XGMReady() {
       ndFile.pos = 0x4;
       // Format description
       XGM_FLAGS = ndFile.get_ui8_at(0x0005);
-      _xgmIsNTSC = (XGM_FLAGS & 0b0001);
-      // ignore multi track
+      _xgmIsNTSC = (XGM_FLAGS & 0b0001) == 0;
+      // multi track
+      bool multi = XGM_FLAGS & 0b0010;
       // packed FM / PSG / GD3
       hasGd3 = XGM_FLAGS & 0b100;
 
       // SLEN: Sample data bloc size / 256 (ex: $0200 means 512*256 = 131072 bytes)
       XGM_SLEN = ndFile.get_ui16_at(0x0006) << 8;
-      Serial.printf("XGM_SLEN: %x\n", XGM_SLEN);
+      ndLog.printf("XGM_SLEN: %x\n", XGM_SLEN);
 
       // FMLEN: FM music data block size / 256 (ex: $0040 means 64*256 = 16384 bytes)
       XGM_FMLEN = ndFile.get_ui16_at(0x0008) << 8;
-      Serial.printf("XGM_FMLEN: %x\n", XGM_FMLEN);
+      ndLog.printf("XGM_FMLEN: %x\n", XGM_FMLEN);
 
       // PSGLEN: PSG music data block size / 256 (ex: $0020 means 32*256 = 8192 bytes)
       XGM_PSGLEN = ndFile.get_ui16_at(0x000a) << 8;
-      Serial.printf("XGM_PSGLEN: %x\n", XGM_PSGLEN);
-
-      // SID: sample id table
-      ndFile.pos = 0x000c;
-
-      for (int i = 0; i < 124; i++) {
-        u16_t value = ndFile.get_ui16();
-        if (value == 0xffff) {
-          XGMSampleAddressTable.push_back(0);
-        } else {
-          XGMSampleAddressTable.push_back(value * 256 + 0x104);
+      ndLog.printf("XGM_PSGLEN: %x\n", XGM_PSGLEN);
+
+      // SID: sample id table (ID 1 - 124 / マルチトラックは 1 - 248, $FFFF = なし)
+      //    サイズは持っていないので、テーブル中で次に大きい先頭 (なければサンプルブロックの終わり) までとする
+      if (multi) _xgmSampleBase = XGM2_MULTI_SAMPLE_BASE;
+      const int numSamples = multi ? XGM_MAX_SAMPLES - 1 : 124;
+      u16_t sid[XGM_MAX_SAMPLES - 1];
+      u32_t sampleStart[XGM_MAX_SAMPLES - 1], sampleLen[XGM_MAX_SAMPLES - 1];
+      for (int i = 0; i < numSamples; i++) {
+        sid[i] = ndFile.get_ui16_at(0x000c + i * 2);
+      }
+      xgm2SampleRanges(sid, numSamples, XGM_SLEN, sampleStart, sampleLen);
+      for (int i = 0; i < numSamples; i++) {
+        if (sampleLen[i]) {
+          u32_t addr = _xgmSampleBase + sampleStart[i];
+          _xgmSetSample(i + 1, addr, addr + sampleLen[i]);
         }
       }
 
-      for (int i = 1; i < 124; i++) {
-        if (XGMSampleAddressTable[i] == 0) {
-          XGMSampleSizeTable.push_back(0);
-        } else {
-          XGMSampleSizeTable.push_back(XGMSampleAddressTable[i + 1] - XGMSampleAddressTable[i]);
+      _xgmMusicOffset = _xgmSampleBase + XGM_SLEN - ndFile.bankSkip;
+      gd3Offset = _xgmMusicOffset + XGM_FMLEN + XGM_PSGLEN;
 
-          // Last sample size
-          if (XGMSampleSizeTable[i] > XGM_SLEN - 0x104) {
-            XGMSampleSizeTable[i] = XGM_SLEN - XGMSampleAddressTable[i] + 0x104;
-          }
+      if (multi) {
+        if (!_xgm2IndexTracks()) {
+          ndLog.println("ERROR: XGM2 multi track file has no track.");
+          return false;
         }
+      } else {
+        _xgm2Tracks.push_back({_xgmMusicOffset, XGM_FMLEN, _xgmMusicOffset + XGM_FMLEN, XGM_PSGLEN});
       }
-
-      for (int i = 0; i < 123; i++) {
-        // Serial.printf("Sample: id %d, add %x, size %x\n", i, XGMSampleAddressTable[i], XGMSampleSizeTable[i]);
-      }
-      gd3Offset = 0x104 + XGM_SLEN + XGM_FMLEN + XGM_PSGLEN;
-
-      _xgm2_ym_offset = 0x104 + XGM_SLEN;
-      _xgm2_psg_offset = 0x104 + XGM_SLEN + XGM_FMLEN;
-      _xgm2_ym_pos = _xgm2_ym_offset;
-      _xgm2_psg_pos = _xgm2_psg_offset;
+      xgmNumTracks = _xgm2Tracks.size();
 
       break;
     }
     default: {
-      Serial.println("Unexpected XGM version.");
+      ndLog.println("Unexpected XGM version.");
       return false;
     }
   }
@@ -1149,8 +1127,62 @@ bool VGM::XGMReady() {
   SI5351.setFreq(freq[1], 1);
   SI5351.enableOutputs(true);
 
+  // フレーム周期
+  _xgmMasterClock = _xgmIsNTSC ? XGM_NTSC_MCLK : XGM_PAL_MCLK;
+  _xgmFrameClocks = _xgmIsNTSC ? XGM_NTSC_FRAME_CLOCKS : XGM_PAL_FRAME_CLOCKS;
+  ndLog.printf("XGM: %s\n", _xgmIsNTSC ? "NTSC" : "PAL");
+
+  return XGMSelectTrack(0);
+}
+
+// XGM2 マルチトラック: FMID / PSGID テーブルからトラックごとのストリーム位置を作る
+//    FMID ($01FC-) / PSGID ($02FC-) は 128 トラック分のブロック内オフセット / 256 ($FFFF = なし)
+//    長さは次にあるトラックの先頭 (なければブロックの終わり) まで (lib/xgm の xgm2IndexTracks)
+//    戻り値: トラックが 1 つ以上ある
+bool VGM::_xgm2IndexTracks() {
+  u16_t fmID[XGM2_MAX_TRACKS], psgID[XGM2_MAX_TRACKS];
+  for (int i = 0; i < XGM2_MAX_TRACKS; i++) {
+    fmID[i] = ndFile.get_ui16_at(0x01fc + i * 2);
+    psgID[i] = ndFile.get_ui16_at(0x02fc + i * 2);
+  }
+
+  _xgm2Tracks.resize(XGM2_MAX_TRACKS);
+  _xgm2Tracks.resize(xgm2IndexTracks(fmID, psgID, _xgmMusicOffset, XGM_FMLEN, XGM_PSGLEN, _xgm2Tracks.data()));
+
+  ndLog.printf("XGM2: multi track, %u tracks\n", _xgm2Tracks.size());
+  return !_xgm2Tracks.empty();
+}
+
+// トラックを頭から再生する準備
+//    マルチトラックのトラック切り替えでも呼ばれる。サンプルバンク・サンプルテーブル (半速版) はそのまま使う
+bool VGM::XGMSelectTrack(u8_t track) {
+  xgmLoaded = false;
+  if (track >= xgmNumTracks) return false;
+  xgmTrack = track;
+
+  if (_xgmPCMTimer) {
+    chipBus->stopDACTimer();
+    _xgmPCMTimer = false;
+  }
+
+  _vgmSamples = 0;
+  _vgmLoop = 0;
+  _xgmFrame = 0;
+  _xgmWaitUntil = 0;
+
+  _xgmUnpin();
+  _xgmVoices.reset();
+
+  if (XGMVersion == 1) {
+    // Music data block position
+    _xgm1.begin(ndFile.data, _xgmMusicOffset + 4, XGM_MLEN);
+  } else {
+    const t_xgm2Track& t = _xgm2Tracks[track];
+    _xgm2.begin(ndFile.data, t.fmOffset, t.fmLen, t.psgOffset, t.psgLen);
+  }
+
   // PCM DAC Select
-  FM.setYM2612(0, 0x2b, 0b10000000, 0);
+  chipBus->setYM2612(0, 0x2b, 0b10000000, 0);
 
   // 表示
   String chip[2] = {"", ""};
@@ -1174,12 +1206,45 @@ bool VGM::XGMReady() {
     chip[c++] = CHIP_LABEL[CHIP2] + " @ " + String(buf).substring(0, 5) + " MHz";
   }
 
+  // マルチトラックは曲名の前にトラック番号
+  String trackEn = gd3.trackEn;
+  if (xgmNumTracks > 1) {
+    trackEn = "Track " + String(track + 1) + "/" + String(xgmNumTracks) + (trackEn.length() ? " " + trackEn : "");
+  }
+
   u32_t n = 1 + ndFile.currentFile;  // フォルダ内曲番
 
-  updateDisp({gd3.trackEn, gd3.trackJp, gd3.gameEn, gd3.gameJp, gd3.systemEn, gd3.systemJp, gd3.authorEn, gd3.authorJp,
+  updateDisp({trackEn, gd3.trackJp, gd3.gameEn, gd3.gameJp, gd3.systemEn, gd3.systemJp, gd3.authorEn, gd3.authorJp,
               gd3.date, chip[0], chip[1], FORMAT_LABEL[(int)ND::fileFormat], 0, n,
               ndFile.files[ndFile.currentDir].size()});
 
+  // XGM2 は FM / PSG ストリームを展開しておく
+  _xgm2Compiled = false;
+  if (XGMVersion == 2) {
+    _xgm2Compile();
+  }
+
+  // ループ先とよく使うサンプルを内部 SRAM へ
+  _xgmPinHotData();
+
+  // XGM1 の PCM はタイマー割り込みで出力する (使えないバスは従来のポーリング)
+  _xgmPCMMixed = 0;
+  _xgmPCMDrop = 0;
+  _xgmPCMUnderruns = 0;
+  _xgm2PCMBufPos = 0;
+  _xgm2PCMBufLen = 0;
+  if (XGMVersion == 1 && _pcmEnabled && chipBus->startDACTimer(XGM1_PCM_RATE, 0)) {
+    for (int i = 0; i < XGM1_PCM_LEAD; i++) {
+      chipBus->pushDAC(DAC_SKIP);
+    }
+    _xgmPCMTimer = true;
+  }
+
+  // ストリームモードのサンプル先読み位置
+  _xgmPrefetchPos = (XGMVersion == 1) ? _xgmMusicOffset + 4 : 0;
+  _xgmPrefetchFrame = 0;
+  _xgmPrefetchEnd = (ndFile.accessMode != ACCESS_STREAM) || (XGMVersion == 2 && !_xgm2Compiled);
+
   xgmLoaded = true;
   _xgmStartTick = micros64();
 
@@ -1195,120 +1260,275 @@ void VGM::xgmProcess() {
     return;
   }
 
-  while (_xgmYMSNFrame <= _xgmFrame) {
+  while (_xgm1.frame <= _xgmFrame) {
     if (_xgm1ProcessYMSN()) {
       endProcedure();
       return;
     }
   }
 
-  _xgmFrame = _xgmYMSNFrame;
-  _xgmWaitUntil = _xgmStartTick + _xgmYMSNFrame * 16666;  // 60Hz
-  _vgmSamples = _xgmYMSNFrame * 735;                      // 44100 / 60
+  _xgmFrame = _xgm1.frame;
+  _xgmWaitUntil = _xgmStartTick + _xgmFrameTime(_xgm1.frame, 1000000);
+  _vgmSamples = _xgmFrameTime(_xgm1.frame, 44100);
+
+  if (!_xgmPrefetchEnd) {
+    _xgm1Prefetch();
+  }
+
+  if (_xgmPCMTimer) {
+    // このフレームの終わりまでの PCM をまとめてミックスして割り込み側に渡す
+    _xgm1FillPCM(_xgmFrameTime(_xgm1.frame, XGM1_PCM_RATE));
+
+    // 待ちはタスクを休ませる
+    while (_xgmWaitUntil > micros64() + 1000) {
+      vTaskDelay(1);
+    }
+    while (_xgmWaitUntil > micros64()) {
+    }
+    return;
+  }
 
   // PCM Stream mixing
-  while (_xgmWaitUntil - XGM1_PCM_DELAY > micros()) {
+  while (_xgmWaitUntil - XGM1_PCM_DELAY > micros64()) {
     _xgm1ProcessPCM();
     ets_delay_us(XGM1_PCM_DELAY);
   }
 }
 
-void VGM::_xgm1ProcessPCM() {
-  int16_t samp = 0;
-  bool sampFlag = false;
-  for (int i = 0; i < XGM1_MAX_PCM_CH; i++) {
-    if (_xgmSampleOn[i]) {
-      samp += (s8_t)ndFile.get_ui8_at(XGMSampleAddressTable[_xgmSampleId[i]] + _xgmSamplePos[i]++);
-      sampFlag = true;
-      if (_xgmSamplePos[i] >= XGMSampleSizeTable[_xgmSampleId[i]]) {
-        _xgmSampleOn[i] = false;
+// frame 先頭の時刻を rate 単位で返す (µs なら 1000000, サンプル数ならサンプルレート)
+//    マスタークロック単位の整数で計算するので、フレーム数が増えても誤差が溜まらない
+u64_t VGM::_xgmFrameTime(u32_t frame, u32_t rate) {
+  return (u64_t)frame * _xgmFrameClocks * rate / _xgmMasterClock;
+}
+
+// target サンプル目までミックスして DAC タイマーのバッファに積む
+void VGM::_xgm1FillPCM(u32_t target) {
+  // 割り込み側で足りなかった分は捨てて時刻を合わせる
+  u32_t underruns = chipBus->takeDACUnderruns();
+  _xgmPCMUnderruns += underruns;
+  _xgmPCMDrop += underruns;
+
+  u16_t out[PCM_MIX_BLOCK];
+  while (_xgmPCMMixed < target) {
+    u32_t n = target - _xgmPCMMixed;
+    if (n > PCM_MIX_BLOCK) n = PCM_MIX_BLOCK;
+    if (_xgmPCMDrop == 0) {
+      u32_t room = DAC_RING_SIZE - chipBus->dacQueued();
+      if (room == 0) break;
+      if (n > room) n = room;
+    }
+
+    _xgm1MixBlock(out, n);
+    _xgmPCMMixed += n;
+
+    for (u32_t i = 0; i < n; i++) {
+      if (_xgmPCMDrop) {
+        _xgmPCMDrop--;
+        continue;
       }
+      chipBus->pushDAC(_pcmEnabled ? out[i] : DAC_SKIP);
     }
   }
-  if (sampFlag) {
-    if (samp > INT8_MAX) {
-      samp = INT8_MAX;
-    } else if (samp < INT8_MIN)
-      samp = INT8_MIN;
-    samp += 128;
-    if (ndConfig.get(CFG_FMPCM) != FMPCM_FM) {
-      FM.setYM2612DAC(samp, 0);
-    }
+}
+
+void VGM::_xgm1ProcessPCM() {
+  u16_t v;
+  _xgm1MixBlock(&v, 1);
+  if (v != PCM_MIX_SKIP && _pcmEnabled) {
+    chipBus->setYM2612DAC(v, 0);
   }
 }
 
-bool VGM::_xgm1ProcessYMSN() {
-  u8_t command = ndFile.get_ui8();
+// n サンプル分を全チャンネルまとめてミックス (発音なしのサンプルは PCM_MIX_SKIP)
+void VGM::_xgm1MixBlock(u16_t* out, u32_t n) {
+  alignas(16) int16_t acc[PCM_MIX_BLOCK];
+  u8_t hit[PCM_MIX_BLOCK];
 
-  switch (command) {
-    case 0x00:
-      // frame wait
-      _xgmYMSNFrame++;
-      break;
+  pcmMixClear(acc, hit, n);
+  for (u8_t m = _xgmVoices.active; m; m &= m - 1) {
+    u8_t ch = __builtin_ctz(m);
+    if (_xgmMixSample(acc, hit, n, ch)) {
+      _xgmVoices.stop(ch);
+    }
+  }
+  pcmMixOut(acc, hit, out, n);
+}
 
-    case 0x10 ... 0x1f:
-      for (int i = 0; i < command % 16 + 1; i++) {
-        FM.write(ndFile.get_ui8(), 1, freq[chipSlot[CHIP_SN76489_0]]);
-      }
-      break;
+// チャンネル ch の再生中サンプルを acc に足して再生位置を進める
+// 戻り値: サンプルの終わりまで再生した
+bool VGM::_xgmMixSample(int16_t* acc, u8_t* hit, u32_t n, u8_t ch) {
+  PCMVoices& v = _xgmVoices;
+  u32_t used;
 
-    case 0x20 ... 0x2f:
-      for (int i = 0; i < command % 16 + 1; i++) {
-        FM.setYM2612(0, ndFile.get_ui8(), ndFile.get_ui8(), 0);
+  if (v.ptr[ch]) {
+    // PSRAM 上のサンプル (半速は展開済み)
+    used = pcmMixAdd(acc, hit, n, v.ptr[ch], v.left[ch], 1, 0);
+    v.ptr[ch] += used;
+  } else {
+    // ストリームモード: ページキャッシュからページ境界ごとに区切って足す
+    // まだ読めていないページは SD を待たずに、その分を鳴らさずに進める (サンプルの時刻は保つ)
+    u8_t bit = 1 << ch;
+    u8_t step = 1, phase = 0;
+    if (v.stride & bit) {
+      step = 2;
+      phase = (v.strideOdd & bit) ? 1 : 0;
+      if (n & 1) v.strideOdd ^= bit;
+    }
+
+    used = 0;
+    u32_t i = phase;  // acc 上の位置
+    while (i < n && used < v.left[ch]) {
+      u32_t avail;
+      const u8_t* p = xgmPages.get(v.addr[ch] + used, &avail, false);
+      if (!p && !avail) {
+        used = v.left[ch];  // 読めないサンプルは打ち切る
+        break;
+      }
+      if (avail > v.left[ch] - used) avail = v.left[ch] - used;
+      u32_t m;
+      if (p) {
+        m = pcmMixAdd(acc + i, hit + i, n - i, (const int8_t*)p, avail, step, 0);
+        xgmPages.release(p);
+      } else {
+        m = (n - i + step - 1) / step;
+        if (m > avail) m = avail;
       }
-      break;
+      used += m;
+      i += m * step;
+    }
+    v.addr[ch] += used;
+  }
 
-    case 0x30 ... 0x3f:
-      for (int i = 0; i < command % 16 + 1; i++) {
-        FM.setYM2612(1, ndFile.get_ui8(), ndFile.get_ui8(), 0);
-      }
-      break;
+  v.left[ch] -= used;
+  return v.left[ch] == 0;
+}
 
-    case 0x40 ... 0x4f:
-      for (int i = 0; i < command % 16 + 1; i++) {
-        FM.setYM2612(0, 0x28, ndFile.get_ui8(), 0);
-      }
-      break;
+// サンプルの先頭ページを先読み要求
+void VGM::_xgmPrefetchSample(u8_t sampleID) {
+  if (sampleID >= XGM_MAX_SAMPLES || _xgmSampleTable[sampleID].pinned) return;
+  xgmPages.prefetch(_xgmSampleTable[sampleID].addr, _xgmSampleTable[sampleID].len);
+}
 
-    case 0x50 ... 0x5f: {
-      // PCM play command:
-      u8_t priority = command & 0xc;
-      u8_t channel = command & 0x3;
-      u8_t sampleID = ndFile.get_ui8();
-
-      if (_xgmSampleOn[channel] == false || _xgmPriorities[channel] <= priority) {
-        if (sampleID == 0) {  // ID 0 は停止
-          _xgmSampleOn[channel] = false;
-        } else {
-          _xgmSampleOn[channel] = true;
-        }
-        _xgmPriorities[channel] = priority;
-        _xgmSamplePos[channel] = 0;
-        _xgmSampleId[channel] = sampleID;
+// サンプルテーブルを空にする (半速版・内部 SRAM のコピーも解放)
+void VGM::_xgmClearSamples() {
+  _xgmUnpin();
+  for (int i = 0; i < XGM_MAX_SAMPLES; i++) {
+    if (_xgmSampleTable[i].half) free(_xgmSampleTable[i].half);
+  }
+  memset(_xgmSampleTable, 0, sizeof(_xgmSampleTable));
+}
+
+// 内部 SRAM のコピーを解放して PSRAM (ストリームモードではページキャッシュ) から鳴らすように戻す
+// 発音回数も数え直す (トラックごとに違う)
+void VGM::_xgmUnpin() {
+  for (int i = 0; i < XGM_MAX_SAMPLES; i++) {
+    t_xgmSample& s = _xgmSampleTable[i];
+    if (s.pinned) {
+      free(s.pinned);
+      s.pinned = NULL;
+      s.data = (ndFile.accessMode == ACCESS_STREAM) ? NULL : (const int8_t*)&ndFile.data[s.addr];
+    }
+    s.uses = 0;
+  }
+
+  if (_xgm2LoopPin) free(_xgm2LoopPin);
+  _xgm2LoopPin = NULL;
+  _xgm2LoopPinLen = 0;
+}
+
+// addr から end まで (ファイル上の位置) をサンプル id にする
+// 終わりはサンプルブロックの終わり (_xgmSampleBase + SLEN) までに切り詰める
+void VGM::_xgmSetSample(u8_t id, u32_t addr, u32_t end) {
+  u32_t bankEnd = _xgmSampleBase + XGM_SLEN;
+  if (end > bankEnd) end = bankEnd;
+  if (addr >= end) return;
+
+  t_xgmSample& s = _xgmSampleTable[id];
+  s.addr = addr;
+  s.len = end - addr;
+  s.data = (ndFile.accessMode == ACCESS_STREAM) ? NULL : (const int8_t*)&ndFile.data[addr];
+}
+
+// 半速版を返す。なければ作る (作れないときは NULL)
+const int8_t* VGM::_xgmHalfSample(u8_t sampleID) {
+  t_xgmSample& s = _xgmSampleTable[sampleID];
+  if (!s.half && s.data) {
+    s.half = (int8_t*)ps_malloc(s.len * 2);
+    if (s.half) {
+      for (u32_t i = 0; i < s.len; i++) {
+        s.half[i * 2] = s.half[i * 2 + 1] = s.data[i];
       }
-      break;
     }
+  }
+  return s.half;
+}
 
-    case 0x7e: {
-      // Loop command, used for music looping sequence
-      _vgmLoop++;
-      Serial.printf("loops: %d\n", _vgmLoop);
-      if (_vgmLoop == ndConfig.get(CFG_NUM_LOOP) && ndConfig.get(CFG_NUM_LOOP) != LOOP_INIFITE) {  //   フェードアウトON
-        nju72341.startFadeout();
-      }
-      ndFile.pos = 0x108 + XGM_SLEN + ndFile.get_ui24();  // ループ位置
-      break;
+// チャンネル ch でサンプルを頭から鳴らす (ID 0 は停止)
+// 鳴っているサンプルより優先度が低いときは何もしない
+void VGM::_xgmStartSample(u8_t ch, u8_t prio, u8_t sampleID, bool halfSpeed) {
+  if (!_xgmVoices.claim(ch, prio, sampleID)) return;
+
+  const t_xgmSample& s = _xgmSampleTable[sampleID < XGM_MAX_SAMPLES ? sampleID : 0];
+  if (halfSpeed && s.len) {
+    const int8_t* half = _xgmHalfSample(sampleID);
+    if (half) {
+      _xgmVoices.start(ch, sampleID, half, s.addr, s.len * 2, false);
+    } else {
+      _xgmVoices.start(ch, sampleID, s.data, s.addr, s.len, true);
     }
+  } else {
+    _xgmVoices.start(ch, sampleID, s.data, s.addr, s.len, false);
+  }
+}
 
-    case 0x7f: {
-      // End command (end of music data).
-      return true;
+// XGM1: 再生位置より先のコマンドを読んで PCM の発音を探す
+void VGM::_xgm1Prefetch() {
+  while (_xgmPrefetchFrame <= _xgm1.frame + XGM_PREFETCH_FRAMES) {
+    u8_t command = ndFile.get_ui8_at(_xgmPrefetchPos++);
+    switch (command) {
+      case 0x00:
+        _xgmPrefetchFrame++;
+        break;
+      case 0x10 ... 0x1f:
+      case 0x40 ... 0x4f:
+        _xgmPrefetchPos += command % 16 + 1;
+        break;
+      case 0x20 ... 0x3f:
+        _xgmPrefetchPos += (command % 16 + 1) * 2;
+        break;
+      case 0x50 ... 0x5f:
+        _xgmPrefetchSample(ndFile.get_ui8_at(_xgmPrefetchPos++));
+        break;
+      case 0x7e:
+        _xgmPrefetchPos = _xgmMusicOffset + 4 + ndFile.get_ui24_at(_xgmPrefetchPos);
+        break;
+      case 0x7f:
+        _xgmPrefetchEnd = true;
+        return;
     }
   }
+}
 
+bool VGM::_xgm1ProcessYMSN() {
+  switch (_xgm1.step(xgmSink)) {
+    case XGM_STEP_LOOP:
+      _xgmCountLoop();
+      break;
+    case XGM_STEP_END:
+      return true;
+  }
   return false;
 }
 
+// ループ回数を数えて、設定回数に達したらフェードアウト
+void VGM::_xgmCountLoop() {
+  _vgmLoop++;
+  ndLog.printf("loops: %d\n", _vgmLoop);
+  if (_vgmLoop == ndConfig.get(CFG_NUM_LOOP) && ndConfig.get(CFG_NUM_LOOP) != LOOP_INIFITE) {  //   フェードアウトON
+    nju72341.startFadeout();
+  }
+}
+
 //---------------------------------------------------------------
 // XGM2 処理
 void VGM::xgm2Process() {
@@ -1318,588 +1538,402 @@ void VGM::xgm2Process() {
     return;
   }
 
-  while (_xgmYMFrame <= _xgmFrame) {
-    if (_xgm2ProcessYM()) {
+  if (_xgm2Compiled) {
+    if (_xgm2ProcessTimeline()) {
       endProcedure();
       return;
-    };
-  }
-  while (_xgmPSGFrame <= _xgmFrame) {
-    if (_xgm2ProcessSN()) {
-      endProcedure();
-      return;
-    };
+    }
+  } else {
+    while (_xgm2.fmFrame <= _xgmFrame) {
+      if (_xgm2ProcessYM()) {
+        endProcedure();
+        return;
+      };
+    }
+    while (_xgm2.psgFrame <= _xgmFrame) {
+      if (_xgm2ProcessSN()) {
+        endProcedure();
+        return;
+      };
+    }
+
+    _xgmFrame = (_xgm2.psgFrame < _xgm2.fmFrame) ? _xgm2.psgFrame : _xgm2.fmFrame;
   }
+  _xgmWaitUntil = _xgmStartTick + _xgmFrameTime(_xgmFrame, 1000000);
+  _vgmSamples = _xgmFrameTime(_xgmFrame, 44100);
 
-  _xgmFrame = (_xgmPSGFrame < _xgmYMFrame) ? _xgmPSGFrame : _xgmYMFrame;
-  _xgmWaitUntil = _xgmStartTick + _xgmFrame * 16666;  // 60Hz
-  _vgmSamples = _xgmFrame * 735;                      // 44100 / 60
+  if (!_xgmPrefetchEnd) {
+    _xgm2Prefetch();
+  }
 
-  while (_xgmWaitUntil - XGM2_PCM_DELAY >= micros()) {
-    _xgm2ProcessPCM();
+  while (_xgmWaitUntil - XGM2_PCM_DELAY >= micros64()) {
+    _xgm2ProcessPCM((_xgmWaitUntil - micros64()) / XGM2_PCM_DELAY);
     ets_delay_us(XGM2_PCM_DELAY);
   }
 }
 
-void VGM::_xgm2ProcessPCM() {
-  int16_t samp = 0;
-  bool sampFlag = false;
-
-  for (int i = 0; i < 3; i++) {
-    if (_xgmSampleOn[i]) {
-      if (_xgmPCMHalfSent[i] == false) {
-        samp += (s8_t)ndFile.get_ui8_at(XGMSampleAddressTable[_xgmSampleId[i]] + _xgmSamplePos[i]++);
-        sampFlag = true;
-
-        if (_xgmSamplePos[i] >= XGMSampleSizeTable[_xgmSampleId[i]]) {
-          _xgmSampleOn[i] = false;
-          _xgmSampleId[i] = 0;
-        }
-      }
-      if (_xgmPCMHalfSpeed[i]) _xgmPCMHalfSent[i] = !_xgmPCMHalfSent[i];
+// タイムラインを次の待ちまで進める
+// 戻り値: 曲終了
+bool VGM::_xgm2ProcessTimeline() {
+  while (true) {
+    // ループ先の直後は内部 SRAM のコピーから読む
+    u32_t fromLoop = _xgm2Cursor - _xgm2Timeline.loopIndex;
+    const t_xgm2Cmd& c = (fromLoop < _xgm2LoopPinLen) ? _xgm2LoopPin[fromLoop] : _xgm2Timeline.cmds[_xgm2Cursor];
+    _xgm2Cursor++;
+    switch (c.type) {
+      case XGM2_EV_YM:
+        chipBus->setYM2612(c.a, c.b, c.c, 0);
+        break;
+      case XGM2_EV_PSG:
+        chipBus->writeRaw(c.a, 1, freq[chipSlot[CHIP_SN76489_0]]);
+        break;
+      case XGM2_EV_PSG_PAIR:
+        chipBus->writeRawPair(c.a, c.b, PSG_CHIP(1), freq[chipSlot[CHIP_SN76489_0]]);
+        break;
+      case XGM2_EV_PCM:
+        _xgm2StartPCM(c.a, c.b);
+        break;
+      case XGM2_EV_WAIT:
+        _xgmFrame += c.a | (c.b << 8);
+        return false;
+      case XGM2_EV_LOOP:
+        _xgm2Cursor = _xgm2Timeline.loopIndex;
+        _xgmCountLoop();
+        break;
+      default:
+        return true;
     }
   }
+}
 
-  if (sampFlag) {
-    if (samp > INT8_MAX) {
-      samp = INT8_MAX;
-    } else if (samp < INT8_MIN)
-      samp = INT8_MIN;
-    samp += 128;
-    if (ndConfig.get(CFG_FMPCM) != FMPCM_FM) {
-      FM.setYM2612DAC(samp, 0);
+// XGM2: タイムラインを再生位置より先に読んで PCM の発音を探す
+void VGM::_xgm2Prefetch() {
+  while (_xgmPrefetchFrame <= _xgmFrame + XGM_PREFETCH_FRAMES) {
+    const t_xgm2Cmd& c = _xgm2Timeline.cmds[_xgmPrefetchPos++];
+    switch (c.type) {
+      case XGM2_EV_PCM:
+        _xgmPrefetchSample(c.b);
+        break;
+      case XGM2_EV_WAIT:
+        _xgmPrefetchFrame += c.a | (c.b << 8);
+        break;
+      case XGM2_EV_LOOP:
+        _xgmPrefetchPos = _xgm2Timeline.loopIndex;
+        break;
+      case XGM2_EV_END:
+        _xgmPrefetchEnd = true;
+        return;
     }
   }
 }
 
-/**
- * @brief   XGM2 PSG 処理
- *
- * @return true   曲終了
- * @return false  処理を継続
- */
-
-bool VGM::_xgm2ProcessYM() {
-  u8_t port = _getYMPort(_xgm2_ym_pos);
-  u8_t channel = _getYMChannel(_xgm2_ym_pos);
-  u8_t command = ndFile.get_ui8_at(_xgm2_ym_pos++);
-  u8_t reg;
-  u8_t value;
-
-  switch (command) {
-    case FM_LOOP: {
-      u32_t loopOffset = ndFile.get_ui24_at(_xgm2_ym_pos);
-      Serial.printf("0x%x - FM end/loop: offset: %x\n", _xgm2_ym_pos - _xgm2_ym_offset - 1, loopOffset);
-      if (loopOffset == 0xffffff) {
-        return true;  // 曲終了
-      } else {
-        _vgmLoop++;
-        _xgm2_ym_pos = _xgm2_ym_offset + loopOffset;
-
-        Serial.printf("loops: %d\n", _vgmLoop);
-        if (_vgmLoop == ndConfig.get(CFG_NUM_LOOP) &&
-            ndConfig.get(CFG_NUM_LOOP) != LOOP_INIFITE) {  //   フェードアウトON
-          nju72341.startFadeout();
-        }
-      }
-      break;
-    }
-
-    case PCM: {
-      u8_t ch = command & 0b011;
-      bool halfspeed = command & 0b100;
-      u8_t priority = command & 0b1000;
-      u8_t sampleID = ndFile.get_ui8_at(_xgm2_ym_pos++);
-
-      // Serial.printf("PCM Ch: %d, Half: %d, Pr: %d, Id: %d\n", ch, halfspeed, priority, sampleID);
-
-      _xgmSampleId[ch] = sampleID;
-      if (sampleID == 0) {
-        _xgmSampleOn[ch] = false;
-      } else {
-        _xgmSampleOn[ch] = true;
-        _xgmSamplePos[ch] = 0;
-        _xgmPCMHalfSpeed[ch] = halfspeed;
-        _xgmPCMHalfSent[ch] = false;
-      }
-      break;
-    }
-
-    case FM_LOAD_INST: {
-      for (int i = 0x30; i <= 0x9C; i += 0x04) {
-        reg = i + channel;
-        value = ndFile.get_ui8_at(_xgm2_ym_pos++);
-        _xgmYmState[port][reg] = value;
-        FM.setYM2612(port, reg, value, 0);
-      }
-
-      reg = 0xb0 + channel;
-      value = ndFile.get_ui8_at(_xgm2_ym_pos++);
-      _xgmYmState[port][reg] = value;
-      FM.setYM2612(port, reg, value, 0);
-
-      reg = 0xb4 + channel;
-      value = ndFile.get_ui8_at(_xgm2_ym_pos++);
-      _xgmYmState[port][reg] = value;
-      FM.setYM2612(port, reg, value, 0);
-      break;
-    }
-
-    case FM_WRITE: {
-      u8_t comsize = (command & 7) + 1;
-      for (int j = 0; j < comsize; j++) {
-        reg = ndFile.get_ui8_at(_xgm2_ym_pos++);
-        value = ndFile.get_ui8_at(_xgm2_ym_pos++);
-        _xgmYmState[port][reg] = value;
-        FM.setYM2612(port, reg, value, 0);
-      }
-      break;
-    }
-
-    case FM0_PAN:
-    case FM1_PAN: {
-      reg = 0xb4 + channel;
-      value = (_xgmYmState[port][reg] & 0x3f) | ((command << 4) & 0xc0);
-      _xgmYmState[port][reg] = value;
-      FM.setYM2612(port, reg, value, 0);
-      break;
-    }
-
-    case FM_FREQ:
-    case FM_FREQ_WAIT: {
-      // wait
-      if ((command & 0xf0) == 0x80) {
-        _xgmYMFrame++;
-      }
-
-      u8_t data1 = ndFile.get_ui8_at(_xgm2_ym_pos++);
-      u8_t data2 = ndFile.get_ui8_at(_xgm2_ym_pos++);
-
-      // pre-key off?
-      if ((data1 & 0x40) != 0) {
-        FM.setYM2612(0, 0x28, 0x00 + (port << 2) + channel, 0);
-      }
-
-      // special mode ?
-      reg = ((command & 8) != 0) ? 0xa8 : 0xa0;
-      // set channel from slot
-      if ((command & 8) != 0) {
-        channel = _getYMSlot(command) - 1;
-      }
-      u16_t lvalue = ((data1 & 0x3f) << 8) | (data2 & 0xff);
-      _xgmYmState[port][reg + channel + 4] = ((lvalue >> 8) & 0x3f);
-      _xgmYmState[port][reg + channel + 0] = (lvalue & 0xff);
-      FM.setYM2612(port, reg + channel + 4, _xgmYmState[port][reg + channel + 4], 0);
-      FM.setYM2612(port, reg + channel + 0, _xgmYmState[port][reg + channel + 0], 0);
-
-      // post-key on?
-      if ((data1 & 0x80) != 0) {
-        FM.setYM2612(0, 0x28, 0xf0 + (port << 2) + channel, 0);
-      }
-      break;
-    }
-
-    case FM_FREQ_DELTA:
-    case FM_FREQ_DELTA_WAIT: {
-      // wait
-      if ((command & 0xf0) == 0xb0) {
-        _xgmYMFrame++;
-      }
+// ------------------------------------------------------------------------------
+// ループ先の内部 SRAM 配置
+//    ループで戻った直後のコマンドとサンプルは PSRAM (ストリームモードでは SD) から冷えた状態で読まれるので、
+//    ロード時に曲を走査して、ループ先から XGM_PIN_LOOP_FRAMES の間に鳴るサンプルと
+//    発音回数の多いサンプルを XGM_PIN_BUDGET まで内部 SRAM にコピーしておく
+//    XGM2 はタイムラインのループ先 XGM2_PIN_LOOP_EVENTS 個も置く
+
+void VGM::_xgmPinHotData() {
+  u8_t loopIDs[XGM_MAX_SAMPLES];
+  u32_t numLoop;
+  if (XGMVersion == 1) {
+    numLoop = _xgm1ScanSamples(loopIDs);
+  } else if (_xgm2Compiled) {
+    numLoop = _xgm2ScanSamples(loopIDs);
+  } else {
+    return;  // インタープリタ再生は走査しない
+  }
 
-      u8_t data1 = ndFile.get_ui8_at(_xgm2_ym_pos++);
-      // sepecial mode?
-      reg = ((command & 8) != 0) ? 0xa8 : 0xa0;
-      // set channel from slot
-      if ((command & 8) != 0) {
-        channel = _getYMSlot(command) - 1;
-      }
-      // get state
-      u16_t lvalue = (_xgmYmState[port][reg + channel + 4] & 0x3f) << 8;
-      lvalue |= _xgmYmState[port][reg + channel + 0] & 0xff;
-      int delta = ((data1 >> 1) & 0x7f) + 1;
-      delta = ((data1 & 1) != 0) ? -delta : delta;
-      lvalue += delta;
-      _xgmYmState[port][reg + channel + 4] = (lvalue >> 8) & 0x3f;
-      _xgmYmState[port][reg + channel + 0] = lvalue & 0xff;
-      FM.setYM2612(port, reg + channel + 4, _xgmYmState[port][reg + channel + 4], 0);
-      FM.setYM2612(port, reg + channel + 0, _xgmYmState[port][reg + channel + 0], 0);
-      break;
+  // ループ先のサンプルを先に、残りは発音回数の多い順
+  u8_t order[XGM_MAX_SAMPLES];
+  u32_t n = 0;
+  bool listed[XGM_MAX_SAMPLES] = {false};
+  for (u32_t i = 0; i < numLoop; i++) {
+    order[n++] = loopIDs[i];
+    listed[loopIDs[i]] = true;
+  }
+  const u32_t firstHot = n;
+  for (int i = 1; i < XGM_MAX_SAMPLES; i++) {
+    if (!listed[i] && _xgmSampleTable[i].uses > 1) order[n++] = i;
+  }
+  std::sort(order + firstHot, order + n,
+            [this](u8_t a, u8_t b) { return _xgmSampleTable[a].uses > _xgmSampleTable[b].uses; });
+
+  u32_t pinnedLoop = 0, pinnedHot = 0, bytes = 0;
+  for (u32_t i = 0; i < n; i++) {
+    u32_t len = _xgmSampleTable[order[i]].len;
+    if (bytes + len > XGM_PIN_BUDGET) continue;  // 入らないものは飛ばして小さいものを詰める
+    if (!_xgmPinSample(order[i])) break;         // 内部 SRAM の空きが足りない
+    bytes += len;
+    if (i < firstHot) {
+      pinnedLoop++;
+    } else {
+      pinnedHot++;
     }
+  }
 
-    case FM_TL: {
-      u8_t data1 = ndFile.get_ui8_at(_xgm2_ym_pos++);
-      // compute reg
-      reg = 0x40 + (_getYMSlot(command) << 2) + channel;
-      // save state
-      _xgmYmState[port][reg] = (data1 >> 1) & 0x7F;
-      // create commands
-      FM.setYM2612(port, reg, _xgmYmState[port][reg], 0);
-      break;
+  // XGM2 タイムラインのループ先
+  if (_xgm2Compiled && _xgm2Timeline.loops()) {
+    u32_t len = _xgm2Timeline.len - _xgm2Timeline.loopIndex;
+    if (len > XGM2_PIN_LOOP_EVENTS) len = XGM2_PIN_LOOP_EVENTS;
+    if (heap_caps_get_free_size(MALLOC_CAP_INTERNAL) > XGM_PIN_HEAP_RESERVE + len * sizeof(t_xgm2Cmd)) {
+      _xgm2LoopPin = (t_xgm2Cmd*)heap_caps_malloc(len * sizeof(t_xgm2Cmd), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
     }
-
-    case FM_TL_DELTA:
-    case FM_TL_DELTA_WAIT: {
-      // wait
-      if ((command & 0xf0) == 0xd0) {
-        _xgmYMFrame++;
-      }
-
-      u8_t data1 = ndFile.get_ui8_at(_xgm2_ym_pos++);
-      // compute reg
-      reg = 0x40 + (_getYMSlot(command) << 2) + channel;
-
-      int delta = ((data1 >> 2) & 0x3f) + 1;
-      delta = ((data1 & 2) != 0) ? -delta : delta;
-
-      // get state
-      int lvalue = _xgmYmState[port][reg] & 0xff;
-      lvalue += delta;
-      // save state
-      _xgmYmState[port][reg] = lvalue;
-      // create commands
-      FM.setYM2612(port, reg, _xgmYmState[port][reg], 0);
-      break;
+    if (_xgm2LoopPin) {
+      memcpy(_xgm2LoopPin, &_xgm2Timeline.cmds[_xgm2Timeline.loopIndex], len * sizeof(t_xgm2Cmd));
+      _xgm2LoopPinLen = len;
     }
+  }
 
-    case FM_KEY: {
-      FM.setYM2612(0, 0x28, (((command & 8) != 0) ? 0xf0 : 0x00) + (port << 2) + channel, 0);
-      break;
-    }
+  ndLog.printf("XGM: pinned %u loop + %u hot samples (%u bytes), %u loop events\n", pinnedLoop, pinnedHot, bytes,
+               _xgm2LoopPinLen);
+}
 
-    case FM_KEY_SEQ: {
-      // create key sequence commands
-      if ((command & 8) != 0) {
-        // ON-OFF sequence
-        FM.setYM2612(0, 0x28, 0xf0 + (port << 2) + channel, 0);
-        FM.setYM2612(0, 0x28, 0x00 + (port << 2) + channel, 0);
-      } else {
-        // OFF-ON sequence
-        FM.setYM2612(0, 0x28, 0x00 + (port << 2) + channel, 0);
-        FM.setYM2612(0, 0x28, 0xf0 + (port << 2) + channel, 0);
+// XGM1: 曲全体の発音回数を数え、ループ先から鳴るサンプルを loopIDs に並べる
+// 戻り値: loopIDs の数
+u32_t VGM::_xgm1ScanSamples(u8_t* loopIDs) {
+  const u32_t start = _xgmMusicOffset + 4;
+  const u32_t end = start + XGM_MLEN;
+  u32_t loopTarget = 0;
+  u32_t numLoop = 0;
+
+  // 1 周目: 終了 / ループまで数える
+  // 2 周目: ループ先から XGM_PIN_LOOP_FRAMES の間のサンプルを集める
+  for (int pass = 0; pass < 2; pass++) {
+    u32_t pos = pass ? loopTarget : start;
+    u32_t frames = 0;
+    bool done = false;
+    while (!done && pos < end && (pass == 0 || frames < XGM_PIN_LOOP_FRAMES)) {
+      u8_t command = ndFile.get_ui8_at(pos++);
+      switch (command) {
+        case 0x00:
+          frames++;
+          break;
+        case 0x10 ... 0x1f:
+        case 0x40 ... 0x4f:
+          pos += command % 16 + 1;
+          break;
+        case 0x20 ... 0x3f:
+          pos += (command % 16 + 1) * 2;
+          break;
+        case 0x50 ... 0x5f: {
+          u8_t id = ndFile.get_ui8_at(pos++);
+          if (id == 0 || id >= XGM_MAX_SAMPLES || !_xgmSampleTable[id].len) break;
+          if (pass == 0) {
+            _xgmSampleTable[id].uses++;
+          } else if (std::find(loopIDs, loopIDs + numLoop, id) == loopIDs + numLoop) {
+            loopIDs[numLoop++] = id;
+          }
+          break;
+        }
+        case 0x7e:
+          if (pass == 0) loopTarget = start + ndFile.get_ui24_at(pos);
+          done = true;
+          break;
+        case 0x7f:
+          done = true;
+          break;
       }
-      break;
-    }
-
-    case FM_DAC_ON: {
-      _xgmYmState[0][0x2b] = 0x80;
-      FM.setYM2612(0, 0x2b, 0x80, 0);
-      break;
-    }
-
-    case FM_DAC_OFF: {
-      _xgmYmState[0][0x2b] = 0x00;
-      FM.setYM2612(0, 0x2b, 0x00, 0);
-      break;
-    }
-
-    case FM_LFO: {
-      u8_t data1 = ndFile.get_ui8_at(_xgm2_ym_pos++);
-      _xgmYmState[0][0x22] = data1;
-      FM.setYM2612(0, 0x22, _xgmYmState[0][0x22], 0);
-      break;
     }
+    if (!loopTarget) break;  // ループしない
+  }
+  return numLoop;
+}
 
-    case FM_CH3_SPECIAL_ON: {
-      value = (_xgmYmState[0][0x27] & 0xbf) | 0x40;
-      _xgmYmState[0][0x27] = value;
-      FM.setYM2612(0, 0x27, value, 0);
-      break;
-    }
+// XGM2: タイムラインから同様に集める
+u32_t VGM::_xgm2ScanSamples(u8_t* loopIDs) {
+  u32_t numLoop = 0;
+  u32_t frame = 0, loopFrame = 0;
+  bool loops = false;
 
-    case FM_CH3_SPECIAL_OFF: {
-      value = (_xgmYmState[0][0x27] & 0xbf) | 0x00;
-      _xgmYmState[0][0x27] = value;
-      FM.setYM2612(0, 0x27, value, 0);
+  for (u32_t i = 0; i < _xgm2Timeline.len; i++) {
+    const t_xgm2Cmd& c = _xgm2Timeline.cmds[i];
+    if (i == _xgm2Timeline.loopIndex) loopFrame = frame;
+    if (c.type == XGM2_EV_WAIT) {
+      frame += c.a | (c.b << 8);
+    } else if (c.type == XGM2_EV_PCM) {
+      if (c.b && c.b < XGM_MAX_SAMPLES && _xgmSampleTable[c.b].len) _xgmSampleTable[c.b].uses++;
+    } else if (c.type == XGM2_EV_LOOP) {
+      loops = true;
       break;
     }
+  }
+  if (!loops) return 0;
 
-    case WAIT_SHORT: {
-      _xgmYMFrame += command + 1;
-      break;
-    }
-    case WAIT_LONG: {
-      _xgmYMFrame += ndFile.get_ui8_at(_xgm2_ym_pos++) + 16;
+  frame = loopFrame;
+  for (u32_t i = _xgm2Timeline.loopIndex; i < _xgm2Timeline.len && frame < loopFrame + XGM_PIN_LOOP_FRAMES; i++) {
+    const t_xgm2Cmd& c = _xgm2Timeline.cmds[i];
+    if (c.type == XGM2_EV_WAIT) {
+      frame += c.a | (c.b << 8);
+    } else if (c.type == XGM2_EV_PCM) {
+      u8_t id = c.b;
+      if (!id || id >= XGM_MAX_SAMPLES || !_xgmSampleTable[id].len) continue;
+      if (std::find(loopIDs, loopIDs + numLoop, id) == loopIDs + numLoop) loopIDs[numLoop++] = id;
+    } else if (c.type == XGM2_EV_LOOP) {
       break;
     }
+  }
+  return numLoop;
+}
 
-    case FRAME_DELAY: {
-      break;
-    }
+// サンプルを内部 SRAM にコピーして以後そちらを鳴らす
+// 戻り値: false = 内部 SRAM の空きが足りない
+bool VGM::_xgmPinSample(u8_t sampleID) {
+  t_xgmSample& s = _xgmSampleTable[sampleID];
+  if (heap_caps_get_free_size(MALLOC_CAP_INTERNAL) < XGM_PIN_HEAP_RESERVE + s.len) return false;
+  int8_t* p = (int8_t*)heap_caps_malloc(s.len, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  if (!p) return false;
 
-    default: {
-      Serial.printf("Unknown XGM2 command: 0x%0x @ 0x%0x\n", command, _xgm2_ym_pos);
+  if (s.data) {
+    memcpy(p, s.data, s.len);
+  } else {
+    // ストリームモード: ページキャッシュ経由で読む
+    u32_t done = 0;
+    while (done < s.len) {
+      u32_t avail;
+      const u8_t* src = xgmPages.get(s.addr + done, &avail);
+      if (!src) {
+        free(p);
+        return true;  // 読めないサンプルは置かずに次へ
+      }
+      if (avail > s.len - done) avail = s.len - done;
+      memcpy(p + done, src, avail);
+      xgmPages.release(src);
+      done += avail;
     }
   }
-
-  return false;
+  s.pinned = p;
+  s.data = p;
+  return true;
 }
 
-// XGM 2 port and channel
-int VGM::_getYMPort(u32_t pos) {
-  u8_t command = ndFile.get_ui8_at(pos);
-  switch (command) {
-    case FM0_PAN:
-      return 0;
-    case FM1_PAN:
-      return 1;
-    case FM_LOAD_INST:
-    case FM_FREQ:
-    case FM_FREQ_WAIT:
-    case FM_FREQ_DELTA:
-    case FM_FREQ_DELTA_WAIT:
-    case FM_KEY:
-    case FM_KEY_SEQ:
-      return (command >> 2) & 1;
-    case FM_WRITE:
-      return (command >> 3) & 1;
-    case FM_TL:
-    case FM_TL_DELTA:
-    case FM_TL_DELTA_WAIT:
-      return (ndFile.get_ui8_at(pos + 1) >> 0) & 1;
-    case FM_KEY_ADV:
-      return (ndFile.get_ui8_at(pos + 1) >> 2) & 1;
-  }
-  return 0;
+// デコーダからの PCM コマンド
+void VGM::_xgmPCMCommand(u8_t command, u8_t sampleID) {
+  if (XGMVersion == 1) {
+    _xgmStartSample(command & 0x3, command & 0xc, sampleID, false);
+  } else {
+    _xgm2StartPCM(command, sampleID);
+  }
 }
 
-int VGM::_getYMChannel(u32_t pos) {
-  u8_t command = ndFile.get_ui8_at(pos);
-  switch (command) {
-    case FM_FREQ:
-    case FM_FREQ_WAIT:
-    case FM_FREQ_DELTA:
-    case FM_FREQ_DELTA_WAIT:
-      if ((command & 8) != 0) return 2;
-    case FM_LOAD_INST:
-    case FM_KEY:
-    case FM_KEY_SEQ:
-    case FM_TL:
-    case FM_TL_DELTA:
-    case FM_TL_DELTA_WAIT:
-    case FM0_PAN:
-    case FM1_PAN:
-      return (command & 3);
-    case FM_WRITE:
-      if ((ndFile.get_ui8_at(pos + 1) & 0xF8) == 0xA8) return 2;
-    case FM_KEY_ADV:
-      return (ndFile.get_ui8_at(pos + 1) & 3);
-  }
-  return -1;
-}
+// PCM 開始 / 停止 (command: 下位 4 ビット = 優先度, 半速, チャンネル)
+void VGM::_xgm2StartPCM(u8_t command, u8_t sampleID) {
+  u8_t ch = command & 0b0011;
+  bool halfspeed = command & 0b0100;
+  u8_t priority = (command >> 3) & 1;
 
-int VGM::_getYMSlot(u8_t command) {
-  switch (command) {
-    case FM_FREQ:
-    case FM_FREQ_WAIT:
-    case FM_FREQ_DELTA:
-    case FM_FREQ_DELTA_WAIT:
-      return ((command & 8) != 0) ? ((command & 3) + 1) : -1;
-    case FM_TL:
-    case FM_TL_DELTA:
-    case FM_TL_DELTA_WAIT:
-      return ((command >> 2) & 3);
-  }
-  return -1;
+  _xgmStartSample(ch, priority, sampleID, halfspeed);
 }
 
-/**
- * @brief SN76489 command processing
- *
- * @return true  End of music data
- * @return false  Continue processing
- */
-bool VGM::_xgm2ProcessSN() {
-  u8_t channel = _getChannel(_xgm2_psg_pos);
-  u8_t command = ndFile.get_ui8_at(_xgm2_psg_pos++);
-  u8_t reg;
-  u8_t value;
-
-  switch (command) {
-    int oldHighFreq;
-
-    case PSG_LOOP: {
-      u32_t loopOffset = ndFile.get_ui24_at(_xgm2_psg_pos);
-      // Serial.printf("0x%x - PSG end/loop: offset: %x\n", _xgm2_psg_pos - _xgm2_psg_offset - 1, loopOffset);
-      if (loopOffset == 0xFFFFFF) {
-        return true;  // 処理終了
-      } else {
-        _xgm2_psg_pos = _xgm2_psg_offset + loopOffset;
-      }
-      break;
-    }
-
-    case PSG_ENV0:
-    case PSG_ENV1:
-    case PSG_ENV2:
-    case PSG_ENV3: {
-      _xgmPsgState[0][channel] = command & 0x0f;
-      value = (0x90 + (channel << 5)) | _xgmPsgState[0][channel];
-      // Serial.printf("0x%x - %2x: PSG ENV ch %d 0x%x\n", _xgm2_psg_pos - _xgm2_psg_offset - 1, command, channel,
-      // value);
-      FM.writeRaw(value, 1, freq[chipSlot[CHIP_SN76489_0]]);
-      break;
-    }
-
-    case PSG_ENV0_DELTA:
-    case PSG_ENV1_DELTA:
-    case PSG_ENV2_DELTA:
-    case PSG_ENV3_DELTA: {
-      // wait
-      if ((command & 0x08)) {
-        _xgmPSGFrame++;
-      }
-
-      int delta = ((command >> 0) & 3) + 1;
-      delta = ((command & 4) != 0) ? -delta : delta;
-      _xgmPsgState[0][channel] = delta + (_xgmPsgState[0][channel] & 0xf);
-      value = (0x90 + (channel << 5)) | _xgmPsgState[0][channel];
-      // Serial.printf("0x%x - %2x: PSG ENV DELTA ch %d 0x%x\n", _xgm2_psg_pos - _xgm2_psg_offset - 1, command,
-      // channel,
-      //              value);
-      FM.writeRaw(value, 1, freq[chipSlot[CHIP_SN76489_0]]);
-      break;
-    }
-
-    case PSG_FREQ:
-    case PSG_FREQ_WAIT: {
-      // wait
-      if ((command & 0xf0) == 0x30) {
-        _xgmPSGFrame++;
-      }
-
-      u8_t data1 = ndFile.get_ui8_at(_xgm2_psg_pos++);
-      oldHighFreq = _xgmPsgState[1][channel] & 0x03f0;
-      int lvalue = ((command & 0x3) << 8) | (data1 & 0xFF);
-
-      _xgmPsgState[1][channel] = lvalue;
-
-      // Workaround for Sega VDP and SN76489
-      // value = (0x80 + (channel << 5)) | (lvalue & 0x0f);
-      if (lvalue == 0) {
-        value = ((0x80 + (channel << 5)) | 1);
-      } else {
-        value = ((0x80 + (channel << 5)) | (lvalue & 0x0f));
-      }
-      FM.writeRaw(value, 1, freq[chipSlot[CHIP_SN76489_0]]);
-
-      // Always send High value for SN76489
-      //      if ((oldHighFreq != (lvalue & 0x3F0)) && (channel < 3)) {
-      if (channel < 3) {
-        value = (0x00 | ((lvalue >> 4) & 0x3f));
-        // Serial.printf("   PSG_FREQ+ ch %d 0x%0x\n", channel, value);
-        FM.writeRaw(value, 1, freq[chipSlot[CHIP_SN76489_0]]);
-      }
-      break;
-    }
-
-    case PSG_FREQ_LOW: {
-      // wait
-      if ((command & 0x1)) {
-        _xgmPSGFrame++;
-      }
-
-      oldHighFreq = _xgmPsgState[1][channel] & 0x03f0;
-
-      u8_t data1 = ndFile.get_ui8_at(_xgm2_psg_pos++);
-      int lvalue = (_xgmPsgState[1][channel] & 0x03f0) | (data1 & 0xF);
-      _xgmPsgState[1][channel] = lvalue;
-      if (lvalue == 0) {
-        value = ((0x80 + (channel << 5)) | 1);
-      } else {
-        value = ((0x80 + (channel << 5)) | (lvalue & 0x0f));
-      }
-      FM.writeRaw(value, 1, freq[chipSlot[CHIP_SN76489_0]]);
-      // Serial.printf("0x%x - %2x: PSG_FREQ_LOW ch %d 0x%x\n", _xgm2_psg_pos - _xgm2_psg_offset - 2, command,
-      // channel,
-      //               value);
+// ------------------------------------------------------------------------------
+// XGM2 タイムラインのコンパイル (lib/xgm/xgm2timeline)
+//    作業用も含めて PSRAM の空きから XGM2_TIMELINE_PSRAM_RESERVE を引いた分までで作り、
+//    大きすぎる・確保できない・ループが収束しないときはインタープリタで再生する
+
+bool VGM::_xgm2Compile() {
+  _xgm2Compiled = false;
+  _xgm2Cursor = 0;
+
+  // 再生用のデコーダはそのまま (先頭) にしておいて、コピーを走らせる
+  u32_t start = millis();
+  _xgm2Timeline.clear();  // 前の曲の分も空きに数える
+  u32_t freePsram = ESP.getFreePsram();
+  size_t budget = freePsram > XGM2_TIMELINE_PSRAM_RESERVE ? freePsram - XGM2_TIMELINE_PSRAM_RESERVE : 0;
+  _xgm2Timeline.alloc = ps_malloc;
+  if (!_xgm2Timeline.compile(_xgm2, budget)) {
+    ndLog.printf("XGM2: timeline not available (PSRAM budget %u bytes), using interpreter.\n", budget);
+    return false;
+  }
 
-      break;
-    }
+  _xgm2Compiled = true;
+  const XGM2Timeline& t = _xgm2Timeline;
+  ndLog.printf("XGM2: timeline %u events (FM %u, PSG %u) in %u ms\n", t.len, t.fmInfo.events, t.psgInfo.events,
+               millis() - start);
+  if (t.fmInfo.loops) {
+    ndLog.printf("XGM2: loop FM 0x%x / PSG 0x%x -> event %u (frame %u)\n", t.fmInfo.loopOffset,
+                 t.psgInfo.loopOffset, t.loopIndex, t.fmInfo.loopFrame);
+  }
+  return true;
+}
 
-    case PSG_FREQ0_DELTA:
-    case PSG_FREQ1_DELTA:
-    case PSG_FREQ2_DELTA:
-    case PSG_FREQ3_DELTA: {
-      // wait
-      if ((command & 0x08)) {
-        _xgmPSGFrame++;
-      }
+// remain: フレーム終わりまでに出せるおおよそのサンプル数
+// まとめてミックスしておき、呼ばれるたびに 1 サンプルずつ出す
+void VGM::_xgm2ProcessPCM(u32_t remain) {
+  if (_xgm2PCMBufPos >= _xgm2PCMBufLen) {
+    u32_t n = remain < 1 ? 1 : remain;
+    if (n > XGM2_PCM_BLOCK) n = XGM2_PCM_BLOCK;
+    _xgm2MixBlock(_xgm2PCMBuf, n);
+    _xgm2PCMBufLen = n;
+    _xgm2PCMBufPos = 0;
+  }
 
-      oldHighFreq = _xgmPsgState[1][channel] & 0x03f0;
-      int delta = ((command >> 0) & 3) + 1;
-      delta = ((command & 4) != 0) != 0 ? -delta : delta;
-      int lvalue = (_xgmPsgState[1][channel] & 0x03ff) + delta;
-      _xgmPsgState[1][channel] = lvalue;
+  u16_t v = _xgm2PCMBuf[_xgm2PCMBufPos++];
+  if (v != PCM_MIX_SKIP && _pcmEnabled) {
+    chipBus->setYM2612DAC(v, 0);
+  }
+}
 
-      // Workaround for Sega VDP and SN76489
-      // value = (0x80 + (channel << 5)) | (lvalue & 0x0f);
-      if (lvalue == 0) {
-        value = ((0x80 + (channel << 5)) | 1);
-      } else {
-        value = ((0x80 + (channel << 5)) | (lvalue & 0x0f));
-      }
+void VGM::_xgm2MixBlock(u16_t* out, u32_t n) {
+  alignas(16) int16_t acc[PCM_MIX_BLOCK];
+  u8_t hit[PCM_MIX_BLOCK];
 
-      FM.writeRaw(value, 1, freq[chipSlot[CHIP_SN76489_0]]);
-      // Serial.printf("0x%x - %2x: PSG FREQ DELTA ch %d 0x%x\n", _xgm2_psg_pos - _xgm2_psg_offset - 1, command,
-      // channel,
-      //              value);
-
-      // high byte changed and not channel 3 (single byte write for channel 3)
-      if ((oldHighFreq != (lvalue & 0x3f0)) && (channel < 3)) {
-        // if (channel < 3) {
-        value = (0x00 | ((lvalue >> 4) & 0x3f));
-        FM.writeRaw(value, 1, freq[chipSlot[CHIP_SN76489_0]]);
-        // Serial.printf(" %2x: PSG_FREQ_DELTA+ ch %d 0x%x\n", command, channel, value);
-      }
-      break;
+  pcmMixClear(acc, hit, n);
+  for (u8_t m = _xgmVoices.active; m; m &= m - 1) {
+    u8_t ch = __builtin_ctz(m);
+    if (_xgmMixSample(acc, hit, n, ch)) {
+      _xgmVoices.stop(ch);
     }
+  }
+  pcmMixOut(acc, hit, out, n);
+}
 
-    case PSG_WAIT_SHORT: {
-      _xgmPSGFrame += command + 1;
-      break;
-    }
-    case PSG_WAIT_LONG: {
-      _xgmPSGFrame += ndFile.get_ui8_at(_xgm2_psg_pos++) + 15;
+// XGM2 インタープリタ (lib/xgm)
+// 戻り値: 曲終了
+bool VGM::_xgm2ProcessYM() {
+  switch (_xgm2.stepFM(xgmSink)) {
+    case XGM_STEP_LOOP:
+      ndLog.printf("FM loop: offset: %x\n", _xgm2.fmLoop);
+      _xgmCountLoop();
       break;
-    }
+    case XGM_STEP_END:
+      return true;
   }
   return false;
 }
 
-u8_t VGM::_getChannel(u32_t pos) {
-  u8_t command = ndFile.get_ui8_at(pos);
-  switch (command) {
-    case PSG_ENV0:
-    case PSG_ENV0_DELTA:
-    case PSG_FREQ0_DELTA:
-      return 0;
-    case PSG_ENV1:
-    case PSG_ENV1_DELTA:
-    case PSG_FREQ1_DELTA:
-      return 1;
-    case PSG_ENV2:
-    case PSG_ENV2_DELTA:
-    case PSG_FREQ2_DELTA:
-      return 2;
-    case PSG_ENV3:
-    case PSG_ENV3_DELTA:
-    case PSG_FREQ3_DELTA:
-      return 3;
-    case PSG_FREQ:
-    case PSG_FREQ_WAIT:
-      return ((command >> 2) & 3);
-    case PSG_FREQ_LOW:
-      return ((ndFile.get_ui8_at(pos + 1) >> 5) & 3);
-  }
-  return 255;
-}
+bool VGM::_xgm2ProcessSN() { return _xgm2.stepPSG(xgmSink) == XGM_STEP_END; }
 
 //---------------------------------------------------------------
 // 曲終了時の処理
 void VGM::endProcedure() {
+  bool wasXGM = xgmLoaded;
   xgmLoaded = false;
   vgmLoaded = false;
 
+  if (_xgmPCMTimer) {
+    chipBus->stopDACTimer();
+    _xgmPCMTimer = false;
+    if (_xgmPCMUnderruns) {
+      ndLog.printf("XGM PCM: %u underruns\n", _xgmPCMUnderruns);
+    }
+  }
+
+  if (wasXGM) {
+    ndLog.printf("XGM PCM: %u started, %u stopped, %u stolen, %u dropped\n", _xgmVoices.started,
+                 _xgmVoices.stopped, _xgmVoices.steals, _xgmVoices.drops);
+  }
+  if (ndFile.accessMode == ACCESS_STREAM) {
+    xgmPages.printStats();
+  }
+  _endRecording();
+
+  // シリアルモードのアップロード曲は 1 曲だけ
+  if (ndConfig.currentMode == MODE_SERIAL) {
+    serialModeDraw();
+    return;
+  }
+
   switch (ndConfig.get(CFG_REPEAT)) {
     case REPEAT_ONE: {
       ndFile.filePlay(0);
@@ -1910,7 +1944,8 @@ void VGM::endProcedure() {
       break;
     }
     case REPEAT_ALL: {
-      if (ndFile.getNumFilesinCurrentDir() - 1 == ndFile.currentFile)
+      bool lastTrack = !wasXGM || xgmTrack + 1 >= xgmNumTracks;
+      if (ndFile.getNumFilesinCurrentDir() - 1 == ndFile.currentFile && lastTrack)
         ndFile.dirPlay(1);
       else
         ndFile.filePlay(1);
@@ -1919,6 +1954,26 @@ void VGM::endProcedure() {
   }
 }
 
+void VGM::stop() {
+  xgmLoaded = false;
+  vgmLoaded = false;
+  if (_xgmPCMTimer) {
+    chipBus->stopDACTimer();
+    _xgmPCMTimer = false;
+  }
+  _endRecording();
+}
+
+// 曲ごとのトレース / WAV を閉じる (次の曲の begin() を待たずにファイルを確定する)
+void VGM::_endRecording() {
+#ifdef USE_CHIPBUS_TRACE
+  chipTrace.end();
+#endif
+#ifdef USE_CHIPBUS_SYNTH
+  chipSynth.end();
+#endif
+}
+
 u64_t VGM::getCurrentTime() {
   if (_vgmSamples >= 264600000) _vgmSamples = 0;
   return _vgmSamples / 44100;
@@ -1929,4 +1984,7 @@ s64_t VGM::micros64() {
   return esp_timer_get_time();
 }
 
+// CFG_FMPCM を読み直す (設定変更時)
+void VGM::updateConfig() { _pcmEnabled = ndConfig.get(CFG_FMPCM) != FMPCM_FM; }
+
 VGM vgm = VGM();
@@ -0,0 +1,261 @@
+#include "vgmcapture.h"
+
+#include <SD.h>
+#include <esp_timer.h>
+
+#include <vector>
+
+#include "file.h"
+#include "ndlog.h"
+
+// ------------------------------------------------------------------------------
+// シリアルモードの VGM 記録
+
+bool VGMCapture::begin(u32_t ym2612Clock, u32_t sn76489Clock) {
+  end();
+
+  if (!ndFile.mountSD()) {
+    ndLog.println("ERROR: SD card not available for capture.");
+    return false;
+  }
+
+  if (!_buf[0]) {
+    _buf[0] = (u8_t*)ps_malloc(CAPTURE_BUFFER_SIZE);
+    _buf[1] = (u8_t*)ps_malloc(CAPTURE_BUFFER_SIZE);
+    if (!_buf[0] || !_buf[1]) {
+      ndLog.println("ERROR: Capture buffer allocation failed.");
+      free(_buf[0]);
+      free(_buf[1]);
+      _buf[0] = _buf[1] = NULL;
+      return false;
+    }
+  }
+  if (!_mutex) {
+    _mutex = xSemaphoreCreateMutex();
+    _queue = xQueueCreate(2, sizeof(u8_t));
+    if (!_mutex || !_queue) {
+      ndLog.println("ERROR: Capture queue create failed!");
+      return false;
+    }
+    xTaskCreatePinnedToCore(_writerTask, "vgmCapture", 4096, this, 1, NULL, PRO_CPU_NUM);
+  }
+
+  // 空いている番号
+  if (!SD.exists(CAPTURE_DIR)) SD.mkdir(CAPTURE_DIR);
+  char name[32];
+  int no;
+  for (no = 1; no < 10000; no++) {
+    snprintf(name, sizeof(name), CAPTURE_DIR "/cap%04d.vgm", no);
+    if (!SD.exists(name)) break;
+  }
+  if (no == 10000) {
+    ndLog.println("ERROR: No free capture file name.");
+    return false;
+  }
+
+  _file = SD.open(name, FILE_WRITE);
+  if (!_file) {
+    ndLog.printf("ERROR: Failed to open capture file: %s\n", name);
+    return false;
+  }
+  path = name;
+
+  // ヘッダは停止時に書き直す
+  u8_t header[CAPTURE_HEADER_SIZE] = {0};
+  _file.write(header, sizeof(header));
+
+  xSemaphoreTake(_mutex, portMAX_DELAY);
+  _active = 0;
+  _fill = 0;
+  bytes = dropped = maxStallUs = writeUs = 0;
+  _ym2612Clock = ym2612Clock;
+  _sn76489Clock = sn76489Clock;
+  _usedYM2612 = _usedYM2203 = _usedSN[0] = _usedSN[1] = false;
+  _lastSample = 0;
+  _startUs = esp_timer_get_time();
+  _recording = true;
+  xSemaphoreGive(_mutex);
+
+  ndLog.printf("Capture: %s\n", name);
+  return true;
+}
+
+void VGMCapture::end() {
+  if (!_recording) return;
+
+  xSemaphoreTake(_mutex, portMAX_DELAY);
+  _recording = false;
+  u32_t total = (esp_timer_get_time() - _startUs) * 44100 / 1000000;
+  xSemaphoreGive(_mutex);
+
+  // ここからは記録タスクと競合しない。最後の待ちと終了コマンドを足して全部書く
+  _waitIdle();
+  _putWait(total);
+  const u8_t eod = 0x66;
+  _put(&eod, 1);
+  _waitIdle();
+  _submit();
+  _waitIdle();
+
+  u32_t gd3Offset = _file.position();
+  u32_t eofOffset = gd3Offset + _writeGD3();
+  _writeHeader(gd3Offset, eofOffset, total);
+  _file.close();
+
+  ndLog.printf("Capture: %s, %u bytes, %u dropped, max stall %u us, %.1f KB/s\n", path.c_str(), bytes, dropped,
+               maxStallUs, writeUs ? (float)bytes * 1000000.0f / writeUs / 1024.0f : 0.0f);
+}
+
+void VGMCapture::_write(u8_t command, u8_t a, u8_t b, u8_t len) {
+  // begin / end が持つのは状態の切り替えの間だけなので少し待てば取れる
+  // 取れなければ記録を捨てて数える (チップへの書き込みは止めない)
+  if (xSemaphoreTake(_mutex, pdMS_TO_TICKS(CAPTURE_LOCK_MS)) != pdTRUE) {
+    dropped += len;
+    return;
+  }
+  if (_recording) {
+    u32_t sample = (esp_timer_get_time() - _startUs) * 44100 / 1000000;
+    const u8_t cmd[3] = {command, a, b};
+    if (_putWait(sample) && _put(cmd, len)) {
+      switch (command) {
+        case 0x52:
+        case 0x53:
+          _usedYM2612 = true;
+          break;
+        case 0x55:
+          _usedYM2203 = true;
+          break;
+        case 0x50:
+          _usedSN[0] = true;
+          break;
+        case 0x30:
+          _usedSN[1] = true;
+          break;
+      }
+    }
+  }
+  xSemaphoreGive(_mutex);
+}
+
+// 前の書き込みから sample までの待ちをまとめて書く
+// 戻り値: 全部書けた (書けなかった分は次の書き込みに持ち越す)
+bool VGMCapture::_putWait(u32_t sample) {
+  while (sample != _lastSample) {
+    u32_t w = sample - _lastSample;
+    if (w > 0xffff) w = 0xffff;
+    u8_t cmd[3];
+    u32_t n = 1;
+    if (w == 735) {
+      cmd[0] = 0x62;
+    } else if (w == 882) {
+      cmd[0] = 0x63;
+    } else if (w <= 16) {
+      cmd[0] = 0x70 + w - 1;
+    } else {
+      cmd[0] = 0x61;
+      cmd[1] = w & 0xff;
+      cmd[2] = w >> 8;
+      n = 3;
+    }
+    if (!_put(cmd, n)) return false;
+    _lastSample += w;
+  }
+  return true;
+}
+
+bool VGMCapture::_put(const u8_t* p, u32_t n) {
+  if (_fill + n > CAPTURE_BUFFER_SIZE) {
+    if (_busy) {
+      // もう一方の面がまだ書けていない
+      dropped += n;
+      return false;
+    }
+    _submit();
+  }
+  memcpy(_buf[_active] + _fill, p, n);
+  _fill += n;
+  bytes += n;
+  return true;
+}
+
+// 記録中の面を書き込みタスクに渡して、もう一方の面に切り替える (_busy でないときだけ呼ぶ)
+void VGMCapture::_submit() {
+  if (_fill == 0) return;
+  _busy = true;
+  _len = _fill;
+  u8_t index = _active;
+  xQueueSend(_queue, &index, 0);
+  _active ^= 1;
+  _fill = 0;
+}
+
+void VGMCapture::_waitIdle() {
+  while (_busy) {
+    vTaskDelay(1);
+  }
+}
+
+static void putU32(u8_t* p, u32_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+void VGMCapture::_writeHeader(u32_t gd3Offset, u32_t eofOffset, u32_t totalSamples) {
+  u8_t h[CAPTURE_HEADER_SIZE] = {0};
+  memcpy(h, "Vgm ", 4);
+  putU32(&h[0x04], eofOffset - 0x04);
+  putU32(&h[0x08], 0x151);
+  if (_usedSN[0] || _usedSN[1]) {
+    putU32(&h[0x0c], _sn76489Clock | (_usedSN[1] ? 0x40000000 : 0));  // 0x30 を使ったら 2 台
+  }
+  putU32(&h[0x14], gd3Offset - 0x14);
+  putU32(&h[0x18], totalSamples);
+  h[0x28] = 0x09;  // SN76489 feedback (Sega VDP)
+  h[0x2a] = 16;    // SN76489 shift register width
+  if (_usedYM2612) putU32(&h[0x2c], _ym2612Clock);
+  putU32(&h[0x34], CAPTURE_HEADER_SIZE - 0x34);
+  if (_usedYM2203) putU32(&h[0x44], _ym2612Clock);  // 0x55 は YM2612 と同じスロット (クロック 0)
+  _file.seek(0);
+  _file.write(h, sizeof(h));
+}
+
+// GD3 を書く。戻り値: バイト数
+u32_t VGMCapture::_writeGD3() {
+  const char* tags[11] = {"Serial capture", "", "", "", "NanoDrive serial mode", "", "", "", "", "NanoDrive",
+                          path.c_str()};
+  std::vector<u8_t> body;
+  for (const char* t : tags) {
+    for (; *t; t++) {
+      body.push_back(*t);  // ASCII だけなので UTF-16LE の下位バイト
+      body.push_back(0);
+    }
+    body.push_back(0);
+    body.push_back(0);
+  }
+  u8_t h[12];
+  memcpy(h, "Gd3 ", 4);
+  putU32(&h[4], 0x100);
+  putU32(&h[8], body.size());
+  _file.write(h, sizeof(h));
+  _file.write(body.data(), body.size());
+  return sizeof(h) + body.size();
+}
+
+void VGMCapture::_writerTask(void* param) {
+  VGMCapture* self = (VGMCapture*)param;
+  u8_t index;
+  while (1) {
+    if (xQueueReceive(self->_queue, &index, portMAX_DELAY) == pdTRUE) {
+      u64_t start = esp_timer_get_time();
+      self->_file.write(self->_buf[index], self->_len);
+      u32_t us = esp_timer_get_time() - start;
+      self->writeUs += us;
+      if (us > self->maxStallUs) self->maxStallUs = us;
+      self->_busy = false;
+    }
+  }
+}
+
+VGMCapture vgmCapture;
@@ -0,0 +1,221 @@
+#include "xgmpages.h"
+#include "ndlog.h"
+
+#include <SD.h>
+
+#define PAGE_NONE 0xffffffff
+
+static SemaphoreHandle_t _fileMutex;  // 先読み用ファイルの排他 (begin/end との競合防止)
+
+// ------------------------------------------------------------------------------
+// XGM サンプルバンクのページキャッシュ
+
+bool XGMPageCache::begin(String path, u32_t base, u32_t size) {
+  end();
+
+  if (!_pages) {
+    _pages = (u8_t*)ps_malloc(XGM_NUM_PAGES * XGM_PAGE_SIZE);
+    if (!_pages) {
+      ndLog.println("ERROR: XGM page cache allocation failed.");
+      return false;
+    }
+  }
+  if (!_mutex) {
+    _mutex = xSemaphoreCreateMutex();
+    _fileMutex = xSemaphoreCreateMutex();
+    _queue = xQueueCreate(XGM_PREFETCH_QUEUE, sizeof(u32_t));
+    if (!_mutex || !_fileMutex || !_queue) {
+      ndLog.println("ERROR: XGM page cache queue create failed!");
+      return false;
+    }
+    xTaskCreatePinnedToCore(_prefetchTask, "xgmPrefetch", 4096, this, 1, NULL, PRO_CPU_NUM);
+  }
+
+  xSemaphoreTake(_fileMutex, portMAX_DELAY);
+  _file = SD.open(path.c_str());
+  _prefetchFile = SD.open(path.c_str());
+  if (!_file || !_prefetchFile) {
+    ndLog.printf("ERROR: Failed to open XGM stream file: %s\n", path.c_str());
+    _file.close();
+    _prefetchFile.close();
+    xSemaphoreGive(_fileMutex);
+    return false;
+  }
+
+  _base = base;
+  _size = size;
+  _numFilePages = (base + size + XGM_PAGE_SIZE - 1) >> XGM_PAGE_BITS;
+  if (_slotOf) free(_slotOf);
+  _slotOf = (s16_t*)ps_malloc(_numFilePages * sizeof(s16_t));
+  if (!_slotOf) {
+    ndLog.println("ERROR: XGM page table allocation failed.");
+    _file.close();
+    _prefetchFile.close();
+    xSemaphoreGive(_fileMutex);
+    return false;
+  }
+  for (u32_t i = 0; i < _numFilePages; i++) {
+    _slotOf[i] = -1;
+  }
+  for (int i = 0; i < XGM_NUM_PAGES; i++) {
+    _pageOf[i] = PAGE_NONE;
+    _lastUse[i] = 0;
+    _loading[i] = false;
+    _pins[i] = 0;
+  }
+  _tick = 0;
+  _hits = _misses = _prefetched = _dropped = _late = 0;
+  xSemaphoreGive(_fileMutex);
+
+  ndLog.printf("XGM stream: sample bank 0x%x bytes, %d pages cached\n", size, XGM_NUM_PAGES);
+  return true;
+}
+
+void XGMPageCache::end() {
+  if (!_mutex) return;
+  xSemaphoreTake(_fileMutex, portMAX_DELAY);
+  xQueueReset(_queue);
+  if (_file) _file.close();
+  if (_prefetchFile) _prefetchFile.close();
+  _numFilePages = 0;
+  xSemaphoreGive(_fileMutex);
+}
+
+const u8_t* XGMPageCache::get(u32_t offset, u32_t* avail, bool wait) {
+  u32_t page = offset >> XGM_PAGE_BITS;
+  if (page >= _numFilePages) {
+    *avail = 0;
+    return NULL;
+  }
+  u32_t in = offset & (XGM_PAGE_SIZE - 1);
+  *avail = XGM_PAGE_SIZE - in;
+
+  xSemaphoreTake(_mutex, portMAX_DELAY);
+  int slot = _slotOf[page];
+  if (slot >= 0) {
+    _hits++;
+    _lastUse[slot] = ++_tick;
+    _pins[slot]++;
+  } else {
+    _misses++;
+  }
+  xSemaphoreGive(_mutex);
+
+  if (slot < 0) {
+    if (!wait) {
+      // 再生中は SD を待たない: 先読みタスクのキューの先頭に入れる
+      if (xQueueSendToFront(_queue, &page, 0) != pdTRUE) _dropped++;
+      _late++;
+      return NULL;
+    }
+    // ミス: その場で読む
+    slot = _load(_file, page, true);
+    if (slot < 0) {
+      *avail = 0;
+      return NULL;
+    }
+  }
+
+  return &_pages[slot * XGM_PAGE_SIZE + in];
+}
+
+void XGMPageCache::release(const u8_t* p) {
+  int slot = (p - _pages) >> XGM_PAGE_BITS;
+  xSemaphoreTake(_mutex, portMAX_DELAY);
+  if (_pins[slot]) _pins[slot]--;
+  xSemaphoreGive(_mutex);
+}
+
+void XGMPageCache::prefetch(u32_t offset, u32_t len) {
+  u32_t first = offset >> XGM_PAGE_BITS;
+  if (len == 0 || first >= _numFilePages) return;
+  u32_t last = (offset + len - 1) >> XGM_PAGE_BITS;
+  if (last >= first + XGM_PREFETCH_PAGES) last = first + XGM_PREFETCH_PAGES - 1;
+  if (last >= _numFilePages) last = _numFilePages - 1;
+
+  for (u32_t page = first; page <= last; page++) {
+    if (_slotOf[page] >= 0) continue;  // 入っている (ロックなしの目安。タスク側で再確認)
+    if (xQueueSend(_queue, &page, 0) != pdTRUE) {
+      _dropped++;
+      return;
+    }
+  }
+}
+
+void XGMPageCache::printStats() {
+  u32_t total = _hits + _misses;
+  ndLog.printf("XGM pages: hit %u / miss %u (%.1f%%), prefetched %u, dropped %u, late %u\n", _hits, _misses,
+               total ? 100.0f * _hits / total : 0.0f, _prefetched, _dropped, _late);
+}
+
+// LRU のスロットを確保して読み込み中にする (使用中・読み込み中のスロットは選ばない)
+int XGMPageCache::_reserve(u32_t page) {
+  xSemaphoreTake(_mutex, portMAX_DELAY);
+  int victim = -1;
+  u32_t oldest = PAGE_NONE;
+  for (int i = 0; i < XGM_NUM_PAGES; i++) {
+    if (_loading[i] || _pins[i]) continue;
+    if (_lastUse[i] < oldest) {
+      oldest = _lastUse[i];
+      victim = i;
+    }
+  }
+  if (victim >= 0) {
+    if (_pageOf[victim] != PAGE_NONE) {
+      _slotOf[_pageOf[victim]] = -1;
+      _pageOf[victim] = PAGE_NONE;
+    }
+    _loading[victim] = true;
+  }
+  xSemaphoreGive(_mutex);
+  return victim;
+}
+
+// 読み込み完了。同じページが先に入っていたらそちらを使う
+// 戻り値: ページの入っているスロット (pin なら使用中にする)
+int XGMPageCache::_publish(int slot, u32_t page, bool pin) {
+  xSemaphoreTake(_mutex, portMAX_DELAY);
+  _loading[slot] = false;
+  int s = _slotOf[page];
+  if (s >= 0) {
+    _lastUse[slot] = 0;
+  } else {
+    _slotOf[page] = slot;
+    _pageOf[slot] = page;
+    _lastUse[slot] = ++_tick;
+    s = slot;
+  }
+  if (pin) _pins[s]++;
+  xSemaphoreGive(_mutex);
+  return s;
+}
+
+int XGMPageCache::_load(File& file, u32_t page, bool pin) {
+  int slot = _reserve(page);
+  if (slot < 0) return -1;
+
+  u8_t* p = &_pages[slot * XGM_PAGE_SIZE];
+  file.seek(page << XGM_PAGE_BITS);
+  int n = file.read(p, XGM_PAGE_SIZE);
+  if (n < 0) n = 0;
+  if (n < XGM_PAGE_SIZE) memset(p + n, 0, XGM_PAGE_SIZE - n);
+
+  return _publish(slot, page, pin);
+}
+
+void XGMPageCache::_prefetchTask(void* param) {
+  XGMPageCache* self = (XGMPageCache*)param;
+  u32_t page;
+  while (1) {
+    if (xQueueReceive(self->_queue, &page, portMAX_DELAY) == pdTRUE) {
+      xSemaphoreTake(_fileMutex, portMAX_DELAY);
+      if (self->_prefetchFile && page < self->_numFilePages && self->_slotOf[page] < 0) {
+        self->_load(self->_prefetchFile, page, false);
+        self->_prefetched++;
+      }
+      xSemaphoreGive(_fileMutex);
+    }
+  }
+}
+
+XGMPageCache xgmPages;
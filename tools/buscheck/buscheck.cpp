@@ -0,0 +1,131 @@
+// ------------------------------------------------------------------------------
+// buscheck: バス用の待ち (lib/fm/buscycles.h) をシミュレーションのサイクルカウンタで確かめる
+//
+//   cd tools/buscheck
+//   g++ -std=c++17 -O2 -I../../lib/fm -o buscheck buscheck.cpp
+//   ./buscheck
+//
+//   - DELAY_NS() の ns -> サイクル変換と待ちが、どのクロックでも指定時間より短くならず、
+//     長すぎもしない (カウンタの読み出し 2 回分以内) こと
+//   - サイクルカウンタが一周しても待ちが切れないこと
+//   - 起動時の校正 (esp_timer と比べる) がずれたクロックでも正しい値になること
+//   - SN76489 の WR 幅がチップの 32 クロック以上あること
+//   - YM2612 のデータライト後の待ちが、シリアルモードで選べるどのクロックでも 83 / 47 サイクル以上あること
+//   だめなら終了コード 1
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <initializer_list>
+
+#include "buscycles.h"
+
+// 読むたびに loopCost サイクル進むカウンタ (待ちループ 1 回分の時間)
+struct SimClock {
+  uint32_t cycles;
+  uint32_t loopCost;
+  uint32_t now() {
+    cycles += loopCost;
+    return cycles;
+  }
+};
+
+// fm.cpp で使っている待ち (ns)
+static const uint32_t delaysNs[] = {200, 500, 3000, 3500, 4000, 5000, 12000, 16000, 24000};
+
+static int failed = 0;
+
+static void check(bool ok, const char* what) {
+  if (!ok) {
+    printf("NG: %s\n", what);
+    failed++;
+  }
+}
+
+// cpuHz で動いているとき ns 待つと実際に何 ns 待つか (校正値は cyclesPerUs)
+static double waitedNs(uint32_t ns, uint32_t cyclesPerUs, double cpuHz, uint32_t start, uint32_t loopCost) {
+  SimClock clock = {start, loopCost};
+  uint32_t c0 = clock.cycles;
+  busWaitCycles(clock, busCyclesForNs(ns, cyclesPerUs));
+  return (uint32_t)(clock.cycles - c0) * 1e9 / cpuHz;
+}
+
+int main() {
+  char msg[128];
+
+  // 1. 変換と待ち
+  const uint32_t mhz[] = {80, 160, 240};
+  for (uint32_t m : mhz) {
+    for (uint32_t ns : delaysNs) {
+      for (uint32_t cost : {1u, 7u, 30u}) {
+        double w = waitedNs(ns, m, m * 1e6, 0x1000, cost);
+        double slack = (cost * 2 + 1) * 1e3 / m;  // 読み出し 2 回 + 切り上げ
+        snprintf(msg, sizeof(msg), "%u MHz, %u ns (loop %u cycles): waited %.1f ns", m, ns, cost, w);
+        check(w >= ns && w <= ns + slack, msg);
+      }
+    }
+    for (uint32_t ns = 0; ns <= 30000; ns += 7) {
+      double w = waitedNs(ns, m, m * 1e6, 0, 1);
+      if (w < ns) {
+        snprintf(msg, sizeof(msg), "%u MHz, %u ns: waited %.1f ns", m, ns, w);
+        check(false, msg);
+        break;
+      }
+    }
+  }
+
+  // 2. カウンタの一周
+  for (uint32_t start = 0xffffff00u; start != 0x100; start += 0x10) {
+    double w = waitedNs(500, 240, 240e6, start, 3);
+    if (w < 500) {
+      snprintf(msg, sizeof(msg), "wrap at 0x%08x: waited %.1f ns", start, w);
+      check(false, msg);
+      break;
+    }
+  }
+
+  // 3. 校正: 10ms (+ 読み出しの遅れ) の間に進んだサイクル数から
+  const double actualMHz[] = {239.7, 240.0, 240.4, 159.6, 80.2};
+  for (double a : actualMHz) {
+    for (int64_t us : {10000, 10001, 10003}) {
+      uint32_t start = 0xfff00000u;
+      uint32_t end = start + (uint32_t)llround(a * us);
+      uint32_t got = busCyclesPerUsFrom(end - start, us);
+      snprintf(msg, sizeof(msg), "calibrate %.1f MHz over %lld us -> %u", a, (long long)us, got);
+      check(got == (uint32_t)lround(a), msg);
+    }
+  }
+  check(busCyclesPerUsFrom(1000, 0) == 0, "calibrate with no elapsed time");
+
+  // 4. SN76489 の WR 幅 (32 クロック) を校正済み / ずれたクロックで
+  const uint32_t psgClocks[] = {4000000, 3579545, 2000000, 1500000};
+  for (uint32_t clk : psgClocks) {
+    for (uint32_t m : mhz) {
+      double need = 32e9 / clk;
+      double w = waitedNs(busPsgWriteNs(clk), m, m * 1e6, 0, 1);
+      double wFast = waitedNs(busPsgWriteNs(clk), m, (m + 0.5) * 1e6, 0, 1);  // 実際は校正値より少し速い
+      snprintf(msg, sizeof(msg), "SN76489 %u Hz at %u MHz: %.1f / %.1f ns for %.1f ns", clk, m, w, wFast, need);
+      check(w >= need && wFast >= need, msg);
+    }
+  }
+
+  // 5. YM2612 のデータライト後の待ち (serialman.cpp の YM2612ClockOptions)
+  const uint32_t ymClocks[] = {7670453, 8000000, 6000000, 7600489, 7159000};
+  for (uint32_t clk : ymClocks) {
+    for (uint32_t cycles : {BUS_YM_WAIT_CYCLES_LONG, BUS_YM_WAIT_CYCLES_SHORT}) {
+      for (uint32_t m : mhz) {
+        double need = cycles * 1e9 / clk;
+        double w = waitedNs(busYmWaitNs(cycles, clk), m, m * 1e6, 0, 1);
+        double wFast = waitedNs(busYmWaitNs(cycles, clk), m, (m + 0.5) * 1e6, 0, 1);
+        snprintf(msg, sizeof(msg), "YM2612 %u Hz, %u cycles at %u MHz: %.1f / %.1f ns for %.1f ns", clk, cycles, m, w,
+                 wFast, need);
+        check(w >= need && wFast >= need, msg);
+      }
+    }
+  }
+
+  if (failed) return 1;
+  printf("ok\n");
+  return 0;
+}
@@ -0,0 +1,158 @@
+// ------------------------------------------------------------------------------
+// dacratecheck: DAC タイマーのサンプルレートと XGM1 PCM の先行バッファをシミュレーションの時計で確かめる
+//
+//   cd tools/dacratecheck
+//   g++ -std=c++17 -O2 -I../../lib/fm -o dacratecheck dacratecheck.cpp
+//   ./dacratecheck
+//
+//   - DACPacer (lib/fm/dacpace.h) で 40MHz のタイマーを回したとき、どのレートでも平均が指定どおりで、
+//     各サンプルの時刻のずれが 1 カウント (25ns) 以内に収まること
+//   - XGM1 の流れ (vgm.cpp の _xgm1FillPCM が先行して詰め、割り込みが 14kHz で取り出す) を
+//     メインループの間隔をばらつかせて動かし、
+//     先行分 (2ms) より短い間隔なら取りこぼしがなく、長く止まっても取りこぼし分を捨てて
+//     サンプルと時刻の対応がずれないこと
+//   だめなら終了コード 1
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <random>
+
+#include "dacpace.h"
+
+// fm.h / chipbus.h / vgm.h と同じ値
+#define DAC_TIMER_HZ 40000000
+#define DAC_RING_SIZE 512
+#define DAC_SKIP 0x100
+#define XGM1_PCM_RATE 14000
+#define XGM1_PCM_LEAD 28
+#define PCM_MIX_BLOCK 64
+
+static int failed = 0;
+
+// 1. タイマーの周期
+static void checkPacer(uint32_t rate, double seconds) {
+  DACPacer pacer;
+  pacer.begin(rate, DAC_TIMER_HZ);
+  uint32_t period = pacer.period();
+  uint64_t t = 0;
+  uint64_t n = (uint64_t)(rate * seconds);
+  double maxErr = 0;
+  for (uint64_t k = 1; k <= n; k++) {
+    t += period;  // k 回目の割り込み
+    if (pacer.step()) period = pacer.period();
+    double ideal = (double)k * DAC_TIMER_HZ / rate;
+    double err = t - ideal;
+    if (err < 0) err = -err;
+    if (err > maxErr) maxErr = err;
+  }
+  double actual = (double)n * DAC_TIMER_HZ / t;
+  double ppm = (actual - rate) / rate * 1e6;
+  bool ok = maxErr <= 1.0 && ppm < 0.1 && ppm > -0.1;
+  printf("%s: %u Hz: %.4f Hz (%+.3f ppm), max drift %.2f counts\n", ok ? "ok" : "NG", rate, actual, ppm, maxErr);
+  if (!ok) failed++;
+}
+
+// 2. XGM1 の先行バッファ (FMChip の pushDAC / 割り込みと VGM::_xgm1FillPCM の手順)
+struct Pipeline {
+  uint16_t ring[DAC_RING_SIZE];
+  uint32_t head = 0, tail = 0, underruns = 0;
+  uint32_t mixed = 0, drop = 0, totalUnderruns = 0;
+  uint32_t isrCount = 0, misaligned = 0, played = 0;
+
+  bool push(uint16_t v) {
+    if (head - tail >= DAC_RING_SIZE) return false;
+    ring[head++ & (DAC_RING_SIZE - 1)] = v;
+    return true;
+  }
+
+  // 割り込み: isrCount 番目のサンプル時刻
+  void isr() {
+    uint32_t k = isrCount++;
+    if (tail == head) {
+      underruns++;
+      return;
+    }
+    uint16_t v = ring[tail++ & (DAC_RING_SIZE - 1)];
+    if (v & DAC_SKIP) return;
+    // 先行分の無音の後は k - LEAD 番目のサンプルが出るはず
+    if (v != ((k - XGM1_PCM_LEAD) & 0xff)) misaligned++;
+    played++;
+  }
+
+  // _xgm1FillPCM(target)
+  void fill(uint32_t target) {
+    uint32_t u = underruns;
+    underruns = 0;
+    totalUnderruns += u;
+    drop += u;
+    while (mixed < target) {
+      uint32_t n = target - mixed;
+      if (n > PCM_MIX_BLOCK) n = PCM_MIX_BLOCK;
+      if (drop == 0) {
+        uint32_t room = DAC_RING_SIZE - (head - tail);
+        if (room == 0) break;
+        if (n > room) n = room;
+      }
+      for (uint32_t i = 0; i < n; i++) {
+        uint32_t sample = mixed + i;
+        if (drop) {
+          drop--;
+          continue;
+        }
+        push(sample & 0xff);
+      }
+      mixed += n;
+    }
+  }
+};
+
+// maxGapUs: メインループの間隔の最大, stallEvery: この回数に 1 回 stallUs 止まる
+static void checkPipeline(const char* name, uint32_t maxGapUs, uint32_t stallEvery, uint32_t stallUs,
+                          bool expectUnderruns) {
+  std::mt19937 rng(7);
+  Pipeline p;
+  for (int i = 0; i < XGM1_PCM_LEAD; i++) p.push(DAC_SKIP);
+
+  DACPacer pacer;
+  pacer.begin(XGM1_PCM_RATE, DAC_TIMER_HZ);
+  uint32_t period = pacer.period();
+  uint64_t nextIsr = period;  // タイマーのカウント (40MHz)
+  uint64_t now = 0;
+  const uint64_t end = (uint64_t)DAC_TIMER_HZ * 30;  // 30 秒
+
+  uint32_t loops = 0;
+  while (now < end) {
+    uint32_t gapUs = 50 + rng() % (maxGapUs - 50 + 1);
+    if (stallEvery && ++loops % stallEvery == 0) gapUs = stallUs;
+    now += (uint64_t)gapUs * (DAC_TIMER_HZ / 1000000);
+    while (nextIsr <= now) {
+      p.isr();
+      if (pacer.step()) period = pacer.period();
+      nextIsr += period;
+    }
+    // 曲の時刻 (_xgmFrameTime) までミックスする
+    p.fill((uint32_t)(now * XGM1_PCM_RATE / DAC_TIMER_HZ));
+  }
+
+  double rate = (double)p.isrCount * DAC_TIMER_HZ / nextIsr;
+  bool ok = p.misaligned == 0 && (expectUnderruns ? p.totalUnderruns > 0 : p.totalUnderruns == 0) &&
+            rate > XGM1_PCM_RATE - 1 && rate < XGM1_PCM_RATE + 1;
+  printf("%s: %s: %u samples (%.2f Hz), %u underruns, %u misaligned\n", ok ? "ok" : "NG", name, p.played, rate,
+         p.totalUnderruns, p.misaligned);
+  if (!ok) failed++;
+}
+
+int main() {
+  const uint32_t rates[] = {14000, 8000, 11025, 13300, 16000, 22050, 32000, 44100};
+  for (uint32_t r : rates) {
+    checkPacer(r, 60);
+  }
+
+  checkPipeline("loop < 1.5 ms", 1500, 0, 0, false);
+  checkPipeline("loop < 1.9 ms", 1900, 0, 0, false);
+  checkPipeline("5 ms stalls", 1000, 200, 5000, true);
+  checkPipeline("40 ms stalls (ring overflow)", 1000, 500, 40000, true);
+
+  return failed ? 1 : 0;
+}
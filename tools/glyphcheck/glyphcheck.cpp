@@ -0,0 +1,149 @@
+// ------------------------------------------------------------------------------
+// glyphcheck: グリフアトラス (lib/glyphatlas) の確認と速度の比較
+//
+//   cd tools/glyphcheck
+//   g++ -std=c++17 -O2 -I../../lib/glyphatlas $(pkg-config --cflags freetype2) -o glyphcheck glyphcheck.cpp
+//     ../../lib/glyphatlas/glyphatlas.cpp $(pkg-config --libs freetype2)
+//   ./glyphcheck font.ttf titles.txt [size]
+//
+//   titles.txt の各行 (UTF-8) を曲の切り替えのように順に描く
+//   アトラスのビットマップが FreeType で直接ラスタライズしたものと一致するかを確かめ、
+//   毎回フォントを読み込み直して描く場合 (今までの Label::setCaption) との時間を比べる
+//   一致しなければ終了コード 1
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "ft2build.h"
+#include FT_FREETYPE_H
+#include "glyphatlas.h"
+
+static bool readAll(const char* path, std::vector<uint8_t>& out) {
+  FILE* fp = fopen(path, "rb");
+  if (!fp) return false;
+  uint8_t buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+    out.insert(out.end(), buf, buf + n);
+  }
+  fclose(fp);
+  return true;
+}
+
+static double nowUs() {
+  return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 今までのやり方: フォントを読み込んで全部の文字をラスタライズして捨てる
+static uint32_t renderDirect(FT_Library lib, const std::vector<uint8_t>& font, int size, const char* str) {
+  FT_Face face;
+  if (FT_New_Memory_Face(lib, font.data(), font.size(), 0, &face)) return 0;
+  FT_Set_Pixel_Sizes(face, 0, size);
+  uint32_t sum = 0, c;
+  while ((c = GlyphAtlas::nextCodepoint(&str)) != 0) {
+    if (FT_Load_Char(face, c, FT_LOAD_RENDER)) continue;
+    sum += face->glyph->bitmap.width * face->glyph->bitmap.rows;
+  }
+  FT_Done_Face(face);
+  return sum;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    fprintf(stderr, "usage: glyphcheck font.ttf titles.txt [size]\n");
+    return 2;
+  }
+  std::vector<uint8_t> font, text;
+  if (!readAll(argv[1], font) || !readAll(argv[2], text)) {
+    fprintf(stderr, "cannot read input\n");
+    return 2;
+  }
+  int size = argc > 3 ? atoi(argv[3]) : 20;
+
+  std::vector<std::string> lines;
+  std::string cur;
+  for (uint8_t b : text) {
+    if (b == '\n' || b == '\r') {
+      if (!cur.empty()) lines.push_back(cur);
+      cur.clear();
+    } else {
+      cur += (char)b;
+    }
+  }
+  if (!cur.empty()) lines.push_back(cur);
+
+  GlyphAtlas atlas;
+  if (!atlas.begin() || !atlas.addFace(0, font.data(), font.size())) {
+    fprintf(stderr, "atlas init failed\n");
+    return 2;
+  }
+  FT_Library lib;
+  FT_Init_FreeType(&lib);
+  FT_Face ref;
+  FT_New_Memory_Face(lib, font.data(), font.size(), 0, &ref);
+  FT_Set_Pixel_Sizes(ref, 0, size);
+
+  // 一致の確認
+  uint32_t checked = 0, mismatches = 0;
+  for (const std::string& line : lines) {
+    const char* p = line.c_str();
+    uint32_t c;
+    while ((c = GlyphAtlas::nextCodepoint(&p)) != 0) {
+      const t_glyph* g = atlas.get(0, size, c);
+      if (FT_Load_Char(ref, c, FT_LOAD_RENDER)) continue;
+      FT_Bitmap& bm = ref->glyph->bitmap;
+      bool ok = g && g->width == bm.width && g->rows == bm.rows && g->left == ref->glyph->bitmap_left &&
+                g->top == ref->glyph->bitmap_top && g->advance == (ref->glyph->advance.x >> 6);
+      for (uint32_t y = 0; ok && y < bm.rows; y++) {
+        ok = memcmp(atlas.bitmap(g) + y * g->width, bm.buffer + y * bm.pitch, bm.width) == 0;
+      }
+      if (!ok) {
+        if (mismatches < 10) fprintf(stderr, "mismatch: U+%04X\n", c);
+        mismatches++;
+      }
+      checked++;
+    }
+  }
+
+  // 速度: 全部の行を 2 周 (2 周目は全部ヒットするはず)
+  atlas.clear();
+  atlas.hits = atlas.misses = atlas.flushes = 0;
+  double t0 = nowUs();
+  uint32_t sink = 0;
+  for (int pass = 0; pass < 2; pass++) {
+    for (const std::string& line : lines) {
+      const char* p = line.c_str();
+      uint32_t c;
+      while ((c = GlyphAtlas::nextCodepoint(&p)) != 0) {
+        const t_glyph* g = atlas.get(0, size, c);
+        if (g) sink += g->width * g->rows;
+      }
+    }
+  }
+  double atlasUs = nowUs() - t0;
+
+  t0 = nowUs();
+  for (int pass = 0; pass < 2; pass++) {
+    for (const std::string& line : lines) {
+      sink += renderDirect(lib, font, size, line.c_str());
+    }
+  }
+  double directUs = nowUs() - t0;
+
+  uint32_t total = atlas.hits + atlas.misses;
+  printf("%zu lines, %u glyphs checked, %u mismatches\n", lines.size(), checked, mismatches);
+  printf("atlas: %u glyphs %u KB, hit %u / miss %u (%.1f%%), flushed %u\n", atlas.glyphs(), atlas.used() / 1024,
+         atlas.hits, atlas.misses, total ? 100.0 * atlas.hits / total : 0.0, atlas.flushes);
+  printf("time: atlas %.0f us, reload + rasterize %.0f us (x%.1f)  [%u]\n", atlasUs, directUs,
+         atlasUs > 0 ? directUs / atlasUs : 0.0, sink & 1);
+
+  FT_Done_Face(ref);
+  FT_Done_FreeType(lib);
+  return mismatches ? 1 : 0;
+}
@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+# NanoDrive シリアルモードへ VGM / VGZ / XGM を送って再生する
+#   使い方: python3 ndupload.py <ポート> <ファイル>   (pyserial が必要)
+#           python3 ndupload.py <ポート> --status     リンクの統計を表示
+#   プロトコルは src/serialman.cpp の 0xf3 / 0xf8 を参照
+
+import struct
+import sys
+import zlib
+
+import serial
+
+CHUNK = 4096
+ACK, NAK = 0x06, 0x15
+STATUS_FIELDS = (
+    "ring free",
+    "jitter free",
+    "received bytes",
+    "consumed bytes",
+    "decoded commands",
+    "executed commands",
+    "ring full",
+    "unknown commands",
+    "underruns",
+    "overruns",
+    "capture bytes",
+    "capture dropped",
+    "capture max stall us",
+    "resync bytes",
+)
+
+
+def command(port, op, arg=0, payload=b""):
+    port.write(struct.pack("<BBIH", 0xF3, ord(op), arg, len(payload)))
+    if op == "D":
+        port.write(payload + struct.pack("<I", zlib.crc32(payload)))
+    res = port.read(1)
+    return len(res) == 1 and res[0] == ACK
+
+
+def status(port):
+    port.write(bytes([0xF8]))
+    head = port.read(2)
+    if len(head) != 2 or head[0] != 0xF8:
+        print("no status reply")
+        return 1
+    body = port.read(head[1])
+    values = struct.unpack("<%dI" % (len(body) // 4), body)
+    for name, value in zip(STATUS_FIELDS, values):
+        print("%-18s %u" % (name, value))
+    return 0
+
+
+def main():
+    if len(sys.argv) != 3:
+        print("usage: ndupload.py <port> <file> | --status")
+        return 1
+    port = serial.Serial(sys.argv[1], timeout=2)
+    # シリアルモードに入る前 (起動直後) のログが残っていれば応答と取り違えないように捨てる
+    port.reset_input_buffer()
+    if sys.argv[2] == "--status":
+        return status(port)
+    data = open(sys.argv[2], "rb").read()
+
+    if not command(port, "B", len(data)):
+        print("upload refused (file too large?)")
+        return 1
+    for pos in range(0, len(data), CHUNK):
+        for retry in range(3):
+            if command(port, "D", pos, data[pos : pos + CHUNK]):
+                break
+        else:
+            print("chunk at 0x%x failed" % pos)
+            return 1
+    if not command(port, "P"):
+        print("play failed")
+        return 1
+    print("%d bytes sent" % len(data))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
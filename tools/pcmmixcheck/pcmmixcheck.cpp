@@ -0,0 +1,133 @@
+// ------------------------------------------------------------------------------
+// pcmmixcheck: ブロックミキサー (lib/pcmmix) を 1 サンプルずつ足す素直なミキサーと比べる
+//
+//   cd tools/pcmmixcheck
+//   g++ -std=c++17 -O2 -I../../lib/pcmmix -o pcmmixcheck pcmmixcheck.cpp ../../lib/pcmmix/pcmmix.cpp
+//   ./pcmmixcheck [回数]
+//
+//   - 1 - 8 チャンネル, 通常速度 / 半速 (phase 0, 1), ブロック途中で終わるサンプル,
+//     acc の途中から足す (ストリームモードのページ境界), 境界に揃っていない src で
+//     pcmMixAdd / pcmMixAddScalar / pcmMixOut の出力と消費数が参照と一致すること
+//   - 8 チャンネル全部が最大振幅でも飽和の結果が一致すること
+//   最後にスカラー版の 1 サンプルあたりの時間を出す
+//   一致しなければ終了コード 1
+//   (PIE 版は ESP32-S3 でしか動かないので、実機では起動時の pcmMixBenchmark で比べる)
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "pcmmix.h"
+
+// 1 チャンネル分の再生状態
+struct Voice {
+  const int8_t* src;
+  uint32_t len;
+  uint8_t step;
+  uint8_t phase;
+  uint32_t start;  // acc 上で足し始める位置
+};
+
+// 参照: サンプルごとに全チャンネルを回して足し、int8 に飽和させる
+static void referenceMix(const std::vector<Voice>& voices, uint32_t n, uint16_t* out, std::vector<uint32_t>& used) {
+  used.assign(voices.size(), 0);
+  for (uint32_t i = 0; i < n; i++) {
+    int sum = 0;
+    bool hit = false;
+    for (size_t c = 0; c < voices.size(); c++) {
+      const Voice& v = voices[c];
+      if (i < v.start + v.phase || used[c] >= v.len) continue;
+      if ((i - v.start - v.phase) % v.step) continue;
+      sum += v.src[used[c]++];
+      hit = true;
+    }
+    if (sum > INT8_MAX) sum = INT8_MAX;
+    if (sum < INT8_MIN) sum = INT8_MIN;
+    out[i] = hit ? (uint16_t)(sum + 128) : PCM_MIX_SKIP;
+  }
+}
+
+typedef uint32_t (*AddFunc)(int16_t*, uint8_t*, uint32_t, const int8_t*, uint32_t, uint8_t, uint8_t);
+
+static void blockMix(AddFunc add, const std::vector<Voice>& voices, uint32_t n, uint16_t* out,
+                     std::vector<uint32_t>& used) {
+  alignas(16) int16_t acc[PCM_MIX_BLOCK];
+  uint8_t hit[PCM_MIX_BLOCK];
+  used.assign(voices.size(), 0);
+  pcmMixClear(acc, hit, n);
+  for (size_t c = 0; c < voices.size(); c++) {
+    const Voice& v = voices[c];
+    if (v.start >= n) continue;
+    used[c] = add(acc + v.start, hit + v.start, n - v.start, v.src, v.len, v.step, v.phase);
+  }
+  pcmMixOut(acc, hit, out, n);
+}
+
+int main(int argc, char** argv) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 20000;
+  std::mt19937 rng(2024);
+
+  // サンプルデータ (余白を付けて、どの位置からでも読めるように)
+  std::vector<int8_t> pool(1 << 16);
+  for (auto& b : pool) b = (int8_t)rng();
+  std::vector<int8_t> loud(256, INT8_MAX), quiet(256, INT8_MIN);
+
+  const AddFunc funcs[] = {pcmMixAdd, pcmMixAddScalar};
+  const char* names[] = {"pcmMixAdd", "pcmMixAddScalar"};
+
+  for (int round = 0; round < rounds; round++) {
+    uint32_t n = 1 + rng() % PCM_MIX_BLOCK;
+    std::vector<Voice> voices(1 + rng() % 8);
+    for (auto& v : voices) {
+      v.len = rng() % 4 == 0 ? rng() % 24 : rng() % 200;
+      v.src = pool.data() + rng() % (pool.size() - 256);  // 境界に揃っていない
+      v.step = rng() % 3 == 0 ? 2 : 1;
+      v.phase = v.step == 2 ? rng() % 2 : 0;
+      v.start = rng() % 4 == 0 ? rng() % n : 0;
+      if (round % 50 == 0) v.src = (rng() & 1 ? loud : quiet).data();
+    }
+
+    uint16_t ref[PCM_MIX_BLOCK], out[PCM_MIX_BLOCK];
+    std::vector<uint32_t> refUsed, outUsed;
+    referenceMix(voices, n, ref, refUsed);
+    for (int f = 0; f < 2; f++) {
+      blockMix(funcs[f], voices, n, out, outUsed);
+      if (memcmp(ref, out, n * sizeof(uint16_t)) != 0 || refUsed != outUsed) {
+        printf("NG: round %d: %s differs (%zu ch, %u samples)\n", round, names[f], voices.size(), n);
+        return 1;
+      }
+    }
+  }
+
+  // スカラー版の速さ (pcmMixBenchmark と同じ並び)
+  const uint32_t len = 16384;
+  alignas(16) int16_t acc[PCM_MIX_BLOCK];
+  uint8_t hit[PCM_MIX_BLOCK];
+  uint16_t out[PCM_MIX_BLOCK];
+  uint32_t sink = 0;
+  for (int ch = 1; ch <= 8; ch++) {
+    auto t0 = std::chrono::steady_clock::now();
+    const int repeat = 200;
+    for (int r = 0; r < repeat; r++) {
+      for (uint32_t pos = 0; pos + PCM_MIX_BLOCK <= len; pos += PCM_MIX_BLOCK) {
+        pcmMixClear(acc, hit, PCM_MIX_BLOCK);
+        for (int c = 0; c < ch; c++) {
+          const int8_t* p = pool.data() + ((pos + c * 1031) % (len - PCM_MIX_BLOCK));
+          pcmMixAddScalar(acc, hit, PCM_MIX_BLOCK, p, PCM_MIX_BLOCK, 1, 0);
+        }
+        pcmMixOut(acc, hit, out, PCM_MIX_BLOCK);
+        sink += out[pos & (PCM_MIX_BLOCK - 1)];
+      }
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+    printf("scalar: %d ch %.2f ns/sample\n", ch, ns / ((double)len * repeat));
+  }
+
+  printf("ok: %d rounds (%u)\n", rounds, sink & 1);
+  return 0;
+}
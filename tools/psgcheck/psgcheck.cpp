@@ -0,0 +1,153 @@
+// ------------------------------------------------------------------------------
+// psgcheck: SN76489 の書き込みをまとめてもチップに届くバイト列が変わらないかを確かめる
+//
+//   cd tools/psgcheck
+//   g++ -std=c++17 -O2 -I../../lib/synth -o psgcheck psgcheck.cpp ../../lib/synth/*.cpp
+//   ./psgcheck [回数]
+//
+//   乱数の SN76489 コマンド列を 3 チップに振り分けて
+//   - 今までの FMChip::write と同じ手順 (下位バイトを保持して上位バイトの前に 1 バイトずつ書く)
+//   - PSGLatch + writeRawPair (CS を下げたまま 2 バイト, 複数チップは CS をまとめて下げる)
+//   に通し、チップごとのバイト列と SynthMix の出力が一致するかを比べる
+//   一致しなければ終了コード 1
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <random>
+#include <vector>
+
+#include "psglatch.h"
+#include "synthmix.h"
+
+#define PSG_CHIP(n) (1 << (n))
+
+// チップごとに届いたバイト列
+struct ChipBytes {
+  std::vector<uint8_t> bytes[3];
+
+  void writeRaw(uint8_t data, uint8_t chipno) { bytes[chipno].push_back(data); }
+  // FMChip::writeRawPair: CS を下げたチップ全部にラッチ, データの順で届く
+  void writeRawPair(uint8_t latch, uint8_t data, uint8_t chipMask) {
+    for (uint8_t c = 0; c < 3; c++) {
+      if (chipMask & PSG_CHIP(c)) {
+        bytes[c].push_back(latch);
+        bytes[c].push_back(data);
+      }
+    }
+  }
+  bool operator==(const ChipBytes& o) const {
+    for (int c = 0; c < 3; c++) {
+      if (bytes[c] != o.bytes[c]) return false;
+    }
+    return true;
+  }
+};
+
+// まとめる前の FMChip::write
+struct Reference {
+  uint8_t low[3] = {0, 0, 0};
+
+  void write(ChipBytes& out, uint8_t data, uint8_t chipno) {
+    if ((data & 0x90) == 0x80 && (data & 0x60) >> 5 != 3) {
+      low[chipno] = data;
+    } else if ((data & 0x80) == 0) {
+      if ((low[chipno] & 0x0F) == 0) {
+        if ((data & 0x3F) == 0) low[chipno] |= 1;
+      }
+      out.writeRaw(low[chipno], chipno);
+      out.writeRaw(data, chipno);
+    } else {
+      out.writeRaw(data, chipno);
+    }
+  }
+};
+
+static void batched(ChipBytes& out, PSGLatch& latch, uint8_t data, uint8_t chipno) {
+  uint8_t low;
+  switch (latch.write(data, chipno, &low)) {
+    case PSG_LATCH_PAIR:
+      out.writeRawPair(low, data, PSG_CHIP(chipno));
+      break;
+    case PSG_LATCH_RAW:
+      out.writeRaw(data, chipno);
+      break;
+  }
+}
+
+// SN76489 のコマンドらしい列 (周波数の 2 バイト, 音量, ノイズ, 上位 6 ビット 0 の周期)
+static uint8_t randomCommand(std::mt19937& rng) {
+  switch (rng() % 6) {
+    case 0:
+      return 0x80 | ((rng() % 3) << 5) | (rng() & 0x0f);  // 周波数下位
+    case 1:
+      return rng() & 0x3f;  // 周波数上位
+    case 2:
+      return 0x00;  // 周期 0 (下位の補正)
+    case 3:
+      return 0x90 | ((rng() & 3) << 5) | (rng() & 0x0f);  // 音量
+    case 4:
+      return 0xe0 | (rng() & 0x07);  // ノイズ
+    default:
+      return rng() & 0xff;
+  }
+}
+
+int main(int argc, char** argv) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 200;
+  std::mt19937 rng(12345);
+  uint32_t total = 0;
+
+  for (int round = 0; round < rounds; round++) {
+    ChipBytes ref, out;
+    Reference r;
+    PSGLatch latch;
+    SynthMix mixRef, mixOut;
+    mixRef.reset(7670453, 3579545);
+    mixOut.reset(7670453, 3579545);
+    std::vector<int16_t> pcmRef(SYNTH_BLOCK * 2), pcmOut(SYNTH_BLOCK * 2);
+
+    for (int i = 0; i < 2000; i++) {
+      uint8_t data = randomCommand(rng);
+      uint8_t chip = rng() % 3;
+      size_t before = ref.bytes[chip].size();
+      r.write(ref, data, chip);
+      batched(out, latch, data, chip);
+
+      // SynthMix は snWrite (PSGLatch) と 1 バイトずつの snWriteRaw を比べる
+      mixOut.snWrite(data, chip, 0);
+      for (size_t j = before; j < ref.bytes[chip].size(); j++) {
+        mixRef.snWriteRaw(ref.bytes[chip][j], chip, 0);
+      }
+      if (i % 64 == 0) {
+        mixRef.render(pcmRef.data(), SYNTH_BLOCK);
+        mixOut.render(pcmOut.data(), SYNTH_BLOCK);
+        if (pcmRef != pcmOut) {
+          printf("NG: round %d command %d: SynthMix output differs\n", round, i);
+          return 1;
+        }
+      }
+    }
+    if (!(ref == out)) {
+      printf("NG: round %d: byte sequence differs\n", round);
+      return 1;
+    }
+
+    // 2 チップ同時 (FMChip::reset の消音) と 1 チップずつ
+    ChipBytes a, b;
+    a.writeRawPair(0x9f, 0xbf, PSG_CHIP(1) | PSG_CHIP(2));
+    b.writeRaw(0x9f, 1);
+    b.writeRaw(0xbf, 1);
+    b.writeRaw(0x9f, 2);
+    b.writeRaw(0xbf, 2);
+    if (!(a == b)) {
+      printf("NG: fan-out differs\n");
+      return 1;
+    }
+    total += out.bytes[0].size() + out.bytes[1].size() + out.bytes[2].size();
+  }
+  printf("ok: %d rounds, %u bytes\n", rounds, total);
+  return 0;
+}
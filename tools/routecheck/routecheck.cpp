@@ -0,0 +1,161 @@
+// ------------------------------------------------------------------------------
+// routecheck: ファイル再生とシリアルモードのチップ振り分けが同じ書き込みになるかを確かめる
+//
+//   cd tools/routecheck
+//   g++ -std=c++17 -O2 -I../../lib/vgmcmd -I../../lib/serialrx -o routecheck routecheck.cpp
+//     ../../lib/vgmcmd/vgmcmd.cpp ../../lib/serialrx/serialrx.cpp
+//   ./routecheck [回数]
+//
+//   両方が受け付けるコマンド (チップ書き込み・待ち・未対応チップ) を乱数で並べ、
+//   - vgm.cpp の vgmProcessMain と同じ手順 (VGMRouter::dispatch + 読み飛ばし)
+//   - serialman.cpp と同じ手順 (SerialRing / SerialDecoder + VGMRouter::write)
+//   に通して、記録したバスへの書き込みが一致するかを比べる
+//   一致しなければ終了コード 1
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <random>
+#include <vector>
+
+#include "serialrx.h"
+#include "vgmcmd.h"
+
+// 書き込みを記録するだけのバス (ChipBus と同じメソッド)
+typedef struct {
+  uint8_t kind, chip, port, reg, value;
+  uint32_t freq;
+} t_write;
+
+class TraceBus {
+ public:
+  typedef uint32_t freq_t;
+  std::vector<t_write> writes;
+
+  void setRegister(uint8_t addr, uint8_t value, int chipno) { _add('N', chipno, 0, addr, value); }
+  void setRegisterOPM(uint8_t addr, uint8_t value, uint8_t chipno) { _add('M', chipno, 0, addr, value); }
+  void setRegisterOPL3(uint8_t port, uint8_t addr, uint8_t data, int chipno) { _add('L', chipno, port, addr, data); }
+  void setRegisterOPLL(uint8_t addr, uint8_t value, uint8_t chipno) { _add('K', chipno, 0, addr, value); }
+  void setYM2612(uint8_t port, uint8_t addr, uint8_t data, uint8_t chipno) { _add('Y', chipno, port, addr, data); }
+  void write(uint8_t data, uint8_t chipno, freq_t freq) { _add('S', chipno, 0, 0, data, freq); }
+  void writeRaw(uint8_t data, uint8_t chipno, freq_t freq) { _add('R', chipno, 0, 0, data, freq); }
+
+ private:
+  void _add(uint8_t kind, uint8_t chip, uint8_t port, uint8_t reg, uint8_t value, uint32_t freq = 0) {
+    writes.push_back({kind, chip, port, reg, value, freq});
+  }
+};
+
+// 全種類の振り分けを使う表 (src/vgm.cpp の setupChipRoutes で全部の USE_* を有効にした場合)
+static void setupRoutes(VGMRouter& r, bool raw) {
+  r.clear();
+  r.route(0x50, VGM_ROUTE_SN76489, 1, 0, 3579545, raw);
+  r.route(0x30, VGM_ROUTE_SN76489, 2, 0, 4000000, raw);
+  r.route(0x51, VGM_ROUTE_OPLL, 1);
+  r.route(0x52, VGM_ROUTE_YM2612, 0, 0);
+  r.route(0x53, VGM_ROUTE_YM2612, 0, 1);
+  r.route(0xa0, VGM_ROUTE_OPN, 0);
+  r.route(0x54, VGM_ROUTE_OPM, 0);
+  r.route(0xa4, VGM_ROUTE_OPM, 0);
+  r.route(0x55, VGM_ROUTE_OPN, 0);
+  r.route(0xa5, VGM_ROUTE_OPN, 1);
+  r.route(0x5a, VGM_ROUTE_OPL3, 1, 0);
+  r.route(0x5e, VGM_ROUTE_OPL3, 1, 0);
+  r.route(0x5f, VGM_ROUTE_OPL3, 1, 1);
+}
+
+// ファイル再生側 (vgmProcessMain と同じ手順。待ちは数えるだけ)
+static void runFile(const VGMRouter& router, const std::vector<uint8_t>& d, TraceBus& bus) {
+  size_t pos = 0;
+  while (pos < d.size()) {
+    uint8_t command = d[pos++];
+    if (router.dispatch(&bus, command, [&]() { return d[pos++]; })) continue;
+    switch (command) {
+      case 0x61:
+        pos += 2;
+        break;
+      case 0x62:
+      case 0x63:
+      case 0x70 ... 0x7f:
+        break;
+      default:
+        pos += vgmCommandLength(command) - 1;
+        break;
+    }
+  }
+}
+
+// シリアルモード側 (細切れに受信してデコードする)
+static void runSerial(const VGMRouter& router, const std::vector<uint8_t>& d, TraceBus& bus, size_t chunk) {
+  static SerialRing ring;
+  SerialDecoder decoder;
+  ring = SerialRing();
+  size_t pos = 0;
+  t_serialCmd c;
+  while (pos < d.size() || ring.available()) {
+    uint32_t space;
+    uint8_t* dst = ring.writePtr(&space);
+    size_t n = d.size() - pos;
+    if (n > chunk) n = chunk;
+    if (n > space) n = space;
+    memcpy(dst, &d[pos], n);
+    ring.commit(n);
+    pos += n;
+    bool progress = false;
+    while (decoder.next(ring, c)) {
+      router.write(&bus, c.command, c.a, c.b);
+      progress = true;
+    }
+    if (!progress && n == 0) break;
+  }
+}
+
+// 両方が受け付けるコマンドを並べる
+static std::vector<uint8_t> makeStream(std::mt19937& rng, size_t commands) {
+  static const uint8_t pool[] = {0x30, 0x50, 0x52, 0x53, 0x54, 0x55, 0x5a, 0x5e, 0x5f, 0xa0, 0xa4, 0xa5,
+                                 0x51, 0x56, 0x5b, 0x4f, 0x3c, 0x45, 0xb2, 0xc3, 0xd0, 0x61, 0x62, 0x63, 0x75};
+  std::vector<uint8_t> d;
+  for (size_t i = 0; i < commands; i++) {
+    uint8_t command = pool[rng() % sizeof(pool)];
+    d.push_back(command);
+    for (uint8_t k = 1; k < vgmCommandLength(command); k++) {
+      d.push_back(rng());
+    }
+  }
+  return d;
+}
+
+static bool same(const t_write& a, const t_write& b) {
+  return a.kind == b.kind && a.chip == b.chip && a.port == b.port && a.reg == b.reg && a.value == b.value &&
+         a.freq == b.freq;
+}
+
+int main(int argc, char** argv) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 200;
+  std::mt19937 rng(1);
+  VGMRouter router;
+  size_t total = 0;
+
+  for (int i = 0; i < rounds; i++) {
+    setupRoutes(router, i & 1);
+    std::vector<uint8_t> d = makeStream(rng, 2000);
+    TraceBus file, serial;
+    runFile(router, d, file);
+    runSerial(router, d, serial, 1 + rng() % 64);
+
+    bool ok = file.writes.size() == serial.writes.size();
+    for (size_t k = 0; ok && k < file.writes.size(); k++) {
+      ok = same(file.writes[k], serial.writes[k]);
+      if (!ok) fprintf(stderr, "round %d: write %zu differs\n", i, k);
+    }
+    if (!ok) {
+      fprintf(stderr, "round %d: file %zu writes, serial %zu writes\n", i, file.writes.size(), serial.writes.size());
+      return 1;
+    }
+    total += file.writes.size();
+  }
+  printf("ok: %d rounds, %zu writes\n", rounds, total);
+  return 0;
+}
@@ -0,0 +1,226 @@
+// ------------------------------------------------------------------------------
+// serialbench: シリアルモードの圧縮コマンド (lib/serialcodec) の往復確認と圧縮率の測定
+//
+//   cd tools/serialbench
+//   g++ -std=c++17 -O2 -I../../lib/serialrx -I../../lib/serialcodec -I../../lib/vgmcmd -o serialbench serialbench.cpp
+//     ../../lib/serialrx/serialrx.cpp ../../lib/serialcodec/serialcodec.cpp ../../lib/vgmcmd/vgmcmd.cpp
+//   ./serialbench session.bin [...]   記録したシリアルモードの受信データ (通常のコマンドだけ)
+//   ./serialbench -vgm input.vgm [...] VGM をシリアルモードのコマンド列にして測る (vgz は解凍してから)
+//
+//   エンコードした結果をデバイスと同じ SerialRing / SerialDecoder / SerialCodec で戻し、
+//   元のコマンド列と一致するかを確かめる。受信は USB のパケットを真似て細切れに入れる
+//   一致しなければ終了コード 1
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "serialcodec.h"
+#include "serialrx.h"
+
+static SerialRing ring;
+static SerialDecoder decoder;
+
+static bool readAll(const char* path, std::vector<uint8_t>& out) {
+  FILE* fp = fopen(path, "rb");
+  if (!fp) return false;
+  uint8_t buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+    out.insert(out.end(), buf, buf + n);
+  }
+  fclose(fp);
+  return true;
+}
+
+// バイト列をリングに入れながらデコードする (chunk バイトずつ)
+// expand = true なら圧縮コマンドを展開する
+static bool decodeStream(const std::vector<uint8_t>& bytes, size_t chunk, bool expand, std::vector<t_serialCmd>& out) {
+  static t_serialCmd expanded[SERIAL_CODEC_MAX_EXPAND];
+  SerialCodec codec;
+  codec.reset();
+  ring = SerialRing();
+  size_t pos = 0;
+  t_serialCmd c;
+  while (pos < bytes.size() || ring.available()) {
+    uint32_t space;
+    uint8_t* dst = ring.writePtr(&space);
+    size_t n = bytes.size() - pos;
+    if (n > chunk) n = chunk;
+    if (n > space) n = space;
+    memcpy(dst, &bytes[pos], n);
+    ring.commit(n);
+    pos += n;
+
+    bool progress = false;
+    while (decoder.next(ring, c)) {
+      progress = true;
+      if (expand && c.command >= 0xf5 && c.command <= 0xf7) {
+        uint32_t m = codec.expand(c, decoder.packed, expanded);
+        for (uint32_t i = 0; i < m; i++) {
+          codec.observe(expanded[i]);
+          out.push_back(expanded[i]);
+        }
+      } else {
+        codec.observe(c);
+        out.push_back(c);
+      }
+    }
+    if (!progress && n == 0) return ring.available() == 0;  // 途中で切れている
+  }
+  return true;
+}
+
+// VGM をシリアルモードのコマンド列にする (src/serialman.cpp が受け付けるものだけ)
+static bool vgmToSession(const std::vector<uint8_t>& d, std::vector<uint8_t>& out) {
+  if (d.size() < 0x40 || memcmp(d.data(), "Vgm ", 4) != 0) return false;
+  uint32_t version = d[8] | (d[9] << 8) | (d[10] << 16) | (d[11] << 24);
+  size_t pos = 0x40;
+  if (version >= 0x150) {
+    uint32_t ofs = d[0x34] | (d[0x35] << 8) | (d[0x36] << 16) | (d[0x37] << 24);
+    if (ofs) pos = 0x34 + ofs;
+  }
+
+  std::vector<uint8_t> pcm;
+  size_t pcmPos = 0;
+  while (pos < d.size()) {
+    uint8_t cmd = d[pos];
+    switch (cmd) {
+      case 0x4f:
+      case 0x50:
+        if (cmd == 0x50) out.insert(out.end(), {0x50, d[pos + 1]});
+        pos += 2;
+        break;
+      case 0x52:
+      case 0x53:
+        out.insert(out.end(), {cmd, d[pos + 1], d[pos + 2]});
+        pos += 3;
+        break;
+      case 0x61:
+        out.insert(out.end(), {0x61, d[pos + 1], d[pos + 2]});
+        pos += 3;
+        break;
+      case 0x62:
+      case 0x63:
+      case 0x70 ... 0x7f:
+        out.push_back(cmd);
+        pos++;
+        break;
+      case 0x66:
+        return true;
+      case 0x67: {  // データブロック (YM2612 PCM だけ拾う)
+        uint8_t type = d[pos + 2];
+        uint32_t size = d[pos + 3] | (d[pos + 4] << 8) | (d[pos + 5] << 16) | ((uint32_t)(d[pos + 6] & 0x7f) << 24);
+        if (type == 0x00) pcm.insert(pcm.end(), d.begin() + pos + 7, d.begin() + pos + 7 + size);
+        pos += 7 + size;
+        break;
+      }
+      case 0x80 ... 0x8f:
+        out.insert(out.end(), {cmd, pcmPos < pcm.size() ? pcm[pcmPos] : (uint8_t)0});
+        pcmPos++;
+        pos++;
+        break;
+      case 0xe0:
+        pcmPos = d[pos + 1] | (d[pos + 2] << 8) | (d[pos + 3] << 16) | ((uint32_t)d[pos + 4] << 24);
+        pos += 5;
+        break;
+      case 0x30 ... 0x3f:
+      case 0x4d ... 0x4e:
+        pos += 2;
+        break;
+      case 0x40:
+      case 0x51:
+      case 0x54 ... 0x5f:
+      case 0xa0 ... 0xbf:
+        pos += 3;
+        break;
+      case 0xc0 ... 0xdf:
+        pos += 4;
+        break;
+      case 0xe1 ... 0xff:
+        pos += 5;
+        break;
+      default:
+        fprintf(stderr, "unknown VGM command 0x%02x at 0x%zx\n", cmd, pos);
+        return false;
+    }
+  }
+  return true;
+}
+
+static bool sameCmd(const t_serialCmd& a, const t_serialCmd& b) {
+  return a.command == b.command && a.a == b.a && a.b == b.b && a.value == b.value;
+}
+
+static bool bench(const char* path, const std::vector<uint8_t>& session) {
+  std::vector<t_serialCmd> original;
+  if (!decodeStream(session, session.size(), false, original)) {
+    fprintf(stderr, "%s: truncated session\n", path);
+    return false;
+  }
+
+  SerialCodec encoder;
+  encoder.reset();
+  std::vector<uint8_t> packed(original.size() * 8 + 8);
+  size_t bytes = encoder.encode(original.data(), original.size(), packed.data());
+  packed.resize(bytes);
+
+  // 64 バイト (USB FS のパケット) ずつと、半端な長さで戻してみる
+  static const size_t chunks[] = {64, 7};
+  for (size_t chunk : chunks) {
+    std::vector<t_serialCmd> decoded;
+    bool ok = decodeStream(packed, chunk, true, decoded) && decoded.size() == original.size();
+    for (size_t i = 0; ok && i < decoded.size(); i++) {
+      if (!sameCmd(decoded[i], original[i])) {
+        fprintf(stderr, "%s: mismatch at command %zu (0x%02x)\n", path, i, original[i].command);
+        ok = false;
+      }
+    }
+    if (!ok) {
+      fprintf(stderr, "%s: round trip failed (chunk %zu)\n", path, chunk);
+      return false;
+    }
+  }
+
+  printf("%s: %zu commands, %zu -> %zu bytes (%.1f%%), dac runs %u, bursts %u, deltas %u\n", path,
+         original.size(), session.size(), bytes, session.size() ? 100.0 * bytes / session.size() : 0.0,
+         encoder.dacRuns, encoder.bursts, encoder.deltas);
+  return true;
+}
+
+int main(int argc, char** argv) {
+  bool vgm = false;
+  bool ok = true;
+  int files = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-vgm") == 0) {
+      vgm = true;
+      continue;
+    }
+    std::vector<uint8_t> data, session;
+    if (!readAll(argv[i], data)) {
+      fprintf(stderr, "%s: cannot open\n", argv[i]);
+      ok = false;
+      continue;
+    }
+    if (vgm) {
+      if (!vgmToSession(data, session)) {
+        fprintf(stderr, "%s: not a VGM file\n", argv[i]);
+        ok = false;
+        continue;
+      }
+    } else {
+      session.swap(data);
+    }
+    ok = bench(argv[i], session) && ok;
+    files++;
+  }
+  if (files == 0) {
+    fprintf(stderr, "usage: serialbench [-vgm] file...\n");
+    return 1;
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,173 @@
+// ------------------------------------------------------------------------------
+// serialrxcheck: シリアルモードの受信リングとデコーダ (lib/serialrx) を細切れの入力で確かめる
+//
+//   cd tools/serialrxcheck
+//   g++ -std=c++17 -O2 -I../../lib/serialrx -I../../lib/vgmcmd -o serialrxcheck serialrxcheck.cpp
+//     ../../lib/serialrx/serialrx.cpp ../../lib/vgmcmd/vgmcmd.cpp
+//   ./serialrxcheck [回数]
+//
+//   - ランダムなコマンド列 (全長さのコマンド, 0xf6 の可変長, 0xf3 のペイロード) を
+//     1 バイト - 数百バイトのランダムな長さに切ってリングに入れ、デコード結果が
+//     バイト列を頭から素直に読んだ結果と一致すること
+//   - リングの折り返しをまたぐ長さを流し、途中で詰まらず最後まで取り出せること
+//   最後に 64 バイト (USB FS のパケット) ずつ入れたときの 1 秒あたりのコマンド数を出す
+//   一致しなければ終了コード 1
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "serialrx.h"
+
+static SerialRing ring;
+
+struct Expected {
+  t_serialCmd cmd;
+  std::vector<uint8_t> packed;  // 0xf6 の値
+  uint32_t payload;             // 0xf3 の後に続くバイト数
+};
+
+static uint32_t le32(const uint8_t* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+
+// 試すコマンド (シリアルモード独自のものと、VGM と同じ長さのもの)
+static const uint8_t commandSet[] = {0x00, 0x50, 0x52, 0x53, 0x61, 0x62, 0x63, 0x70, 0x7f, 0x80, 0x8f, 0xa0,
+                                     0xb4, 0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfc};
+
+// ランダムなコマンド列を作り、頭から読んだ期待値も作る
+static void generate(std::mt19937& rng, uint32_t count, std::vector<uint8_t>& bytes, std::vector<Expected>& expected) {
+  bytes.clear();
+  expected.clear();
+  for (uint32_t k = 0; k < count; k++) {
+    uint8_t command = commandSet[rng() % sizeof(commandSet)];
+    uint8_t len = serialCommandLength(command);
+    uint8_t p[SERIAL_CMD_MAX_LEN];
+    p[0] = command;
+    for (uint8_t i = 1; i < len; i++) p[i] = rng();
+
+    Expected e = {};
+    if (command == 0xf3) {
+      p[6] = rng() % 4 == 0 ? rng() : 0;  // ペイロードは短めに
+      p[7] = 0;
+    }
+    e.cmd.command = command;
+    e.cmd.a = len > 1 ? p[1] : 0;
+    e.cmd.b = len > 2 ? p[2] : 0;
+    if (len == 5) {
+      e.cmd.value = le32(p + 1);
+    } else if (command == 0xf3) {
+      e.cmd.value = le32(p + 2);
+      e.cmd.length = p[6] | (p[7] << 8);
+      e.payload = e.cmd.length;
+    } else if (command == 0xf5) {
+      e.cmd.value = p[3];
+    } else if (command == 0xf6) {
+      e.cmd.value = le32(p + 2) & ((1u << SERIAL_PACKED_MAX) - 1);
+      e.cmd.length = __builtin_popcount(e.cmd.value);
+    }
+    bytes.insert(bytes.end(), p, p + len);
+    for (uint32_t i = 0; i < e.cmd.length && command == 0xf6; i++) {
+      e.packed.push_back(rng());
+    }
+    bytes.insert(bytes.end(), e.packed.begin(), e.packed.end());
+    for (uint32_t i = 0; i < e.payload; i++) bytes.push_back(rng());
+    expected.push_back(e);
+  }
+}
+
+static bool sameCmd(const t_serialCmd& a, const t_serialCmd& b) {
+  return a.command == b.command && a.a == b.a && a.b == b.b && a.length == b.length && a.value == b.value;
+}
+
+// chunk() が返す長さずつリングに入れ、そのたびに取り出せるだけ取り出す
+// (serialman.cpp の受信タスクと同じく、0xf3 のペイロードはリングから直接読み捨てる)
+template <typename Chunk>
+static bool feed(const std::vector<uint8_t>& bytes, const std::vector<Expected>& expected, Chunk chunk,
+                 const char* name) {
+  ring = SerialRing();
+  SerialDecoder decoder;
+  size_t pos = 0, k = 0;
+  uint32_t payload = 0;
+  t_serialCmd c;
+  while (pos < bytes.size() || ring.available()) {
+    uint32_t space;
+    uint8_t* dst = ring.writePtr(&space);
+    size_t n = bytes.size() - pos;
+    size_t want = chunk();
+    if (n > want) n = want;
+    if (n > space) n = space;
+    memcpy(dst, &bytes[pos], n);
+    ring.commit(n);
+    pos += n;
+
+    bool progress = false;
+    while (true) {
+      if (payload) {
+        uint32_t r = ring.read(NULL, payload);
+        payload -= r;
+        progress |= r > 0;
+        if (payload) break;
+      }
+      if (!decoder.next(ring, c)) break;
+      progress = true;
+      if (k >= expected.size()) {
+        printf("NG: %s: extra command 0x%02x\n", name, c.command);
+        return false;
+      }
+      const Expected& e = expected[k];
+      if (!sameCmd(c, e.cmd) || (c.command == 0xf6 && memcmp(decoder.packed, e.packed.data(), e.packed.size()))) {
+        printf("NG: %s: command %zu (0x%02x) differs\n", name, k, e.cmd.command);
+        return false;
+      }
+      payload = e.payload;
+      k++;
+    }
+    if (!progress && n == 0) {
+      printf("NG: %s: stuck at command %zu with %u bytes in the ring\n", name, k, ring.available());
+      return false;
+    }
+  }
+  if (k != expected.size() || decoder.commands != expected.size()) {
+    printf("NG: %s: %zu of %zu commands\n", name, k, expected.size());
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 200;
+  std::mt19937 rng(41);
+  std::vector<uint8_t> bytes;
+  std::vector<Expected> expected;
+
+  for (int round = 0; round < rounds; round++) {
+    // リングを何周かするだけの長さ
+    generate(rng, 2000 + rng() % 20000, bytes, expected);
+    uint32_t maxChunk = 1 + rng() % (round % 4 == 0 ? 8 : 600);
+    char name[64];
+    snprintf(name, sizeof(name), "round %d (chunks <= %u)", round, maxChunk);
+    if (!feed(bytes, expected, [&] { return 1 + rng() % maxChunk; }, name)) return 1;
+  }
+
+  // 1 バイトずつ / リングより大きな塊
+  generate(rng, 50000, bytes, expected);
+  if (!feed(bytes, expected, [] { return 1; }, "1 byte")) return 1;
+  if (!feed(bytes, expected, [] { return SERIAL_RING_SIZE * 2; }, "whole ring")) return 1;
+
+  // 64 バイトずつ入れたときのコマンド数 / 秒
+  const int repeat = 20;
+  auto t0 = std::chrono::steady_clock::now();
+  for (int r = 0; r < repeat; r++) {
+    if (!feed(bytes, expected, [] { return 64; }, "64 bytes")) return 1;
+  }
+  double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  printf("64 byte packets: %.2f Mcommands/s (%.1f MB/s)\n", (double)expected.size() * repeat / s / 1e6,
+         (double)bytes.size() * repeat / s / 1e6);
+
+  printf("ok: %d rounds\n", rounds);
+  return 0;
+}
@@ -0,0 +1,622 @@
+// ------------------------------------------------------------------------------
+// vgm2xgm2: VGM (YM2612 + SN76489) を XGM2 に変換するホスト用ツール
+//
+//   g++ -std=c++17 -O2 -I../../lib/vgmcmd -o vgm2xgm2 vgm2xgm2.cpp ../../lib/vgmcmd/vgmcmd.cpp
+//   ./vgm2xgm2 [-pal] input.vgm output.xgm
+//
+//   VGM の読み方は src/vgm.cpp (vgmProcessMain) と同じ。出力するコマンドは
+//   src/vgm.cpp の _xgm2ProcessYM / _xgm2ProcessSN が解釈するものだけを使う
+//
+//   - 書き込みを 1 フレーム (NTSC 59.92Hz / PAL 49.70Hz) 単位にまとめる
+//   - 値の変わらない書き込みは捨てる (キーオンやタイマーなど書くこと自体に意味があるものは残す)
+//   - 周波数 / TL は差分が小さければ DELTA コマンド、フレーム最後のコマンドは _WAIT 付きにする
+//   - キーオフ + 周波数 + キーオンは FM_FREQ のフラグにまとめる
+//   - PSG はフレームの終わりの状態だけを書く
+//   - PCM (DAC) は変換しない (サンプルバンクは空)。vgz は解凍してから渡すこと
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "vgmcmd.h"
+
+#define NTSC_MCLK 53693175
+#define PAL_MCLK 53203424
+#define NTSC_FRAME_CLOCKS (3420 * 262)
+#define PAL_FRAME_CLOCKS (3420 * 313)
+#define NO_CMD ((size_t)-1)
+
+static uint32_t u16at(const std::vector<uint8_t>& d, size_t p) { return d[p] | (d[p + 1] << 8); }
+static uint32_t u32at(const std::vector<uint8_t>& d, size_t p) {
+  return d[p] | (d[p + 1] << 8) | (d[p + 2] << 16) | ((uint32_t)d[p + 3] << 24);
+}
+
+// ------------------------------------------------------------------------------
+// FM ストリーム
+class FMStream {
+ public:
+  std::vector<uint8_t> out;
+  uint32_t writes = 0;   // デコーダがチップに書く回数
+  uint32_t dropped = 0;  // 値が変わらないので捨てた書き込み
+  uint32_t dac = 0;      // 変換しなかった DAC 書き込み
+
+  FMStream() { forget(); }
+
+  // デコーダ側のレジスタ状態を不明にする (ループ先は 2 周目と状態が違うので差分を使えない)
+  void forget() {
+    for (int p = 0; p < 2; p++) {
+      for (int r = 0; r < 256; r++) _ym[p][r] = -1;
+      _latch[p][0] = _latch[p][1] = -1;
+    }
+    _last = NO_CMD;
+  }
+
+  void write(int port, uint8_t reg, uint8_t val) {
+    // 周波数上位はラッチされて下位を書いたときに反映される
+    if ((reg >= 0xa4 && reg <= 0xa6) || (port == 0 && reg >= 0xac && reg <= 0xae)) {
+      _latch[port][reg >= 0xac] = val;
+      return;
+    }
+    if ((reg >= 0xa0 && reg <= 0xa2) || (port == 0 && reg >= 0xa8 && reg <= 0xaa)) {
+      _freq(port, reg, val);
+      return;
+    }
+
+    if (port == 0 && reg == 0x28) {
+      _key(val);
+      return;
+    }
+    if (port == 0 && reg == 0x2a) {
+      dac++;
+      return;
+    }
+    if (port == 0 && reg == 0x2b && (val == 0x80 || val == 0x00)) {
+      if (_ym[0][0x2b] == val) {
+        dropped++;
+        return;
+      }
+      _ym[0][0x2b] = val;
+      _cmd(val ? 0xfc : 0xfd);
+      writes++;
+      return;
+    }
+    if (port == 0 && reg == 0x22) {
+      if (_ym[0][0x22] == val) {
+        dropped++;
+        return;
+      }
+      _ym[0][0x22] = val;
+      _cmd(0xf9, val);
+      writes++;
+      return;
+    }
+    if (port == 0 && reg >= 0x24 && reg <= 0x27) {
+      _raw(port, reg, val);  // タイマー / モード: 同じ値でも書く
+      return;
+    }
+
+    if (_ym[port][reg] == val) {
+      dropped++;
+      return;
+    }
+
+    // TL
+    if (reg >= 0x40 && reg <= 0x4f && (reg & 3) != 3 && val < 0x80) {
+      int ch = reg & 3;
+      int slot = (reg >> 2) & 3;
+      int old = _ym[port][reg];
+      int d = val - old;
+      if (old >= 0 && d >= -64 && d <= 64) {
+        _cmd(0xc0 | (slot << 2) | ch, (((d < 0 ? -d : d) - 1) << 2) | ((d < 0) << 1) | port);
+      } else {
+        _cmd(0x90 | (slot << 2) | ch, (val << 1) | port);
+      }
+      _ym[port][reg] = val;
+      writes++;
+      return;
+    }
+
+    // パンだけ変わるとき
+    if (reg >= 0xb4 && reg <= 0xb6 && _ym[port][reg] >= 0 && ((_ym[port][reg] ^ val) & 0x3f) == 0) {
+      _cmd((port ? 0x70 : 0x60) | ((val >> 6) << 2) | (reg & 3));
+      _ym[port][reg] = val;
+      writes++;
+      return;
+    }
+
+    _raw(port, reg, val);
+  }
+
+  // フレーム終わり: 使われなかったラッチを書いて wait フレーム待つ
+  void endFrame(uint32_t wait) {
+    for (int p = 0; p < 2; p++) {
+      for (int s = 0; s < 2; s++) {
+        if (_latch[p][s] >= 0) {
+          _raw(p, s ? 0xac : 0xa4, _latch[p][s]);
+          _latch[p][s] = -1;
+        }
+      }
+    }
+
+    // 最後のコマンドを _WAIT 付きにする
+    if (wait > 0 && _last != NO_CMD) {
+      uint8_t c = out[_last] & 0xf0;
+      if (c == 0x30 || c == 0xa0 || c == 0xc0) {
+        out[_last] += (c == 0x30) ? 0x50 : 0x10;
+        wait--;
+      }
+    }
+    while (wait > 0) {
+      if (wait <= 15) {
+        out.push_back(wait - 1);
+        wait = 0;
+      } else {
+        uint32_t w = wait > 271 ? 271 : wait;
+        out.push_back(0x0f);
+        out.push_back(w - 16);
+        wait -= w;
+      }
+    }
+    _last = NO_CMD;
+  }
+
+  void end(uint32_t loopOffset) {
+    out.push_back(0xff);
+    out.push_back(loopOffset & 0xff);
+    out.push_back((loopOffset >> 8) & 0xff);
+    out.push_back((loopOffset >> 16) & 0xff);
+  }
+
+ private:
+  int _ym[2][256];    // デコーダ側の状態 (-1 = 不明)
+  int _latch[2][2];   // 周波数上位のラッチ (通常 / CH3 スペシャル)
+  size_t _last;       // このフレームの最後のコマンド位置
+
+  void _cmd(uint8_t c) {
+    _last = out.size();
+    out.push_back(c);
+  }
+  void _cmd(uint8_t c, uint8_t d) {
+    _cmd(c);
+    out.push_back(d);
+  }
+
+  void _raw(int port, uint8_t reg, uint8_t val) {
+    // 直前が同じポートの FM_WRITE なら 8 個までつなげる
+    if (_last != NO_CMD && (out[_last] & 0xf8) == (0xe0 | (port << 3)) && (out[_last] & 7) < 7) {
+      out[_last]++;
+    } else {
+      _cmd(0xe0 | (port << 3));
+    }
+    out.push_back(reg);
+    out.push_back(val);
+    _ym[port][reg] = val;
+    writes++;
+  }
+
+  void _freq(int port, uint8_t reg, uint8_t lo) {
+    bool special = reg >= 0xa8;
+    int ch = reg & 3;
+    int hi = _latch[port][special] >= 0 ? _latch[port][special] : _ym[port][reg + 4];
+    _latch[port][special] = -1;
+
+    if (hi < 0) {
+      _raw(port, reg, lo);  // 上位が分からないのでそのまま
+      return;
+    }
+    if (_ym[port][reg + 4] == hi && _ym[port][reg] == lo) {
+      dropped++;
+      return;
+    }
+
+    int flags = 0;
+    int oldHi = _ym[port][reg + 4], oldLo = _ym[port][reg];
+    int now = ((hi & 0x3f) << 8) | lo;
+    int d = (oldHi >= 0 && oldLo >= 0) ? now - (((oldHi & 0x3f) << 8) | oldLo) : 0x10000;
+    uint8_t base = (special ? 8 : 0) | (port << 2) | ch;
+
+    if (d >= -128 && d <= 128) {
+      _cmd(0xa0 | base, (((d < 0 ? -d : d) - 1) << 1) | (d < 0));
+    } else {
+      // 直前の同じチャンネルのキーオフをまとめる
+      if (!special && _last != NO_CMD && out[_last] == (0x40 | (port << 2) | ch)) {
+        out.resize(_last);
+        writes--;
+        flags = 0x40;
+      }
+      _cmd(0x30 | base, flags | (hi & 0x3f));
+      out.push_back(lo);
+      writes += flags ? 1 : 0;
+    }
+    _ym[port][reg + 4] = hi & 0x3f;
+    _ym[port][reg] = lo;
+    writes += 2;
+  }
+
+  void _key(uint8_t val) {
+    int ch = val & 3;
+    int port = (val >> 2) & 1;
+    int ops = val & 0xf0;
+    if (ch == 3 || (ops != 0xf0 && ops != 0x00)) {
+      _raw(0, 0x28, val);
+      return;
+    }
+    bool on = ops == 0xf0;
+    uint8_t id = (port << 2) | ch;
+
+    if (_last != NO_CMD) {
+      uint8_t c = out[_last];
+      // 周波数の後のキーオン
+      if (on && c == (0x30 | id) && !(out[_last + 1] & 0x80)) {
+        out[_last + 1] |= 0x80;
+        writes++;
+        return;
+      }
+      // 反対のキー操作の直後ならシーケンスにする
+      if (c == (0x40 | (on ? 0 : 8) | id)) {
+        out[_last] = 0x50 | (on ? 0 : 8) | id;
+        writes++;
+        return;
+      }
+    }
+    _cmd(0x40 | (on ? 8 : 0) | id);
+    writes++;
+  }
+};
+
+// ------------------------------------------------------------------------------
+// PSG ストリーム
+class PSGStream {
+ public:
+  std::vector<uint8_t> out;
+  uint32_t writes = 0;
+  uint32_t dropped = 0;  // フレーム内で上書きされた / 値が変わらない書き込み
+
+  PSGStream() {
+    for (int i = 0; i < 4; i++) {
+      _tone[i] = 0;
+      _vol[i] = 15;
+    }
+    forget();
+  }
+
+  void forget() {
+    for (int i = 0; i < 4; i++) {
+      _stTone[i] = -1;
+      _stVol[i] = -1;
+    }
+    _last = NO_CMD;
+  }
+
+  void write(uint8_t b) {
+    _written++;
+    if (b & 0x80) {
+      _latchCh = (b >> 5) & 3;
+      _latchVol = b & 0x10;
+      if (_latchVol) {
+        _vol[_latchCh] = b & 0x0f;
+      } else if (_latchCh == 3) {
+        _tone[3] = b & 0x07;
+        _noiseWritten = true;
+      } else {
+        _tone[_latchCh] = (_tone[_latchCh] & 0x3f0) | (b & 0x0f);
+      }
+    } else {
+      if (_latchVol) {
+        _vol[_latchCh] = b & 0x0f;
+      } else if (_latchCh == 3) {
+        _tone[3] = b & 0x07;
+        _noiseWritten = true;
+      } else {
+        _tone[_latchCh] = (_tone[_latchCh] & 0x00f) | ((b & 0x3f) << 4);
+      }
+    }
+  }
+
+  void endFrame(uint32_t wait) {
+    uint32_t before = writes;
+    for (int ch = 0; ch < 4; ch++) {
+      _emitTone(ch);
+      _emitVol(ch);
+    }
+    // SN に書いた数とデコーダが書く数の差 (ペアは 2 と数える)
+    uint32_t emitted = writes - before;
+    if (_written > emitted) dropped += _written - emitted;
+    _written = 0;
+    _noiseWritten = false;
+
+    if (wait > 0 && _last != NO_CMD) {
+      uint8_t c = out[_last];
+      if ((c & 0xf0) == 0x20) {
+        out[_last] += 0x10;
+        wait--;
+      } else if (c == 0x10) {
+        out[_last] = 0x11;
+        wait--;
+      } else if ((c >= 0x40 && c <= 0x7f) || c >= 0xc0) {
+        if (!(c & 8)) {
+          out[_last] |= 8;
+          wait--;
+        }
+      }
+    }
+    while (wait > 0) {
+      if (wait <= 14) {
+        out.push_back(wait - 1);
+        wait = 0;
+      } else {
+        uint32_t w = wait > 270 ? 270 : wait;
+        out.push_back(0x0e);
+        out.push_back(w - 15);
+        wait -= w;
+      }
+    }
+    _last = NO_CMD;
+  }
+
+  void end(uint32_t loopOffset) {
+    out.push_back(0x0f);
+    out.push_back(loopOffset & 0xff);
+    out.push_back((loopOffset >> 8) & 0xff);
+    out.push_back((loopOffset >> 16) & 0xff);
+  }
+
+ private:
+  int _tone[4], _vol[4];      // SN の状態 (tone[3] はノイズ)
+  int _stTone[4], _stVol[4];  // デコーダ側の状態 (-1 = 不明)
+  int _latchCh = 0;
+  bool _latchVol = false;
+  bool _noiseWritten = false;  // ノイズは書くと LFSR がリセットされるので同じ値でも書く
+  uint32_t _written = 0;
+  size_t _last;
+
+  void _cmd(uint8_t c) {
+    _last = out.size();
+    out.push_back(c);
+  }
+
+  void _emitTone(int ch) {
+    int v = _tone[ch];
+    int old = _stTone[ch];
+
+    if (ch == 3) {
+      if (!_noiseWritten && old == v) return;
+      _cmd(0x20 | (3 << 2));
+      out.push_back(v);
+      writes++;
+    } else {
+      if (old == v) return;
+      int d = v - old;
+      if (old >= 0 && d >= -4 && d <= 4) {
+        _cmd((0x40 + ch * 0x10) | ((d < 0) << 2) | ((d < 0 ? -d : d) - 1));
+        writes += ((old & 0x3f0) != (v & 0x3f0)) ? 2 : 1;
+      } else if (old >= 0 && (old & 0x3f0) == (v & 0x3f0)) {
+        _cmd(0x10);
+        out.push_back((ch << 5) | (v & 0x0f));
+        writes++;
+      } else {
+        _cmd(0x20 | (ch << 2) | (v >> 8));
+        out.push_back(v & 0xff);
+        writes += 2;
+      }
+    }
+    _stTone[ch] = v;
+  }
+
+  void _emitVol(int ch) {
+    int v = _vol[ch];
+    int old = _stVol[ch];
+    if (old == v) return;
+    int d = v - old;
+    if (old >= 0 && d >= -4 && d <= 4) {
+      _cmd((0xc0 + ch * 0x10) | ((d < 0) << 2) | ((d < 0 ? -d : d) - 1));
+    } else {
+      _cmd((0x80 + ch * 0x10) | v);
+    }
+    _stVol[ch] = v;
+    writes++;
+  }
+};
+
+// ------------------------------------------------------------------------------
+
+static bool readFile(const char* path, std::vector<uint8_t>& data) {
+  FILE* f = fopen(path, "rb");
+  if (!f) return false;
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  data.resize(size);
+  bool ok = fread(data.data(), 1, size, f) == (size_t)size;
+  fclose(f);
+  return ok;
+}
+
+static void put16(std::vector<uint8_t>& d, size_t p, uint32_t v) {
+  d[p] = v & 0xff;
+  d[p + 1] = (v >> 8) & 0xff;
+}
+
+static void pad256(std::vector<uint8_t>& d) {
+  while (d.size() & 0xff) d.push_back(0);
+}
+
+int main(int argc, char** argv) {
+  bool pal = false;
+  const char* in = NULL;
+  const char* outPath = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-pal")) {
+      pal = true;
+    } else if (!in) {
+      in = argv[i];
+    } else {
+      outPath = argv[i];
+    }
+  }
+  if (!in || !outPath) {
+    fprintf(stderr, "usage: vgm2xgm2 [-pal] input.vgm output.xgm\n");
+    return 1;
+  }
+
+  std::vector<uint8_t> vgm;
+  if (!readFile(in, vgm) || vgm.size() < 0x40) {
+    fprintf(stderr, "ERROR: Failed to read %s\n", in);
+    return 1;
+  }
+  if (vgm[0] == 0x1f && vgm[1] == 0x8b) {
+    fprintf(stderr, "ERROR: vgz is not supported. Decompress it first.\n");
+    return 1;
+  }
+  if (memcmp(vgm.data(), "Vgm ", 4) != 0) {
+    fprintf(stderr, "ERROR: Bad VGM ident.\n");
+    return 1;
+  }
+
+  uint32_t version = u32at(vgm, 0x08);
+  uint32_t gd3Offset = u32at(vgm, 0x14) ? 0x14 + u32at(vgm, 0x14) : 0;
+  uint32_t loopOffset = u32at(vgm, 0x1c) ? 0x1c + u32at(vgm, 0x1c) : 0;
+  uint32_t dataOffset = (version >= 0x150 && u32at(vgm, 0x34)) ? 0x34 + u32at(vgm, 0x34) : 0x40;
+  uint32_t end = gd3Offset ? gd3Offset : vgm.size();
+
+  const uint64_t mclk = pal ? PAL_MCLK : NTSC_MCLK;
+  const uint64_t frameClocks = pal ? PAL_FRAME_CLOCKS : NTSC_FRAME_CLOCKS;
+
+  FMStream fm;
+  PSGStream psg;
+  uint64_t samples = 0;
+  uint32_t frame = 0;
+  uint32_t vgmWrites = 0, ignored = 0;
+  uint32_t fmLoop = 0xffffff, psgLoop = 0xffffff;
+
+  auto frameAt = [&](uint64_t s) { return (uint32_t)(s * mclk / (44100 * frameClocks)); };
+  auto advance = [&]() {
+    uint32_t f = frameAt(samples);
+    if (f > frame) {
+      fm.endFrame(f - frame);
+      psg.endFrame(f - frame);
+      frame = f;
+    }
+  };
+
+  uint32_t pos = dataOffset;
+  bool done = false;
+  while (!done && pos < end) {
+    if (pos == loopOffset) {
+      // ループ先: ここまでの書き込みを出してから位置を覚える
+      fm.endFrame(0);
+      psg.endFrame(0);
+      fm.forget();
+      psg.forget();
+      fmLoop = fm.out.size();
+      psgLoop = psg.out.size();
+    }
+
+    uint8_t command = vgm[pos++];
+    switch (command) {
+      case 0x50:
+        advance();
+        psg.write(vgm[pos++]);
+        vgmWrites++;
+        break;
+      case 0x52:
+      case 0x53:
+        advance();
+        fm.write(command & 1, vgm[pos], vgm[pos + 1]);
+        pos += 2;
+        vgmWrites++;
+        break;
+      case 0x61:
+        samples += u16at(vgm, pos);
+        pos += 2;
+        break;
+      case 0x62:
+        samples += 735;
+        break;
+      case 0x63:
+        samples += 882;
+        break;
+      case 0x66:
+        done = true;
+        break;
+      case 0x67: {
+        uint32_t size = u32at(vgm, pos + 2);
+        pos += 6 + size;
+        break;
+      }
+      case 0x70 ... 0x7f:
+        samples += (command & 15) + 1;
+        break;
+      case 0x80 ... 0x8f:
+        advance();
+        fm.write(0, 0x2a, 0);
+        vgmWrites++;
+        samples += command & 15;
+        break;
+      case 0xe0:
+        pos += 4;
+        break;
+      default:
+        // 他のチップ・DAC ストリームなどは長さ (lib/vgmcmd) だけ見て飛ばす
+        if (vgmCommandLength(command) > 1) {
+          pos += vgmCommandLength(command) - 1;
+          ignored++;
+          break;
+        }
+        fprintf(stderr, "Unknown VGM command: 0x%02x @ 0x%x\n", command, pos - 1);
+        done = true;
+        break;
+    }
+  }
+
+  // 最後の書き込みが反映されるように 1 フレーム待ってから終了 / ループ
+  uint32_t last = frameAt(samples);
+  if (last <= frame) last = frame + 1;
+  fm.endFrame(last - frame);
+  psg.endFrame(last - frame);
+  fm.end(fmLoop);
+  psg.end(psgLoop);
+  pad256(fm.out);
+  pad256(psg.out);
+
+  // XGM2 ヘッダ
+  std::vector<uint8_t> xgm(0x104, 0);
+  memcpy(xgm.data(), "XGM2", 4);
+  xgm[4] = 0x10;
+  xgm[5] = (pal ? 0b0001 : 0) | (gd3Offset ? 0b0100 : 0);
+  put16(xgm, 0x06, 0);  // サンプルなし
+  put16(xgm, 0x08, fm.out.size() >> 8);
+  put16(xgm, 0x0a, psg.out.size() >> 8);
+  for (int i = 0; i < 124; i++) {
+    put16(xgm, 0x0c + i * 2, 0xffff);
+  }
+  xgm.insert(xgm.end(), fm.out.begin(), fm.out.end());
+  xgm.insert(xgm.end(), psg.out.begin(), psg.out.end());
+  if (gd3Offset) {
+    xgm.insert(xgm.end(), vgm.begin() + gd3Offset, vgm.end());
+  }
+
+  if (fm.out.size() > 0xffff00 || psg.out.size() > 0xffff00) {
+    fprintf(stderr, "ERROR: Stream too large for XGM2.\n");
+    return 1;
+  }
+
+  FILE* f = fopen(outPath, "wb");
+  if (!f || fwrite(xgm.data(), 1, xgm.size(), f) != xgm.size()) {
+    fprintf(stderr, "ERROR: Failed to write %s\n", outPath);
+    if (f) fclose(f);
+    return 1;
+  }
+  fclose(f);
+
+  printf("%s: %u frames (%s), loop %s\n", in, last, pal ? "PAL" : "NTSC", loopOffset ? "yes" : "no");
+  printf("  size   : %zu -> %zu bytes (FM %zu, PSG %zu)\n", vgm.size(), xgm.size(), fm.out.size(), psg.out.size());
+  printf("  writes : %u -> %u (FM %u, PSG %u), redundant FM %u / PSG %u\n", vgmWrites, fm.writes + psg.writes,
+         fm.writes, psg.writes, fm.dropped, psg.dropped);
+  if (fm.dac) printf("  WARNING: %u DAC writes dropped (PCM is not converted)\n", fm.dac);
+  if (ignored) printf("  WARNING: %u commands for other chips / streams ignored\n", ignored);
+  return 0;
+}
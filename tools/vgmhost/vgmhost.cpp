@@ -0,0 +1,643 @@
+// ------------------------------------------------------------------------------
+// vgmhost: 再生エンジンのコマンド解釈をホストで動かす
+//
+//   cd tools/vgmhost
+//   g++ -std=c++17 -O2 -I../../lib/vgmcmd -I../../lib/xgm -I../../lib/synth -o vgmhost vgmhost.cpp
+//     ../../lib/vgmcmd/vgmcmd.cpp ../../lib/xgm/xgm.cpp ../../lib/synth/*.cpp
+//   ./vgmhost file.vgm|file.xgm [-t out.ndtr] [-w out.wav] [-c ref.wav] [-s dB] [-n 回数]
+//   ./vgmhost --diff a.ndtr b.ndtr [--no-dac]
+//   ./vgmhost --selftest
+//
+//   実機と同じコード (VGMRouter, XGM1Decoder / XGM2Decoder) で曲を最後 (ループは 1 回目の終わり) まで解釈し、
+//   チップへの書き込みを待ちから計算したサンプル時刻付きで記録する
+//   -t: USE_CHIPBUS_TRACE の実機トレースと同じ形式 (lib/fm/chipbus.h) で書き出す
+//   -w: USE_CHIPBUS_SYNTH と同じソフト音源 (lib/synth の SynthMix) で WAV にする。実時間比 (RTF) も出す
+//   -c: レンダリング結果を基準の WAV と比べる。S/N が -s (既定 60dB) 未満なら終了コード 1
+//       (ソフト音源を変えたときの回帰確認用。基準は前の版の -w の出力)
+//   -n: 解釈を繰り返して 1 秒あたりのコマンド数と実時間比を出す
+//   --diff: 2 つのトレースの書き込み列 (時刻は見ない) を比べる。違えば終了コード 1
+//     実機のトレースと比べるときは --no-dac で DAC (PCM) の書き込みを除く
+//   --selftest: YM2612 / SN76489 のソフト音源を決まったレジスタ設定で鳴らして、
+//     オペレータの接続と音程を確かめる。だめなら終了コード 1
+//   VGM の PCM ストリーム (0x90 - 0x95) と XGM の PCM は数えるだけ
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <vector>
+
+#include "synthmix.h"
+#include "vgmcmd.h"
+#include "xgm.h"
+
+// lib/fm/chipbus.h と同じ値
+#define TRACE_SN76489 0x00
+#define TRACE_SN76489_RAW 0x10
+#define TRACE_YM2612 0x20
+#define TRACE_YM2612_DAC 0x30
+#define TRACE_OPN 0x40
+#define TRACE_OPM 0x50
+#define TRACE_OPL3 0x60
+#define TRACE_OPLL 0x70
+#define TRACE_VERSION 1
+
+#define PSG_CHIP(n) (1 << (n))
+
+#define XGM_NTSC_MCLK 53693175
+#define XGM_PAL_MCLK 53203424
+#define XGM_NTSC_FRAME_CLOCKS (3420 * 262)
+#define XGM_PAL_FRAME_CLOCKS (3420 * 313)
+
+typedef struct __attribute__((packed)) {
+  uint32_t sample;
+  uint8_t chip;
+  uint8_t port;
+  uint8_t reg;
+  uint8_t value;
+} t_traceRecord;
+
+// 書き込みを記録するバス (TraceChipBus と同じレコード)
+class HostBus {
+ public:
+  typedef uint32_t freq_t;
+  std::vector<t_traceRecord> records;
+  uint32_t sample = 0;  // 現在のサンプル時刻
+
+  void setRegister(uint8_t addr, uint8_t value, int chipno) { _add(TRACE_OPN | chipno, 0, addr, value); }
+  void setRegisterOPM(uint8_t addr, uint8_t value, uint8_t chipno) { _add(TRACE_OPM | chipno, 0, addr, value); }
+  void setRegisterOPL3(uint8_t port, uint8_t addr, uint8_t data, int chipno) {
+    _add(TRACE_OPL3 | chipno, port, addr, data);
+  }
+  void setRegisterOPLL(uint8_t addr, uint8_t value, uint8_t chipno) { _add(TRACE_OPLL | chipno, 0, addr, value); }
+  void setYM2612(uint8_t port, uint8_t addr, uint8_t data, uint8_t chipno) {
+    _add(TRACE_YM2612 | chipno, port, addr, data);
+  }
+  void setYM2612DAC(uint8_t data, uint8_t chipno) { _add(TRACE_YM2612_DAC | chipno, 0, 0x2a, data); }
+  void write(uint8_t data, uint8_t chipno, freq_t) { _add(TRACE_SN76489 | chipno, 0, 0, data); }
+  void writeRaw(uint8_t data, uint8_t chipno, freq_t) { _add(TRACE_SN76489_RAW | chipno, 0, 0, data); }
+  void writeRawPair(uint8_t latch, uint8_t data, uint8_t chipMask, freq_t) {
+    for (uint8_t c = 0; c < 3; c++) {
+      if (chipMask & PSG_CHIP(c)) {
+        _add(TRACE_SN76489_RAW | c, 0, 0, latch);
+        _add(TRACE_SN76489_RAW | c, 0, 0, data);
+      }
+    }
+  }
+
+ private:
+  void _add(uint8_t chip, uint8_t port, uint8_t reg, uint8_t value) {
+    records.push_back({sample, chip, port, reg, value});
+  }
+};
+
+// XGM のデコーダから HostBus へ (vgm.cpp の XGMChipSink と同じ振り分け)
+class HostSink : public XGMSink {
+ public:
+  HostBus* bus = NULL;
+  uint32_t pcm_ = 0;
+
+  void ym(uint8_t port, uint8_t reg, uint8_t value) override { bus->setYM2612(port, reg, value, 0); }
+  void psg(uint8_t data) override { bus->writeRaw(data, 1, 0); }
+  void psgPair(uint8_t latch, uint8_t data) override { bus->writeRawPair(latch, data, PSG_CHIP(1), 0); }
+  void psgLatched(uint8_t data) override { bus->write(data, 1, 0); }
+  void pcm(uint8_t, uint8_t) override { pcm_++; }
+};
+
+typedef struct {
+  uint32_t ymClock = 7670453;
+  uint32_t snClock = 3579545;
+  uint32_t commands = 0;
+  uint32_t samples = 0;  // 曲の長さ (44.1kHz)
+  uint32_t pcm = 0;      // PCM ストリーム / XGM PCM コマンド
+  uint32_t unknown = 0;
+} t_result;
+
+static bool readAll(const char* path, std::vector<uint8_t>& out) {
+  FILE* fp = fopen(path, "rb");
+  if (!fp) return false;
+  uint8_t buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+    out.insert(out.end(), buf, buf + n);
+  }
+  fclose(fp);
+  return true;
+}
+
+static uint32_t u16at(const std::vector<uint8_t>& d, size_t p) { return d[p] | (d[p + 1] << 8); }
+static uint32_t u32at(const std::vector<uint8_t>& d, size_t p) {
+  return d[p] | (d[p + 1] << 8) | (d[p + 2] << 16) | ((uint32_t)d[p + 3] << 24);
+}
+
+static double nowUs() {
+  return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 全部の USE_* を有効にした setupChipRoutes と同じ表
+static void setupRoutes(VGMRouter& r, uint32_t snClock) {
+  r.clear();
+  r.route(0x50, VGM_ROUTE_SN76489, 1, 0, snClock);
+  r.route(0x30, VGM_ROUTE_SN76489, 2, 0, snClock);
+  r.route(0x51, VGM_ROUTE_OPLL, 1);
+  r.route(0x52, VGM_ROUTE_YM2612, 0, 0);
+  r.route(0x53, VGM_ROUTE_YM2612, 0, 1);
+  r.route(0xa0, VGM_ROUTE_OPN, 0);
+  r.route(0x54, VGM_ROUTE_OPM, 0);
+  r.route(0xa4, VGM_ROUTE_OPM, 0);
+  r.route(0x55, VGM_ROUTE_OPN, 0);
+  r.route(0xa5, VGM_ROUTE_OPN, 1);
+  r.route(0x5a, VGM_ROUTE_OPL3, 1, 0);
+  r.route(0x5e, VGM_ROUTE_OPL3, 1, 0);
+  r.route(0x5f, VGM_ROUTE_OPL3, 1, 1);
+}
+
+// VGM (vgmProcessMain と同じ手順)
+static bool runVGM(const std::vector<uint8_t>& d, HostBus& bus, t_result& res) {
+  static VGMRouter router;
+  uint32_t version = u32at(d, 0x08);
+  if (u32at(d, 0x0c) & 0x3fffffff) res.snClock = u32at(d, 0x0c) & 0x3fffffff;
+  if (version >= 0x110 && (u32at(d, 0x2c) & 0x3fffffff)) res.ymClock = u32at(d, 0x2c) & 0x3fffffff;
+  setupRoutes(router, res.snClock);
+  size_t pos = (version >= 0x150 && u32at(d, 0x34)) ? 0x34 + u32at(d, 0x34) : 0x40;
+  std::vector<uint8_t> bank;  // データブロック (YM2612 PCM)
+  size_t bankPos = 0;
+
+  while (pos < d.size()) {
+    uint8_t command = d[pos++];
+    res.commands++;
+    if (router.dispatch(&bus, command, [&]() { return d[pos++]; })) continue;
+    switch (command) {
+      case 0x61:
+        bus.sample += u16at(d, pos);
+        pos += 2;
+        break;
+      case 0x62:
+        bus.sample += 735;
+        break;
+      case 0x63:
+        bus.sample += 882;
+        break;
+      case 0x70 ... 0x7f:
+        bus.sample += (command & 0x0f) + 1;
+        break;
+      case 0x80 ... 0x8f:
+        bus.setYM2612DAC(bankPos < bank.size() ? bank[bankPos] : 0, 0);
+        bankPos++;
+        bus.sample += command & 0x0f;
+        break;
+      case 0x67: {
+        uint8_t type = d[pos + 1];
+        uint32_t size = u32at(d, pos + 2) & 0x7fffffff;
+        if (type == 0) bank.insert(bank.end(), d.begin() + pos + 6, d.begin() + pos + 6 + size);
+        pos += 6 + size;
+        break;
+      }
+      case 0xe0:
+        bankPos = u32at(d, pos);
+        pos += 4;
+        break;
+      case 0x90 ... 0x95:
+        res.pcm++;
+        pos += vgmCommandLength(command) - 1;
+        break;
+      case 0x66:
+        res.samples = bus.sample;
+        return true;
+      default:
+        res.unknown++;
+        pos += vgmCommandLength(command) - 1;
+        break;
+    }
+  }
+  res.samples = bus.sample;
+  return true;
+}
+
+static uint32_t frameSample(uint32_t frame, bool ntsc) {
+  uint64_t clocks = (uint64_t)frame * (ntsc ? XGM_NTSC_FRAME_CLOCKS : XGM_PAL_FRAME_CLOCKS);
+  return (uint32_t)(clocks * 44100 / (ntsc ? XGM_NTSC_MCLK : XGM_PAL_MCLK));
+}
+
+// XGM1 (_xgm1ProcessYMSN と同じ。ストリームモードではないのでサンプルバンクは抜けていない)
+static bool runXGM1(const std::vector<uint8_t>& d, HostBus& bus, t_result& res) {
+  uint32_t slen = u16at(d, 0x100) << 8;
+  bool ntsc = (d[0x103] & 1) == 0;
+  uint32_t music = 0x104 + slen;
+  if (music + 4 > d.size()) return false;
+  uint32_t mlen = u32at(d, music);
+  if (music + 4 + mlen > d.size()) return false;
+
+  HostSink sink;
+  sink.bus = &bus;
+  XGM1Decoder dec;
+  dec.begin(d.data(), music + 4, mlen);
+  while (dec.pos < music + 4 + mlen) {
+    bus.sample = frameSample(dec.frame, ntsc);
+    res.commands++;
+    if (dec.step(sink) != XGM_STEP_NEXT) break;
+  }
+  res.samples = frameSample(dec.frame, ntsc);
+  res.pcm = sink.pcm_;
+  res.unknown = dec.unknown;
+  return true;
+}
+
+// XGM2 (FM / PSG をフレーム順に交互に進める。マルチトラックは最初のトラック)
+static bool runXGM2(const std::vector<uint8_t>& d, HostBus& bus, t_result& res) {
+  uint8_t flags = d[0x05];
+  bool ntsc = (flags & 1) == 0;
+  uint32_t slen = u16at(d, 0x06) << 8;
+  uint32_t fmlen = u16at(d, 0x08) << 8;
+  uint32_t psglen = u16at(d, 0x0a) << 8;
+  uint32_t base = (flags & 2) ? 0x3fc : 0x104;
+  uint32_t fm = base + slen, psg = fm + fmlen;
+  if (flags & 2) {
+    // FMID / PSGID テーブルの最初のトラック
+    fm += u16at(d, 0x1fc) << 8;
+    psg += u16at(d, 0x2fc) << 8;
+  }
+  if (psg + psglen > d.size()) return false;
+
+  HostSink sink;
+  sink.bus = &bus;
+  XGM2Decoder dec;
+  dec.begin(d.data(), fm, fmlen, psg, psglen);
+  bool fmDone = false, psgDone = false;
+  while (!fmDone || !psgDone) {
+    bool doFM = !fmDone && (psgDone || dec.fmFrame <= dec.psgFrame);
+    bus.sample = frameSample(doFM ? dec.fmFrame : dec.psgFrame, ntsc);
+    res.commands++;
+    if (doFM) {
+      fmDone = dec.stepFM(sink) != XGM_STEP_NEXT || dec.fmPos >= fm + fmlen;
+    } else {
+      psgDone = dec.stepPSG(sink) != XGM_STEP_NEXT || dec.psgPos >= psg + psglen;
+    }
+  }
+  res.samples = frameSample(dec.fmFrame > dec.psgFrame ? dec.fmFrame : dec.psgFrame, ntsc);
+  res.pcm = sink.pcm_;
+  res.unknown = dec.unknown;
+  return true;
+}
+
+static bool run(const std::vector<uint8_t>& d, HostBus& bus, t_result& res) {
+  if (d.size() < 0x40) return false;
+  uint32_t ident = u32at(d, 0);
+  if (ident == 0x206d6756) return runVGM(d, bus, res);   // "Vgm "
+  if (ident == 0x204d4758) return runXGM1(d, bus, res);  // "XGM "
+  if (ident == 0x324d4758) return runXGM2(d, bus, res);  // "XGM2"
+  return false;
+}
+
+// SynthChipBus と同じ振り分けでトレースをソフト音源に通す
+static void render(const std::vector<t_traceRecord>& records, const t_result& res, std::vector<int16_t>& out) {
+  static SynthMix mix;
+  mix.reset(res.ymClock, res.snClock);
+  uint32_t frames = res.samples;
+  for (const t_traceRecord& r : records) {
+    if (r.sample > frames) frames = r.sample;
+  }
+  out.assign((size_t)frames * 2, 0);
+
+  uint32_t rendered = 0;
+  auto advance = [&](uint32_t target) {
+    while (rendered < target) {
+      uint32_t n = target - rendered > SYNTH_BLOCK ? SYNTH_BLOCK : target - rendered;
+      mix.render(&out[(size_t)rendered * 2], n);
+      rendered += n;
+    }
+  };
+  for (const t_traceRecord& r : records) {
+    advance(r.sample);
+    uint8_t chip = r.chip & 0x0f;
+    switch (r.chip & 0xf0) {
+      case TRACE_YM2612:
+        if (chip == 0) mix.ym(r.port, r.reg, r.value);
+        break;
+      case TRACE_YM2612_DAC:
+        if (chip == 0) mix.ym(0, 0x2a, r.value);
+        break;
+      case TRACE_SN76489:
+        mix.snWrite(r.value, chip, 0);
+        break;
+      case TRACE_SN76489_RAW:
+        mix.snWriteRaw(r.value, chip, 0);
+        break;
+    }
+  }
+  advance(frames);
+}
+
+// 44 バイトの WAV ヘッダ (16bit ステレオ)
+static bool writeWav(const char* path, const std::vector<int16_t>& pcm) {
+  FILE* fp = fopen(path, "wb");
+  if (!fp) return false;
+  uint32_t bytes = pcm.size() * 2;
+  uint32_t v;
+  uint16_t h;
+  fwrite("RIFF", 1, 4, fp);
+  v = 36 + bytes;
+  fwrite(&v, 4, 1, fp);
+  fwrite("WAVEfmt ", 1, 8, fp);
+  v = 16;
+  fwrite(&v, 4, 1, fp);
+  h = 1;
+  fwrite(&h, 2, 1, fp);
+  h = 2;
+  fwrite(&h, 2, 1, fp);
+  v = SYNTH_RATE;
+  fwrite(&v, 4, 1, fp);
+  v = SYNTH_RATE * 4;
+  fwrite(&v, 4, 1, fp);
+  h = 4;
+  fwrite(&h, 2, 1, fp);
+  h = 16;
+  fwrite(&h, 2, 1, fp);
+  fwrite("data", 1, 4, fp);
+  fwrite(&bytes, 4, 1, fp);
+  fwrite(pcm.data(), 2, pcm.size(), fp);
+  fclose(fp);
+  return true;
+}
+
+// data チャンクを探す (16bit ステレオ 44.1kHz のみ)
+static bool readWav(const char* path, std::vector<int16_t>& pcm) {
+  std::vector<uint8_t> d;
+  if (!readAll(path, d) || d.size() < 12 || memcmp(d.data(), "RIFF", 4) != 0) return false;
+  size_t p = 12;
+  bool fmtOk = false;
+  while (p + 8 <= d.size()) {
+    uint32_t size = u32at(d, p + 4);
+    if (memcmp(&d[p], "fmt ", 4) == 0) {
+      fmtOk = u16at(d, p + 8) == 1 && u16at(d, p + 10) == 2 && u32at(d, p + 12) == SYNTH_RATE &&
+              u16at(d, p + 22) == 16;
+    } else if (memcmp(&d[p], "data", 4) == 0) {
+      if (!fmtOk) return false;
+      size_t n = (size < d.size() - p - 8 ? size : d.size() - p - 8) / 2;
+      pcm.resize(n);
+      memcpy(pcm.data(), &d[p + 8], n * 2);
+      return true;
+    }
+    p += 8 + size + (size & 1);
+  }
+  return false;
+}
+
+// 基準との S/N (dB)
+static double compareWav(const std::vector<int16_t>& a, const std::vector<int16_t>& ref, int32_t* maxDiff) {
+  size_t n = a.size() > ref.size() ? a.size() : ref.size();
+  double sig = 0, err = 0;
+  *maxDiff = 0;
+  for (size_t i = 0; i < n; i++) {
+    int32_t x = i < a.size() ? a[i] : 0;
+    int32_t y = i < ref.size() ? ref[i] : 0;
+    int32_t e = x - y;
+    if (abs(e) > *maxDiff) *maxDiff = abs(e);
+    sig += (double)y * y;
+    err += (double)e * e;
+  }
+  if (err == 0) return INFINITY;
+  if (sig == 0) return -INFINITY;
+  return 10.0 * log10(sig / err);
+}
+
+static bool writeTrace(const char* path, const std::vector<t_traceRecord>& records) {
+  FILE* fp = fopen(path, "wb");
+  if (!fp) return false;
+  const uint32_t version = TRACE_VERSION;
+  fwrite("NDTR", 1, 4, fp);
+  fwrite(&version, 4, 1, fp);
+  fwrite(records.data(), sizeof(t_traceRecord), records.size(), fp);
+  fclose(fp);
+  return true;
+}
+
+static bool readTrace(const char* path, std::vector<t_traceRecord>& records, bool noDac) {
+  std::vector<uint8_t> d;
+  if (!readAll(path, d) || d.size() < 8 || memcmp(d.data(), "NDTR", 4) != 0) return false;
+  for (size_t p = 8; p + sizeof(t_traceRecord) <= d.size(); p += sizeof(t_traceRecord)) {
+    t_traceRecord r;
+    memcpy(&r, &d[p], sizeof(r));
+    if (r.chip == 0xf0) continue;  // リセット
+    if (noDac && (r.chip & 0xf0) == TRACE_YM2612_DAC) continue;
+    records.push_back(r);
+  }
+  return true;
+}
+
+static int diff(const char* a, const char* b, bool noDac) {
+  std::vector<t_traceRecord> ra, rb;
+  if (!readTrace(a, ra, noDac) || !readTrace(b, rb, noDac)) {
+    fprintf(stderr, "cannot read trace\n");
+    return 2;
+  }
+  size_t n = ra.size() < rb.size() ? ra.size() : rb.size();
+  for (size_t i = 0; i < n; i++) {
+    const t_traceRecord &x = ra[i], &y = rb[i];
+    if (x.chip != y.chip || x.port != y.port || x.reg != y.reg || x.value != y.value) {
+      printf("differ at write %zu: %02x %u %02x %02x (sample %u) / %02x %u %02x %02x (sample %u)\n", i, x.chip,
+             x.port, x.reg, x.value, x.sample, y.chip, y.port, y.reg, y.value, y.sample);
+      return 1;
+    }
+  }
+  if (ra.size() != rb.size()) {
+    printf("length differs: %zu / %zu writes\n", ra.size(), rb.size());
+    return 1;
+  }
+  printf("same: %zu writes\n", n);
+  return 0;
+}
+
+// 上がりのゼロクロスから周波数 (Hz) を出す
+static double measureFreq(const std::vector<int16_t>& pcm) {
+  size_t frames = pcm.size() / 2;
+  size_t first = 0, last = 0, crossings = 0;
+  for (size_t i = 1; i < frames; i++) {
+    if (pcm[(i - 1) * 2] < 0 && pcm[i * 2] >= 0) {
+      if (crossings == 0) first = i;
+      last = i;
+      crossings++;
+    }
+  }
+  if (crossings < 2) return 0;
+  return (double)(crossings - 1) * SYNTH_RATE / (last - first);
+}
+
+static int32_t peak(const std::vector<int16_t>& pcm) {
+  int32_t p = 0;
+  for (int16_t v : pcm) {
+    if (abs(v) > p) p = abs(v);
+  }
+  return p;
+}
+
+// YM2612 CH1 を 1 秒鳴らす (tl: レジスタ順 +0, +4, +8, +C の TL)
+static void renderYM(uint8_t alg, const uint8_t tl[4], uint16_t fnum, uint8_t block, std::vector<int16_t>& out) {
+  static SynthMix mix;
+  mix.reset(7670453, 3579545);
+  for (int o = 0; o < 4; o++) {
+    mix.ym(0, 0x30 + o * 4, 0x01);  // DT 0, MUL 1
+    mix.ym(0, 0x40 + o * 4, tl[o]);
+    mix.ym(0, 0x50 + o * 4, 0x1f);  // AR 31
+    mix.ym(0, 0x60 + o * 4, 0x00);
+    mix.ym(0, 0x70 + o * 4, 0x00);
+    mix.ym(0, 0x80 + o * 4, 0x0f);  // SL 0, RR 15
+  }
+  mix.ym(0, 0xa4, (block << 3) | (fnum >> 8));
+  mix.ym(0, 0xa0, fnum & 0xff);
+  mix.ym(0, 0xb0, alg);
+  mix.ym(0, 0xb4, 0xc0);
+  mix.ym(0, 0x28, 0xf0);
+  out.assign(SYNTH_RATE * 2, 0);
+  for (uint32_t i = 0; i < SYNTH_RATE; i += SYNTH_BLOCK) {
+    uint32_t n = SYNTH_RATE - i > SYNTH_BLOCK ? SYNTH_BLOCK : SYNTH_RATE - i;
+    mix.render(&out[i * 2], n);
+  }
+}
+
+static int selftest() {
+  int failed = 0;
+  auto check = [&](bool ok, const char* what) {
+    printf("%s: %s\n", ok ? "ok" : "NG", what);
+    if (!ok) failed++;
+  };
+  std::vector<int16_t> pcm;
+
+  // 440Hz: fnum = 440 * 144 * 2^20 / 7670453 / 2^(4 - 1)
+  const uint16_t fnum = 1083;
+
+  // アルゴリズム 7: S1 (+0) だけ鳴らして音程
+  const uint8_t s1[4] = {0, 127, 127, 127};
+  renderYM(7, s1, fnum, 4, pcm);
+  double f = measureFreq(pcm);
+  printf("  YM2612 S1: %.1f Hz, peak %d\n", f, peak(pcm));
+  check(fabs(f - 440.0) < 440.0 * 0.01, "YM2612 pitch");
+
+  // アルゴリズム 4: (S1 -> S2) + (S3 -> S4)。S2 (+8) はキャリア, S3 (+4) はモジュレータ
+  const uint8_t s2[4] = {127, 127, 0, 127};
+  renderYM(4, s2, fnum, 4, pcm);
+  int32_t p2 = peak(pcm);
+  const uint8_t s3[4] = {127, 0, 127, 127};
+  renderYM(4, s3, fnum, 4, pcm);
+  int32_t p3 = peak(pcm);
+  printf("  YM2612 alg 4: S2 only peak %d, S3 only peak %d\n", p2, p3);
+  check(p2 > 1000 && p3 == 0, "YM2612 operator routing (S2 at +8 is a carrier, S3 at +4 a modulator)");
+
+  // アルゴリズム 0: S1 -> S2 -> S3 -> S4。S4 (+C) だけ鳴らすと正弦波
+  const uint8_t s4[4] = {127, 127, 127, 0};
+  renderYM(0, s4, fnum, 4, pcm);
+  f = measureFreq(pcm);
+  printf("  YM2612 alg 0 S4: %.1f Hz\n", f);
+  check(fabs(f - 440.0) < 440.0 * 0.01, "YM2612 carrier S4");
+
+  // SN76489: トーン 0, 周期 254 (3579545 / 32 / 254 = 440.4Hz)
+  static SynthMix mix;
+  mix.reset(7670453, 3579545);
+  mix.snWriteRaw(0x80 | (254 & 0x0f), 0, 0);
+  mix.snWriteRaw(254 >> 4, 0, 0);
+  mix.snWriteRaw(0x90, 0, 0);  // 音量最大
+  pcm.assign(SYNTH_RATE * 2, 0);
+  for (uint32_t i = 0; i < SYNTH_RATE; i += SYNTH_BLOCK) {
+    uint32_t n = SYNTH_RATE - i > SYNTH_BLOCK ? SYNTH_BLOCK : SYNTH_RATE - i;
+    mix.render(&pcm[i * 2], n);
+  }
+  f = measureFreq(pcm);
+  printf("  SN76489: %.1f Hz\n", f);
+  check(fabs(f - 3579545.0 / 32 / 254) < 3579545.0 / 32 / 254 * 0.01, "SN76489 pitch");
+
+  return failed ? 1 : 0;
+}
+
+int main(int argc, char** argv) {
+  if (argc >= 4 && strcmp(argv[1], "--diff") == 0) {
+    return diff(argv[2], argv[3], argc > 4 && strcmp(argv[4], "--no-dac") == 0);
+  }
+  if (argc >= 2 && strcmp(argv[1], "--selftest") == 0) {
+    return selftest();
+  }
+  if (argc < 2) {
+    fprintf(stderr,
+            "usage: vgmhost file.vgm|file.xgm [-t out.ndtr] [-w out.wav] [-c ref.wav] [-s dB] [-n repeat]\n"
+            "       vgmhost --diff a.ndtr b.ndtr [--no-dac]\n"
+            "       vgmhost --selftest\n");
+    return 2;
+  }
+  const char *tracePath = NULL, *wavPath = NULL, *refPath = NULL;
+  double minSNR = 60.0;
+  int repeat = 1;
+  for (int i = 2; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "-t") == 0) {
+      tracePath = argv[i + 1];
+    } else if (strcmp(argv[i], "-w") == 0) {
+      wavPath = argv[i + 1];
+    } else if (strcmp(argv[i], "-c") == 0) {
+      refPath = argv[i + 1];
+    } else if (strcmp(argv[i], "-s") == 0) {
+      minSNR = atof(argv[i + 1]);
+    } else if (strcmp(argv[i], "-n") == 0) {
+      repeat = atoi(argv[i + 1]);
+    }
+  }
+  if (repeat < 1) repeat = 1;
+
+  std::vector<uint8_t> d;
+  if (!readAll(argv[1], d)) {
+    fprintf(stderr, "cannot read %s\n", argv[1]);
+    return 2;
+  }
+
+  HostBus bus;
+  t_result res;
+  double t0 = nowUs();
+  for (int i = 0; i < repeat; i++) {
+    bus = HostBus();
+    res = t_result();
+    if (!run(d, bus, res)) {
+      fprintf(stderr, "unsupported or broken file\n");
+      return 2;
+    }
+  }
+  double us = (nowUs() - t0) / repeat;
+  double sec = res.samples / 44100.0;
+
+  printf("%u commands, %zu writes, %.1f s, %u pcm, %u unknown\n", res.commands, bus.records.size(), sec, res.pcm,
+         res.unknown);
+  printf("time: %.0f us, %.1f M commands/s, x%.0f realtime\n", us, us > 0 ? res.commands / us : 0.0,
+         us > 0 ? sec * 1e6 / us : 0.0);
+
+  if (tracePath && !writeTrace(tracePath, bus.records)) {
+    fprintf(stderr, "cannot write %s\n", tracePath);
+    return 2;
+  }
+
+  int rc = res.unknown ? 1 : 0;
+  if (wavPath || refPath) {
+    std::vector<int16_t> pcm;
+    t0 = nowUs();
+    render(bus.records, res, pcm);
+    double renderSec = (nowUs() - t0) / 1e6;
+    double audioSec = pcm.size() / 2.0 / SYNTH_RATE;
+    printf("synth: %.2f sec rendered in %.2f sec (RTF %.3f)\n", audioSec, renderSec,
+           audioSec > 0 ? renderSec / audioSec : 0.0);
+    if (wavPath && !writeWav(wavPath, pcm)) {
+      fprintf(stderr, "cannot write %s\n", wavPath);
+      return 2;
+    }
+    if (refPath) {
+      std::vector<int16_t> ref;
+      if (!readWav(refPath, ref)) {
+        fprintf(stderr, "cannot read %s (16bit stereo 44.1kHz)\n", refPath);
+        return 2;
+      }
+      int32_t maxDiff;
+      double snr = compareWav(pcm, ref, &maxDiff);
+      printf("reference: %zu / %zu frames, S/N %.1f dB, max diff %d\n", pcm.size() / 2, ref.size() / 2, snr,
+             maxDiff);
+      if (snr < minSNR) rc = 1;
+    }
+  }
+  return rc;
+}
@@ -0,0 +1,695 @@
+// ------------------------------------------------------------------------------
+// xgmcheck: XGM2 タイムライン (lib/xgm/xgm2timeline) をインタープリタと比べる
+//
+//   cd tools/xgmcheck
+//   g++ -std=c++17 -O2 -I../../lib/xgm -o xgmcheck xgmcheck.cpp ../../lib/xgm/*.cpp
+//   ./xgmcheck [回数] [file.xgm ...]
+//
+//   - 乱数で作った FM / PSG ストリーム (ループあり / なし, ループの中でデルタ系を使うもの,
+//     FM と PSG でループ位置がずれているもの) をインタープリタ (vgm.cpp の xgm2Process と同じ順) と
+//     タイムラインで 3 周分再生し、書き込みとフレームが一致すること
+//     タイムラインが作れなかった曲はインタープリタで再生されるので比べない (数だけ出す)
+//   - 作業用メモリの上限が足りないとき・確保に失敗したときは作らずに false を返すこと
+//   - XGM2 のサンプル ID テーブルから作る範囲 (xgm2SampleRanges) が、ID の順に関係なく
+//     次に大きい先頭までになり、サンプルブロック (SLEN) の外に出ないこと
+//   - 合成したマルチトラックの XGM2 を XGMReady と同じ手順 (xgm2SampleRanges / xgm2IndexTracks) で読み、
+//     トラックを切り替えながら鳴らしてトラック単体と同じになり、共有のサンプルが正しい範囲を指すこと
+//   - ファイルを渡すとその XGM2 も比べる (マルチトラックは全トラック)
+//   だめなら終了コード 1
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "xgm.h"
+#include "xgm2timeline.h"
+
+#define LOOPS 3  // 比べる周回数
+
+static int failed = 0;
+
+static void check(bool ok, const char* what) {
+  if (!ok) {
+    printf("NG: %s\n", what);
+    failed++;
+  }
+}
+
+// ------------------------------------------------------------------------------
+// 書き込みの記録
+
+struct Write {
+  uint32_t frame;
+  t_xgm2Cmd cmd;
+  bool operator==(const Write& o) const {
+    return frame == o.frame && memcmp(&cmd, &o.cmd, sizeof(t_xgm2Cmd)) == 0;
+  }
+};
+
+class LogSink : public XGMSink {
+ public:
+  std::vector<Write>* log;
+  const uint32_t* frame;
+  void ym(uint8_t port, uint8_t reg, uint8_t value) override { _add(XGM2_EV_YM, port, reg, value); }
+  void psg(uint8_t data) override { _add(XGM2_EV_PSG, data, 0, 0); }
+  void psgPair(uint8_t latch, uint8_t data) override { _add(XGM2_EV_PSG_PAIR, latch, data, 0); }
+  void pcm(uint8_t command, uint8_t id) override { _add(XGM2_EV_PCM, command, id, 0); }
+
+ private:
+  void _add(uint8_t type, uint8_t a, uint8_t b, uint8_t c) { log->push_back({*frame, {type, a, b, c}}); }
+};
+
+// vgm.cpp の xgm2Process (インタープリタ) と同じ順に、frameLimit まで
+static void interpret(XGM2Decoder dec, uint32_t frameLimit, std::vector<Write>& log) {
+  uint32_t frame = 0;
+  LogSink sink;
+  sink.log = &log;
+  sink.frame = &frame;
+  dec.rewind();
+  while (frame < frameLimit) {
+    while (dec.fmFrame <= frame) {
+      if (dec.stepFM(sink) == XGM_STEP_END) return;
+    }
+    while (dec.psgFrame <= frame) {
+      if (dec.stepPSG(sink) == XGM_STEP_END) return;
+    }
+    frame = dec.psgFrame < dec.fmFrame ? dec.psgFrame : dec.fmFrame;
+  }
+}
+
+// vgm.cpp の _xgm2ProcessTimeline と同じ
+static void playTimeline(const XGM2Timeline& t, uint32_t frameLimit, std::vector<Write>& log) {
+  uint32_t frame = 0, cursor = 0;
+  while (frame < frameLimit && cursor < t.len) {
+    const t_xgm2Cmd& c = t.cmds[cursor++];
+    switch (c.type) {
+      case XGM2_EV_WAIT:
+        frame += c.a | (c.b << 8);
+        break;
+      case XGM2_EV_LOOP:
+        cursor = t.loopIndex;
+        break;
+      case XGM2_EV_END:
+        return;
+      default:
+        log.push_back({frame, c});
+        break;
+    }
+  }
+}
+
+// 一致すれば true
+static bool compare(const XGM2Decoder& dec, const XGM2Timeline& t, const char* name) {
+  uint32_t limit = t.fmInfo.endFrame > t.psgInfo.endFrame ? t.fmInfo.endFrame : t.psgInfo.endFrame;
+  if (t.loops()) limit = t.fmInfo.endFrame + (LOOPS - 1) * (t.fmInfo.endFrame - t.fmInfo.loopFrame);
+  limit++;
+
+  std::vector<Write> a, b;
+  interpret(dec, limit, a);
+  playTimeline(t, limit, b);
+  // インタープリタは最後のフレームを途中まで処理しているので、それより前で比べる
+  while (!a.empty() && a.back().frame >= limit) a.pop_back();
+  while (!b.empty() && b.back().frame >= limit) b.pop_back();
+  if (a == b) return true;
+
+  size_t i = 0;
+  while (i < a.size() && i < b.size() && a[i] == b[i]) i++;
+  printf("NG: %s: differs at write %zu of %zu / %zu", name, i, a.size(), b.size());
+  if (i < a.size()) printf(", interpreter frame %u type %u", a[i].frame, a[i].cmd.type);
+  if (i < b.size()) printf(", timeline frame %u type %u", b[i].frame, b[i].cmd.type);
+  printf("\n");
+  return false;
+}
+
+// ------------------------------------------------------------------------------
+// 乱数の XGM2 ストリーム
+//    コマンドの割り当ては lib/xgm/xgm.cpp と同じ
+
+class StreamGen {
+ public:
+  std::mt19937& rng;
+  std::vector<uint8_t> out;
+  bool safe = false;  // ループ本体: 前の周回の状態に依存するコマンドは、本体の中で絶対値を書いた後だけ
+  bool fmSet[2][0x100];
+  bool psgEnvSet[4], psgFreqSet[4];
+
+  explicit StreamGen(std::mt19937& r) : rng(r) { startBody(false); }
+
+  void startBody(bool s) {
+    safe = s;
+    memset(fmSet, 0, sizeof(fmSet));
+    memset(psgEnvSet, 0, sizeof(psgEnvSet));
+    memset(psgFreqSet, 0, sizeof(psgFreqSet));
+  }
+
+  void put(uint8_t b) { out.push_back(b); }
+  void put24(uint32_t v) {
+    put(v & 0xff);
+    put((v >> 8) & 0xff);
+    put((v >> 16) & 0xff);
+  }
+  uint32_t r(uint32_t n) { return rng() % n; }
+  bool freqSet(uint8_t port, uint8_t ch) { return fmSet[port][0xa0 + ch] && fmSet[port][0xa4 + ch]; }
+
+  // FM のコマンド 1 つ (待ちなし)
+  void fmCommand() {
+    uint8_t port = r(2), ch = r(3);
+    switch (r(12)) {
+      case 0: {  // FM_WRITE
+        uint8_t n = r(4) + 1;
+        put(0xe0 | (port << 3) | (n - 1));
+        for (int i = 0; i < n; i++) {
+          uint8_t reg = 0x30 + r(0x90);
+          put(reg);
+          put(rng());
+          fmSet[port][reg] = true;
+        }
+        break;
+      }
+      case 1:  // FM_LOAD_INST
+        put(0x20 | (port << 2) | ch);
+        for (int i = 0x30; i <= 0x9c; i += 4) {
+          put(rng());
+          fmSet[port][i + ch] = true;
+        }
+        put(rng());
+        put(rng());
+        fmSet[port][0xb0 + ch] = fmSet[port][0xb4 + ch] = true;
+        break;
+      case 2:  // FM_FREQ (キーオフ / オンのフラグ付き)
+        put(0x30 | (port << 2) | ch);
+        put(rng());
+        put(rng());
+        fmSet[port][0xa0 + ch] = fmSet[port][0xa4 + ch] = true;
+        break;
+      case 3:
+        if (safe && !freqSet(port, ch)) return;
+        put(0xa0 | (port << 2) | ch);  // FM_FREQ_DELTA
+        put(rng());
+        break;
+      case 4: {  // FM_TL
+        uint8_t slot = r(4);
+        put(0x90 | (slot << 2) | ch);
+        put((rng() & 0xfe) | port);
+        fmSet[port][0x40 + (slot << 2) + ch] = true;
+        break;
+      }
+      case 5: {  // FM_TL_DELTA
+        uint8_t slot = r(4);
+        if (safe && !fmSet[port][0x40 + (slot << 2) + ch]) return;
+        put(0xc0 | (slot << 2) | ch);
+        put((rng() & 0xfe) | port);
+        break;
+      }
+      case 6:  // FM_KEY / FM_KEY_SEQ
+        put((r(2) ? 0x40 : 0x50) | r(16));
+        break;
+      case 7:  // FM0_PAN / FM1_PAN
+        if (safe && !fmSet[port][0xb4 + ch]) return;
+        put((port ? 0x70 : 0x60) | (r(4) << 2) | ch);
+        break;
+      case 8:  // PCM
+        put(0x10 | r(16));
+        put(r(8));
+        break;
+      case 9:  // FM_LFO
+        put(0xf9);
+        put(rng());
+        fmSet[0][0x22] = true;
+        break;
+      case 10:  // CH3 特殊モード
+        if (safe && !fmSet[0][0x27]) return;
+        put(r(2) ? 0xfa : 0xfb);
+        break;
+      default:  // DAC, FRAME_DELAY
+        put(0xfc + r(2));
+        if (r(4) == 0) put(0xf0);
+        break;
+    }
+  }
+
+  // FM の待ち (frames 以下, 進めたフレーム数を返す)
+  uint32_t fmWait(uint32_t frames) {
+    uint32_t n = r(4) == 0 ? 16 + r(40) : 1 + r(15);
+    if (n > frames) n = frames;
+    if (n == 1 && r(2)) {
+      // 書き込み付きの待ち (FM_FREQ_WAIT / FM_FREQ_DELTA_WAIT / FM_TL_DELTA_WAIT)
+      uint8_t port = r(2), ch = r(3), slot = r(4);
+      switch (r(3)) {
+        case 0:
+          put(0x80 | (port << 2) | ch);
+          put(rng());
+          put(rng());
+          fmSet[port][0xa0 + ch] = fmSet[port][0xa4 + ch] = true;
+          return 1;
+        case 1:
+          if (safe && !freqSet(port, ch)) break;
+          put(0xb0 | (port << 2) | ch);
+          put(rng());
+          return 1;
+        default:
+          if (safe && !fmSet[port][0x40 + (slot << 2) + ch]) break;
+          put(0xd0 | (slot << 2) | ch);
+          put((rng() & 0xfe) | port);
+          return 1;
+      }
+    }
+    if (n >= 16) {
+      put(0x0f);
+      put(n - 16);
+    } else {
+      put(n - 1);
+    }
+    return n;
+  }
+
+  // PSG のコマンド 1 つ (待ちなし)
+  void psgCommand() {
+    uint8_t ch = r(4);
+    switch (r(5)) {
+      case 0:  // PSG_ENV
+        put(0x80 + (ch << 4) + r(16));
+        psgEnvSet[ch] = true;
+        break;
+      case 1:  // PSG_ENV_DELTA
+        if (safe && !psgEnvSet[ch]) return;
+        put(0xc0 + (ch << 4) + r(8));
+        break;
+      case 2:  // PSG_FREQ
+        put(0x20 | (ch << 2) | r(4));
+        put(rng());
+        psgFreqSet[ch] = true;
+        break;
+      case 3:  // PSG_FREQ_LOW (待ちなし)
+        if (safe && !psgFreqSet[ch]) return;
+        put(0x10);
+        put((ch << 5) | r(16));
+        break;
+      default:  // PSG_FREQ_DELTA
+        if (safe && !psgFreqSet[ch]) return;
+        put(0x40 + (ch << 4) + r(8));
+        break;
+    }
+  }
+
+  uint32_t psgWait(uint32_t frames) {
+    uint32_t n = r(4) == 0 ? 15 + r(40) : 1 + r(14);
+    if (n > frames) n = frames;
+    if (n == 1 && r(2)) {
+      uint8_t ch = r(4);
+      switch (r(3)) {
+        case 0:
+          put(0x30 | (ch << 2) | r(4));  // PSG_FREQ_WAIT
+          put(rng());
+          psgFreqSet[ch] = true;
+          return 1;
+        case 1:
+          if (safe && !psgFreqSet[ch]) break;
+          put(0x11);  // PSG_FREQ_LOW + 待ち
+          put((ch << 5) | r(16));
+          return 1;
+        default:
+          if (safe && !psgEnvSet[ch]) break;
+          put(0xc8 + (ch << 4) + r(4));  // PSG_ENV_DELTA + 待ち
+          return 1;
+      }
+    }
+    if (n >= 15) {
+      put(0x0e);
+      put(n - 15);
+    } else {
+      put(n - 1);
+    }
+    return n;
+  }
+
+  // ちょうど frames フレーム分
+  void fill(bool fm, uint32_t frames) {
+    while (frames > 0) {
+      for (uint32_t k = r(4); k > 0; k--) {
+        fm ? fmCommand() : psgCommand();
+      }
+      frames -= fm ? fmWait(frames) : psgWait(frames);
+    }
+  }
+};
+
+struct Song {
+  std::vector<uint8_t> data;
+  XGM2Decoder dec;
+};
+
+// loopFrame[0] / [1]: FM / PSG のループ先 (-1 = ループしない), endFrame[0] / [1]: 終わり
+// safeBody: ループ本体で前の周回の状態に依存しない
+// tail: ループ / 終了コマンドと同じフレームに書き込みを置く
+static void makeSong(std::mt19937& rng, Song& song, const int32_t loopFrame[2], const uint32_t endFrame[2], bool safeBody,
+                     bool tail) {
+  std::vector<uint8_t> streams[2];
+  for (int s = 0; s < 2; s++) {
+    bool fm = s == 0;
+    StreamGen g(rng);
+    uint32_t loopOffset = 0xffffff;
+    if (loopFrame[s] >= 0) {
+      g.fill(fm, loopFrame[s]);
+      loopOffset = g.out.size();
+      g.startBody(safeBody);
+      g.fill(fm, endFrame[s] - loopFrame[s]);
+    } else {
+      g.fill(fm, endFrame[s]);
+    }
+    if (tail) fm ? g.fmCommand() : g.psgCommand();
+    g.put(fm ? 0xff : 0x0f);
+    g.put24(loopOffset);
+    streams[s] = g.out;
+  }
+  song.data = streams[0];
+  song.data.insert(song.data.end(), streams[1].begin(), streams[1].end());
+  song.data.resize(song.data.size() + 64, 0);  // 読み過ぎ防止
+  song.dec.begin(song.data.data(), 0, streams[0].size(), streams[0].size(), streams[1].size());
+}
+
+// ------------------------------------------------------------------------------
+
+static void* failAlloc(size_t) { return NULL; }
+
+// サンプル ID テーブル
+static void checkSampleRanges(std::mt19937& rng) {
+  char msg[128];
+
+  // ID の順と先頭の順が違う / ブロックの外 / 同じ先頭
+  const uint16_t sid[] = {0x0002, 0x0010, 0x0008, 0xffff, 0x0020, 0x0002};
+  const uint32_t wantStart[] = {0x200, 0x1000, 0x800, 0, 0, 0x200};
+  const uint32_t wantLen[] = {0x600, 0x800, 0x800, 0, 0, 0x600};
+  uint32_t start[6], len[6];
+  xgm2SampleRanges(sid, 6, 0x1800, start, len);
+  for (int i = 0; i < 6; i++) {
+    snprintf(msg, sizeof(msg), "sample %d: 0x%x + 0x%x (want 0x%x + 0x%x)", i + 1, start[i], len[i], wantStart[i],
+             wantLen[i]);
+    check(start[i] == wantStart[i] && len[i] == wantLen[i], msg);
+  }
+
+  // 乱数のテーブル: 範囲はブロックの中で、他のサンプルの先頭を含まず、終わりは次の先頭かブロックの終わり
+  for (int round = 0; round < 2000; round++) {
+    uint16_t ids[248];
+    uint32_t st[248], ln[248];
+    int count = 1 + rng() % 248;
+    uint32_t slen = (1 + rng() % 64) << 8;
+    for (int i = 0; i < count; i++) {
+      ids[i] = rng() % 5 == 0 ? 0xffff : rng() % 80;
+    }
+    xgm2SampleRanges(ids, count, slen, st, ln);
+    for (int i = 0; i < count; i++) {
+      bool inside = ids[i] != 0xffff && ids[i] * 256u < slen;
+      bool ok = inside ? ln[i] > 0 && st[i] == ids[i] * 256u && st[i] + ln[i] <= slen : ln[i] == 0;
+      bool endsAtStart = st[i] + ln[i] == slen;
+      for (int j = 0; j < count && ok && inside; j++) {
+        if (ids[j] == 0xffff) continue;
+        uint32_t other = ids[j] * 256u;
+        if (other > st[i] && other < st[i] + ln[i]) ok = false;
+        if (other == st[i] + ln[i]) endsAtStart = true;
+      }
+      if (inside && !endsAtStart) ok = false;
+      if (!ok) {
+        snprintf(msg, sizeof(msg), "random table %d: sample %d 0x%x + 0x%x (SLEN 0x%x)", round, i + 1, st[i], ln[i],
+                 slen);
+        check(false, msg);
+        return;
+      }
+    }
+  }
+}
+
+static bool readFile(const char* path, std::vector<uint8_t>& data) {
+  FILE* f = fopen(path, "rb");
+  if (!f) return false;
+  fseek(f, 0, SEEK_END);
+  data.resize(ftell(f));
+  fseek(f, 0, SEEK_SET);
+  bool ok = fread(data.data(), 1, data.size(), f) == data.size();
+  fclose(f);
+  return ok;
+}
+
+static uint32_t u16at(const std::vector<uint8_t>& d, size_t p) { return d[p] | (d[p + 1] << 8); }
+static void put16(std::vector<uint8_t>& d, size_t p, uint32_t v) {
+  d[p] = v & 0xff;
+  d[p + 1] = (v >> 8) & 0xff;
+}
+
+// ヘッダから読んだサンプルとトラック
+struct XGM2Index {
+  uint32_t sampleBase;
+  uint32_t sampleStart[248], sampleLen[248];
+  int numSamples;
+  t_xgm2Track tracks[XGM2_MAX_TRACKS];
+};
+
+// XGMReady と同じ手順でヘッダを読む (サンプル ID テーブルとトラック)
+// 戻り値: トラック数 (0 = 読めない)
+static int indexXGM2(const std::vector<uint8_t>& d, XGM2Index& x) {
+  if (d.size() < 0x104 || memcmp(d.data(), "XGM2", 4) != 0) return 0;
+  bool multi = d[0x05] & 2;
+  uint32_t slen = u16at(d, 0x06) << 8, fmLen = u16at(d, 0x08) << 8, psgLen = u16at(d, 0x0a) << 8;
+  x.sampleBase = multi ? 0x3fc : 0x104;
+  x.numSamples = multi ? 248 : 124;
+  uint16_t sid[248];
+  for (int i = 0; i < x.numSamples; i++) sid[i] = u16at(d, 0x0c + i * 2);
+  xgm2SampleRanges(sid, x.numSamples, slen, x.sampleStart, x.sampleLen);
+
+  uint32_t music = x.sampleBase + slen;
+  if (music + fmLen + psgLen > d.size()) return 0;
+  if (!multi) {
+    x.tracks[0] = {music, fmLen, music + fmLen, psgLen};
+    return 1;
+  }
+  uint16_t fmID[XGM2_MAX_TRACKS], psgID[XGM2_MAX_TRACKS];
+  for (int i = 0; i < XGM2_MAX_TRACKS; i++) {
+    fmID[i] = u16at(d, 0x1fc + i * 2);
+    psgID[i] = u16at(d, 0x2fc + i * 2);
+  }
+  return xgm2IndexTracks(fmID, psgID, music, fmLen, psgLen, x.tracks);
+}
+
+// 合成したマルチトラックファイル: サンプルバンクは共有, トラックごとの FM / PSG ストリームは
+// ブロック内で順不同に並べる。インデックスしたトラックを切り替えながら鳴らして、
+// トラック単体のストリームと同じ書き込みになり、サンプルが元のデータを指すこと
+static void checkMultiTrack(std::mt19937& rng) {
+  char msg[160];
+  for (int round = 0; round < 200; round++) {
+    // トラック
+    int numTracks = 1 + rng() % 12;
+    std::vector<std::vector<uint8_t>> fmStreams(numTracks), psgStreams(numTracks);
+    for (int t = 0; t < numTracks; t++) {
+      int32_t loopFrame[2] = {-1, -1};
+      uint32_t endFrame[2];
+      endFrame[0] = endFrame[1] = 10 + rng() % 200;
+      if (rng() & 1) loopFrame[0] = loopFrame[1] = rng() % (endFrame[0] - 1);
+      Song song;
+      makeSong(rng, song, loopFrame, endFrame, true, false);
+      const uint8_t* p = song.data.data();
+      fmStreams[t].assign(p, p + song.dec.fmLen);
+      psgStreams[t].assign(p + song.dec.psgOffset, p + song.dec.psgOffset + song.dec.psgLen);
+    }
+
+    // サンプル (ID は飛び飛び, 中身は ID ごとに違う)
+    int numSamples = rng() % 20;
+    std::vector<int> ids, sizes;
+    for (int k = 0; k < numSamples; k++) {
+      ids.push_back(1 + rng() % 248);
+      sizes.push_back((1 + rng() % 8) * 256);
+    }
+
+    // ファイル
+    std::vector<uint8_t> d(0x3fc, 0xff);
+    memcpy(d.data(), "XGM2", 4);
+    d[4] = 0x10;
+    d[5] = 0b0010;  // NTSC, マルチトラック
+    std::vector<int> sampleAt(249, -1), sampleSize(249, 0);
+    for (int k = 0; k < numSamples; k++) {
+      if (sampleAt[ids[k]] >= 0) continue;
+      sampleAt[ids[k]] = d.size() - 0x3fc;
+      sampleSize[ids[k]] = sizes[k];
+      put16(d, 0x0c + (ids[k] - 1) * 2, sampleAt[ids[k]] >> 8);
+      for (int i = 0; i < sizes[k]; i++) d.push_back(ids[k] * 7 + i);
+    }
+    uint32_t slen = d.size() - 0x3fc;
+
+    // ブロック内の並びはトラック順と変える
+    auto block = [&](std::vector<std::vector<uint8_t>>& streams, uint32_t idTable) {
+      std::vector<int> order(numTracks);
+      for (int t = 0; t < numTracks; t++) order[t] = t;
+      std::shuffle(order.begin(), order.end(), rng);
+      uint32_t start = d.size();
+      for (int t : order) {
+        put16(d, idTable + t * 2, (d.size() - start) >> 8);
+        d.insert(d.end(), streams[t].begin(), streams[t].end());
+        while ((d.size() - start) & 0xff) d.push_back(0);
+      }
+      return (uint32_t)(d.size() - start);
+    };
+    uint32_t fmLen = block(fmStreams, 0x1fc);
+    uint32_t psgLen = block(psgStreams, 0x2fc);
+    put16(d, 0x06, slen >> 8);
+    put16(d, 0x08, fmLen >> 8);
+    put16(d, 0x0a, psgLen >> 8);
+    d.resize(d.size() + 64, 0);
+
+    XGM2Index x;
+    int n = indexXGM2(d, x);
+    snprintf(msg, sizeof(msg), "multi track round %d: %d tracks indexed, %d written", round, n, numTracks);
+    check(n == numTracks, msg);
+    if (n != numTracks) return;
+
+    // サンプル
+    for (int id = 1; id <= 248; id++) {
+      bool ok = x.sampleLen[id - 1] == (uint32_t)sampleSize[id];
+      if (ok && sampleSize[id]) {
+        const uint8_t* p = &d[x.sampleBase + x.sampleStart[id - 1]];
+        for (int i = 0; i < sampleSize[id] && ok; i++) ok = p[i] == (uint8_t)(id * 7 + i);
+      }
+      if (!ok) {
+        snprintf(msg, sizeof(msg), "multi track round %d: sample %d 0x%x bytes (want 0x%x)", round, id,
+                 x.sampleLen[id - 1], sampleSize[id]);
+        check(false, msg);
+        return;
+      }
+    }
+
+    // トラックを切り替えながら (デコーダは使い回す)
+    XGM2Decoder dec;
+    for (int k = 0; k < numTracks * 2; k++) {
+      int t = rng() % numTracks;
+      const t_xgm2Track& tr = x.tracks[t];
+      dec.begin(d.data(), tr.fmOffset, tr.fmLen, tr.psgOffset, tr.psgLen);
+
+      std::vector<uint8_t> alone = fmStreams[t];
+      alone.insert(alone.end(), psgStreams[t].begin(), psgStreams[t].end());
+      alone.resize(alone.size() + 64, 0);
+      XGM2Decoder ref;
+      ref.begin(alone.data(), 0, fmStreams[t].size(), fmStreams[t].size(), psgStreams[t].size());
+
+      std::vector<Write> a, b;
+      interpret(dec, 1000, a);
+      interpret(ref, 1000, b);
+      bool ok = tr.fmLen >= fmStreams[t].size() && tr.psgLen >= psgStreams[t].size() && a == b;
+      if (!ok) {
+        snprintf(msg, sizeof(msg), "multi track round %d: track %d differs (%zu / %zu writes)", round, t, a.size(),
+                 b.size());
+        check(false, msg);
+        return;
+      }
+    }
+  }
+}
+
+static void checkFile(const char* path) {
+  std::vector<uint8_t> d;
+  char msg[256];
+  XGM2Index x;
+  int n = readFile(path, d) ? indexXGM2(d, x) : 0;
+  if (!n) {
+    snprintf(msg, sizeof(msg), "%s: not an XGM2 file", path);
+    check(false, msg);
+    return;
+  }
+  d.resize(d.size() + 64, 0);
+  for (int i = 0; i < n; i++) {
+    const t_xgm2Track& tr = x.tracks[i];
+    XGM2Decoder dec;
+    dec.begin(d.data(), tr.fmOffset, tr.fmLen, tr.psgOffset, tr.psgLen);
+    XGM2Timeline t;
+    if (!t.compile(dec, 64 << 20)) {
+      printf("%s track %d: no timeline (interpreter)\n", path, i + 1);
+      continue;
+    }
+    snprintf(msg, sizeof(msg), "%s track %d", path, i + 1);
+    if (compare(dec, t, msg)) {
+      printf("ok: %s: %u events\n", msg, t.len);
+    } else {
+      failed++;
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 2000;
+  std::mt19937 rng(2612);
+  const char* kinds[] = {"loop", "loop (state in body)", "no loop", "loop mismatch", "loop tail"};
+  uint32_t compiled[5] = {0}, fallback[5] = {0};
+
+  for (int round = 0; round < rounds; round++) {
+    int kind = round % 5;
+    int32_t loopFrame[2] = {-1, -1};
+    uint32_t endFrame[2];
+    endFrame[0] = endFrame[1] = 20 + rng() % 400;
+    switch (kind) {
+      case 0:
+      case 1:
+      case 4:
+        loopFrame[0] = loopFrame[1] = rng() % (endFrame[0] - 1);
+        break;
+      case 2:
+        endFrame[1] = 20 + rng() % 400;
+        break;
+      case 3:
+        loopFrame[0] = rng() % (endFrame[0] - 1);
+        loopFrame[1] = (loopFrame[0] + 1 + rng() % 8) % endFrame[0];
+        break;
+    }
+    Song song;
+    makeSong(rng, song, loopFrame, endFrame, kind != 1, kind == 4);
+
+    XGM2Timeline t;
+    if (!t.compile(song.dec, 16 << 20)) {
+      fallback[kind]++;
+      continue;
+    }
+    compiled[kind]++;
+    char name[64];
+    snprintf(name, sizeof(name), "round %d (%s)", round, kinds[kind]);
+    if (!compare(song.dec, t, name)) {
+      failed++;
+      if (failed > 5) return 1;
+    }
+  }
+
+  for (int k = 0; k < 5; k++) {
+    printf("%s: %u timelines, %u interpreter\n", kinds[k], compiled[k], fallback[k]);
+  }
+  // 状態に依存しないループと終わりのある曲は必ず作れる / ループ位置のずれは作らない
+  check(fallback[0] == 0 && fallback[2] == 0, "timeline not built for a loop-safe song");
+  check(compiled[3] == 0, "timeline built for mismatched loops");
+  check(compiled[1] > 0 && fallback[1] > 0, "state-dependent loop bodies not exercised");
+
+  // 作業用メモリの上限と確保の失敗
+  {
+    const int32_t loopFrame[2] = {50, 50};
+    const uint32_t endFrame[2] = {300, 300};
+    Song song;
+    makeSong(rng, song, loopFrame, endFrame, true, false);
+    XGM2Timeline t;
+    check(t.compile(song.dec, 16 << 20), "reference song");
+    size_t need = (t.fmInfo.events + t.psgInfo.events) * sizeof(t_xgm2Event) + t.len * sizeof(t_xgm2Cmd);
+    check(t.compile(song.dec, need), "exact budget");
+    check(!t.compile(song.dec, need - 1) && t.len == 0 && t.cmds == NULL, "budget one byte short");
+    check(!t.compile(song.dec, 0), "zero budget");
+    t.alloc = failAlloc;
+    check(!t.compile(song.dec, 16 << 20) && t.len == 0, "allocation failure");
+  }
+
+  checkSampleRanges(rng);
+  checkMultiTrack(rng);
+
+  for (int i = 2; i < argc; i++) {
+    checkFile(argv[i]);
+  }
+
+  if (failed) return 1;
+  printf("ok: %d rounds\n", rounds);
+  return 0;
+}